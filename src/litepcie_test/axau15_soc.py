@@ -60,6 +60,7 @@ class BaseSoC(SoCMini):
                  remote_ip=None,
                  with_led_chaser=True,
                  with_pcie=False,
+                 pcie_ndmas=1,
                  # pcie_speed="gen4",
                  #  pcie_speed="gen3",
                  with_sdcard=False,
@@ -90,8 +91,8 @@ class BaseSoC(SoCMini):
 
         # PCIe -------------------------------------------------------------------------------------
         if with_pcie:
-            self._add_pcie_x4(pcie_speed="gen4")
-            # self._add_pcie_x1()
+            self._add_pcie_x4(pcie_speed="gen4", ndmas=pcie_ndmas)
+            # self._add_pcie_x1(ndmas=pcie_ndmas)
 
             # ICAP (For FPGA reload over PCIe).
             # from litex.soc.cores.icap import ICAP
@@ -115,7 +116,7 @@ class BaseSoC(SoCMini):
         #         sys_clk_freq=sys_clk_freq)
         self.add_led_chaser()
 
-    def _add_pcie_x1(self, pcie_speed="gen4"):
+    def _add_pcie_x1(self, pcie_speed="gen4", ndmas=1):
         """ for some reasons, x1 doesn't work yet
         """
         platform = self.platform
@@ -129,7 +130,7 @@ class BaseSoC(SoCMini):
             bar0_size=0x800000,  # 8MB - Control registers (BAR0)
             bar2_size=0x800000,  # 1MB - DMA buffers (64-bit BAR, uses BAR2+3)
         )
-        self.add_pcie(phy=self.pcie_phy, ndmas=1, with_dma_monitor=True,
+        self.add_pcie(phy=self.pcie_phy, ndmas=ndmas, with_dma_monitor=True,
                       with_dma_synchronizer=True,
                       with_dma_status=True, address_width=32)
 
@@ -139,7 +140,7 @@ class BaseSoC(SoCMini):
         # platform.toolchain.pre_placement_commands.append(
         #     "set_property LOC GTHE4_CHANNEL_X0Y0 [get_cells -hierarchical -filter {{NAME=~*pcie_usp_i/*gthe4_channel_gen.gen_gthe4_channel_inst[0].GTHE4_CHANNEL_PRIM_INST}}]")
 
-    def _add_pcie_x4(self, pcie_speed="gen4", ):
+    def _add_pcie_x4(self, pcie_speed="gen4", ndmas=1):
         platform = self.platform
         self.pcie_phy = CustomUSPPCIEPHY(
             platform,
@@ -155,7 +156,7 @@ class BaseSoC(SoCMini):
             bar2_size=0x800000,  # 1MB - DMA buffers (64-bit BAR, uses BAR2+3)
             # bar4_size=0x200000,    # 2MB - Memory mapped region (64-bit BAR, uses BAR4+5)
         )
-        self.add_pcie(phy=self.pcie_phy, ndmas=1, with_dma_monitor=True,
+        self.add_pcie(phy=self.pcie_phy, ndmas=ndmas, with_dma_monitor=True,
                       with_dma_synchronizer=True,
                       with_dma_status=True, address_width=32,)
 
@@ -285,6 +286,7 @@ def build():
         'with_ctrl': True,
         # 'with_sdcard': True,
         'with_pcie': True,
+        'pcie_ndmas': 1,  # one /dev/litepcieX per DMA channel, >1 for multi-channel tests
         'sys_clk_freq': 100e6,
         'integrated_main_ram_size': 8 * 1024,
     }
@@ -18,6 +18,7 @@ BUILD_TYPE="Release"
 CLEAN_BUILD=0
 VERBOSE=0
 BUILD_KERNEL=0
+BUILD_PYTHON=0
 
 while [[ $# -gt 0 ]]; do
     case $1 in
@@ -37,6 +38,10 @@ while [[ $# -gt 0 ]]; do
             BUILD_KERNEL=1
             shift
             ;;
+        -p|--python)
+            BUILD_PYTHON=1
+            shift
+            ;;
         -h|--help)
             echo "Usage: $0 [options]"
             echo "Options:"
@@ -44,6 +49,7 @@ while [[ $# -gt 0 ]]; do
             echo "  -c, --clean     Clean build (remove build directory first)"
             echo "  -v, --verbose   Verbose build output"
             echo "  -k, --kernel    Build kernel modules (Linux only, requires kernel headers)"
+            echo "  -p, --python    Build the pylitepcie Python extension (requires Python headers)"
             echo "  -h, --help      Show this help message"
             exit 0
             ;;
@@ -80,6 +86,9 @@ fi
 if [ $BUILD_KERNEL -eq 1 ]; then
     CMAKE_ARGS="$CMAKE_ARGS -DBUILD_KERNEL_MODULE=ON"
 fi
+if [ $BUILD_PYTHON -eq 1 ]; then
+    CMAKE_ARGS="$CMAKE_ARGS -DBUILD_PYTHON_MODULE=ON"
+fi
 
 if ! cmake $CMAKE_ARGS ..; then
     echo -e "${RED}CMake configuration failed!${NC}"
@@ -104,6 +113,7 @@ echo "Executables built:"
 echo "  DMA Test Programs:"
 echo "    - $BUILD_DIR/litepcie_dma_test_optimized"
 echo "    - $BUILD_DIR/litepcie_dma_test_optimized_v2"
+echo "    - $BUILD_DIR/litepcie_dma_test_cpp"
 echo "  User Utilities:"
 echo "    - $BUILD_DIR/litepcie_util"
 echo "    - $BUILD_DIR/litepcie_test"
@@ -111,6 +121,11 @@ echo "    - $BUILD_DIR/litepcie_latency_test"
 echo "    - $BUILD_DIR/litepcie_latency_test_simple"
 echo "    - $BUILD_DIR/litepcie_latency_test_final"
 
+if [ $BUILD_PYTHON -eq 1 ]; then
+    echo "  Python Extension:"
+    echo "    - $BUILD_DIR/pylitepcie*.so   (PYTHONPATH=$BUILD_DIR python3 -c 'import pylitepcie')"
+fi
+
 if [ $BUILD_KERNEL -eq 1 ]; then
     echo ""
     echo "Kernel module targets available:"
@@ -78,6 +78,10 @@
 #define DMA_BUFFER_COUNT       256
 #define DMA_BUFFER_SIZE        8192
 #define DMA_BUFFER_TOTAL_SIZE (DMA_BUFFER_COUNT*DMA_BUFFER_SIZE)
+
+/* Limits for LITEPCIE_IOCTL_DMA_GEOMETRY (defaults above are used at probe). */
+#define DMA_BUFFER_COUNT_MAX   256       /* DMA table depth of the gateware */
+#define DMA_BUFFER_SIZE_MAX    (1<<23)   /* fits the 24-bit descriptor length */
 //#define DMA_BUFFER_ALIGNED
 
 /* DMA Offsets */
@@ -22,6 +22,33 @@ struct litepcie_ioctl_reg {
 	uint8_t is_write;
 };
 
+/* Vectored register access (LITEPCIE_IOCTL_REG_BATCH): ops run in order in
+ * one call. A poll re-reads addr until (val & mask) == expect, or fails the
+ * batch with ETIMEDOUT after timeout_us.
+ */
+#define LITEPCIE_REG_OP_READ  0
+#define LITEPCIE_REG_OP_WRITE 1
+#define LITEPCIE_REG_OP_POLL  2
+
+#define LITEPCIE_REG_OPS_MAX             1024
+#define LITEPCIE_REG_POLL_TIMEOUT_MAX_US 10000000 /* 10 s */
+
+struct litepcie_reg_op {
+	uint32_t addr;
+	uint32_t val;        /* write: value to write, read/poll: value read (out) */
+	uint32_t mask;       /* poll */
+	uint32_t expect;     /* poll */
+	uint32_t timeout_us; /* poll, clamped to LITEPCIE_REG_POLL_TIMEOUT_MAX_US */
+	uint8_t op;
+	uint8_t reserved[3];
+};
+
+struct litepcie_ioctl_reg_batch {
+	uint64_t ops;   /* user pointer to count struct litepcie_reg_op */
+	uint32_t count; /* 1 to LITEPCIE_REG_OPS_MAX */
+	uint32_t done;  /* out: ops completed, ops[done] failed when the ioctl fails */
+};
+
 struct litepcie_ioctl_flash {
 	int tx_len; /* 8 to 40 */
 	__u64 tx_data; /* 8 to 40 bits */
@@ -37,6 +64,10 @@ struct litepcie_ioctl_dma {
 	uint8_t loopback_enable;
 };
 
+/* DMA_WRITER/DMA_READER enable value: stop, but keep the descriptor table
+ * programmed so the next enable only rebases the counters. */
+#define LITEPCIE_DMA_PAUSE 2
+
 struct litepcie_ioctl_dma_writer {
 	uint8_t enable;
 	int64_t hw_count;
@@ -72,19 +103,201 @@ struct litepcie_ioctl_mmap_dma_update {
 	int64_t sw_count;
 };
 
+struct litepcie_ioctl_mmap_dma_ctrl_info {
+	uint64_t dma_ctrl_offset;
+	uint64_t dma_ctrl_size;
+};
+
+#define LITEPCIE_DMA_SUBSCRIBERS_MAX 8
+
+/* RX fan-out state of one subscriber (LITEPCIE_IOCTL_DMA_SUBSCRIBE slot). */
+struct litepcie_mmap_dma_subscriber {
+	int64_t sw_count; /* copy of the slot's cursor page, by the driver */
+	int64_t drops;    /* best-effort: RX buffers overwritten before consumed, by the driver */
+	int64_t reserved[6];
+};
+
+/* Shared DMA control page (one per channel, mmapped at dma_ctrl_offset).
+ *
+ * hw_count fields are written by the driver on each DMA interrupt, sw_count
+ * fields are written by userspace and replace the MMAP_DMA_*_UPDATE ioctls.
+ * Both halves sit on their own cache line to avoid false sharing.
+ */
+struct litepcie_mmap_dma_ctrl {
+	int64_t writer_hw_count;
+	int64_t reader_hw_count;
+	int64_t reserved0[6];
+	int64_t writer_sw_count;
+	int64_t reader_sw_count;
+	int64_t reserved1[6];
+	int64_t writer_gate_count; /* slowest required RX cursor, primary included */
+	int64_t writer_overflows;  /* RX buffers overwritten before the gate consumed them */
+	int64_t reserved2[6];
+	struct litepcie_mmap_dma_subscriber subscribers[LITEPCIE_DMA_SUBSCRIBERS_MAX];
+};
+
+/* Cursor of one RX subscriber, mmapped read-write at dma_cursor_offset by the
+ * subscribed file only (its own slot's page). Subscribers map the shared
+ * control page read-only, so they can't touch the owner's sw_counts.
+ */
+struct litepcie_mmap_dma_cursor {
+	int64_t sw_count;
+	int64_t reserved[7];
+};
+
+struct litepcie_ioctl_mmap_dma_cursor_info {
+	uint64_t dma_cursor_offset;
+	uint64_t dma_cursor_size;
+};
+
+#define LITEPCIE_DMA_TS_COUNT 256 /* DMA_BUFFER_COUNT_MAX */
+
+/* Per-buffer completion timestamps (mmapped read-only at dma_ts_offset).
+ *
+ * When the driver sees hw_count move from n to m (MSI handler or moderation
+ * poll), it stamps the slots n..m-1 (i % buffer_count) with CLOCK_MONOTONIC
+ * in ns, before publishing m. A stamp is valid until the slot is reused a
+ * ring later.
+ */
+struct litepcie_mmap_dma_ts {
+	uint64_t writer_ts[LITEPCIE_DMA_TS_COUNT]; /* RX buffer written to host memory */
+	uint64_t reader_ts[LITEPCIE_DMA_TS_COUNT]; /* TX buffer fetched by the FPGA */
+};
+
+struct litepcie_ioctl_mmap_dma_ts_info {
+	uint64_t dma_ts_offset;
+	uint64_t dma_ts_size;
+};
+
+struct litepcie_ioctl_dma_irq {
+	uint8_t writer_disable;
+	uint8_t reader_disable;
+};
+
+struct litepcie_ioctl_mmap_bar0_info {
+	uint64_t bar0_offset; /* mmap offset of BAR0, read-only (read-write with CAP_SYS_RAWIO) */
+	uint64_t bar0_size;
+	uint64_t dma_base;    /* offset of this channel's DMA CSRs in BAR0 */
+};
+
+/* DMA ring geometry of a channel, 0 keeps the current value.
+ * Returns the live geometry, -EBUSY while the channel is running,
+ * mmapped or locked by another file.
+ */
+struct litepcie_ioctl_dma_geometry {
+	uint32_t buffer_size;    /* multiple of the page size, up to DMA_BUFFER_SIZE_MAX */
+	uint32_t buffer_count;   /* power of two, up to DMA_BUFFER_COUNT_MAX */
+	uint32_t buffer_per_irq; /* one MSI every buffer_per_irq buffers */
+};
+
+/* Register user memory as the writer (RX) or reader (TX) ring of a channel.
+ * addr must be page aligned and size equal buffer_size * buffer_count; each
+ * buffer must be bus contiguous after DMA mapping (always true for
+ * page-sized buffers, or with hugepage/IOMMU backed memory). addr = 0
+ * unregisters. Requires the DMA lock and a stopped DMA.
+ */
+struct litepcie_ioctl_dma_user_buffer {
+	uint64_t addr;
+	uint64_t size;
+	uint8_t writer; /* 1: writer ring (device to host), 0: reader ring */
+};
+
+/* Route the DMA MSIs of a channel to a CPU, -1 keeps the current routing.
+ * Needs one vector per DMA interrupt (MSI MultiVector / MSI-X), -EOPNOTSUPP
+ * otherwise. Only for the DMAs locked by the caller.
+ */
+struct litepcie_ioctl_dma_irq_affinity {
+	int32_t writer_cpu;
+	int32_t reader_cpu;
+};
+
+/* Signal an eventfd when a DMA direction reaches its readiness watermark:
+ * RX (writer) buffers ready, or TX (reader) buffers free. The watermark also
+ * drives POLLIN/POLLOUT (0: default, 3 ready / 1 free). fd -1 drops the
+ * eventfd. Only for the DMAs locked by the caller.
+ */
+struct litepcie_ioctl_dma_eventfd {
+	int32_t fd;
+	uint32_t watermark;
+	uint8_t writer; /* 1: writer (device to host), 0: reader */
+};
+
+/* MSI / moderation-poll counters of a channel, cleared on DMA start. Buffers
+ * per MSI = *_irq_buffers / *_irqs. Polls only run with irq_moderation_us.
+ */
+struct litepcie_ioctl_dma_irq_stats {
+	uint64_t writer_irqs;
+	uint64_t writer_irq_buffers;
+	uint64_t writer_polls;
+	uint64_t writer_poll_buffers;
+	uint64_t reader_irqs;
+	uint64_t reader_irq_buffers;
+	uint64_t reader_polls;
+	uint64_t reader_poll_buffers;
+	uint32_t moderation_us; /* 0: fixed buffer_per_irq */
+};
+
+/* Attach to (enable) / detach from the RX stream of the channel's writer owner
+ * as a read-only subscriber with its own cursor page. Required
+ * subscribers gate writer_overflows, best-effort ones get per-slot drops.
+ */
+struct litepcie_ioctl_dma_subscribe {
+	uint8_t enable;
+	uint8_t required;
+	int32_t slot; /* out: index in litepcie_mmap_dma_ctrl.subscribers, -1 when detached */
+};
+
+/* Message mode of a channel (both DMAs stopped, locked by the caller). RX
+ * descriptors end on the stream's last and raise an MSI each, so one message
+ * lands per RX buffer. TX descriptors are no longer looped: each
+ * LITEPCIE_IOCTL_DMA_MSG_SEND queues one for the next TX slot (reader
+ * sw_count % buffer_count), with the real length. Closing the last owner
+ * goes back to streaming.
+ */
+struct litepcie_ioctl_dma_msg_mode {
+	uint8_t enable;
+};
+
+#define LITEPCIE_DMA_MSG_ALIGN 32         /* length granularity: the widest DMA data word */
+#define LITEPCIE_DMA_MSG_LAST  (1 << 0)   /* end of message: flag the stream's last */
+#define LITEPCIE_DMA_MSG_IRQ   (1 << 1)   /* reader MSI once fetched (POLLOUT, eventfd) */
+
+/* length 0 only refreshes the counts. EAGAIN while half the ring is queued,
+ * count and hw_count are still returned. */
+struct litepcie_ioctl_dma_msg {
+	uint32_t length;   /* bytes, multiple of LITEPCIE_DMA_MSG_ALIGN, <= buffer_size */
+	uint32_t flags;
+	int64_t count;     /* out: reader sw_count before the transfer (its slot) */
+	int64_t hw_count;  /* out: reader hw_count, transfers fetched */
+};
+
 #define LITEPCIE_IOCTL 'S'
 
 #define LITEPCIE_IOCTL_REG               _IOWR(LITEPCIE_IOCTL,  0, struct litepcie_ioctl_reg)
 #define LITEPCIE_IOCTL_FLASH             _IOWR(LITEPCIE_IOCTL,  1, struct litepcie_ioctl_flash)
 #define LITEPCIE_IOCTL_ICAP              _IOWR(LITEPCIE_IOCTL,  2, struct litepcie_ioctl_icap)
+#define LITEPCIE_IOCTL_REG_BATCH         _IOWR(LITEPCIE_IOCTL,  3, struct litepcie_ioctl_reg_batch)
 
 #define LITEPCIE_IOCTL_DMA                       _IOW(LITEPCIE_IOCTL,  20, struct litepcie_ioctl_dma)
 #define LITEPCIE_IOCTL_DMA_WRITER                _IOWR(LITEPCIE_IOCTL, 21, struct litepcie_ioctl_dma_writer)
 #define LITEPCIE_IOCTL_DMA_READER                _IOWR(LITEPCIE_IOCTL, 22, struct litepcie_ioctl_dma_reader)
+#define LITEPCIE_IOCTL_DMA_IRQ                   _IOW(LITEPCIE_IOCTL,  23, struct litepcie_ioctl_dma_irq)
 #define LITEPCIE_IOCTL_MMAP_DMA_INFO             _IOR(LITEPCIE_IOCTL,  24, struct litepcie_ioctl_mmap_dma_info)
 #define LITEPCIE_IOCTL_LOCK                      _IOWR(LITEPCIE_IOCTL, 25, struct litepcie_ioctl_lock)
 #define LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE    _IOW(LITEPCIE_IOCTL,  26, struct litepcie_ioctl_mmap_dma_update)
 #define LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE    _IOW(LITEPCIE_IOCTL,  27, struct litepcie_ioctl_mmap_dma_update)
+#define LITEPCIE_IOCTL_MMAP_DMA_CTRL_INFO        _IOR(LITEPCIE_IOCTL,  28, struct litepcie_ioctl_mmap_dma_ctrl_info)
+#define LITEPCIE_IOCTL_MMAP_BAR0_INFO            _IOR(LITEPCIE_IOCTL,  29, struct litepcie_ioctl_mmap_bar0_info)
+#define LITEPCIE_IOCTL_DMA_GEOMETRY              _IOWR(LITEPCIE_IOCTL, 31, struct litepcie_ioctl_dma_geometry)
+#define LITEPCIE_IOCTL_DMA_USER_BUFFER           _IOW(LITEPCIE_IOCTL,  32, struct litepcie_ioctl_dma_user_buffer)
+#define LITEPCIE_IOCTL_DMA_IRQ_AFFINITY          _IOW(LITEPCIE_IOCTL,  33, struct litepcie_ioctl_dma_irq_affinity)
+#define LITEPCIE_IOCTL_DMA_EVENTFD               _IOW(LITEPCIE_IOCTL,  34, struct litepcie_ioctl_dma_eventfd)
+#define LITEPCIE_IOCTL_DMA_IRQ_STATS             _IOR(LITEPCIE_IOCTL,  35, struct litepcie_ioctl_dma_irq_stats)
+#define LITEPCIE_IOCTL_DMA_SUBSCRIBE             _IOWR(LITEPCIE_IOCTL, 36, struct litepcie_ioctl_dma_subscribe)
+#define LITEPCIE_IOCTL_MMAP_DMA_TS_INFO          _IOR(LITEPCIE_IOCTL,  37, struct litepcie_ioctl_mmap_dma_ts_info)
+#define LITEPCIE_IOCTL_DMA_MSG_MODE              _IOW(LITEPCIE_IOCTL,  39, struct litepcie_ioctl_dma_msg_mode)
+#define LITEPCIE_IOCTL_DMA_MSG_SEND              _IOWR(LITEPCIE_IOCTL, 40, struct litepcie_ioctl_dma_msg)
+#define LITEPCIE_IOCTL_MMAP_DMA_CURSOR_INFO      _IOR(LITEPCIE_IOCTL,  41, struct litepcie_ioctl_mmap_dma_cursor_info)
 
 /* Include latency test definitions */
 #include "litepcie_latency.h"
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe latency histogram
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2024 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef _LITEPCIE_HIST_H
+#define _LITEPCIE_HIST_H
+
+/*
+ * Log-linear latency histogram, shared by the driver and the latency tools.
+ *
+ * Values are in ns. They are exact below 64 ns. Above that, each power of two
+ * is split in 32 buckets, so the error stays under 3.2%. Values from 2^40 ns
+ * (~18 minutes) up are clamped to the last bucket. The histogram is a fixed
+ * ~9 KB whatever the sample count. It is not locked: give each thread its
+ * own one and litepcie_hist_merge() them for the report.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#define litepcie_hist_div(a, b) div64_u64(a, b)
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#define litepcie_hist_div(a, b) ((a) / (b))
+#endif
+
+#define LITEPCIE_HIST_LINEAR_BITS 6  /* exact values below 2^6 ns */
+#define LITEPCIE_HIST_SUB_BITS    5  /* 2^5 buckets per power of two above */
+#define LITEPCIE_HIST_MAX_BITS    40 /* values clamped to 2^40 - 1 ns */
+#define LITEPCIE_HIST_BUCKETS \
+	((1 << LITEPCIE_HIST_LINEAR_BITS) + \
+	 ((LITEPCIE_HIST_MAX_BITS - LITEPCIE_HIST_LINEAR_BITS) << LITEPCIE_HIST_SUB_BITS))
+
+/* Quantiles in parts per million, usable without floating point. */
+#define LITEPCIE_HIST_P50   500000
+#define LITEPCIE_HIST_P99   990000
+#define LITEPCIE_HIST_P999  999000
+#define LITEPCIE_HIST_P9999 999900
+
+struct litepcie_hist {
+	uint64_t count;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t sum_ns;
+	uint64_t buckets[LITEPCIE_HIST_BUCKETS];
+};
+
+static inline void litepcie_hist_reset(struct litepcie_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min_ns = ~(uint64_t)0;
+}
+
+static inline unsigned int litepcie_hist_index(uint64_t ns)
+{
+	unsigned int msb, shift;
+
+	if (ns < (1 << LITEPCIE_HIST_LINEAR_BITS))
+		return ns;
+	if (ns >= (1ULL << LITEPCIE_HIST_MAX_BITS))
+		ns = (1ULL << LITEPCIE_HIST_MAX_BITS) - 1;
+	msb = 63 - __builtin_clzll(ns);
+	shift = msb - LITEPCIE_HIST_SUB_BITS;
+	return (1 << LITEPCIE_HIST_LINEAR_BITS) +
+		((msb - LITEPCIE_HIST_LINEAR_BITS) << LITEPCIE_HIST_SUB_BITS) +
+		(unsigned int)(ns >> shift) - (1 << LITEPCIE_HIST_SUB_BITS);
+}
+
+/* Highest value that falls in a bucket. */
+static inline uint64_t litepcie_hist_bucket_ns(unsigned int index)
+{
+	unsigned int group, sub, shift;
+
+	if (index < (1 << LITEPCIE_HIST_LINEAR_BITS))
+		return index;
+	index -= 1 << LITEPCIE_HIST_LINEAR_BITS;
+	group = index >> LITEPCIE_HIST_SUB_BITS;
+	sub = index & ((1 << LITEPCIE_HIST_SUB_BITS) - 1);
+	shift = group + LITEPCIE_HIST_LINEAR_BITS - LITEPCIE_HIST_SUB_BITS;
+	return ((((uint64_t)1 << LITEPCIE_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+static inline void litepcie_hist_record(struct litepcie_hist *h, uint64_t ns)
+{
+	h->buckets[litepcie_hist_index(ns)]++;
+	h->count++;
+	h->sum_ns += ns;
+	if (ns < h->min_ns)
+		h->min_ns = ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+static inline void litepcie_hist_merge(struct litepcie_hist *dst, const struct litepcie_hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < LITEPCIE_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum_ns += src->sum_ns;
+	if (src->min_ns < dst->min_ns)
+		dst->min_ns = src->min_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+}
+
+static inline uint64_t litepcie_hist_mean_ns(const struct litepcie_hist *h)
+{
+	return h->count ? litepcie_hist_div(h->sum_ns, h->count) : 0;
+}
+
+/* Value at quantile ppm / 1e6: the top of the bucket holding that rank,
+ * clamped to [min_ns, max_ns]. 0 when empty. */
+static inline uint64_t litepcie_hist_quantile_ns(const struct litepcie_hist *h, uint32_t ppm)
+{
+	uint64_t rank, seen = 0, ns;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	rank = litepcie_hist_div(h->count * ppm + 999999, 1000000);
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < LITEPCIE_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	ns = litepcie_hist_bucket_ns(i < LITEPCIE_HIST_BUCKETS ? i : LITEPCIE_HIST_BUCKETS - 1);
+	if (ns > h->max_ns)
+		ns = h->max_ns;
+	if (ns < h->min_ns)
+		ns = h->min_ns;
+	return ns;
+}
+
+#ifndef __KERNEL__
+/* Userspace reports: the four tail quantiles, then one row per power of two. */
+static inline void litepcie_hist_print(FILE *f, const struct litepcie_hist *h)
+{
+	fprintf(f, "  p50:    %10.3f us\n", litepcie_hist_quantile_ns(h, LITEPCIE_HIST_P50) / 1000.0);
+	fprintf(f, "  p99:    %10.3f us\n", litepcie_hist_quantile_ns(h, LITEPCIE_HIST_P99) / 1000.0);
+	fprintf(f, "  p99.9:  %10.3f us\n", litepcie_hist_quantile_ns(h, LITEPCIE_HIST_P999) / 1000.0);
+	fprintf(f, "  p99.99: %10.3f us\n", litepcie_hist_quantile_ns(h, LITEPCIE_HIST_P9999) / 1000.0);
+}
+
+static inline void litepcie_hist_print_distribution(FILE *f, const struct litepcie_hist *h)
+{
+	uint64_t rows[LITEPCIE_HIST_MAX_BITS - LITEPCIE_HIST_LINEAR_BITS + 1];
+	uint64_t peak = 0;
+	unsigned int i, row, nrows = sizeof(rows) / sizeof(rows[0]);
+	int bar;
+
+	if (!h->count)
+		return;
+	memset(rows, 0, sizeof(rows));
+	for (i = 0; i < LITEPCIE_HIST_BUCKETS; i++) {
+		row = i < (1 << LITEPCIE_HIST_LINEAR_BITS) ? 0 :
+			((i - (1 << LITEPCIE_HIST_LINEAR_BITS)) >> LITEPCIE_HIST_SUB_BITS) + 1;
+		rows[row] += h->buckets[i];
+	}
+	for (row = 0; row < nrows; row++)
+		if (rows[row] > peak)
+			peak = rows[row];
+	for (row = 0; row < nrows; row++) {
+		uint64_t lo = row ? 1ULL << (row + LITEPCIE_HIST_LINEAR_BITS - 1) : 0;
+		uint64_t hi = 1ULL << (row + LITEPCIE_HIST_LINEAR_BITS);
+
+		if (!rows[row])
+			continue;
+		fprintf(f, "  %10.3f - %10.3f us: %10llu (%5.1f%%) ", lo / 1000.0, hi / 1000.0,
+			(unsigned long long)rows[row], 100.0 * rows[row] / h->count);
+		for (bar = 0; bar < (int)(rows[row] * 40 / peak); bar++)
+			fputc('#', f);
+		fputc('\n', f);
+	}
+}
+#endif
+
+#endif /* _LITEPCIE_HIST_H */
@@ -14,9 +14,11 @@
 #include <linux/limits.h>
 #include <linux/pci.h>
 #include <linux/io.h>
+#include <linux/slab.h>
 
 #include "litepcie.h"
 #include "litepcie_latency.h"
+#include "litepcie_hist.h"
 #include "csr.h"
 
 /* Need to match the structure from main.c */
@@ -43,19 +45,23 @@ static inline void litepcie_writel(struct litepcie_device *s, uint32_t addr, uin
 }
 
 /* Perform latency test in kernel space */
-int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_latency *lat)
+int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_latency_ext *ext)
 {
+	struct litepcie_ioctl_latency *lat = ext ? &ext->lat : NULL;
 	uint64_t start_ns, end_ns, latency_ns;
-	uint64_t min_ns = ULLONG_MAX;
-	uint64_t max_ns = 0;
-	uint64_t total_ns = 0;
 	uint32_t i, test_val;
 	uint32_t readback;
 	unsigned long flags;
+	struct litepcie_hist *hist;
 	
 	/* Validate parameters */
 	if (!dev || !lat)
 		return -EINVAL;
+
+	hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+	litepcie_hist_reset(hist);
 	
 	/* Limit iterations to prevent blocking too long */
 	if (lat->iterations > 100000)
@@ -84,6 +90,7 @@ int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_lat
 		/* Verify data integrity */
 		if (readback != test_val) {
 			local_irq_restore(flags);
+			kfree(hist);
 			dev_err(&dev->dev->dev, "Latency test data mismatch at iteration %u: "
 			        "wrote 0x%08x, read 0x%08x\n", i, test_val, readback);
 			return -EIO;
@@ -91,26 +98,26 @@ int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_lat
 		
 		/* Calculate latency */
 		latency_ns = end_ns - start_ns;
-		total_ns += latency_ns;
-		
-		if (latency_ns < min_ns)
-			min_ns = latency_ns;
-		if (latency_ns > max_ns)
-			max_ns = latency_ns;
+		litepcie_hist_record(hist, latency_ns);
 	}
 	
 	/* Re-enable interrupts */
 	local_irq_restore(flags);
 	
 	/* Return results */
-	lat->min_ns = min_ns;
-	lat->max_ns = max_ns;
-	lat->avg_ns = total_ns / lat->iterations;
-	lat->total_ns = total_ns;
+	lat->min_ns = hist->min_ns;
+	lat->max_ns = hist->max_ns;
+	lat->avg_ns = litepcie_hist_mean_ns(hist);
+	lat->total_ns = hist->sum_ns;
+	ext->p50_ns = litepcie_hist_quantile_ns(hist, LITEPCIE_HIST_P50);
+	ext->p99_ns = litepcie_hist_quantile_ns(hist, LITEPCIE_HIST_P99);
+	ext->p999_ns = litepcie_hist_quantile_ns(hist, LITEPCIE_HIST_P999);
+	ext->p9999_ns = litepcie_hist_quantile_ns(hist, LITEPCIE_HIST_P9999);
+	kfree(hist);
 	
 	dev_info(&dev->dev->dev, "Latency test complete: %u iterations, "
-	         "min=%llu ns, avg=%llu ns, max=%llu ns\n",
-	         lat->iterations, lat->min_ns, lat->avg_ns, lat->max_ns);
+	         "min=%llu ns, avg=%llu ns, p99=%llu ns, max=%llu ns\n",
+	         lat->iterations, lat->min_ns, lat->avg_ns, ext->p99_ns, lat->max_ns);
 	
 	return 0;
 }
\ No newline at end of file
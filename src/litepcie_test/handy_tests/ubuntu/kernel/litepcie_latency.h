@@ -13,6 +13,8 @@
 
 #include <linux/types.h>
 
+#include "litepcie_hist.h"
+
 /* Latency test IOCTL structure */
 struct litepcie_ioctl_latency {
 	uint32_t iterations;      /* Number of measurements */
@@ -22,7 +24,35 @@ struct litepcie_ioctl_latency {
 	uint64_t total_ns;       /* Total time for all iterations */
 };
 
+/* Same test with tail percentiles. The size of litepcie_ioctl_latency is part
+ * of LITEPCIE_IOCTL_LATENCY_TEST, so it can't grow; new fields go here. */
+struct litepcie_ioctl_latency_ext {
+	struct litepcie_ioctl_latency lat;
+	uint64_t p50_ns;         /* Percentiles, from a litepcie_hist */
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t p9999_ns;
+};
+
+/* DMA loopback latency test IOCTL structure: one buffer at a time through
+ * reader -> loopback -> writer, timed in kernel from the reader descriptor
+ * write to the writer LOOP_STATUS update. */
+struct litepcie_ioctl_dma_latency {
+	uint32_t iterations;      /* Number of transfers (0: 1000) */
+	uint32_t buffer_size;     /* Bytes per transfer (output) */
+	uint64_t min_ns;          /* Minimum latency in nanoseconds */
+	uint64_t max_ns;          /* Maximum latency in nanoseconds */
+	uint64_t avg_ns;          /* Average latency in nanoseconds */
+	uint64_t p50_ns;          /* Percentiles, from hist */
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t p9999_ns;
+	struct litepcie_hist hist; /* Every transfer (output) */
+};
+
 /* IOCTL command for latency test */
 #define LITEPCIE_IOCTL_LATENCY_TEST _IOWR(LITEPCIE_IOCTL, 30, struct litepcie_ioctl_latency)
+#define LITEPCIE_IOCTL_DMA_LATENCY_TEST _IOWR(LITEPCIE_IOCTL, 38, struct litepcie_ioctl_dma_latency)
+#define LITEPCIE_IOCTL_LATENCY_TEST_EXT _IOWR(LITEPCIE_IOCTL, 42, struct litepcie_ioctl_latency_ext)
 
 #endif /* _LITEPCIE_LATENCY_H */
\ No newline at end of file
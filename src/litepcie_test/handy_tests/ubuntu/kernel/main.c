@@ -32,7 +32,15 @@
 #include <linux/poll.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/eventfd.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/uio.h>
 
 #if defined(__arm__) || defined(__aarch64__)
 #include <linux/dma-direct.h>
@@ -54,18 +62,108 @@
 #define LITEPCIE_NAME "litepcie"
 #define LITEPCIE_MINOR_COUNT 32
 
+/* Back the DMA rings with physically contiguous chunks of this size (e.g. 2 MB)
+ * instead of one allocation per buffer; 0 keeps per-buffer allocations. */
+static unsigned int dma_chunk_size;
+module_param(dma_chunk_size, uint, 0444);
+MODULE_PARM_DESC(dma_chunk_size, "DMA ring allocation chunk size in bytes (0 = per buffer, default)");
+
+static unsigned int irq_moderation_us;
+module_param(irq_moderation_us, uint, 0444);
+MODULE_PARM_DESC(irq_moderation_us, "Adaptive DMA MSI moderation period in us (0 = fixed buffer_per_irq, default)");
+
+static unsigned int stats_sample_ms = 100;
+module_param(stats_sample_ms, uint, 0444);
+MODULE_PARM_DESC(stats_sample_ms, "DMA FIFO and table level sampling period in ms for debugfs stats (0 = off, default 100)");
+
 #ifndef CSR_BASE
 #define CSR_BASE 0x00000000
 #endif
 
+/* mmap layout (follows the live ring geometry): TX buffers, RX buffers,
+ * shared DMA control page, timestamps, subscriber cursor, read-only BAR0. */
+#define DMA_TOTAL_SIZE(dmachan)  ((uint64_t)(dmachan)->buffer_size * (dmachan)->buffer_count)
+#define DMA_CTRL_OFFSET(dmachan) (2 * DMA_TOTAL_SIZE(dmachan))
+#define DMA_TS_SIZE              PAGE_ALIGN(sizeof(struct litepcie_mmap_dma_ts))
+#define DMA_TS_OFFSET(dmachan)   (DMA_CTRL_OFFSET(dmachan) + PAGE_SIZE)
+#define DMA_CURSOR_OFFSET(dmachan) (DMA_TS_OFFSET(dmachan) + DMA_TS_SIZE)
+#define BAR0_OFFSET(dmachan)     (DMA_CURSOR_OFFSET(dmachan) + PAGE_SIZE)
+
+/* Default readiness watermarks: RX buffers ready (POLLIN), TX buffers free (POLLOUT). */
+#define DMA_WRITER_WATERMARK_DEFAULT 3
+#define DMA_READER_WATERMARK_DEFAULT 1
+
+/* 24-bit depth and level fields of the DMA buffering FIFO CSRs. */
+#define DMA_FIFO_LEVEL_MASK 0xffffff
+
+/* Stop: bounded wait for the flushed table (LEVEL), then for the descriptor in
+ * flight at the slowest link rate (Gen1 x1), instead of a fixed millisecond. */
+#define DMA_STOP_TIMEOUT_US     1000
+#define DMA_DRAIN_BYTES_PER_US  250
+
+/* RX fan-out subscriber slot flags. */
+#define DMA_SUBSCRIBER_ACTIVE   (1 << 0)
+#define DMA_SUBSCRIBER_REQUIRED (1 << 1) /* gates writer_overflows, no per-slot drops */
+
+/* User memory registered as a DMA ring (LITEPCIE_IOCTL_DMA_USER_BUFFER). */
+struct litepcie_dma_user {
+	struct page **pages;
+	unsigned int npages; /* 0: the ring uses the driver buffers */
+	struct sg_table sgt;
+	dma_addr_t handle[DMA_BUFFER_COUNT_MAX];
+};
+
+/* Adaptive MSI moderation of one DMA direction: per-buffer MSIs while idle,
+ * MSI masked and LOOP_STATUS polled from an hrtimer while busy. */
+struct litepcie_dma_moderation {
+	struct litepcie_chan *chan;
+	bool writer;
+	uint8_t armed;   /* DMA running with moderation on */
+	uint8_t polling; /* MSI masked, timer running */
+	spinlock_t lock; /* hw_count updates: MSI handler vs timer */
+	struct hrtimer timer;
+	ktime_t irq_last;
+	uint64_t irqs, irq_buffers;
+	uint64_t polls, poll_buffers;
+};
+
+/* Health counters of one DMA direction for debugfs. Never reset, so they can be
+ * scraped as totals. Updated where hw_count already is, the levels are sampled
+ * from a delayed work every stats_sample_ms. */
+struct litepcie_dma_stats {
+	uint64_t irqs, irq_buffers; /* MSIs taken and the buffers they brought */
+	uint64_t buffers;           /* buffers completed, MSI or poll */
+	uint64_t lost;              /* writer: overwritten before the gate consumed them,
+	                             * reader: fetched before userspace filled them */
+	uint64_t dropped;           /* skipped by read()/write() ("too late") */
+	int64_t lost_accounted;     /* reader: underflows counted below this count */
+	int64_t occupancy_max;      /* ring occupancy high-water mark, in buffers */
+	uint32_t fifo_level, fifo_level_max;
+	uint32_t table_level, table_level_max;
+	uint64_t samples;
+};
+
 struct litepcie_dma_chan {
 	uint32_t base;
 	uint32_t writer_interrupt;
 	uint32_t reader_interrupt;
-	dma_addr_t reader_handle[DMA_BUFFER_COUNT];
-	dma_addr_t writer_handle[DMA_BUFFER_COUNT];
-	uint32_t *reader_addr[DMA_BUFFER_COUNT];
-	uint32_t *writer_addr[DMA_BUFFER_COUNT];
+	uint32_t buffer_size;
+	uint32_t buffer_count;
+	uint32_t buffer_per_irq;
+	uint32_t chunk_size;  /* contiguous allocation backing the ring, multiple of buffer_size */
+	uint32_t chunk_count;
+	atomic_t mmap_count; /* live mappings of the TX/RX buffers */
+	struct mutex ring_lock; /* serializes mmap() against geometry changes */
+	dma_addr_t reader_handle[DMA_BUFFER_COUNT_MAX];
+	dma_addr_t writer_handle[DMA_BUFFER_COUNT_MAX];
+	uint32_t *reader_addr[DMA_BUFFER_COUNT_MAX];
+	uint32_t *writer_addr[DMA_BUFFER_COUNT_MAX];
+	dma_addr_t reader_chunk_handle[DMA_BUFFER_COUNT_MAX];
+	dma_addr_t writer_chunk_handle[DMA_BUFFER_COUNT_MAX];
+	void *reader_chunk_addr[DMA_BUFFER_COUNT_MAX];
+	void *writer_chunk_addr[DMA_BUFFER_COUNT_MAX];
+	struct litepcie_dma_user reader_user;
+	struct litepcie_dma_user writer_user;
 	int64_t reader_hw_count;
 	int64_t reader_hw_count_last;
 	int64_t reader_sw_count;
@@ -76,13 +174,33 @@ struct litepcie_dma_chan {
 	uint8_t reader_enable;
 	uint8_t writer_lock;
 	uint8_t reader_lock;
+	uint8_t writer_irq_disable; /* busy-poll: keep the DMA MSI masked */
+	uint8_t reader_irq_disable;
+	uint8_t writer_table; /* descriptors still programmed in the FPGA (paused), next start resumes */
+	uint8_t reader_table;
+	uint8_t msg_mode;     /* variable-length transfers: LITEPCIE_IOCTL_DMA_MSG_MODE */
+	struct litepcie_mmap_dma_ctrl *ctrl; /* shared control page */
+	struct litepcie_mmap_dma_ts *ts;     /* per-buffer completion timestamps */
+	struct litepcie_mmap_dma_cursor *cursor[LITEPCIE_DMA_SUBSCRIBERS_MAX]; /* one page per slot */
+	uint8_t ctrl_mapped;
+	uint32_t writer_watermark; /* RX buffers ready before POLLIN / eventfd signal */
+	uint32_t reader_watermark; /* TX buffers free before POLLOUT / eventfd signal */
+	struct eventfd_ctx *writer_eventfd; /* protected by litepcie_device.lock */
+	struct eventfd_ctx *reader_eventfd;
+	struct litepcie_dma_moderation writer_mod;
+	struct litepcie_dma_moderation reader_mod;
+	uint8_t subscribers; /* RX fan-out slots in use, protected by litepcie_device.lock */
+	uint8_t subscriber_flags[LITEPCIE_DMA_SUBSCRIBERS_MAX];
+	int64_t subscriber_accounted[LITEPCIE_DMA_SUBSCRIBERS_MAX]; /* drops counted below this count */
+	int64_t writer_gate_accounted; /* writer_overflows counted below this count */
+	struct litepcie_dma_stats writer_stats;
+	struct litepcie_dma_stats reader_stats;
 };
 
 struct litepcie_chan {
 	struct litepcie_device *litepcie_dev;
 	struct litepcie_dma_chan dma;
 	struct cdev cdev;
-	uint32_t block_size;
 	uint32_t core_base;
 	wait_queue_head_t wait_rd; /* to wait for an ongoing read */
 	wait_queue_head_t wait_wr; /* to wait for an ongoing write */
@@ -102,22 +220,31 @@ struct litepcie_device {
 	spinlock_t lock;                              /* Spinlock for synchronization */
 	int minor_base;                               /* Base minor number for the device */
 	int irqs;                                     /* Number of IRQs */
+	void *irq_data[32];                           /* dev_id of each requested vector */
+	uint64_t irq_count[32];                       /* MSIs taken per vector */
+	uint8_t irq_per_vector;                       /* one vector per DMA interrupt, no shared scan */
 	int channels;                                 /* Number of DMA channels */
+	struct delayed_work stats_work;               /* DMA FIFO/table level sampling */
+	struct dentry *debugfs;                       /* debugfs/litepcie/<pci name> */
 };
 
 struct litepcie_chan_priv {
 	struct litepcie_chan *chan;
 	bool reader;
 	bool writer;
+	bool ctrl;
+	int subscriber; /* RX fan-out slot, -1: none */
+	atomic_t cursor_maps; /* live mappings of the slot's cursor page */
 };
 
 /* Forward declaration for latency test */
-extern int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_latency *lat);
+extern int litepcie_latency_test(struct litepcie_device *dev, struct litepcie_ioctl_latency_ext *ext);
 
 static int litepcie_major;
 static int litepcie_minor_idx;
 static struct class *litepcie_class;
 static dev_t litepcie_dev_t;
+static struct dentry *litepcie_debugfs;
 
 /* Function to read a 32-bit value from a LitePCIe device register */
 static inline uint32_t litepcie_readl(struct litepcie_device *s, uint32_t addr)
@@ -143,8 +270,12 @@ static inline void litepcie_writel(struct litepcie_device *s, uint32_t addr, uin
 /* Function to enable a specific interrupt on a LitePCIe device */
 static void litepcie_enable_interrupt(struct litepcie_device *s, int irq_num)
 {
+	unsigned long flags;
 	uint32_t v;
 
+	/* The moderation timer and MSI handlers also update it */
+	spin_lock_irqsave(&s->lock, flags);
+
 	/* Read the current interrupt enable register value */
 	v = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
 
@@ -153,13 +284,18 @@ static void litepcie_enable_interrupt(struct litepcie_device *s, int irq_num)
 
 	/* Write the updated value back to the register */
 	litepcie_writel(s, CSR_PCIE_MSI_ENABLE_ADDR, v);
+
+	spin_unlock_irqrestore(&s->lock, flags);
 }
 
 /* Function to disable a specific interrupt on a LitePCIe device */
 static void litepcie_disable_interrupt(struct litepcie_device *s, int irq_num)
 {
+	unsigned long flags;
 	uint32_t v;
 
+	spin_lock_irqsave(&s->lock, flags);
+
 	/* Read the current interrupt enable register value */
 	v = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
 
@@ -168,152 +304,663 @@ static void litepcie_disable_interrupt(struct litepcie_device *s, int irq_num)
 
 	/* Write the updated value back to the register */
 	litepcie_writel(s, CSR_PCIE_MSI_ENABLE_ADDR, v);
+
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static void litepcie_dma_free_buffers(struct litepcie_device *s, struct litepcie_dma_chan *dmachan)
+{
+	int i;
+
+	for (i = 0; i < dmachan->chunk_count; i++) {
+		if (dmachan->reader_chunk_addr[i])
+			dmam_free_coherent(&s->dev->dev, dmachan->chunk_size,
+				dmachan->reader_chunk_addr[i], dmachan->reader_chunk_handle[i]);
+		if (dmachan->writer_chunk_addr[i])
+			dmam_free_coherent(&s->dev->dev, dmachan->chunk_size,
+				dmachan->writer_chunk_addr[i], dmachan->writer_chunk_handle[i]);
+		dmachan->reader_chunk_addr[i] = NULL;
+		dmachan->writer_chunk_addr[i] = NULL;
+	}
+	for (i = 0; i < dmachan->buffer_count; i++) {
+		dmachan->reader_addr[i] = NULL;
+		dmachan->writer_addr[i] = NULL;
+	}
+	dmachan->chunk_count = 0;
+}
+
+static int litepcie_dma_alloc_chunks(struct litepcie_device *s, struct litepcie_dma_chan *dmachan,
+	uint32_t buffer_size, uint32_t buffer_count, uint32_t buffer_per_chunk)
+{
+	unsigned long attrs = (buffer_per_chunk > 1) ? DMA_ATTR_FORCE_CONTIGUOUS : 0;
+	gfp_t gfp = (buffer_per_chunk > 1) ? (GFP_KERNEL | __GFP_NOWARN) : GFP_KERNEL;
+	uint32_t offset;
+	int i, chunk;
+
+	dmachan->buffer_size = buffer_size;
+	dmachan->buffer_count = buffer_count;
+	dmachan->chunk_size = buffer_size * buffer_per_chunk;
+	dmachan->chunk_count = buffer_count / buffer_per_chunk;
+
+	/* for each dma chunk */
+	for (i = 0; i < dmachan->chunk_count; i++) {
+		/* allocate rd */
+		dmachan->reader_chunk_addr[i] = dmam_alloc_attrs(
+			&s->dev->dev,
+			dmachan->chunk_size,
+			&dmachan->reader_chunk_handle[i],
+			gfp, attrs);
+		/* allocate wr */
+		dmachan->writer_chunk_addr[i] = dmam_alloc_attrs(
+			&s->dev->dev,
+			dmachan->chunk_size,
+			&dmachan->writer_chunk_handle[i],
+			gfp, attrs);
+		/* check */
+		if (!dmachan->writer_chunk_addr[i]
+			|| !dmachan->reader_chunk_addr[i])
+			return -ENOMEM;
+	}
+
+	/* carve the dma buffers out of the chunks */
+	for (i = 0; i < buffer_count; i++) {
+		chunk  = i / buffer_per_chunk;
+		offset = (i % buffer_per_chunk) * buffer_size;
+		dmachan->reader_addr[i]   = dmachan->reader_chunk_addr[chunk] + offset;
+		dmachan->reader_handle[i] = dmachan->reader_chunk_handle[chunk] + offset;
+		dmachan->writer_addr[i]   = dmachan->writer_chunk_addr[chunk] + offset;
+		dmachan->writer_handle[i] = dmachan->writer_chunk_handle[chunk] + offset;
+	}
+
+	return 0;
+}
+
+static int litepcie_dma_alloc_buffers(struct litepcie_device *s, struct litepcie_dma_chan *dmachan,
+	uint32_t buffer_size, uint32_t buffer_count)
+{
+	uint32_t buffer_per_chunk = 1;
+	int ret;
+
+	/* buffer_count is a power of two, keep the chunks evenly filled */
+	if (dma_chunk_size > buffer_size)
+		buffer_per_chunk = min_t(uint32_t, rounddown_pow_of_two(dma_chunk_size / buffer_size),
+			buffer_count);
+
+	ret = litepcie_dma_alloc_chunks(s, dmachan, buffer_size, buffer_count, buffer_per_chunk);
+	if (ret && buffer_per_chunk > 1) {
+		dev_warn(&s->dev->dev, "Failed to allocate %u KB dma chunks, using per-buffer allocations\n",
+			(buffer_size * buffer_per_chunk) / 1024);
+		litepcie_dma_free_buffers(s, dmachan);
+		ret = litepcie_dma_alloc_chunks(s, dmachan, buffer_size, buffer_count, 1);
+	}
+	if (ret)
+		dev_err(&s->dev->dev, "Failed to allocate dma buffers\n");
+
+	return ret;
+}
+
+struct litepcie_pages {
+	unsigned long addr;
+	unsigned int order;
+};
+
+static void litepcie_free_pages(void *data)
+{
+	struct litepcie_pages *pages = data;
+
+	free_pages(pages->addr, pages->order);
+}
+
+/* devm_get_free_pages() on a given NUMA node. */
+static unsigned long litepcie_devm_get_free_pages_node(struct device *dev, int node,
+	gfp_t gfp, unsigned int order)
+{
+	struct litepcie_pages *pages;
+	struct page *page;
+
+	pages = devm_kmalloc(dev, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return 0;
+	page = alloc_pages_node(node, gfp, order);
+	if (!page)
+		return 0;
+	pages->addr = (unsigned long)page_address(page);
+	pages->order = order;
+	if (devm_add_action_or_reset(dev, litepcie_free_pages, pages))
+		return 0;
+
+	return pages->addr;
 }
 
 static int litepcie_dma_init(struct litepcie_device *s)
 {
 
-	int i, j;
+	int i, j, ret, node;
 	struct litepcie_dma_chan *dmachan;
 
 	if (!s)
 		return -ENODEV;
 
+	/* The rings come from dmam_alloc_attrs(), which already allocates on
+	 * dev_to_node(); keep the pages the CPU polls on the same node. */
+	node = dev_to_node(&s->dev->dev);
+	if (node != NUMA_NO_NODE)
+		dev_info(&s->dev->dev, "DMA buffers on NUMA node %d\n", node);
+
 	/* for each dma channel */
 	for (i = 0; i < s->channels; i++) {
 		dmachan = &s->chan[i].dma;
-		/* for each dma buffer */
-		for (j = 0; j < DMA_BUFFER_COUNT; j++) {
-			/* allocate rd */
-			dmachan->reader_addr[j] = dmam_alloc_coherent(
-				&s->dev->dev,
-				DMA_BUFFER_SIZE,
-				&dmachan->reader_handle[j],
-				GFP_KERNEL);
-			/* allocate wr */
-			dmachan->writer_addr[j] = dmam_alloc_coherent(
-				&s->dev->dev,
-				DMA_BUFFER_SIZE,
-				&dmachan->writer_handle[j],
-				GFP_KERNEL);
-			/* check */
-			if (!dmachan->writer_addr[j]
-				|| !dmachan->reader_addr[j]) {
-				dev_err(&s->dev->dev, "Failed to allocate dma buffers\n");
+		/* allocate shared control page */
+		dmachan->ctrl = (struct litepcie_mmap_dma_ctrl *)litepcie_devm_get_free_pages_node(
+			&s->dev->dev, node, GFP_KERNEL | __GFP_ZERO, 0);
+		if (!dmachan->ctrl) {
+			dev_err(&s->dev->dev, "Failed to allocate dma control page\n");
+			return -ENOMEM;
+		}
+		BUILD_BUG_ON(DMA_BUFFER_COUNT_MAX > LITEPCIE_DMA_TS_COUNT);
+		dmachan->ts = (struct litepcie_mmap_dma_ts *)litepcie_devm_get_free_pages_node(
+			&s->dev->dev, node, GFP_KERNEL | __GFP_ZERO, get_order(DMA_TS_SIZE));
+		if (!dmachan->ts) {
+			dev_err(&s->dev->dev, "Failed to allocate dma timestamp ring\n");
+			return -ENOMEM;
+		}
+		/* subscriber cursors: a page each, only the page of its slot is mapped writable */
+		for (j = 0; j < LITEPCIE_DMA_SUBSCRIBERS_MAX; j++) {
+			dmachan->cursor[j] = (struct litepcie_mmap_dma_cursor *)litepcie_devm_get_free_pages_node(
+				&s->dev->dev, node, GFP_KERNEL | __GFP_ZERO, 0);
+			if (!dmachan->cursor[j]) {
+				dev_err(&s->dev->dev, "Failed to allocate dma subscriber cursor\n");
 				return -ENOMEM;
 			}
 		}
+		/* allocate the default ring */
+		atomic_set(&dmachan->mmap_count, 0);
+		dmachan->buffer_per_irq = DMA_BUFFER_PER_IRQ;
+		ret = litepcie_dma_alloc_buffers(s, dmachan, DMA_BUFFER_SIZE, DMA_BUFFER_COUNT);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Publish writer counters to the shared control page. */
+static inline void litepcie_dma_writer_ctrl_publish(struct litepcie_dma_chan *dmachan)
+{
+	WRITE_ONCE(dmachan->ctrl->writer_hw_count, dmachan->writer_hw_count);
+	WRITE_ONCE(dmachan->ctrl->writer_sw_count, dmachan->writer_sw_count);
+}
+
+/* Publish reader counters to the shared control page. */
+static inline void litepcie_dma_reader_ctrl_publish(struct litepcie_dma_chan *dmachan)
+{
+	WRITE_ONCE(dmachan->ctrl->reader_hw_count, dmachan->reader_hw_count);
+	WRITE_ONCE(dmachan->ctrl->reader_sw_count, dmachan->reader_sw_count);
+}
+
+/* Pick up the sw_counts written by userspace to the shared control page
+ * (in message mode the driver moves the reader's itself). */
+static inline void litepcie_dma_ctrl_sync(struct litepcie_dma_chan *dmachan)
+{
+	if (!dmachan->ctrl_mapped)
+		return;
+	dmachan->writer_sw_count = READ_ONCE(dmachan->ctrl->writer_sw_count);
+	if (!dmachan->msg_mode)
+		dmachan->reader_sw_count = READ_ONCE(dmachan->ctrl->reader_sw_count);
+}
+
+/* RX buffers ready for userspace (sw_count taken from the page when mapped). */
+static inline int64_t litepcie_dma_writer_ready(struct litepcie_dma_chan *dmachan)
+{
+	int64_t sw_count = dmachan->ctrl_mapped ? READ_ONCE(dmachan->ctrl->writer_sw_count) :
+		READ_ONCE(dmachan->writer_sw_count);
+
+	return dmachan->writer_hw_count - sw_count;
+}
+
+/* TX buffers userspace may still fill (same half-ring limit as POLLOUT). */
+static inline int64_t litepcie_dma_reader_free(struct litepcie_dma_chan *dmachan)
+{
+	int64_t sw_count = dmachan->ctrl_mapped ? READ_ONCE(dmachan->ctrl->reader_sw_count) :
+		READ_ONCE(dmachan->reader_sw_count);
+
+	return dmachan->buffer_count / 2 - (sw_count - dmachan->reader_hw_count);
+}
+
+static inline void litepcie_dma_stats_occupancy(struct litepcie_dma_stats *stats, int64_t occupancy)
+{
+	if (occupancy > stats->occupancy_max)
+		WRITE_ONCE(stats->occupancy_max, occupancy);
+}
+
+/*
+ * RX fan-out accounting after a writer hw_count update: the slowest required
+ * cursor (primary included) gates writer_overflows, best-effort subscribers
+ * get their own drops. A buffer is lost once the DMA writes its slot again.
+ */
+static void litepcie_dma_writer_fanout(struct litepcie_device *s, struct litepcie_dma_chan *dmachan)
+{
+	struct litepcie_mmap_dma_ctrl *ctrl = dmachan->ctrl;
+	int64_t floor = dmachan->writer_hw_count - dmachan->buffer_count + 1;
+	int64_t gate = dmachan->ctrl_mapped ? READ_ONCE(ctrl->writer_sw_count) :
+		READ_ONCE(dmachan->writer_sw_count);
+	int64_t sw_count, lost;
+	int i;
+
+	if (READ_ONCE(dmachan->subscribers)) {
+		spin_lock(&s->lock);
+		for (i = 0; i < LITEPCIE_DMA_SUBSCRIBERS_MAX; i++) {
+			if (!(dmachan->subscriber_flags[i] & DMA_SUBSCRIBER_ACTIVE))
+				continue;
+			sw_count = READ_ONCE(dmachan->cursor[i]->sw_count);
+			WRITE_ONCE(ctrl->subscribers[i].sw_count, sw_count);
+			if (dmachan->subscriber_flags[i] & DMA_SUBSCRIBER_REQUIRED) {
+				gate = min(gate, sw_count);
+				continue;
+			}
+			lost = floor - max(sw_count, dmachan->subscriber_accounted[i]);
+			if (lost > 0) {
+				dmachan->subscriber_accounted[i] = floor;
+				WRITE_ONCE(ctrl->subscribers[i].drops, ctrl->subscribers[i].drops + lost);
+			}
+		}
+		spin_unlock(&s->lock);
+	}
+
+	WRITE_ONCE(ctrl->writer_gate_count, gate);
+	litepcie_dma_stats_occupancy(&dmachan->writer_stats, dmachan->writer_hw_count - gate);
+	lost = floor - max(gate, dmachan->writer_gate_accounted);
+	if (lost > 0) {
+		dmachan->writer_gate_accounted = floor;
+		WRITE_ONCE(ctrl->writer_overflows, ctrl->writer_overflows + lost);
+		WRITE_ONCE(dmachan->writer_stats.lost, dmachan->writer_stats.lost + lost);
+	}
+}
+
+/* Reader counterpart: TX buffers queued, and buffers the DMA fetched before
+ * userspace (write() or the mmap'ed sw_count) filled them. */
+static void litepcie_dma_reader_account(struct litepcie_dma_chan *dmachan)
+{
+	struct litepcie_dma_stats *stats = &dmachan->reader_stats;
+	int64_t sw_count = dmachan->ctrl_mapped ? READ_ONCE(dmachan->ctrl->reader_sw_count) :
+		READ_ONCE(dmachan->reader_sw_count);
+	int64_t lost = dmachan->reader_hw_count - max(sw_count, stats->lost_accounted);
+
+	litepcie_dma_stats_occupancy(stats, sw_count - dmachan->reader_hw_count);
+	if (lost > 0) {
+		stats->lost_accounted = dmachan->reader_hw_count;
+		WRITE_ONCE(stats->lost, stats->lost + lost);
 	}
+}
+
+static inline void litepcie_eventfd_signal(struct eventfd_ctx *ctx)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	eventfd_signal(ctx);
+#else
+	eventfd_signal(ctx, 1);
+#endif
+}
+
+/* Signal the eventfds whose watermark is reached (IRQ context or under s->lock). */
+static void litepcie_dma_writer_notify(struct litepcie_dma_chan *dmachan)
+{
+	if (dmachan->writer_eventfd && litepcie_dma_writer_ready(dmachan) >= dmachan->writer_watermark)
+		litepcie_eventfd_signal(dmachan->writer_eventfd);
+}
+
+static void litepcie_dma_reader_notify(struct litepcie_dma_chan *dmachan)
+{
+	if (dmachan->reader_eventfd && litepcie_dma_reader_free(dmachan) >= dmachan->reader_watermark)
+		litepcie_eventfd_signal(dmachan->reader_eventfd);
+}
+
+/* Extend a LOOP_STATUS value (loop count << 16 | buffer index) to a 64-bit buffer count. */
+static inline void litepcie_dma_update_hw_count(int64_t *hw_count, int64_t *hw_count_last,
+	uint32_t loop_status, uint32_t buffer_count)
+{
+	*hw_count &= ~(((int64_t)buffer_count << 16) - 1);
+	*hw_count |= (loop_status >> 16) * buffer_count + (loop_status & 0xffff);
+	if (*hw_count_last > *hw_count)
+		*hw_count += (int64_t)buffer_count << 16;
+	*hw_count_last = *hw_count;
+}
 
+/* Stamp the buffers completed since the last update, before their hw_count is published. */
+static inline void litepcie_dma_stamp(uint64_t *ts, int64_t from, int64_t to, uint32_t buffer_count)
+{
+	uint64_t now = ktime_get_ns();
+
+	if (to - from > buffer_count)
+		from = to - buffer_count;
+	for (; from < to; from++)
+		WRITE_ONCE(ts[from & (buffer_count - 1)], now);
+	smp_wmb();
+}
+
+/* Descriptor MSI spacing: every buffer with adaptive moderation or messages, the geometry's otherwise. */
+static inline uint32_t litepcie_dma_irq_every(struct litepcie_dma_chan *dmachan)
+{
+	return irq_moderation_us || dmachan->msg_mode ? 1 : dmachan->buffer_per_irq;
+}
+
+/* Streams fill whole buffers whatever the data's last (unless DMA_BUFFER_ALIGNED),
+ * messages end their RX buffer on it. */
+static inline uint32_t litepcie_dma_last_flags(struct litepcie_dma_chan *dmachan)
+{
+#ifndef DMA_BUFFER_ALIGNED
+	if (!dmachan->msg_mode)
+		return DMA_LAST_DISABLE;
+#endif
 	return 0;
 }
 
+static void litepcie_dma_moderation_start(struct litepcie_dma_moderation *mod)
+{
+	mod->polling = 0;
+	mod->irq_last = 0;
+	mod->irqs = 0;
+	mod->irq_buffers = 0;
+	mod->polls = 0;
+	mod->poll_buffers = 0;
+	WRITE_ONCE(mod->armed, irq_moderation_us != 0);
+}
+
+/* Wait for the timer and leave the MSI masked (the DMA is being stopped). */
+static void litepcie_dma_moderation_stop(struct litepcie_device *s, struct litepcie_dma_moderation *mod,
+	int irq_num)
+{
+	if (!READ_ONCE(mod->armed))
+		return;
+	WRITE_ONCE(mod->armed, 0);
+	hrtimer_cancel(&mod->timer);
+	mod->polling = 0;
+	litepcie_disable_interrupt(s, irq_num);
+}
+
+/* Restart the RX fan-out cursors and counters along with the writer. */
+static void litepcie_dma_writer_fanout_reset(struct litepcie_device *s, struct litepcie_dma_chan *dmachan)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&s->lock, flags);
+	for (i = 0; i < LITEPCIE_DMA_SUBSCRIBERS_MAX; i++) {
+		WRITE_ONCE(dmachan->cursor[i]->sw_count, dmachan->writer_hw_count);
+		WRITE_ONCE(dmachan->ctrl->subscribers[i].sw_count, dmachan->writer_hw_count);
+		WRITE_ONCE(dmachan->ctrl->subscribers[i].drops, 0);
+		dmachan->subscriber_accounted[i] = dmachan->writer_hw_count;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	WRITE_ONCE(dmachan->ctrl->writer_gate_count, dmachan->writer_hw_count);
+	WRITE_ONCE(dmachan->ctrl->writer_overflows, 0);
+	dmachan->writer_gate_accounted = dmachan->writer_hw_count;
+}
+
+/* Attach a read-only RX subscriber at the current hw_count, returns its slot or -EBUSY. */
+static int litepcie_dma_subscribe(struct litepcie_device *s, struct litepcie_dma_chan *dmachan, bool required)
+{
+	unsigned long flags;
+	int i, slot = -EBUSY;
+
+	spin_lock_irqsave(&s->lock, flags);
+	for (i = 0; i < LITEPCIE_DMA_SUBSCRIBERS_MAX; i++) {
+		if (dmachan->subscriber_flags[i])
+			continue;
+		WRITE_ONCE(dmachan->cursor[i]->sw_count, dmachan->writer_hw_count);
+		WRITE_ONCE(dmachan->ctrl->subscribers[i].sw_count, dmachan->writer_hw_count);
+		WRITE_ONCE(dmachan->ctrl->subscribers[i].drops, 0);
+		dmachan->subscriber_accounted[i] = dmachan->writer_hw_count;
+		dmachan->subscriber_flags[i] = DMA_SUBSCRIBER_ACTIVE | (required ? DMA_SUBSCRIBER_REQUIRED : 0);
+		dmachan->subscribers++;
+		slot = i;
+		break;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return slot;
+}
+
+static void litepcie_dma_unsubscribe(struct litepcie_device *s, struct litepcie_dma_chan *dmachan, int slot)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	dmachan->subscriber_flags[slot] = 0;
+	dmachan->subscribers--;
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+/* Counters of a restarted table: from 0 after programming, else from its LOOP_STATUS,
+ * whose buffer index is the next descriptor the resumed engine takes. */
+static int64_t litepcie_dma_table_position(struct litepcie_device *s, struct litepcie_dma_chan *dmachan,
+	uint32_t loop_status_offset)
+{
+	int64_t hw_count = 0, hw_count_last = 0;
+
+	litepcie_dma_update_hw_count(&hw_count, &hw_count_last,
+		litepcie_readl(s, dmachan->base + loop_status_offset), dmachan->buffer_count);
+	return hw_count;
+}
+
+/* Wait for a flushed table to empty and the descriptor in flight to land. */
+static void litepcie_dma_table_drain(struct litepcie_device *s, struct litepcie_dma_chan *dmachan,
+	uint32_t level_offset)
+{
+	unsigned int us;
+
+	for (us = 0; us < DMA_STOP_TIMEOUT_US; us++) {
+		if (!litepcie_readl(s, dmachan->base + level_offset))
+			break;
+		udelay(1);
+	}
+	udelay(min(DIV_ROUND_UP(dmachan->buffer_size, DMA_DRAIN_BYTES_PER_US), DMA_STOP_TIMEOUT_US - us));
+}
+
 static void litepcie_dma_writer_start(struct litepcie_device *s, int chan_num)
 {
 	struct litepcie_dma_chan *dmachan;
+	dma_addr_t handle;
 	int i;
 
 	dmachan = &s->chan[chan_num].dma;
 
-	/* Fill DMA Writer descriptors. */
-	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
-	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
-	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 0);
-	for (i = 0; i < DMA_BUFFER_COUNT; i++) {
-		/* Fill buffer size + parameters. */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET,
-#ifndef DMA_BUFFER_ALIGNED
-			DMA_LAST_DISABLE |
-#endif
-			(!(i%DMA_BUFFER_PER_IRQ == 0)) * DMA_IRQ_DISABLE | /* generate an msi */
-			DMA_BUFFER_SIZE);                                  /* every n buffers */
-		/* Fill 32-bit Address LSB. */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET + 4, (dmachan->writer_handle[i] >>  0) & 0xffffffff);
-		/* Write descriptor (and fill 32-bit Address MSB for 64-bit mode). */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_WE_OFFSET,        (dmachan->writer_handle[i] >> 32) & 0xffffffff);
+	if (dmachan->writer_table) {
+		/* Paused: the descriptors are still in the FPGA, only rebase the counters. */
+		dmachan->writer_hw_count = litepcie_dma_table_position(s, dmachan,
+			PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET);
+	} else {
+		/* Fill DMA Writer descriptors. */
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 0);
+		for (i = 0; i < dmachan->buffer_count; i++) {
+			/* Registered user buffer or driver buffer. */
+			handle = dmachan->writer_user.npages ? dmachan->writer_user.handle[i] : dmachan->writer_handle[i];
+			/* Fill buffer size + parameters. */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET,
+				litepcie_dma_last_flags(dmachan) |
+				(!(i%litepcie_dma_irq_every(dmachan) == 0)) * DMA_IRQ_DISABLE | /* generate an msi */
+				dmachan->buffer_size);                                         /* every n buffers */
+			/* Fill 32-bit Address LSB. */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET + 4, (handle >>  0) & 0xffffffff);
+			/* Write descriptor (and fill 32-bit Address MSB for 64-bit mode). */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_WE_OFFSET,        (handle >> 32) & 0xffffffff);
+		}
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 1);
+		dmachan->writer_table = 1;
+		dmachan->writer_hw_count = 0;
 	}
-	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 1);
 
 	/* Clear counters. */
-	dmachan->writer_hw_count = 0;
-	dmachan->writer_hw_count_last = 0;
-	dmachan->writer_sw_count = 0;
+	dmachan->writer_hw_count_last = dmachan->writer_hw_count;
+	dmachan->writer_sw_count = dmachan->writer_hw_count;
+	litepcie_dma_writer_ctrl_publish(dmachan);
+	litepcie_dma_writer_fanout_reset(s, dmachan);
+	litepcie_dma_moderation_start(&dmachan->writer_mod);
 
 	/* Start DMA Writer. */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 1);
 }
 
+/* Stop the engine but leave the table programmed (no flush, LOOP_STATUS kept) for
+ * the next start. The counters stay readable; a buffer in flight may be partial. */
+static void litepcie_dma_writer_pause(struct litepcie_device *s, int chan_num)
+{
+	struct litepcie_dma_chan *dmachan;
+
+	dmachan = &s->chan[chan_num].dma;
+
+	litepcie_dma_moderation_stop(s, &dmachan->writer_mod, dmachan->writer_interrupt);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
+}
+
 static void litepcie_dma_writer_stop(struct litepcie_device *s, int chan_num)
 {
 	struct litepcie_dma_chan *dmachan;
 
 	dmachan = &s->chan[chan_num].dma;
 
+	litepcie_dma_moderation_stop(s, &dmachan->writer_mod, dmachan->writer_interrupt);
+
 	/* Flush and stop DMA Writer. */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 0);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
-	udelay(1000);
+	litepcie_dma_table_drain(s, dmachan, PCIE_DMA_WRITER_TABLE_LEVEL_OFFSET);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
+	dmachan->writer_table = 0;
 
 	/* Clear counters. */
 	dmachan->writer_hw_count = 0;
 	dmachan->writer_hw_count_last = 0;
 	dmachan->writer_sw_count = 0;
+	litepcie_dma_writer_ctrl_publish(dmachan);
 }
 
 static void litepcie_dma_reader_start(struct litepcie_device *s, int chan_num)
 {
 	struct litepcie_dma_chan *dmachan;
+	dma_addr_t handle;
 	int i;
 
 	dmachan = &s->chan[chan_num].dma;
 
-	/* Fill DMA Reader descriptors. */
-	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
-	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
-	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 0);
-	for (i = 0; i < DMA_BUFFER_COUNT; i++) {
-		/* Fill buffer size + parameters. */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET,
+	if (dmachan->msg_mode) {
+		/* Messages: empty single-shot table, filled by litepcie_dma_msg_send(). */
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 0);
+		dmachan->reader_table = 0;
+		dmachan->reader_hw_count = 0;
+	} else if (dmachan->reader_table) {
+		/* Paused: the descriptors are still in the FPGA, only rebase the counters. */
+		dmachan->reader_hw_count = litepcie_dma_table_position(s, dmachan,
+			PCIE_DMA_READER_TABLE_LOOP_STATUS_OFFSET);
+	} else {
+		/* Fill DMA Reader descriptors. */
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 0);
+		for (i = 0; i < dmachan->buffer_count; i++) {
+			/* Registered user buffer or driver buffer. */
+			handle = dmachan->reader_user.npages ? dmachan->reader_user.handle[i] : dmachan->reader_handle[i];
+			/* Fill buffer size + parameters. */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET,
 #ifndef DMA_BUFFER_ALIGNED
-			DMA_LAST_DISABLE |
+				DMA_LAST_DISABLE |
 #endif
-			(!(i%DMA_BUFFER_PER_IRQ == 0)) * DMA_IRQ_DISABLE | /* generate an msi */
-			DMA_BUFFER_SIZE);                                  /* every n buffers */
-		/* Fill 32-bit Address LSB. */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET + 4, (dmachan->reader_handle[i] >>  0) & 0xffffffff);
-		/* Write descriptor (and fill 32-bit Address MSB for 64-bit mode). */
-		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_WE_OFFSET, (dmachan->reader_handle[i] >> 32) & 0xffffffff);
+				(!(i%litepcie_dma_irq_every(dmachan) == 0)) * DMA_IRQ_DISABLE | /* generate an msi */
+				dmachan->buffer_size);                                         /* every n buffers */
+			/* Fill 32-bit Address LSB. */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET + 4, (handle >>  0) & 0xffffffff);
+			/* Write descriptor (and fill 32-bit Address MSB for 64-bit mode). */
+			litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_WE_OFFSET, (handle >> 32) & 0xffffffff);
+		}
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 1);
+		dmachan->reader_table = 1;
+		dmachan->reader_hw_count = 0;
 	}
-	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 1);
 
 	/* Clear counters */
-	dmachan->reader_hw_count = 0;
-	dmachan->reader_hw_count_last = 0;
-	dmachan->reader_sw_count = 0;
+	dmachan->reader_hw_count_last = dmachan->reader_hw_count;
+	dmachan->reader_sw_count = dmachan->reader_hw_count;
+	dmachan->reader_stats.lost_accounted = dmachan->reader_hw_count;
+	litepcie_dma_reader_ctrl_publish(dmachan);
+	litepcie_dma_moderation_start(&dmachan->reader_mod);
 
 	/* Start dma reader */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 1);
 }
 
+static void litepcie_dma_reader_pause(struct litepcie_device *s, int chan_num)
+{
+	struct litepcie_dma_chan *dmachan;
+
+	dmachan = &s->chan[chan_num].dma;
+
+	litepcie_dma_moderation_stop(s, &dmachan->reader_mod, dmachan->reader_interrupt);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
+}
+
 static void litepcie_dma_reader_stop(struct litepcie_device *s, int chan_num)
 {
 	struct litepcie_dma_chan *dmachan;
 
 	dmachan = &s->chan[chan_num].dma;
 
+	litepcie_dma_moderation_stop(s, &dmachan->reader_mod, dmachan->reader_interrupt);
+
 	/* flush and stop dma reader */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 0);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
-	udelay(1000);
+	litepcie_dma_table_drain(s, dmachan, PCIE_DMA_READER_TABLE_LEVEL_OFFSET);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
+	dmachan->reader_table = 0;
 
 	/* clear counters */
 	dmachan->reader_hw_count = 0;
 	dmachan->reader_hw_count_last = 0;
 	dmachan->reader_sw_count = 0;
+	litepcie_dma_reader_ctrl_publish(dmachan);
+}
+
+/* Reallocate the ring of a stopped and unmapped channel. */
+static int litepcie_dma_set_geometry(struct litepcie_device *s, struct litepcie_chan *chan,
+	uint32_t buffer_size, uint32_t buffer_count, uint32_t buffer_per_irq)
+{
+	struct litepcie_dma_chan *dmachan = &chan->dma;
+	uint32_t old_size = dmachan->buffer_size;
+	uint32_t old_count = dmachan->buffer_count;
+	int ret;
+
+	/* a paused table still points at the old ring: flush it and let the
+	 * descriptor in flight land before the pages go */
+	if (dmachan->writer_table)
+		litepcie_dma_writer_stop(s, chan->index);
+	if (dmachan->reader_table)
+		litepcie_dma_reader_stop(s, chan->index);
+
+	if (buffer_size != old_size || buffer_count != old_count) {
+		litepcie_dma_free_buffers(s, dmachan);
+		ret = litepcie_dma_alloc_buffers(s, dmachan, buffer_size, buffer_count);
+		if (ret) {
+			/* fall back to the previous geometry */
+			litepcie_dma_free_buffers(s, dmachan);
+			if (litepcie_dma_alloc_buffers(s, dmachan, old_size, old_count)) {
+				litepcie_dma_free_buffers(s, dmachan);
+				dmachan->buffer_count = 0;
+			}
+			return ret;
+		}
+	}
+	dmachan->buffer_per_irq = buffer_per_irq;
+	/* keep the readiness watermarks reachable on the new ring */
+	dmachan->writer_watermark = min(dmachan->writer_watermark, dmachan->buffer_count);
+	dmachan->reader_watermark = min(dmachan->reader_watermark, max(dmachan->buffer_count / 2, 1U));
+
+	return 0;
 }
 
 static void litepcie_stop_dma(struct litepcie_device *s)
@@ -323,83 +970,681 @@ static void litepcie_stop_dma(struct litepcie_device *s)
 
 	for (i = 0; i < s->channels; i++) {
 		dmachan = &s->chan[i].dma;
+		litepcie_dma_moderation_stop(s, &dmachan->writer_mod, dmachan->writer_interrupt);
+		litepcie_dma_moderation_stop(s, &dmachan->reader_mod, dmachan->reader_interrupt);
 		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0b0);
 		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0b0);
 	}
 }
 
-static irqreturn_t litepcie_interrupt(int irq, void *data)
+/* Kernel-timed DMA loopback: one single-shot descriptor per direction per
+ * transfer (LOOP_PROG_N=0 tables), reader descriptor write to writer
+ * LOOP_STATUS update, IRQs off. Descriptors are queued without MSI, so the
+ * handlers and the ring counters are left alone. */
+#define DMA_LATENCY_ITERATIONS_MAX 100000
+#define DMA_LATENCY_TIMEOUT_NS     (1 * NSEC_PER_MSEC)
+
+static int litepcie_dma_latency_test(struct litepcie_device *s, struct litepcie_chan *chan,
+	struct litepcie_ioctl_dma_latency *m)
 {
-	struct litepcie_device *s = (struct litepcie_device *) data;
-	struct litepcie_chan *chan;
-	uint32_t loop_status;
-	uint32_t clear_mask, irq_vector, irq_enable;
-	int i;
+	struct litepcie_dma_chan *dmachan = &chan->dma;
+	uint32_t desc, loop_status, loopback, tag;
+	uint64_t start_ns, end_ns;
+	unsigned long flags;
+	bool done;
+	uint32_t i;
+	int ret = 0;
 
-/* Single MSI */
-#ifdef CSR_PCIE_MSI_CLEAR_ADDR
-	irq_vector = litepcie_readl(s, CSR_PCIE_MSI_VECTOR_ADDR);
-	irq_enable = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
-/* MSI MultiVector / MSI-X */
-#else
-	irq_vector = 0;
-	for (i = 0; i < s->irqs; i++) {
-		if (irq == pci_irq_vector(s->dev, i)) {
-			irq_vector = (1 << i);
-			break;
-		}
-	}
-	irq_enable = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
-#endif
+	if (m->iterations > DMA_LATENCY_ITERATIONS_MAX)
+		m->iterations = DMA_LATENCY_ITERATIONS_MAX;
+	if (m->iterations == 0)
+		m->iterations = 1000;
+	m->buffer_size = dmachan->buffer_size;
+	litepcie_hist_reset(&m->hist);
 
-#ifdef DEBUG_MSI
-	dev_dbg(&s->dev->dev, "MSI: 0x%x 0x%x\n", irq_vector, irq_enable);
+	desc =
+#ifndef DMA_BUFFER_ALIGNED
+		DMA_LAST_DISABLE |
 #endif
-	irq_vector &= irq_enable;
-	clear_mask = 0;
+		DMA_IRQ_DISABLE | dmachan->buffer_size;
 
-	for (i = 0; i < s->channels; i++) {
-		chan = &s->chan[i];
-		/* dma reader interrupt handling */
-		if (irq_vector & (1 << chan->dma.reader_interrupt)) {
-			loop_status = litepcie_readl(s, chan->dma.base +
-				PCIE_DMA_READER_TABLE_LOOP_STATUS_OFFSET);
-			chan->dma.reader_hw_count &= ((~(DMA_BUFFER_COUNT - 1) << 16) & 0xffffffffffff0000);
-			chan->dma.reader_hw_count |= (loop_status >> 16) * DMA_BUFFER_COUNT + (loop_status & 0xffff);
-			if (chan->dma.reader_hw_count_last > chan->dma.reader_hw_count)
-				chan->dma.reader_hw_count += (1 << (ilog2(DMA_BUFFER_COUNT) + 16));
-			chan->dma.reader_hw_count_last = chan->dma.reader_hw_count;
-#ifdef DEBUG_MSI
-			dev_dbg(&s->dev->dev, "MSI DMA%d Reader buf: %lld\n", i,
-				chan->dma.reader_hw_count);
-#endif
-			wake_up_interruptible(&chan->wait_wr);
-			clear_mask |= (1 << chan->dma.reader_interrupt);
+	loopback = litepcie_readl(s, dmachan->base + PCIE_DMA_LOOPBACK_ENABLE_OFFSET);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_LOOPBACK_ENABLE_OFFSET, 1);
+
+	/* Empty single-shot tables, engines on: each descriptor written runs once. */
+	dmachan->writer_table = 0;
+	dmachan->reader_table = 0;
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_PROG_N_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_LOOP_PROG_N_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 1);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 1);
+
+	for (i = 0; i < m->iterations; i++) {
+		tag = 0x4c4f4f50 ^ i;
+		WRITE_ONCE(dmachan->reader_addr[0][0], tag);
+		WRITE_ONCE(dmachan->writer_addr[0][0], ~tag);
+		wmb();
+
+		loop_status = litepcie_readl(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET);
+
+		/* Writer descriptor first, so the loopback data has somewhere to land. */
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET, desc);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_VALUE_OFFSET + 4,
+			(dmachan->writer_handle[0] >>  0) & 0xffffffff);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_WE_OFFSET,
+			(dmachan->writer_handle[0] >> 32) & 0xffffffff);
+
+		local_irq_save(flags);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET, desc);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET + 4,
+			(dmachan->reader_handle[0] >>  0) & 0xffffffff);
+		start_ns = ktime_get_ns();
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_WE_OFFSET,
+			(dmachan->reader_handle[0] >> 32) & 0xffffffff);
+		do {
+			done = litepcie_readl(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET) != loop_status;
+			end_ns = ktime_get_ns();
+		} while (!done && end_ns - start_ns < DMA_LATENCY_TIMEOUT_NS);
+		local_irq_restore(flags);
+
+		if (!done) {
+			dev_err(&s->dev->dev, "DMA%d latency test timeout at transfer %u\n", chan->index, i);
+			ret = -ETIMEDOUT;
+			break;
 		}
-		/* dma writer interrupt handling */
-		if (irq_vector & (1 << chan->dma.writer_interrupt)) {
-			loop_status = litepcie_readl(s, chan->dma.base +
-				PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET);
-			chan->dma.writer_hw_count &= ((~(DMA_BUFFER_COUNT - 1) << 16) & 0xffffffffffff0000);
-			chan->dma.writer_hw_count |= (loop_status >> 16) * DMA_BUFFER_COUNT + (loop_status & 0xffff);
-			if (chan->dma.writer_hw_count_last > chan->dma.writer_hw_count)
-				chan->dma.writer_hw_count += (1 << (ilog2(DMA_BUFFER_COUNT) + 16));
-			chan->dma.writer_hw_count_last = chan->dma.writer_hw_count;
-#ifdef DEBUG_MSI
-			dev_dbg(&s->dev->dev, "MSI DMA%d Writer buf: %lld\n", i,
-				chan->dma.writer_hw_count);
-#endif
-			wake_up_interruptible(&chan->wait_rd);
-			clear_mask |= (1 << chan->dma.writer_interrupt);
+
+		/* LOOP_STATUS moves with the descriptor, give the data the same budget. */
+		while (READ_ONCE(dmachan->writer_addr[0][0]) != tag &&
+		       ktime_get_ns() - start_ns < DMA_LATENCY_TIMEOUT_NS)
+			cpu_relax();
+		rmb();
+		if (READ_ONCE(dmachan->writer_addr[0][0]) != tag) {
+			dev_err(&s->dev->dev, "DMA%d latency test data mismatch at transfer %u: "
+				"sent 0x%08x, received 0x%08x\n", chan->index, i, tag,
+				READ_ONCE(dmachan->writer_addr[0][0]));
+			ret = -EIO;
+			break;
 		}
-	}
+		litepcie_hist_record(&m->hist, end_ns - start_ns);
 
-#ifdef CSR_PCIE_MSI_CLEAR_ADDR
-	litepcie_writel(s, CSR_PCIE_MSI_CLEAR_ADDR, clear_mask);
-#endif
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
 
-	return IRQ_HANDLED;
-}
+	/* Flush and stop both engines, whatever was left queued. */
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_FLUSH_OFFSET, 1);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 0);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_TABLE_FLUSH_OFFSET, 1);
+	litepcie_writel(s, dmachan->base + PCIE_DMA_LOOPBACK_ENABLE_OFFSET, loopback);
+
+	m->min_ns = m->hist.count ? m->hist.min_ns : 0;
+	m->max_ns = m->hist.max_ns;
+	m->avg_ns = litepcie_hist_mean_ns(&m->hist);
+	m->p50_ns = litepcie_hist_quantile_ns(&m->hist, LITEPCIE_HIST_P50);
+	m->p99_ns = litepcie_hist_quantile_ns(&m->hist, LITEPCIE_HIST_P99);
+	m->p999_ns = litepcie_hist_quantile_ns(&m->hist, LITEPCIE_HIST_P999);
+	m->p9999_ns = litepcie_hist_quantile_ns(&m->hist, LITEPCIE_HIST_P9999);
+
+	if (ret == 0)
+		dev_info(&s->dev->dev, "DMA%d latency test complete: %u transfers of %u bytes, "
+			"min=%llu ns, p50=%llu ns, p99=%llu ns, max=%llu ns\n", chan->index,
+			m->iterations, m->buffer_size, m->min_ns, m->p50_ns, m->p99_ns, m->max_ns);
+
+	return ret;
+}
+
+static void litepcie_dma_user_unpin(struct page **pages, unsigned int npages, bool dirty)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	unpin_user_pages_dirty_lock(pages, npages, dirty);
+#else
+	unsigned int i;
+
+	for (i = 0; i < npages; i++) {
+		if (dirty)
+			set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+#endif
+}
+
+static bool litepcie_dma_user_need_sync(struct device *dev, struct sg_table *sgt)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+		if (dma_need_sync(dev, sg_dma_address(sg)))
+			return true;
+	return false;
+#elif defined(__arm__) || defined(__aarch64__)
+	/* no dma_need_sync(): assume the ARM targets are not coherent */
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* Pin a user buffer and map it as the DMA ring, buffer i at offset i * buffer_size. */
+static int litepcie_dma_user_map(struct litepcie_device *s, struct litepcie_dma_chan *dmachan,
+	struct litepcie_dma_user *user, uint64_t addr, uint64_t size, enum dma_data_direction dir)
+{
+	struct scatterlist *sg;
+	uint64_t seg_start, offset;
+	unsigned int npages, gup_flags;
+	int i, j, n, ret;
+
+	if (!dmachan->buffer_count || size != DMA_TOTAL_SIZE(dmachan) || (addr & ~PAGE_MASK))
+		return -EINVAL;
+
+	npages = size >> PAGE_SHIFT;
+	user->pages = kvmalloc_array(npages, sizeof(*user->pages), GFP_KERNEL);
+	if (!user->pages)
+		return -ENOMEM;
+
+	/* Pin for the lifetime of the registration. A TX ring is only read by the
+	 * device, but before 6.2 a read-only pin may get the zero page or lose
+	 * the page to a later COW: pin it writable there too. */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+	gup_flags = (dir == DMA_FROM_DEVICE) ? FOLL_WRITE : 0;
+#else
+	gup_flags = FOLL_WRITE;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	n = pin_user_pages_fast(addr, npages, gup_flags | FOLL_LONGTERM, user->pages);
+#else
+	n = get_user_pages_fast(addr, npages, gup_flags, user->pages);
+#endif
+	if (n != npages) {
+		ret = (n < 0) ? n : -EFAULT;
+		goto err_unpin;
+	}
+
+	ret = sg_alloc_table_from_pages(&user->sgt, user->pages, npages, 0, size, GFP_KERNEL);
+	if (ret)
+		goto err_unpin;
+
+	user->sgt.nents = dma_map_sg(&s->dev->dev, user->sgt.sgl, user->sgt.orig_nents, dir);
+	if (!user->sgt.nents) {
+		ret = -EIO;
+		goto err_free_table;
+	}
+
+	/* The ring stays mapped while user space and the device hand buffers over
+	 * through the counters, without the driver in between (ctrl page, busy
+	 * poll): no place for dma_sync_*(). Refuse bounce buffers and non-coherent
+	 * mappings. */
+	if (litepcie_dma_user_need_sync(&s->dev->dev, &user->sgt)) {
+		dev_err(&s->dev->dev, "User buffers need DMA syncs (swiotlb or non-coherent DMA), not supported\n");
+		ret = -EOPNOTSUPP;
+		goto err_unmap;
+	}
+
+	/* one descriptor per buffer: each buffer must sit in a single bus segment */
+	i = 0;
+	seg_start = 0;
+	for_each_sg(user->sgt.sgl, sg, user->sgt.nents, j) {
+		while (i < dmachan->buffer_count) {
+			offset = (uint64_t)i * dmachan->buffer_size;
+			if (offset < seg_start ||
+			    offset + dmachan->buffer_size > seg_start + sg_dma_len(sg))
+				break;
+			user->handle[i++] = sg_dma_address(sg) + (offset - seg_start);
+		}
+		seg_start += sg_dma_len(sg);
+	}
+	if (i != dmachan->buffer_count) {
+		dev_err(&s->dev->dev, "User buffer is not DMA contiguous per %u bytes buffer\n",
+			dmachan->buffer_size);
+		ret = -EINVAL;
+		goto err_unmap;
+	}
+
+	user->npages = npages;
+
+	return 0;
+
+err_unmap:
+	dma_unmap_sg(&s->dev->dev, user->sgt.sgl, user->sgt.orig_nents, dir);
+err_free_table:
+	sg_free_table(&user->sgt);
+err_unpin:
+	if (n > 0)
+		litepcie_dma_user_unpin(user->pages, n, false);
+	kvfree(user->pages);
+	user->pages = NULL;
+
+	return ret;
+}
+
+static void litepcie_dma_user_unmap(struct litepcie_device *s, struct litepcie_dma_user *user,
+	enum dma_data_direction dir)
+{
+	if (!user->npages)
+		return;
+
+	dma_unmap_sg(&s->dev->dev, user->sgt.sgl, user->sgt.orig_nents, dir);
+	sg_free_table(&user->sgt);
+	litepcie_dma_user_unpin(user->pages, user->npages, dir == DMA_FROM_DEVICE);
+	kvfree(user->pages);
+	user->pages = NULL;
+	user->npages = 0;
+}
+
+/* Install (or drop, ctx NULL) a channel eventfd, watermark 0 restores the default. */
+static void litepcie_dma_eventfd_set(struct litepcie_device *s, struct litepcie_chan *chan, bool writer,
+	struct eventfd_ctx *ctx, uint32_t watermark)
+{
+	struct eventfd_ctx *old;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (writer) {
+		old = chan->dma.writer_eventfd;
+		chan->dma.writer_eventfd = ctx;
+		chan->dma.writer_watermark = watermark ? watermark : DMA_WRITER_WATERMARK_DEFAULT;
+		litepcie_dma_writer_notify(&chan->dma);
+	} else {
+		old = chan->dma.reader_eventfd;
+		chan->dma.reader_eventfd = ctx;
+		chan->dma.reader_watermark = watermark ? watermark : DMA_READER_WATERMARK_DEFAULT;
+		litepcie_dma_reader_notify(&chan->dma);
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+}
+
+/* Stop a DMA running on a registered user buffer and drop the registration. */
+static void litepcie_dma_user_release(struct litepcie_device *s, struct litepcie_chan *chan, bool writer)
+{
+	if (writer && chan->dma.writer_user.npages) {
+		litepcie_disable_interrupt(s, chan->dma.writer_interrupt);
+		litepcie_dma_writer_stop(s, chan->index);
+		chan->dma.writer_enable = 0;
+		litepcie_dma_user_unmap(s, &chan->dma.writer_user, DMA_FROM_DEVICE);
+	}
+	if (!writer && chan->dma.reader_user.npages) {
+		litepcie_disable_interrupt(s, chan->dma.reader_interrupt);
+		litepcie_dma_reader_stop(s, chan->index);
+		chan->dma.reader_enable = 0;
+		litepcie_dma_user_unmap(s, &chan->dma.reader_user, DMA_TO_DEVICE);
+	}
+}
+
+/* Message mode TX: the single-shot table holds exactly the queued transfers
+ * not yet taken, the rest are fetched (the last one may still be in flight,
+ * well inside the half-ring margin). Under s->lock, like the submissions. */
+static void litepcie_dma_msg_reader_hw_count(struct litepcie_device *s, struct litepcie_dma_chan *dmachan)
+{
+	int64_t hw_count = dmachan->reader_sw_count -
+		litepcie_readl(s, dmachan->base + PCIE_DMA_READER_TABLE_LEVEL_OFFSET);
+
+	if (hw_count > dmachan->reader_hw_count)
+		dmachan->reader_hw_count = hw_count;
+}
+
+/* Queue the next TX slot as one transfer of its real length. The descriptor
+ * goes out before sw_count moves, so a concurrent LEVEL read never counts it
+ * as fetched early. Same half-ring limit as write() and POLLOUT. */
+static int litepcie_dma_msg_send(struct litepcie_device *s, struct litepcie_chan *chan,
+	struct litepcie_ioctl_dma_msg *m)
+{
+	struct litepcie_dma_chan *dmachan = &chan->dma;
+	unsigned long flags;
+	dma_addr_t handle;
+	uint32_t slot;
+	int ret = 0;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (!m->length || dmachan->reader_sw_count - dmachan->reader_hw_count >= dmachan->buffer_count / 2) {
+		litepcie_dma_msg_reader_hw_count(s, dmachan);
+		WRITE_ONCE(dmachan->ctrl->reader_hw_count, dmachan->reader_hw_count);
+	}
+	if (m->length && dmachan->reader_sw_count - dmachan->reader_hw_count >= dmachan->buffer_count / 2)
+		ret = -EAGAIN;
+
+	m->count = dmachan->reader_sw_count;
+	if (m->length && !ret) {
+		slot = dmachan->reader_sw_count % dmachan->buffer_count;
+		handle = dmachan->reader_user.npages ? dmachan->reader_user.handle[slot] : dmachan->reader_handle[slot];
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET,
+			(m->flags & LITEPCIE_DMA_MSG_LAST ? 0 : DMA_LAST_DISABLE) |
+			(m->flags & LITEPCIE_DMA_MSG_IRQ ? 0 : DMA_IRQ_DISABLE) |
+			m->length);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_VALUE_OFFSET + 4, (handle >>  0) & 0xffffffff);
+		litepcie_writel(s, dmachan->base + PCIE_DMA_READER_TABLE_WE_OFFSET,        (handle >> 32) & 0xffffffff);
+		dmachan->reader_sw_count++;
+		WRITE_ONCE(dmachan->ctrl->reader_sw_count, dmachan->reader_sw_count);
+	}
+	m->hw_count = dmachan->reader_hw_count;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return ret;
+}
+
+/* Fetch the reader LOOP_STATUS and wake up waiters, returns the new buffers. */
+static int64_t litepcie_dma_reader_update(struct litepcie_device *s, struct litepcie_chan *chan)
+{
+	int64_t hw_count = chan->dma.reader_hw_count;
+	uint32_t loop_status;
+
+	if (chan->dma.msg_mode) {
+		spin_lock(&s->lock);
+		litepcie_dma_msg_reader_hw_count(s, &chan->dma);
+		spin_unlock(&s->lock);
+	} else {
+		loop_status = litepcie_readl(s, chan->dma.base +
+			PCIE_DMA_READER_TABLE_LOOP_STATUS_OFFSET);
+		litepcie_dma_update_hw_count(&chan->dma.reader_hw_count,
+			&chan->dma.reader_hw_count_last, loop_status, chan->dma.buffer_count);
+	}
+	litepcie_dma_stamp(chan->dma.ts->reader_ts, hw_count, chan->dma.reader_hw_count, chan->dma.buffer_count);
+	WRITE_ONCE(chan->dma.ctrl->reader_hw_count, chan->dma.reader_hw_count);
+	WRITE_ONCE(chan->dma.reader_stats.buffers,
+		chan->dma.reader_stats.buffers + chan->dma.reader_hw_count - hw_count);
+	litepcie_dma_reader_account(&chan->dma);
+#ifdef DEBUG_MSI
+	dev_dbg(&s->dev->dev, "MSI DMA%d Reader buf: %lld\n", chan->index,
+		chan->dma.reader_hw_count);
+#endif
+	wake_up_interruptible(&chan->wait_wr);
+	if (READ_ONCE(chan->dma.reader_eventfd)) {
+		spin_lock(&s->lock);
+		litepcie_dma_reader_notify(&chan->dma);
+		spin_unlock(&s->lock);
+	}
+	return chan->dma.reader_hw_count - hw_count;
+}
+
+static int64_t litepcie_dma_writer_update(struct litepcie_device *s, struct litepcie_chan *chan)
+{
+	int64_t hw_count = chan->dma.writer_hw_count;
+	uint32_t loop_status;
+
+	loop_status = litepcie_readl(s, chan->dma.base +
+		PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET);
+	litepcie_dma_update_hw_count(&chan->dma.writer_hw_count,
+		&chan->dma.writer_hw_count_last, loop_status, chan->dma.buffer_count);
+	litepcie_dma_stamp(chan->dma.ts->writer_ts, hw_count, chan->dma.writer_hw_count, chan->dma.buffer_count);
+	WRITE_ONCE(chan->dma.ctrl->writer_hw_count, chan->dma.writer_hw_count);
+	WRITE_ONCE(chan->dma.writer_stats.buffers,
+		chan->dma.writer_stats.buffers + chan->dma.writer_hw_count - hw_count);
+	litepcie_dma_writer_fanout(s, &chan->dma);
+#ifdef DEBUG_MSI
+	dev_dbg(&s->dev->dev, "MSI DMA%d Writer buf: %lld\n", chan->index,
+		chan->dma.writer_hw_count);
+#endif
+	wake_up_interruptible(&chan->wait_rd);
+	if (READ_ONCE(chan->dma.writer_eventfd)) {
+		spin_lock(&s->lock);
+		litepcie_dma_writer_notify(&chan->dma);
+		spin_unlock(&s->lock);
+	}
+	return chan->dma.writer_hw_count - hw_count;
+}
+
+static int64_t litepcie_dma_update(struct litepcie_dma_moderation *mod)
+{
+	struct litepcie_chan *chan = mod->chan;
+
+	return mod->writer ? litepcie_dma_writer_update(chan->litepcie_dev, chan) :
+		litepcie_dma_reader_update(chan->litepcie_dev, chan);
+}
+
+/* MSI taken: account it, and switch to timer polling when MSIs come in too fast. */
+static void litepcie_dma_irq(struct litepcie_device *s, struct litepcie_dma_moderation *mod, int irq_num)
+{
+	struct litepcie_dma_stats *stats = mod->writer ? &mod->chan->dma.writer_stats :
+		&mod->chan->dma.reader_stats;
+	int64_t buffers;
+	ktime_t now;
+
+	spin_lock(&mod->lock);
+	buffers = litepcie_dma_update(mod);
+	mod->irqs++;
+	mod->irq_buffers += buffers;
+	WRITE_ONCE(stats->irqs, stats->irqs + 1);
+	WRITE_ONCE(stats->irq_buffers, stats->irq_buffers + buffers);
+	spin_unlock(&mod->lock);
+
+	if (!READ_ONCE(mod->armed) || mod->polling)
+		return;
+	now = ktime_get();
+	if (mod->irqs > 1 && ktime_us_delta(now, mod->irq_last) < irq_moderation_us) {
+		litepcie_disable_interrupt(s, irq_num);
+		mod->polling = 1;
+		hrtimer_start(&mod->timer, us_to_ktime(irq_moderation_us), HRTIMER_MODE_REL_SOFT);
+	}
+	mod->irq_last = now;
+}
+
+static void litepcie_dma_reader_irq(struct litepcie_device *s, struct litepcie_chan *chan)
+{
+	litepcie_dma_irq(s, &chan->dma.reader_mod, chan->dma.reader_interrupt);
+}
+
+static void litepcie_dma_writer_irq(struct litepcie_device *s, struct litepcie_chan *chan)
+{
+	litepcie_dma_irq(s, &chan->dma.writer_mod, chan->dma.writer_interrupt);
+}
+
+/* Moderation timer (softirq): poll until a period brings no new buffer, then re-arm the MSI. */
+static enum hrtimer_restart litepcie_dma_moderation_timer(struct hrtimer *timer)
+{
+	struct litepcie_dma_moderation *mod = container_of(timer, struct litepcie_dma_moderation, timer);
+	struct litepcie_chan *chan = mod->chan;
+	struct litepcie_device *s = chan->litepcie_dev;
+	int irq_num = mod->writer ? chan->dma.writer_interrupt : chan->dma.reader_interrupt;
+	uint8_t irq_disable = mod->writer ? chan->dma.writer_irq_disable : chan->dma.reader_irq_disable;
+	unsigned long flags;
+	int64_t buffers;
+
+	spin_lock_irqsave(&mod->lock, flags);
+	buffers = litepcie_dma_update(mod);
+	mod->polls++;
+	mod->poll_buffers += buffers;
+	spin_unlock_irqrestore(&mod->lock, flags);
+
+	if (!READ_ONCE(mod->armed))
+		return HRTIMER_NORESTART;
+	if (buffers) {
+		hrtimer_forward_now(timer, us_to_ktime(irq_moderation_us));
+		return HRTIMER_RESTART;
+	}
+
+	/* Drained: back to per-buffer MSIs (busy-poll keeps them masked). */
+	mod->polling = 0;
+	mod->irq_last = ktime_get();
+	if (!irq_disable) {
+		litepcie_enable_interrupt(s, irq_num);
+		/* Catch a buffer completed while the MSI was masked. */
+		spin_lock_irqsave(&mod->lock, flags);
+		mod->poll_buffers += litepcie_dma_update(mod);
+		spin_unlock_irqrestore(&mod->lock, flags);
+	}
+	return HRTIMER_NORESTART;
+}
+
+static void litepcie_dma_moderation_init(struct litepcie_chan *chan, struct litepcie_dma_moderation *mod,
+	bool writer)
+{
+	mod->chan = chan;
+	mod->writer = writer;
+	spin_lock_init(&mod->lock);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&mod->timer, litepcie_dma_moderation_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+#else
+	hrtimer_init(&mod->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	mod->timer.function = litepcie_dma_moderation_timer;
+#endif
+}
+
+/* Shared handler: single MSI, or not enough vectors for one per DMA interrupt. */
+static irqreturn_t litepcie_interrupt(int irq, void *data)
+{
+	struct litepcie_device *s = (struct litepcie_device *) data;
+	struct litepcie_chan *chan;
+	uint32_t clear_mask, irq_vector, irq_enable;
+	int i;
+
+/* Single MSI */
+#ifdef CSR_PCIE_MSI_CLEAR_ADDR
+	s->irq_count[0]++;
+	irq_vector = litepcie_readl(s, CSR_PCIE_MSI_VECTOR_ADDR);
+	irq_enable = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
+/* MSI MultiVector / MSI-X */
+#else
+	irq_vector = 0;
+	for (i = 0; i < s->irqs; i++) {
+		if (irq == pci_irq_vector(s->dev, i)) {
+			irq_vector = (1 << i);
+			s->irq_count[i]++;
+			break;
+		}
+	}
+	irq_enable = litepcie_readl(s, CSR_PCIE_MSI_ENABLE_ADDR);
+#endif
+
+#ifdef DEBUG_MSI
+	dev_dbg(&s->dev->dev, "MSI: 0x%x 0x%x\n", irq_vector, irq_enable);
+#endif
+	irq_vector &= irq_enable;
+	clear_mask = 0;
+
+	for (i = 0; i < s->channels; i++) {
+		chan = &s->chan[i];
+		/* dma reader interrupt handling */
+		if (irq_vector & (1 << chan->dma.reader_interrupt)) {
+			litepcie_dma_reader_irq(s, chan);
+			clear_mask |= (1 << chan->dma.reader_interrupt);
+		}
+		/* dma writer interrupt handling */
+		if (irq_vector & (1 << chan->dma.writer_interrupt)) {
+			litepcie_dma_writer_irq(s, chan);
+			clear_mask |= (1 << chan->dma.writer_interrupt);
+		}
+	}
+
+#ifdef CSR_PCIE_MSI_CLEAR_ADDR
+	litepcie_writel(s, CSR_PCIE_MSI_CLEAR_ADDR, clear_mask);
+#endif
+
+	return IRQ_HANDLED;
+}
+
+/* Per-vector handlers: the vector identifies the channel and direction, so
+ * neither the MSI enable CSR read nor the channel scan is needed. Masked
+ * interrupts (DMA disabled, busy-poll) are not raised by the MSI controller. */
+static irqreturn_t litepcie_dma_reader_interrupt(int irq, void *data)
+{
+	struct litepcie_chan *chan = data;
+
+	chan->litepcie_dev->irq_count[chan->dma.reader_interrupt]++;
+	litepcie_dma_reader_irq(chan->litepcie_dev, chan);
+
+	return IRQ_HANDLED;
+}
+
+static irqreturn_t litepcie_dma_writer_interrupt(int irq, void *data)
+{
+	struct litepcie_chan *chan = data;
+
+	chan->litepcie_dev->irq_count[chan->dma.writer_interrupt]++;
+	litepcie_dma_writer_irq(chan->litepcie_dev, chan);
+
+	return IRQ_HANDLED;
+}
+
+static void litepcie_irq_affinity(int irq, const struct cpumask *mask)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+	irq_set_affinity_and_hint(irq, mask);
+#else
+	irq_set_affinity_hint(irq, mask);
+#endif
+}
+
+static void litepcie_free_irqs(struct litepcie_device *s)
+{
+	int i, irq;
+
+	for (i = 0; i < s->irqs; i++) {
+		irq = pci_irq_vector(s->dev, i);
+		litepcie_irq_affinity(irq, NULL);
+		free_irq(irq, s->irq_data[i]);
+	}
+	s->irqs = 0;
+}
+
+static int litepcie_request_irqs(struct litepcie_device *s, int nvecs)
+{
+	struct litepcie_chan *chan;
+	irq_handler_t handler;
+	void *data;
+	int node = dev_to_node(&s->dev->dev);
+	int i, c, irq, ret;
+
+	/* With MSI MultiVector / MSI-X, vector n carries DMA interrupt n. */
+	s->irq_per_vector = 0;
+#ifndef CSR_PCIE_MSI_CLEAR_ADDR
+	s->irq_per_vector = 1;
+	for (c = 0; c < s->channels; c++) {
+		if (s->chan[c].dma.reader_interrupt >= nvecs ||
+		    s->chan[c].dma.writer_interrupt >= nvecs)
+			s->irq_per_vector = 0;
+	}
+#endif
+
+	s->irqs = 0;
+	for (i = 0; i < nvecs; i++) {
+		irq = pci_irq_vector(s->dev, i);
+		handler = litepcie_interrupt;
+		data = s;
+		chan = NULL;
+		for (c = 0; s->irq_per_vector && c < s->channels; c++) {
+			if (i == s->chan[c].dma.reader_interrupt)
+				handler = litepcie_dma_reader_interrupt;
+			else if (i == s->chan[c].dma.writer_interrupt)
+				handler = litepcie_dma_writer_interrupt;
+			else
+				continue;
+			chan = &s->chan[c];
+			data = chan;
+			break;
+		}
+
+		/* Request IRQ */
+		ret = request_irq(irq, handler, 0, LITEPCIE_NAME, data);
+		if (ret < 0) {
+			dev_err(&s->dev->dev, "Failed to allocate IRQ %d\n", irq);
+			litepcie_free_irqs(s);
+			return ret;
+		}
+		s->irq_data[i] = data;
+		s->irqs += 1;
+
+		/* Spread the channels over the cores of the device's NUMA node,
+		 * LITEPCIE_IOCTL_DMA_IRQ_AFFINITY moves them to the consumers. */
+		if (chan)
+			litepcie_irq_affinity(irq, cpumask_of(cpumask_local_spread(chan->index, node)));
+	}
+
+	if (s->irq_per_vector)
+		dev_info(&s->dev->dev, "Per-channel DMA IRQ vectors enabled.\n");
+
+	return 0;
+}
 
 static int litepcie_open(struct inode *inode, struct file *file)
 {
@@ -410,18 +1655,22 @@ static int litepcie_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	chan_priv->chan = chan;
+	chan_priv->subscriber = -1;
+	atomic_set(&chan_priv->cursor_maps, 0);
 	file->private_data = chan_priv;
 
 	if (chan->dma.reader_enable == 0) { /* clear only if disabled */
 		chan->dma.reader_hw_count = 0;
 		chan->dma.reader_hw_count_last = 0;
 		chan->dma.reader_sw_count = 0;
+		litepcie_dma_reader_ctrl_publish(&chan->dma);
 	}
 
 	if (chan->dma.writer_enable == 0) { /* clear only if disabled */
 		chan->dma.writer_hw_count = 0;
 		chan->dma.writer_hw_count_last = 0;
 		chan->dma.writer_sw_count = 0;
+		litepcie_dma_writer_ctrl_publish(&chan->dma);
 	}
 
 	return 0;
@@ -435,37 +1684,71 @@ static int litepcie_release(struct inode *inode, struct file *file)
 	if (chan_priv->reader) {
 		/* disable interrupt */
 		litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
-		/* disable DMA */
-		litepcie_dma_reader_stop(chan->litepcie_dev, chan->index);
+		/* disable DMA; only a driver ring the owner left paused keeps its table
+		 * (opt-in), the next session sees 0-based counters otherwise */
+		if (chan->dma.reader_enable || !chan->dma.reader_table || chan->dma.reader_user.npages)
+			litepcie_dma_reader_stop(chan->litepcie_dev, chan->index);
 		chan->dma.reader_lock = 0;
 		chan->dma.reader_enable = 0;
+		chan->dma.reader_irq_disable = 0;
+		litepcie_dma_user_unmap(chan->litepcie_dev, &chan->dma.reader_user, DMA_TO_DEVICE);
+		litepcie_dma_eventfd_set(chan->litepcie_dev, chan, false, NULL, 0);
 	}
 
 	if (chan_priv->writer) {
 		/* disable interrupt */
 		litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
-		/* disable DMA */
-		litepcie_dma_writer_stop(chan->litepcie_dev, chan->index);
+		/* disable DMA; only a driver ring the owner left paused keeps its table
+		 * (opt-in), the next session sees 0-based counters otherwise */
+		if (chan->dma.writer_enable || !chan->dma.writer_table || chan->dma.writer_user.npages)
+			litepcie_dma_writer_stop(chan->litepcie_dev, chan->index);
 		chan->dma.writer_lock = 0;
 		chan->dma.writer_enable = 0;
+		chan->dma.writer_irq_disable = 0;
+		litepcie_dma_user_unmap(chan->litepcie_dev, &chan->dma.writer_user, DMA_FROM_DEVICE);
+		litepcie_dma_eventfd_set(chan->litepcie_dev, chan, true, NULL, 0);
+	}
+
+	/* last owner gone: back to streaming */
+	if (chan->dma.msg_mode && !chan->dma.writer_lock && !chan->dma.reader_lock) {
+		chan->dma.msg_mode = 0;
+		chan->dma.writer_table = 0;
+		chan->dma.reader_table = 0;
 	}
 
+	if (chan_priv->subscriber >= 0)
+		litepcie_dma_unsubscribe(chan->litepcie_dev, &chan->dma, chan_priv->subscriber);
+
+	if (chan_priv->ctrl)
+		chan->dma.ctrl_mapped = 0;
+
 	kfree(chan_priv);
 
 	return 0;
 }
 
-static ssize_t litepcie_read(struct file *file, char __user *data, size_t size, loff_t *offset)
+/* read(2) and splice(2) from the RX ring, whole DMA buffers only. splice()
+ * copies each buffer into pipe pages, so its slot is released at once like
+ * with read(): the ring pages themselves never leave the driver. */
+static ssize_t litepcie_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	size_t len;
-	int i, ret;
+	struct file *file = iocb->ki_filp;
+	size_t len, size = iov_iter_count(to);
+	int ret;
 	int overflows;
 
 	struct litepcie_chan_priv *chan_priv = file->private_data;
 	struct litepcie_chan *chan = chan_priv->chan;
 	struct litepcie_device *s = chan->litepcie_dev;
 
-	if (file->f_flags & O_NONBLOCK) {
+	/* the writer fills the registered user buffer, not the driver ring */
+	if (chan->dma.writer_user.npages)
+		return -EBUSY;
+	/* subscribers consume through their own mmap cursor */
+	if (chan_priv->subscriber >= 0)
+		return -EPERM;
+
+	if ((file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
 		if (chan->dma.writer_hw_count == chan->dma.writer_sw_count)
 			ret = -EAGAIN;
 		else
@@ -478,30 +1761,33 @@ static ssize_t litepcie_read(struct file *file, char __user *data, size_t size,
 	if (ret < 0)
 		return ret;
 
-	i = 0;
 	overflows = 0;
 	len = size;
-	while (len >= DMA_BUFFER_SIZE) {
+	while (len >= chan->dma.buffer_size) {
 		if ((chan->dma.writer_hw_count - chan->dma.writer_sw_count) > 0) {
-			if ((chan->dma.writer_hw_count - chan->dma.writer_sw_count) > DMA_BUFFER_COUNT/2) {
+			if ((chan->dma.writer_hw_count - chan->dma.writer_sw_count) > chan->dma.buffer_count/2) {
+				/* lost buffer: zeroes, never stale memory */
 				overflows++;
+				if (iov_iter_zero(chan->dma.buffer_size, to) != chan->dma.buffer_size)
+					return -EFAULT;
 			} else {
-				ret = copy_to_user(data + (chan->block_size * i),
-						   chan->dma.writer_addr[chan->dma.writer_sw_count%DMA_BUFFER_COUNT],
-						   DMA_BUFFER_SIZE);
-				if (ret)
+				if (copy_to_iter(chan->dma.writer_addr[chan->dma.writer_sw_count%chan->dma.buffer_count],
+						 chan->dma.buffer_size, to) != chan->dma.buffer_size)
 					return -EFAULT;
 			}
-			len -= DMA_BUFFER_SIZE;
+			len -= chan->dma.buffer_size;
 			chan->dma.writer_sw_count += 1;
-			i++;
 		} else {
 			break;
 		}
 	}
 
-	if (overflows)
+	WRITE_ONCE(chan->dma.ctrl->writer_sw_count, chan->dma.writer_sw_count);
+
+	if (overflows) {
+		WRITE_ONCE(chan->dma.writer_stats.dropped, chan->dma.writer_stats.dropped + overflows);
 		dev_err(&s->dev->dev, "Reading too late, %d buffers lost\n", overflows);
+	}
 
 #ifdef DEBUG_READ
 	dev_dbg(&s->dev->dev, "read: read %ld bytes out of %ld\n", size - len, size);
@@ -510,52 +1796,64 @@ static ssize_t litepcie_read(struct file *file, char __user *data, size_t size,
 	return size - len;
 }
 
-static ssize_t litepcie_write(struct file *file, const char __user *data, size_t size, loff_t *offset)
+/* write(2) and splice(2) (vmsplice()d or socket pipes) to the TX ring,
+ * whole DMA buffers only: a partial buffer stays with the caller. */
+static ssize_t litepcie_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	size_t len;
-	int i, ret;
+	struct file *file = iocb->ki_filp;
+	size_t len, size = iov_iter_count(from);
+	int ret;
 	int underflows;
 
 	struct litepcie_chan_priv *chan_priv = file->private_data;
 	struct litepcie_chan *chan = chan_priv->chan;
 	struct litepcie_device *s = chan->litepcie_dev;
 
-	if (file->f_flags & O_NONBLOCK) {
+	/* the reader fetches the registered user buffer, not the driver ring;
+	 * messages are queued with LITEPCIE_IOCTL_DMA_MSG_SEND */
+	if (chan->dma.reader_user.npages || chan->dma.msg_mode)
+		return -EBUSY;
+	if (chan_priv->subscriber >= 0)
+		return -EPERM;
+
+	if ((file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
 		if (chan->dma.reader_hw_count == chan->dma.reader_sw_count)
 			ret = -EAGAIN;
 		else
 			ret = 0;
 	} else {
 		ret = wait_event_interruptible(chan->wait_wr,
-					       (chan->dma.reader_sw_count - chan->dma.reader_hw_count) < DMA_BUFFER_COUNT/2);
+					       (chan->dma.reader_sw_count - chan->dma.reader_hw_count) < chan->dma.buffer_count/2);
 	}
 
 	if (ret < 0)
 		return ret;
 
-	i = 0;
 	underflows = 0;
 	len = size;
-	while (len >= DMA_BUFFER_SIZE) {
-		if ((chan->dma.reader_sw_count - chan->dma.reader_hw_count) < DMA_BUFFER_COUNT/2) {
+	while (len >= chan->dma.buffer_size) {
+		if ((chan->dma.reader_sw_count - chan->dma.reader_hw_count) < chan->dma.buffer_count/2) {
 			if ((chan->dma.reader_sw_count - chan->dma.reader_hw_count) < 0) {
 				underflows++;
+				iov_iter_advance(from, chan->dma.buffer_size);
 			} else {
-				ret = copy_from_user(chan->dma.reader_addr[chan->dma.reader_sw_count%DMA_BUFFER_COUNT],
-						     data + (chan->block_size * i), DMA_BUFFER_SIZE);
-				if (ret)
+				if (copy_from_iter(chan->dma.reader_addr[chan->dma.reader_sw_count%chan->dma.buffer_count],
+						   chan->dma.buffer_size, from) != chan->dma.buffer_size)
 					return -EFAULT;
 			}
-			len -= DMA_BUFFER_SIZE;
+			len -= chan->dma.buffer_size;
 			chan->dma.reader_sw_count += 1;
-			i++;
 		} else {
 			break;
 		}
 	}
 
-	if (underflows)
+	WRITE_ONCE(chan->dma.ctrl->reader_sw_count, chan->dma.reader_sw_count);
+
+	if (underflows) {
+		WRITE_ONCE(chan->dma.reader_stats.dropped, chan->dma.reader_stats.dropped + underflows);
 		dev_err(&s->dev->dev, "Writing too late, %d buffers lost\n", underflows);
+	}
 
 #ifdef DEBUG_WRITE
 	dev_dbg(&s->dev->dev, "write: write %ld bytes out of %ld\n", size - len, size);
@@ -564,52 +1862,251 @@ static ssize_t litepcie_write(struct file *file, const char __user *data, size_t
 	return size - len;
 }
 
-static int litepcie_mmap(struct file *file, struct vm_area_struct *vma)
+static int litepcie_mmap_dma_ctrl(struct file *file, struct vm_area_struct *vma)
 {
 	struct litepcie_chan_priv *chan_priv = file->private_data;
 	struct litepcie_chan *chan = chan_priv->chan;
 	struct litepcie_device *s = chan->litepcie_dev;
-	unsigned long pfn;
-	int is_tx, i;
 
-	if (vma->vm_end - vma->vm_start != DMA_BUFFER_TOTAL_SIZE)
-		return -EINVAL;
-
-	if (vma->vm_pgoff == 0)
-		is_tx = 1;
-	else if (vma->vm_pgoff == (DMA_BUFFER_TOTAL_SIZE >> PAGE_SHIFT))
-		is_tx = 0;
-	else
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE)
 		return -EINVAL;
 
-	for (i = 0; i < DMA_BUFFER_COUNT; i++) {
-#if defined(__arm__) || defined(__aarch64__)
-		void *va;
-		if (is_tx)
-			va = phys_to_virt(dma_to_phys(&s->dev->dev, chan->dma.reader_handle[i]));
-		else
-			va = phys_to_virt(dma_to_phys(&s->dev->dev, chan->dma.writer_handle[i]));
-		pfn = page_to_pfn(virt_to_page(va));
+	/* Read-only for subscribers, they write their own cursor page. */
+	if (chan_priv->subscriber >= 0) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+		vma->vm_flags &= ~VM_MAYWRITE;
 #else
-		if (is_tx)
-			pfn = __pa(chan->dma.reader_addr[i]) >> PAGE_SHIFT;
-		else
-			pfn = __pa(chan->dma.writer_addr[i]) >> PAGE_SHIFT;
+		vm_flags_clear(vma, VM_MAYWRITE);
 #endif
-		/*
-		 * Note: the memory is cached, so the user must explicitly
-		 * flush the CPU caches on architectures which require it.
-		 */
-		if (remap_pfn_range(vma, vma->vm_start + i * DMA_BUFFER_SIZE, pfn,
-				    DMA_BUFFER_SIZE, vma->vm_page_prot)) {
-			dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
-			return -EAGAIN;
-		}
 	}
 
+	if (remap_pfn_range(vma, vma->vm_start, virt_to_phys(chan->dma.ctrl) >> PAGE_SHIFT,
+			    PAGE_SIZE, vma->vm_page_prot)) {
+		dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
+		return -EAGAIN;
+	}
+
+	/* From now on, sw_counts are also written by userspace through the page. */
+	if (chan_priv->subscriber < 0) {
+		chan_priv->ctrl = 1;
+		chan->dma.ctrl_mapped = 1;
+	}
+
+	return 0;
+}
+
+static int litepcie_mmap_dma_ts(struct file *file, struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = file->private_data;
+	struct litepcie_chan *chan = chan_priv->chan;
+	struct litepcie_device *s = chan->litepcie_dev;
+
+	/* Read-only: only the driver stamps. */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_end - vma->vm_start != DMA_TS_SIZE)
+		return -EINVAL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+
+	if (remap_pfn_range(vma, vma->vm_start, virt_to_phys(chan->dma.ts) >> PAGE_SHIFT,
+			    DMA_TS_SIZE, vma->vm_page_prot)) {
+		dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Track the cursor mappings, the slot can't be released and reused under them. */
+static void litepcie_cursor_vm_open(struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = vma->vm_private_data;
+
+	atomic_inc(&chan_priv->cursor_maps);
+}
+
+static void litepcie_cursor_vm_close(struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = vma->vm_private_data;
+
+	atomic_dec(&chan_priv->cursor_maps);
+}
+
+static const struct vm_operations_struct litepcie_cursor_vm_ops = {
+	.open  = litepcie_cursor_vm_open,
+	.close = litepcie_cursor_vm_close,
+};
+
+static int litepcie_mmap_dma_cursor(struct file *file, struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = file->private_data;
+	struct litepcie_chan *chan = chan_priv->chan;
+	struct litepcie_device *s = chan->litepcie_dev;
+
+	/* Only a subscriber has a cursor, and only maps its own slot. */
+	if (chan_priv->subscriber < 0)
+		return -EPERM;
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	if (remap_pfn_range(vma, vma->vm_start,
+			    virt_to_phys(chan->dma.cursor[chan_priv->subscriber]) >> PAGE_SHIFT,
+			    PAGE_SIZE, vma->vm_page_prot)) {
+		dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
+		return -EAGAIN;
+	}
+
+	vma->vm_private_data = chan_priv;
+	vma->vm_ops = &litepcie_cursor_vm_ops;
+	litepcie_cursor_vm_open(vma);
+
 	return 0;
 }
 
+static int litepcie_mmap_bar0(struct file *file, struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = file->private_data;
+	struct litepcie_chan *chan = chan_priv->chan;
+	struct litepcie_device *s = chan->litepcie_dev;
+
+	/* Read-only, CSR writes go through the REG ioctls, unless trusted for raw I/O. */
+	if (vma->vm_end - vma->vm_start > PAGE_ALIGN(s->bar0_size))
+		return -EINVAL;
+	if (!capable(CAP_SYS_RAWIO)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+		vma->vm_flags &= ~VM_MAYWRITE;
+#else
+		vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+	}
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	if (io_remap_pfn_range(vma, vma->vm_start, s->bar0_phys_addr >> PAGE_SHIFT,
+			       vma->vm_end - vma->vm_start, vma->vm_page_prot)) {
+		dev_err(&s->dev->dev, "mmap io_remap_pfn_range failed\n");
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Track the TX/RX buffer mappings, the ring can't be reallocated under them. */
+static void litepcie_dma_vm_open(struct vm_area_struct *vma)
+{
+	struct litepcie_chan *chan = vma->vm_private_data;
+
+	atomic_inc(&chan->dma.mmap_count);
+}
+
+static void litepcie_dma_vm_close(struct vm_area_struct *vma)
+{
+	struct litepcie_chan *chan = vma->vm_private_data;
+
+	atomic_dec(&chan->dma.mmap_count);
+}
+
+static const struct vm_operations_struct litepcie_dma_vm_ops = {
+	.open  = litepcie_dma_vm_open,
+	.close = litepcie_dma_vm_close,
+};
+
+static int litepcie_mmap_locked(struct file *file, struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = file->private_data;
+	struct litepcie_chan *chan = chan_priv->chan;
+	struct litepcie_device *s = chan->litepcie_dev;
+	unsigned long pfn;
+	int is_tx, i;
+
+	if (vma->vm_pgoff == (DMA_CTRL_OFFSET(&chan->dma) >> PAGE_SHIFT))
+		return litepcie_mmap_dma_ctrl(file, vma);
+
+	if (vma->vm_pgoff == (DMA_TS_OFFSET(&chan->dma) >> PAGE_SHIFT))
+		return litepcie_mmap_dma_ts(file, vma);
+
+	if (vma->vm_pgoff == (DMA_CURSOR_OFFSET(&chan->dma) >> PAGE_SHIFT))
+		return litepcie_mmap_dma_cursor(file, vma);
+
+	if (vma->vm_pgoff == (BAR0_OFFSET(&chan->dma) >> PAGE_SHIFT))
+		return litepcie_mmap_bar0(file, vma);
+
+	if (!chan->dma.buffer_count || vma->vm_end - vma->vm_start != DMA_TOTAL_SIZE(&chan->dma))
+		return -EINVAL;
+
+	if (vma->vm_pgoff == 0)
+		is_tx = 1;
+	else if (vma->vm_pgoff == (DMA_TOTAL_SIZE(&chan->dma) >> PAGE_SHIFT))
+		is_tx = 0;
+	else
+		return -EINVAL;
+
+	/* subscribers share the RX buffers of the primary, read-only */
+	if (chan_priv->subscriber >= 0) {
+		if (is_tx || (vma->vm_flags & VM_WRITE))
+			return -EPERM;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+		vma->vm_flags &= ~VM_MAYWRITE;
+#else
+		vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+	}
+
+	/* one remap per contiguous chunk (a single buffer without dma_chunk_size) */
+	for (i = 0; i < chan->dma.chunk_count; i++) {
+#if defined(__arm__) || defined(__aarch64__)
+		void *va;
+		if (is_tx)
+			va = phys_to_virt(dma_to_phys(&s->dev->dev, chan->dma.reader_chunk_handle[i]));
+		else
+			va = phys_to_virt(dma_to_phys(&s->dev->dev, chan->dma.writer_chunk_handle[i]));
+		pfn = page_to_pfn(virt_to_page(va));
+#else
+		if (is_tx)
+			pfn = __pa(chan->dma.reader_chunk_addr[i]) >> PAGE_SHIFT;
+		else
+			pfn = __pa(chan->dma.writer_chunk_addr[i]) >> PAGE_SHIFT;
+#endif
+		/*
+		 * Note: the memory is cached, so the user must explicitly
+		 * flush the CPU caches on architectures which require it.
+		 */
+		if (remap_pfn_range(vma, vma->vm_start + (unsigned long)i * chan->dma.chunk_size, pfn,
+				    chan->dma.chunk_size, vma->vm_page_prot)) {
+			dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
+			return -EAGAIN;
+		}
+	}
+
+	vma->vm_private_data = chan;
+	vma->vm_ops = &litepcie_dma_vm_ops;
+	litepcie_dma_vm_open(vma);
+
+	return 0;
+}
+
+static int litepcie_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct litepcie_chan_priv *chan_priv = file->private_data;
+	struct litepcie_chan *chan = chan_priv->chan;
+	int ret;
+
+	/* the offsets and pages are the current geometry's */
+	mutex_lock(&chan->dma.ring_lock);
+	ret = litepcie_mmap_locked(file, vma);
+	mutex_unlock(&chan->dma.ring_lock);
+
+	return ret;
+}
+
 static unsigned int litepcie_poll(struct file *file, poll_table *wait)
 {
 	unsigned int mask = 0;
@@ -623,6 +2120,8 @@ static unsigned int litepcie_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &chan->wait_rd, wait);
 	poll_wait(file, &chan->wait_wr, wait);
 
+	litepcie_dma_ctrl_sync(&chan->dma);
+
 #ifdef DEBUG_POLL
 	dev_dbg(&s->dev->dev, "poll: writer hw_count: %10lld / sw_count %10lld\n",
 	chan->dma.writer_hw_count, chan->dma.writer_sw_count);
@@ -630,15 +2129,75 @@ static unsigned int litepcie_poll(struct file *file, poll_table *wait)
 	chan->dma.reader_hw_count, chan->dma.reader_sw_count);
 #endif
 
-	if ((chan->dma.writer_hw_count - chan->dma.writer_sw_count) > 2)
+	/* subscribers: RX readiness from their own cursor, never writable */
+	if (chan_priv->subscriber >= 0) {
+		if ((chan->dma.writer_hw_count - READ_ONCE(chan->dma.cursor[chan_priv->subscriber]->sw_count)) >=
+		    chan->dma.writer_watermark)
+			mask |= POLLIN | POLLRDNORM;
+		return mask;
+	}
+
+	if ((chan->dma.writer_hw_count - chan->dma.writer_sw_count) >= chan->dma.writer_watermark)
 		mask |= POLLIN | POLLRDNORM;
 
-	if ((chan->dma.reader_sw_count - chan->dma.reader_hw_count) < DMA_BUFFER_COUNT/2)
+	if ((chan->dma.buffer_count/2 - (chan->dma.reader_sw_count - chan->dma.reader_hw_count)) >=
+	    chan->dma.reader_watermark)
 		mask |= POLLOUT | POLLWRNORM;
 
 	return mask;
 }
 
+/* Register batches */
+
+static int litepcie_reg_batch(struct litepcie_device *s, struct litepcie_reg_op *ops,
+	uint32_t count, uint32_t *done)
+{
+	uint64_t deadline;
+	uint32_t i, spins;
+
+	/* Check the whole batch first, nothing runs if an op is bad. */
+	for (i = 0; i < count; i++) {
+		if (ops[i].op > LITEPCIE_REG_OP_POLL || (ops[i].addr & 3) ||
+		    ops[i].addr < CSR_BASE || ops[i].addr - CSR_BASE > s->bar0_size - 4)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct litepcie_reg_op *op = &ops[i];
+
+		*done = i;
+		switch (op->op) {
+		case LITEPCIE_REG_OP_READ:
+			op->val = litepcie_readl(s, op->addr);
+			break;
+		case LITEPCIE_REG_OP_WRITE:
+			litepcie_writel(s, op->addr, op->val);
+			break;
+		case LITEPCIE_REG_OP_POLL:
+			/* Spin a few us (SPI transfers, short waits), then sleep between reads. */
+			deadline = ktime_get_ns() +
+				(uint64_t)min_t(uint32_t, op->timeout_us, LITEPCIE_REG_POLL_TIMEOUT_MAX_US) * NSEC_PER_USEC;
+			for (spins = 0;; spins++) {
+				op->val = litepcie_readl(s, op->addr);
+				if ((op->val & op->mask) == op->expect)
+					break;
+				if (ktime_get_ns() >= deadline)
+					return -ETIMEDOUT;
+				if (signal_pending(current))
+					return -EINTR;
+				if (spins < 32)
+					udelay(1);
+				else
+					usleep_range(10, 20);
+			}
+			break;
+		}
+	}
+	*done = count;
+
+	return 0;
+}
+
 #ifdef CSR_FLASH_BASE
 /* SPI */
 
@@ -685,141 +2244,501 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			ret = -EFAULT;
 			break;
 		}
-		if (m.is_write)
-			litepcie_writel(dev, m.addr, m.val);
-		else
-			m.val = litepcie_readl(dev, m.addr);
+		if (m.is_write)
+			litepcie_writel(dev, m.addr, m.val);
+		else
+			m.val = litepcie_readl(dev, m.addr);
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	break;
+	case LITEPCIE_IOCTL_REG_BATCH:
+	{
+		struct litepcie_ioctl_reg_batch m;
+		struct litepcie_reg_op *ops;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (m.count == 0 || m.count > LITEPCIE_REG_OPS_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+		ops = kmalloc_array(m.count, sizeof(*ops), GFP_KERNEL);
+		if (!ops) {
+			ret = -ENOMEM;
+			break;
+		}
+		if (copy_from_user(ops, u64_to_user_ptr(m.ops), m.count * sizeof(*ops))) {
+			kfree(ops);
+			ret = -EFAULT;
+			break;
+		}
+
+		m.done = 0;
+		ret = litepcie_reg_batch(dev, ops, m.count, &m.done);
+
+		/* Values read so far are returned on failure too. */
+		if (copy_to_user(u64_to_user_ptr(m.ops), ops, m.count * sizeof(*ops)) ||
+		    copy_to_user((void *)arg, &m, sizeof(m)))
+			ret = -EFAULT;
+		kfree(ops);
+	}
+	break;
+#ifdef CSR_FLASH_BASE
+	case LITEPCIE_IOCTL_FLASH:
+	{
+		struct litepcie_ioctl_flash m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = litepcie_flash_spi(dev, &m);
+		if (ret == 0) {
+			if (copy_to_user((void *)arg, &m, sizeof(m))) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+	}
+	break;
+#endif
+#ifdef CSR_ICAP_BASE
+	case LITEPCIE_IOCTL_ICAP:
+	{
+		struct litepcie_ioctl_icap m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		litepcie_writel(dev, CSR_ICAP_ADDR_ADDR, m.addr);
+		litepcie_writel(dev, CSR_ICAP_DATA_ADDR, m.data);
+		litepcie_writel(dev, CSR_ICAP_WRITE_ADDR, 1);
+	}
+	break;
+#endif
+	case LITEPCIE_IOCTL_DMA:
+	{
+		struct litepcie_ioctl_dma m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* loopback */
+		litepcie_writel(chan->litepcie_dev, chan->dma.base + PCIE_DMA_LOOPBACK_ENABLE_OFFSET, m.loopback_enable);
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_WRITER:
+	{
+		struct litepcie_ioctl_dma_writer m;
+		bool pause;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* pause: a disable that keeps the descriptor table for the next enable */
+		pause = m.enable == LITEPCIE_DMA_PAUSE;
+		if (pause)
+			m.enable = 0;
+
+		if (m.enable && !chan->dma.buffer_count) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		/* subscribers only follow the writer started by its owner */
+		if (m.enable != chan->dma.writer_enable && chan_priv->subscriber >= 0) {
+			ret = -EPERM;
+			break;
+		}
+
+		if (m.enable != chan->dma.writer_enable) {
+			/* enable / disable DMA */
+			if (m.enable) {
+				litepcie_dma_writer_start(chan->litepcie_dev, chan->index);
+				if (!chan->dma.writer_irq_disable)
+					litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
+			} else {
+				litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
+				if (pause)
+					litepcie_dma_writer_pause(chan->litepcie_dev, chan->index);
+				else
+					litepcie_dma_writer_stop(chan->litepcie_dev, chan->index);
+			}
+
+		}
+
+		chan->dma.writer_enable = m.enable;
+
+		litepcie_dma_ctrl_sync(&chan->dma);
+		m.hw_count = chan->dma.writer_hw_count;
+		m.sw_count = chan->dma.writer_sw_count;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_READER:
+	{
+		struct litepcie_ioctl_dma_reader m;
+		bool pause;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		pause = m.enable == LITEPCIE_DMA_PAUSE;
+		if (pause)
+			m.enable = 0;
+
+		if (m.enable && !chan->dma.buffer_count) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (m.enable != chan->dma.reader_enable && chan_priv->subscriber >= 0) {
+			ret = -EPERM;
+			break;
+		}
+
+		if (m.enable != chan->dma.reader_enable) {
+			/* enable / disable DMA */
+			if (m.enable) {
+				litepcie_dma_reader_start(chan->litepcie_dev, chan->index);
+				if (!chan->dma.reader_irq_disable)
+					litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
+			} else {
+				litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
+				if (pause)
+					litepcie_dma_reader_pause(chan->litepcie_dev, chan->index);
+				else
+					litepcie_dma_reader_stop(chan->litepcie_dev, chan->index);
+			}
+		}
+
+		chan->dma.reader_enable = m.enable;
+
+		litepcie_dma_ctrl_sync(&chan->dma);
+		m.hw_count = chan->dma.reader_hw_count;
+		m.sw_count = chan->dma.reader_sw_count;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_IRQ:
+	{
+		struct litepcie_ioctl_dma_irq m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* Only the DMA owners: masking would stall the owner's poll()/eventfd
+		 * wakeups. Subscribers busy-poll with the MSIs left as they are. */
+		if (chan_priv->subscriber >= 0 ||
+		    (m.writer_disable && !chan_priv->writer) ||
+		    (m.reader_disable && !chan_priv->reader)) {
+			ret = -EPERM;
+			break;
+		}
+
+		/* mask / unmask the DMA MSIs, also while the DMA is running */
+		if (chan_priv->writer) {
+			chan->dma.writer_irq_disable = m.writer_disable;
+			if (chan->dma.writer_enable) {
+				if (m.writer_disable)
+					litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
+				else
+					litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
+			}
+		}
+
+		if (chan_priv->reader) {
+			chan->dma.reader_irq_disable = m.reader_disable;
+			if (chan->dma.reader_enable) {
+				if (m.reader_disable)
+					litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
+				else
+					litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
+			}
+		}
+	}
+	break;
+	case LITEPCIE_IOCTL_MMAP_DMA_INFO:
+	{
+		struct litepcie_ioctl_mmap_dma_info m;
+
+		m.dma_tx_buf_offset = 0;
+		m.dma_tx_buf_size = chan->dma.buffer_size;
+		m.dma_tx_buf_count = chan->dma.buffer_count;
+
+		m.dma_rx_buf_offset = DMA_TOTAL_SIZE(&chan->dma);
+		m.dma_rx_buf_size = chan->dma.buffer_size;
+		m.dma_rx_buf_count = chan->dma.buffer_count;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	break;
+	case LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE:
+	{
+		struct litepcie_ioctl_mmap_dma_update m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
 
-		if (copy_to_user((void *)arg, &m, sizeof(m))) {
-			ret = -EFAULT;
+		if (chan_priv->subscriber >= 0) {
+			ret = -EPERM;
 			break;
 		}
+
+		chan->dma.writer_sw_count = m.sw_count;
+		WRITE_ONCE(chan->dma.ctrl->writer_sw_count, m.sw_count);
 	}
 	break;
-#ifdef CSR_FLASH_BASE
-	case LITEPCIE_IOCTL_FLASH:
+	case LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE:
 	{
-		struct litepcie_ioctl_flash m;
+		struct litepcie_ioctl_mmap_dma_update m;
 
 		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
-		ret = litepcie_flash_spi(dev, &m);
-		if (ret == 0) {
-			if (copy_to_user((void *)arg, &m, sizeof(m))) {
-				ret = -EFAULT;
-				break;
-			}
+
+		if (chan_priv->subscriber >= 0) {
+			ret = -EPERM;
+			break;
+		}
+		/* messages: the driver moves sw_count with each transfer */
+		if (chan->dma.msg_mode) {
+			ret = -EBUSY;
+			break;
 		}
+
+		chan->dma.reader_sw_count = m.sw_count;
+		WRITE_ONCE(chan->dma.ctrl->reader_sw_count, m.sw_count);
 	}
 	break;
-#endif
-#ifdef CSR_ICAP_BASE
-	case LITEPCIE_IOCTL_ICAP:
+	case LITEPCIE_IOCTL_MMAP_DMA_CTRL_INFO:
 	{
-		struct litepcie_ioctl_icap m;
+		struct litepcie_ioctl_mmap_dma_ctrl_info m;
 
-		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+		m.dma_ctrl_offset = DMA_CTRL_OFFSET(&chan->dma);
+		m.dma_ctrl_size = PAGE_SIZE;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
+	}
+	break;
+	case LITEPCIE_IOCTL_MMAP_DMA_TS_INFO:
+	{
+		struct litepcie_ioctl_mmap_dma_ts_info m;
 
-		litepcie_writel(dev, CSR_ICAP_ADDR_ADDR, m.addr);
-		litepcie_writel(dev, CSR_ICAP_DATA_ADDR, m.data);
-		litepcie_writel(dev, CSR_ICAP_WRITE_ADDR, 1);
+		m.dma_ts_offset = DMA_TS_OFFSET(&chan->dma);
+		m.dma_ts_size = DMA_TS_SIZE;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
 	}
 	break;
-#endif
-	case LITEPCIE_IOCTL_DMA:
+	case LITEPCIE_IOCTL_MMAP_DMA_CURSOR_INFO:
 	{
-		struct litepcie_ioctl_dma m;
+		struct litepcie_ioctl_mmap_dma_cursor_info m;
 
-		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+		m.dma_cursor_offset = DMA_CURSOR_OFFSET(&chan->dma);
+		m.dma_cursor_size = PAGE_SIZE;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
+	}
+	break;
+	case LITEPCIE_IOCTL_MMAP_BAR0_INFO:
+	{
+		struct litepcie_ioctl_mmap_bar0_info m;
 
-		/* loopback */
-		litepcie_writel(chan->litepcie_dev, chan->dma.base + PCIE_DMA_LOOPBACK_ENABLE_OFFSET, m.loopback_enable);
+		m.bar0_offset = BAR0_OFFSET(&chan->dma);
+		m.bar0_size = PAGE_ALIGN(dev->bar0_size);
+		m.dma_base = chan->dma.base - CSR_BASE;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
 	}
 	break;
-	case LITEPCIE_IOCTL_DMA_WRITER:
+	case LITEPCIE_IOCTL_DMA_GEOMETRY:
 	{
-		struct litepcie_ioctl_dma_writer m;
+		struct litepcie_ioctl_dma_geometry m;
 
 		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		if (m.enable != chan->dma.writer_enable) {
-			/* enable / disable DMA */
-			if (m.enable) {
-				litepcie_dma_writer_start(chan->litepcie_dev, chan->index);
-				litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
-			} else {
-				litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.writer_interrupt);
-				litepcie_dma_writer_stop(chan->litepcie_dev, chan->index);
+		if (m.buffer_size || m.buffer_count || m.buffer_per_irq) {
+			if (!m.buffer_size)
+				m.buffer_size = chan->dma.buffer_size;
+			if (!m.buffer_count)
+				m.buffer_count = chan->dma.buffer_count;
+			if (!m.buffer_per_irq)
+				m.buffer_per_irq = min(chan->dma.buffer_per_irq, m.buffer_count);
+
+			if (m.buffer_size % PAGE_SIZE || m.buffer_size > DMA_BUFFER_SIZE_MAX ||
+			    m.buffer_count < 2 || m.buffer_count > DMA_BUFFER_COUNT_MAX ||
+			    !is_power_of_2(m.buffer_count) || m.buffer_per_irq > m.buffer_count) {
+				ret = -EINVAL;
+				break;
 			}
 
-		}
+			/* only by a DMA owner */
+			if (!chan_priv->writer && !chan_priv->reader) {
+				ret = -EPERM;
+				break;
+			}
 
-		chan->dma.writer_enable = m.enable;
+			/* only when stopped, unmapped and not owned by another file; no
+			 * mmap() in between, it would map the pages about to be freed */
+			mutex_lock(&chan->dma.ring_lock);
+			if (chan->dma.writer_enable || chan->dma.reader_enable ||
+			    atomic_read(&chan->dma.mmap_count) || chan_priv->subscriber >= 0 ||
+			    chan->dma.writer_user.npages || chan->dma.reader_user.npages ||
+			    (chan->dma.writer_lock && !chan_priv->writer) ||
+			    (chan->dma.reader_lock && !chan_priv->reader))
+				ret = -EBUSY;
+			else
+				ret = litepcie_dma_set_geometry(dev, chan, m.buffer_size,
+					m.buffer_count, m.buffer_per_irq);
+			mutex_unlock(&chan->dma.ring_lock);
+			if (ret)
+				break;
+		}
 
-		m.hw_count = chan->dma.writer_hw_count;
-		m.sw_count = chan->dma.writer_sw_count;
+		m.buffer_size = chan->dma.buffer_size;
+		m.buffer_count = chan->dma.buffer_count;
+		m.buffer_per_irq = chan->dma.buffer_per_irq;
 
 		if (copy_to_user((void *)arg, &m, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
-
 	}
 	break;
-	case LITEPCIE_IOCTL_DMA_READER:
+	case LITEPCIE_IOCTL_DMA_USER_BUFFER:
 	{
-		struct litepcie_ioctl_dma_reader m;
+		struct litepcie_ioctl_dma_user_buffer m;
 
 		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		if (m.enable != chan->dma.reader_enable) {
-			/* enable / disable DMA */
-			if (m.enable) {
-				litepcie_dma_reader_start(chan->litepcie_dev, chan->index);
-				litepcie_enable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
-			} else {
-				litepcie_disable_interrupt(chan->litepcie_dev, chan->dma.reader_interrupt);
-				litepcie_dma_reader_stop(chan->litepcie_dev, chan->index);
-			}
+		/* only for the DMA locked by this file, while it is stopped */
+		if (m.writer ? !chan_priv->writer : !chan_priv->reader) {
+			ret = -EPERM;
+			break;
+		}
+		if (m.writer ? chan->dma.writer_enable : chan->dma.reader_enable) {
+			ret = -EBUSY;
+			break;
+		}
+		/* RX subscribers map the driver ring */
+		if (m.writer && m.addr && READ_ONCE(chan->dma.subscribers)) {
+			ret = -EBUSY;
+			break;
 		}
 
-		chan->dma.reader_enable = m.enable;
-
-		m.hw_count = chan->dma.reader_hw_count;
-		m.sw_count = chan->dma.reader_sw_count;
+		litepcie_dma_user_release(dev, chan, m.writer);
+		/* a paused driver ring's table: full stop (flush, drain) before the switch */
+		if (m.writer && chan->dma.writer_table)
+			litepcie_dma_writer_stop(dev, chan->index);
+		if (!m.writer && chan->dma.reader_table)
+			litepcie_dma_reader_stop(dev, chan->index);
+		if (m.addr)
+			ret = litepcie_dma_user_map(dev, &chan->dma,
+				m.writer ? &chan->dma.writer_user : &chan->dma.reader_user,
+				m.addr, m.size, m.writer ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_MSG_MODE:
+	{
+		struct litepcie_ioctl_dma_msg_mode m;
 
-		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
 
+		/* channel wide: this file owns its DMAs, none other does, both stopped */
+		if ((!chan_priv->writer && !chan_priv->reader) || chan_priv->subscriber >= 0) {
+			ret = -EPERM;
+			break;
+		}
+		if ((chan->dma.writer_lock && !chan_priv->writer) ||
+		    (chan->dma.reader_lock && !chan_priv->reader) ||
+		    chan->dma.writer_enable || chan->dma.reader_enable) {
+			ret = -EBUSY;
+			break;
+		}
+
+		chan->dma.msg_mode = m.enable != 0;
+		/* kept tables carry the other descriptor flags */
+		chan->dma.writer_table = 0;
+		chan->dma.reader_table = 0;
 	}
 	break;
-	case LITEPCIE_IOCTL_MMAP_DMA_INFO:
+	case LITEPCIE_IOCTL_DMA_MSG_SEND:
 	{
-		struct litepcie_ioctl_mmap_dma_info m;
+		struct litepcie_ioctl_dma_msg m;
 
-		m.dma_tx_buf_offset = 0;
-		m.dma_tx_buf_size = DMA_BUFFER_SIZE;
-		m.dma_tx_buf_count = DMA_BUFFER_COUNT;
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (!chan->dma.msg_mode || !chan_priv->reader) {
+			ret = -EPERM;
+			break;
+		}
+		if (!chan->dma.reader_enable || m.length > chan->dma.buffer_size ||
+		    m.length % LITEPCIE_DMA_MSG_ALIGN) {
+			ret = -EINVAL;
+			break;
+		}
 
-		m.dma_rx_buf_offset = DMA_BUFFER_TOTAL_SIZE;
-		m.dma_rx_buf_size = DMA_BUFFER_SIZE;
-		m.dma_rx_buf_count = DMA_BUFFER_COUNT;
+		/* on -EAGAIN too: the caller gets the refreshed counts to wait on */
+		ret = litepcie_dma_msg_send(dev, chan, &m);
+		if (ret && ret != -EAGAIN)
+			break;
 
 		if (copy_to_user((void *)arg, &m, sizeof(m))) {
 			ret = -EFAULT;
@@ -827,28 +2746,139 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 		}
 	}
 	break;
-	case LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE:
+	case LITEPCIE_IOCTL_DMA_IRQ_AFFINITY:
 	{
-		struct litepcie_ioctl_mmap_dma_update m;
+		struct litepcie_ioctl_dma_irq_affinity m;
 
 		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		chan->dma.writer_sw_count = m.sw_count;
+		if (!dev->irq_per_vector) {
+			ret = -EOPNOTSUPP;
+			break;
+		}
+		/* only for the DMAs locked by this file */
+		if ((m.writer_cpu >= 0 && !chan_priv->writer) ||
+		    (m.reader_cpu >= 0 && !chan_priv->reader)) {
+			ret = -EPERM;
+			break;
+		}
+		if ((m.writer_cpu >= 0 && (m.writer_cpu >= nr_cpu_ids || !cpu_online(m.writer_cpu))) ||
+		    (m.reader_cpu >= 0 && (m.reader_cpu >= nr_cpu_ids || !cpu_online(m.reader_cpu)))) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (m.writer_cpu >= 0)
+			litepcie_irq_affinity(pci_irq_vector(dev->dev, chan->dma.writer_interrupt),
+				cpumask_of(m.writer_cpu));
+		if (m.reader_cpu >= 0)
+			litepcie_irq_affinity(pci_irq_vector(dev->dev, chan->dma.reader_interrupt),
+				cpumask_of(m.reader_cpu));
 	}
 	break;
-	case LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE:
+	case LITEPCIE_IOCTL_DMA_EVENTFD:
 	{
-		struct litepcie_ioctl_mmap_dma_update m;
+		struct litepcie_ioctl_dma_eventfd m;
+		struct eventfd_ctx *ctx = NULL;
 
 		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
 			ret = -EFAULT;
 			break;
 		}
 
-		chan->dma.reader_sw_count = m.sw_count;
+		/* only for the DMAs locked by this file */
+		if ((m.writer && !chan_priv->writer) || (!m.writer && !chan_priv->reader)) {
+			ret = -EPERM;
+			break;
+		}
+		if (m.watermark > (m.writer ? chan->dma.buffer_count : chan->dma.buffer_count / 2)) {
+			ret = -EINVAL;
+			break;
+		}
+		if (m.fd >= 0) {
+			ctx = eventfd_ctx_fdget(m.fd);
+			if (IS_ERR(ctx)) {
+				ret = PTR_ERR(ctx);
+				break;
+			}
+		}
+
+		litepcie_dma_eventfd_set(dev, chan, m.writer, ctx, m.watermark);
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_IRQ_STATS:
+	{
+		struct litepcie_ioctl_dma_irq_stats m;
+
+		m.writer_irqs         = chan->dma.writer_mod.irqs;
+		m.writer_irq_buffers  = chan->dma.writer_mod.irq_buffers;
+		m.writer_polls        = chan->dma.writer_mod.polls;
+		m.writer_poll_buffers = chan->dma.writer_mod.poll_buffers;
+		m.reader_irqs         = chan->dma.reader_mod.irqs;
+		m.reader_irq_buffers  = chan->dma.reader_mod.irq_buffers;
+		m.reader_polls        = chan->dma.reader_mod.polls;
+		m.reader_poll_buffers = chan->dma.reader_mod.poll_buffers;
+		m.moderation_us       = irq_moderation_us;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m)))
+			ret = -EFAULT;
+	}
+	break;
+	case LITEPCIE_IOCTL_DMA_SUBSCRIBE:
+	{
+		struct litepcie_ioctl_dma_subscribe m;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (m.enable) {
+			/* the writer owner consumes through writer_sw_count */
+			if (chan_priv->writer || chan_priv->reader) {
+				ret = -EPERM;
+				break;
+			}
+			if (chan_priv->subscriber >= 0) {
+				ret = -EINVAL;
+				break;
+			}
+			/* a writable control page mapping would outlive the subscription */
+			if (chan_priv->ctrl) {
+				ret = -EBUSY;
+				break;
+			}
+			/* with a registered user buffer the driver ring is not the one filled */
+			if (chan->dma.writer_user.npages) {
+				ret = -EBUSY;
+				break;
+			}
+			m.slot = litepcie_dma_subscribe(dev, &chan->dma, m.required);
+			if (m.slot < 0) {
+				ret = m.slot;
+				break;
+			}
+			chan_priv->subscriber = m.slot;
+		} else {
+			if (chan_priv->subscriber < 0) {
+				ret = -EINVAL;
+				break;
+			}
+			/* the slot's cursor page is still mapped, it could be reused */
+			if (atomic_read(&chan_priv->cursor_maps)) {
+				ret = -EBUSY;
+				break;
+			}
+			litepcie_dma_unsubscribe(dev, &chan->dma, chan_priv->subscriber);
+			chan_priv->subscriber = -1;
+			m.slot = -1;
+		}
+
+		if (copy_to_user((void *)arg, &m, sizeof(m)))
+			ret = -EFAULT;
 	}
 	break;
 	case LITEPCIE_IOCTL_LOCK:
@@ -863,7 +2893,7 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 
 		m.dma_reader_status = 1;
 		if (m.dma_reader_request) {
-			if (chan->dma.reader_lock) {
+			if (chan->dma.reader_lock || chan_priv->subscriber >= 0) {
 				m.dma_reader_status = 0;
 			} else {
 				chan->dma.reader_lock = 1;
@@ -871,13 +2901,16 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			}
 		}
 		if (m.dma_reader_release) {
+			litepcie_dma_user_release(dev, chan, false);
+			litepcie_dma_eventfd_set(dev, chan, false, NULL, 0);
 			chan->dma.reader_lock = 0;
 			chan_priv->reader = 0;
+			chan->dma.reader_irq_disable = 0;
 		}
 
 		m.dma_writer_status = 1;
 		if (m.dma_writer_request) {
-			if (chan->dma.writer_lock) {
+			if (chan->dma.writer_lock || chan_priv->subscriber >= 0) {
 				m.dma_writer_status = 0;
 			} else {
 				chan->dma.writer_lock = 1;
@@ -885,8 +2918,11 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			}
 		}
 		if (m.dma_writer_release) {
+			litepcie_dma_user_release(dev, chan, true);
+			litepcie_dma_eventfd_set(dev, chan, true, NULL, 0);
 			chan->dma.writer_lock = 0;
 			chan_priv->writer = 0;
+			chan->dma.writer_irq_disable = 0;
 		}
 
 		if (copy_to_user((void *)arg, &m, sizeof(m))) {
@@ -896,19 +2932,71 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 
 	}
 	break;
+	case LITEPCIE_IOCTL_DMA_LATENCY_TEST:
+	{
+		struct litepcie_ioctl_dma_latency *m;
+		bool reader_lock, writer_lock;
+
+		/* Needs both directions idle and unshared, on the driver buffers. */
+		if ((chan->dma.reader_lock && !chan_priv->reader) ||
+		    (chan->dma.writer_lock && !chan_priv->writer) ||
+		    chan->dma.reader_enable || chan->dma.writer_enable ||
+		    chan->dma.subscribers || chan_priv->subscriber >= 0 ||
+		    chan->dma.reader_user.npages || chan->dma.writer_user.npages) {
+			ret = -EBUSY;
+			break;
+		}
+		/* no rings left by a failed geometry change */
+		if (!chan->dma.buffer_count) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		m = kmalloc(sizeof(*m), GFP_KERNEL);
+		if (!m) {
+			ret = -ENOMEM;
+			break;
+		}
+		if (copy_from_user(m, (void *)arg, sizeof(*m))) {
+			kfree(m);
+			ret = -EFAULT;
+			break;
+		}
+
+		/* Hold the DMA locks for the duration, like a LOCK request would. */
+		reader_lock = !chan->dma.reader_lock;
+		writer_lock = !chan->dma.writer_lock;
+		chan->dma.reader_lock = 1;
+		chan->dma.writer_lock = 1;
+
+		ret = litepcie_dma_latency_test(dev, chan, m);
+
+		if (reader_lock)
+			chan->dma.reader_lock = 0;
+		if (writer_lock)
+			chan->dma.writer_lock = 0;
+
+		if (ret == 0 && copy_to_user((void *)arg, m, sizeof(*m)))
+			ret = -EFAULT;
+		kfree(m);
+	}
+	break;
 	case LITEPCIE_IOCTL_LATENCY_TEST:
+	case LITEPCIE_IOCTL_LATENCY_TEST_EXT:
 	{
-		struct litepcie_ioctl_latency m;
+		struct litepcie_ioctl_latency_ext m = {};
+		/* the original command only knows the leading litepcie_ioctl_latency */
+		size_t size = cmd == LITEPCIE_IOCTL_LATENCY_TEST ? sizeof(m.lat) : sizeof(m);
 		int ret_lat;
 
-		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+		if (copy_from_user(&m, (void *)arg, size)) {
 			ret = -EFAULT;
 			break;
 		}
 
 		ret_lat = litepcie_latency_test(dev, &m);
 		if (ret_lat == 0) {
-			if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			if (copy_to_user((void *)arg, &m, size)) {
 				ret = -EFAULT;
 				break;
 			}
@@ -929,12 +3017,129 @@ static const struct file_operations litepcie_fops = {
 	.unlocked_ioctl = litepcie_ioctl,
 	.open = litepcie_open,
 	.release = litepcie_release,
-	.read = litepcie_read,
+	.read_iter = litepcie_read_iter,
 	.poll = litepcie_poll,
-	.write = litepcie_write,
+	.write_iter = litepcie_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
 	.mmap = litepcie_mmap,
 };
 
+static void litepcie_dma_stats_sample(struct litepcie_dma_stats *stats, uint32_t fifo_level,
+	uint32_t table_level)
+{
+	WRITE_ONCE(stats->fifo_level, fifo_level);
+	if (fifo_level > stats->fifo_level_max)
+		WRITE_ONCE(stats->fifo_level_max, fifo_level);
+	WRITE_ONCE(stats->table_level, table_level);
+	if (table_level > stats->table_level_max)
+		WRITE_ONCE(stats->table_level_max, table_level);
+	WRITE_ONCE(stats->samples, stats->samples + 1);
+}
+
+/* Sample the DMA buffering FIFO and descriptor table levels, off the hot path. */
+static void litepcie_stats_work(struct work_struct *work)
+{
+	struct litepcie_device *s = container_of(to_delayed_work(work), struct litepcie_device, stats_work);
+	struct litepcie_dma_chan *dmachan;
+	int i;
+
+	for (i = 0; i < s->channels; i++) {
+		dmachan = &s->chan[i].dma;
+		litepcie_dma_stats_sample(&dmachan->writer_stats,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_BUFFERING_WRITER_FIFO_LEVEL_ADDR) & DMA_FIFO_LEVEL_MASK,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_WRITER_TABLE_LEVEL_OFFSET));
+		litepcie_dma_stats_sample(&dmachan->reader_stats,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_BUFFERING_READER_FIFO_LEVEL_ADDR) & DMA_FIFO_LEVEL_MASK,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_READER_TABLE_LEVEL_OFFSET));
+	}
+
+	schedule_delayed_work(&s->stats_work, msecs_to_jiffies(stats_sample_ms));
+}
+
+static void litepcie_stats_show_dma(struct seq_file *m, int index, const char *dir, const char *lost,
+	const char *dropped, struct litepcie_dma_stats *stats, int64_t occupancy, uint32_t fifo_depth)
+{
+	seq_printf(m, "dma%d.%s.irqs %llu\n", index, dir, READ_ONCE(stats->irqs));
+	seq_printf(m, "dma%d.%s.irq_buffers %llu\n", index, dir, READ_ONCE(stats->irq_buffers));
+	seq_printf(m, "dma%d.%s.buffers %llu\n", index, dir, READ_ONCE(stats->buffers));
+	seq_printf(m, "dma%d.%s.%s %llu\n", index, dir, lost, READ_ONCE(stats->lost));
+	seq_printf(m, "dma%d.%s.%s %llu\n", index, dir, dropped, READ_ONCE(stats->dropped));
+	seq_printf(m, "dma%d.%s.occupancy %lld\n", index, dir, occupancy);
+	seq_printf(m, "dma%d.%s.occupancy_max %lld\n", index, dir, READ_ONCE(stats->occupancy_max));
+	seq_printf(m, "dma%d.%s.fifo_depth %u\n", index, dir, fifo_depth);
+	seq_printf(m, "dma%d.%s.fifo_level %u\n", index, dir, READ_ONCE(stats->fifo_level));
+	seq_printf(m, "dma%d.%s.fifo_level_max %u\n", index, dir, READ_ONCE(stats->fifo_level_max));
+	seq_printf(m, "dma%d.%s.table_level %u\n", index, dir, READ_ONCE(stats->table_level));
+	seq_printf(m, "dma%d.%s.table_level_max %u\n", index, dir, READ_ONCE(stats->table_level_max));
+	seq_printf(m, "dma%d.%s.samples %llu\n", index, dir, READ_ONCE(stats->samples));
+}
+
+/* debugfs/litepcie/<pci name>/stats: one "name value" counter per line. */
+static int litepcie_stats_show(struct seq_file *m, void *v)
+{
+	struct litepcie_device *s = m->private;
+	struct litepcie_dma_chan *dmachan;
+	int64_t sw_count;
+	int i;
+
+	for (i = 0; i < s->irqs; i++)
+		seq_printf(m, "irq%d.count %llu\n", i, READ_ONCE(s->irq_count[i]));
+
+	for (i = 0; i < s->channels; i++) {
+		dmachan = &s->chan[i].dma;
+		seq_printf(m, "dma%d.buffer_count %u\n", i, dmachan->buffer_count);
+		seq_printf(m, "dma%d.buffer_size %u\n", i, dmachan->buffer_size);
+		litepcie_stats_show_dma(m, i, "writer", "overflows", "read_drops", &dmachan->writer_stats,
+			READ_ONCE(dmachan->writer_enable) ?
+			READ_ONCE(dmachan->writer_hw_count) - READ_ONCE(dmachan->ctrl->writer_gate_count) : 0,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_BUFFERING_WRITER_FIFO_DEPTH_ADDR) & DMA_FIFO_LEVEL_MASK);
+		sw_count = dmachan->ctrl_mapped ? READ_ONCE(dmachan->ctrl->reader_sw_count) :
+			READ_ONCE(dmachan->reader_sw_count);
+		litepcie_stats_show_dma(m, i, "reader", "underflows", "write_drops", &dmachan->reader_stats,
+			READ_ONCE(dmachan->reader_enable) ? sw_count - READ_ONCE(dmachan->reader_hw_count) : 0,
+			litepcie_readl(s, dmachan->base + PCIE_DMA_BUFFERING_READER_FIFO_DEPTH_ADDR) & DMA_FIFO_LEVEL_MASK);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(litepcie_stats);
+
+static void litepcie_stats_init(struct litepcie_device *s)
+{
+	s->debugfs = debugfs_create_dir(pci_name(s->dev), litepcie_debugfs);
+	debugfs_create_file("stats", 0444, s->debugfs, s, &litepcie_stats_fops);
+
+	INIT_DELAYED_WORK(&s->stats_work, litepcie_stats_work);
+	if (stats_sample_ms)
+		schedule_delayed_work(&s->stats_work, msecs_to_jiffies(stats_sample_ms));
+}
+
+static void litepcie_stats_exit(struct litepcie_device *s)
+{
+	debugfs_remove_recursive(s->debugfs);
+	cancel_delayed_work_sync(&s->stats_work);
+}
+
+/* /sys/class/litepcie/litepcieN/numa_node: where the DMA buffers live, -1 if unknown. */
+static ssize_t numa_node_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct litepcie_device *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", dev_to_node(&s->dev->dev));
+}
+static DEVICE_ATTR_RO(numa_node);
+
+static struct attribute *litepcie_attrs[] = {
+	&dev_attr_numa_node.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(litepcie);
+
 static int litepcie_alloc_chdev(struct litepcie_device *s)
 {
 	int i, j;
@@ -956,7 +3161,8 @@ static int litepcie_alloc_chdev(struct litepcie_device *s)
 	index = litepcie_minor_idx;
 	for (i = 0; i < s->channels; i++) {
 		dev_info(&s->dev->dev, "Creating /dev/litepcie%d\n", index);
-		if (!device_create(litepcie_class, NULL, MKDEV(litepcie_major, index), NULL, "litepcie%d", index)) {
+		if (!device_create_with_groups(litepcie_class, &s->dev->dev, MKDEV(litepcie_major, index),
+					       s, litepcie_groups, "litepcie%d", index)) {
 			ret = -EINVAL;
 			dev_err(&s->dev->dev, "Failed to create device\n");
 			goto fail_create;
@@ -1049,6 +3255,8 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 		dev_err(&dev->dev, "Could not map BAR0\n");
 		goto fail1;
 	}
+	litepcie_dev->bar0_phys_addr = pci_resource_start(dev, 0);
+	litepcie_dev->bar0_size = pci_resource_len(dev, 0);
 
 	/* Reset LitePCIe core */
 #ifdef CSR_CTRL_RESET_ADDR
@@ -1093,23 +3301,6 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 	dev_info(&dev->dev, "%d MSI IRQs allocated.\n", irqs);
 #endif
 
-	litepcie_dev->irqs = 0;
-	for (i = 0; i < irqs; i++) {
-		int irq = pci_irq_vector(dev, i);
-
-		/* Request IRQ */
-		ret = request_irq(irq, litepcie_interrupt, 0, LITEPCIE_NAME, litepcie_dev);
-		if (ret < 0) {
-			dev_err(&dev->dev, " Failed to allocate IRQ %d\n", dev->irq);
-			while (--i >= 0) {
-				irq = pci_irq_vector(dev, i);
-				free_irq(irq, dev);
-			}
-			goto fail2;
-		}
-		litepcie_dev->irqs += 1;
-	}
-
 	litepcie_dev->channels = DMA_CHANNELS;
 
 	/* create all chardev in /dev */
@@ -1121,12 +3312,16 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 
 	for (i = 0; i < litepcie_dev->channels; i++) {
 		litepcie_dev->chan[i].index = i;
-		litepcie_dev->chan[i].block_size = DMA_BUFFER_SIZE;
 		litepcie_dev->chan[i].minor = litepcie_dev->minor_base + i;
 		litepcie_dev->chan[i].litepcie_dev = litepcie_dev;
 		litepcie_dev->chan[i].dma.writer_lock = 0;
 		litepcie_dev->chan[i].dma.reader_lock = 0;
+		litepcie_dev->chan[i].dma.writer_watermark = DMA_WRITER_WATERMARK_DEFAULT;
+		litepcie_dev->chan[i].dma.reader_watermark = DMA_READER_WATERMARK_DEFAULT;
+		litepcie_dma_moderation_init(&litepcie_dev->chan[i], &litepcie_dev->chan[i].dma.writer_mod, true);
+		litepcie_dma_moderation_init(&litepcie_dev->chan[i], &litepcie_dev->chan[i].dma.reader_mod, false);
 		init_waitqueue_head(&litepcie_dev->chan[i].wait_rd);
+		mutex_init(&litepcie_dev->chan[i].dma.ring_lock);
 		init_waitqueue_head(&litepcie_dev->chan[i].wait_wr);
 		switch (i) {
 #ifdef CSR_PCIE_DMA7_BASE
@@ -1202,6 +3397,13 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 		goto fail3;
 	}
 
+	/* request the IRQs once the channels know their interrupts */
+	ret = litepcie_request_irqs(litepcie_dev, irqs);
+	if (ret)
+		goto fail3;
+
+	litepcie_stats_init(litepcie_dev);
+
 #ifdef CSR_UART_XOVER_RXTX_ADDR
 	tty_res = devm_kzalloc(&dev->dev, sizeof(struct resource), GFP_KERNEL);
 	if (!tty_res)
@@ -1213,12 +3415,17 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 	litepcie_dev->uart = platform_device_register_simple("liteuart", litepcie_minor_idx, tty_res, 1);
 	if (IS_ERR(litepcie_dev->uart)) {
 		ret = PTR_ERR(litepcie_dev->uart);
-		goto fail3;
+		goto fail4;
 	}
 #endif
 
 	return 0;
 
+#ifdef CSR_UART_XOVER_RXTX_ADDR
+fail4:
+	litepcie_stats_exit(litepcie_dev);
+	litepcie_free_irqs(litepcie_dev);
+#endif
 fail3:
 	litepcie_free_chdev(litepcie_dev);
 fail2:
@@ -1230,13 +3437,14 @@ fail1:
 /* Function to remove the LitePCIe PCI device */
 static void litepcie_pci_remove(struct pci_dev *dev)
 {
-	int i, irq;
 	struct litepcie_device *litepcie_dev;
 
 	litepcie_dev = pci_get_drvdata(dev);
 
 	dev_info(&dev->dev, "\e[1m[Removing device]\e[0m\n");
 
+	litepcie_stats_exit(litepcie_dev);
+
 	/* Stop the DMAs */
 	litepcie_stop_dma(litepcie_dev);
 
@@ -1244,10 +3452,7 @@ static void litepcie_pci_remove(struct pci_dev *dev)
 	litepcie_writel(litepcie_dev, CSR_PCIE_MSI_ENABLE_ADDR, 0);
 
 	/* Free all IRQs */
-	for (i = 0; i < litepcie_dev->irqs; i++) {
-		irq = pci_irq_vector(dev, i);
-		free_irq(irq, litepcie_dev);
-	}
+	litepcie_free_irqs(litepcie_dev);
 
 	platform_device_unregister(litepcie_dev->uart);
 
@@ -1333,6 +3538,8 @@ static int __init litepcie_module_init(void)
 	litepcie_major = MAJOR(litepcie_dev_t);
 	litepcie_minor_idx = MINOR(litepcie_dev_t);
 
+	litepcie_debugfs = debugfs_create_dir(LITEPCIE_NAME, NULL);
+
 	ret = pci_register_driver(&litepcie_pci_driver);
 	if (ret < 0) {
 		pr_err(" Error while registering PCI driver\n");
@@ -1342,6 +3549,7 @@ static int __init litepcie_module_init(void)
 	return 0;
 
 fail_register:
+	debugfs_remove_recursive(litepcie_debugfs);
 	unregister_chrdev_region(litepcie_dev_t, LITEPCIE_MINOR_COUNT);
 fail_alloc_chrdev_region:
 	class_destroy(litepcie_class);
@@ -1353,6 +3561,7 @@ fail_create_class:
 static void __exit litepcie_module_exit(void)
 {
 	pci_unregister_driver(&litepcie_pci_driver);
+	debugfs_remove_recursive(litepcie_debugfs);
 	unregister_chrdev_region(litepcie_dev_t, LITEPCIE_MINOR_COUNT);
 	class_destroy(litepcie_class);
 }
@@ -0,0 +1,736 @@
+/*
+ * LitePCIe DMA Benchmark Suite
+ *
+ * Sweeps the DMA loopback over buffer size, commit batch, copy (read/write)
+ * vs zero-copy, thread/IRQ placement and channel count, and reports every
+ * point in one format:
+ * - Warmup, then repeated measurement windows per point
+ * - Throughput mean, stddev and 95% confidence interval over the windows
+ * - RX delivery latency percentiles (zero-copy: DMA completion stamp to
+ *   the consumer seeing the buffer), with a 95% CI of the p99
+ * - Text, JSON or CSV output
+ * - Comparison against a stored CSV baseline, exit status 2 on regression
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+
+#include "litepcie.h"
+#include "liblitepcie.h"
+#include "litepcie_dma.h"
+#include "litepcie_hist.h"
+
+#define BENCH_LIST_MAX      16
+#define BENCH_CHANNELS_MAX  8
+#define BENCH_REPEATS_MAX   100
+#define BENCH_POINTS_MAX    512
+
+/* Output formats */
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSON 1
+#define OUTPUT_CSV  2
+
+#define PLACEMENT_LOCAL -2
+
+#define CSV_HEADER "mode,buffer_size,batch,placement,channels,repeats," \
+    "gbps_mean,gbps_stddev,gbps_ci95,lat_p50_us,lat_p99_us,lat_p999_us,lat_p9999_us,lat_p99_ci95_us"
+
+/* One measured configuration */
+struct bench_point {
+    uint8_t zero_copy;
+    uint32_t buffer_size;  /* requested, 0: driver geometry */
+    uint32_t batch;        /* buffers committed per pass, 0: all available */
+    char placement[16];
+    int thread_cpu;        /* channel i runs on thread_cpu + i, -1: not pinned, -2: local */
+    int irq_cpu;           /* channel i MSIs routed to irq_cpu + i, -1: unchanged, -2: local */
+    int channels;
+    /* results */
+    int valid;
+    uint32_t buffer_size_live;
+    int repeats;
+    double gbps[BENCH_REPEATS_MAX];
+    double gbps_mean, gbps_stddev, gbps_ci95;
+    struct litepcie_hist hist; /* all windows, zero-copy only */
+    double p99_ci95_us;
+};
+
+/* One channel of a point */
+struct bench_worker {
+    pthread_t thread;
+    int index;
+    struct bench_point *point;
+    struct litepcie_dma_ctrl dma;
+    int failed;
+    int irq_unrouted;
+    int64_t rx_buffers;
+    struct litepcie_hist *hist; /* one per window */
+};
+
+static struct {
+    const char *device;
+    uint32_t buffer_count;
+    uint32_t buffer_sizes[BENCH_LIST_MAX];
+    int buffer_size_count;
+    uint32_t batches[BENCH_LIST_MAX];
+    int batch_count;
+    uint8_t modes[2];
+    int mode_count;
+    char placements[BENCH_LIST_MAX][16];
+    int placement_count;
+    uint32_t channels[BENCH_LIST_MAX];
+    int channel_count;
+    double warmup_s;
+    double window_s;
+    int repeats;
+    int output;
+    const char *output_file;
+    const char *baseline_file;
+    double tolerance_pct;
+} config = {
+    .device = "/dev/litepcie0",
+    .buffer_sizes = {0}, .buffer_size_count = 1,
+    .batches = {0}, .batch_count = 1,
+    .modes = {0, 1}, .mode_count = 2,
+    .placements = {"local"}, .placement_count = 1,
+    .channels = {1}, .channel_count = 1,
+    .warmup_s = 1.0,
+    .window_s = 2.0,
+    .repeats = 5,
+    .output = OUTPUT_TEXT,
+    .tolerance_pct = 5.0,
+};
+
+static volatile int keep_running = 1;
+static int bench_stop;
+static int bench_window = -1;
+static pthread_barrier_t bench_barrier;
+static struct bench_point points[BENCH_POINTS_MAX];
+static int point_count;
+
+static void signal_handler(int sig) {
+    (void)sig;
+    keep_running = 0;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Sleep in small steps so CTRL+C ends a window early. */
+static void bench_sleep(double seconds) {
+    uint64_t end = bench_now_ns() + (uint64_t)(seconds * 1e9);
+
+    while (keep_running && bench_now_ns() < end)
+        usleep(10000);
+}
+
+/* Two-sided 95% Student t quantile for df degrees of freedom. */
+static double t95(int df) {
+    static const double t[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+
+    if (df < 1)
+        return 0;
+    return df < (int)(sizeof(t) / sizeof(t[0])) ? t[df] : 1.960;
+}
+
+/* Mean, sample stddev and CI95 half-width of n values. */
+static void bench_ci(const double *v, int n, double *mean, double *stddev, double *ci95) {
+    double sum = 0, sq = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += v[i];
+    *mean = n ? sum / n : 0;
+    for (i = 0; i < n; i++)
+        sq += (v[i] - *mean) * (v[i] - *mean);
+    *stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+    *ci95 = n > 1 ? t95(n - 1) * *stddev / sqrt(n) : 0;
+}
+
+/* Channel i uses the device whose trailing number is the first one's + i. */
+static void bench_device_name(char *name, size_t size, int index) {
+    const char *end = config.device + strlen(config.device);
+    const char *digits = end;
+
+    while (digits > config.device && digits[-1] >= '0' && digits[-1] <= '9')
+        digits--;
+    if (digits == end) {
+        snprintf(name, size, "%s", config.device);
+        return;
+    }
+    snprintf(name, size, "%.*s%d", (int)(digits - config.device), config.device, atoi(digits) + index);
+}
+
+static void bench_pin(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "Could not pin to CPU %d\n", cpu);
+}
+
+/* Loopback: commit RX and TX buffers as they come, at most batch per pass. */
+static void *bench_worker_func(void *arg) {
+    struct bench_worker *w = arg;
+    const struct bench_point *p = w->point;
+    struct litepcie_placement placement;
+    struct litepcie_dma_span span[2];
+    char device[1024];
+    unsigned count, seen, s, j;
+    uint64_t now, ts;
+    int window, thread_cpu, irq_cpu;
+
+    bench_device_name(device, sizeof(device), w->index);
+    thread_cpu = p->thread_cpu >= 0 ? p->thread_cpu + w->index : -1;
+    irq_cpu = p->irq_cpu >= 0 ? p->irq_cpu + w->index : -1;
+    if (p->thread_cpu == PLACEMENT_LOCAL && !litepcie_placement_init(&placement, device))
+        thread_cpu = irq_cpu = litepcie_placement_cpu(&placement, w->index);
+    if (thread_cpu >= 0)
+        bench_pin(thread_cpu);
+
+    memset(&w->dma, 0, sizeof(w->dma));
+    w->dma.fds.fd = -1;
+    w->dma.use_reader = 1;
+    w->dma.use_writer = 1;
+    w->dma.loopback = 1;
+    w->dma.buffer_size = p->buffer_size;
+    w->dma.buffer_count = config.buffer_count;
+    if (p->zero_copy) {
+        w->dma.batch_commit = 1;
+        w->dma.use_ctrl_page = 1;
+        w->dma.use_timestamps = 1;
+    }
+    if (litepcie_dma_init(&w->dma, device, p->zero_copy)) {
+        fprintf(stderr, "%s: DMA init failed\n", device);
+        w->failed = 1;
+    } else if (irq_cpu >= 0 && litepcie_dma_set_irq_cpu(w->dma.fds.fd, irq_cpu, irq_cpu)) {
+        w->irq_unrouted = 1;
+    }
+
+    pthread_barrier_wait(&bench_barrier);
+    if (w->failed)
+        return NULL;
+
+    w->dma.reader_enable = 1;
+    w->dma.writer_enable = 1;
+    while (!__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+        litepcie_dma_process(&w->dma);
+        window = __atomic_load_n(&bench_window, __ATOMIC_RELAXED);
+
+        /* RX */
+        count = litepcie_dma_read_spans(&w->dma, span);
+        if (p->batch && count > p->batch)
+            count = p->batch;
+        if (w->dma.ts && window >= 0 && count) {
+            now = bench_now_ns();
+            seen = 0;
+            for (s = 0; s < 2; s++) {
+                for (j = 0; j < span[s].count && seen < count; j++, seen++) {
+                    ts = litepcie_dma_buffer_ts(&w->dma, span[s].buf + (size_t)j * w->dma.buffer_size);
+                    if (ts && now > ts)
+                        litepcie_hist_record(&w->hist[window], now - ts);
+                }
+            }
+        }
+        litepcie_dma_read_commit(&w->dma, count);
+        __atomic_store_n(&w->rx_buffers, w->rx_buffers + count, __ATOMIC_RELAXED);
+
+        /* TX */
+        count = litepcie_dma_write_spans(&w->dma, span);
+        if (p->batch && count > p->batch)
+            count = p->batch;
+        litepcie_dma_write_commit(&w->dma, count);
+    }
+
+    litepcie_dma_cleanup(&w->dma);
+    return NULL;
+}
+
+/* Run one point: all channels together, warmup then config.repeats windows. */
+static void bench_run_point(struct bench_point *p) {
+    struct bench_worker workers[BENCH_CHANNELS_MAX];
+    struct litepcie_hist window_hist;
+    double p99[BENCH_REPEATS_MAX];
+    double mean, stddev;
+    int64_t start[BENCH_CHANNELS_MAX], buffers;
+    uint64_t t0, t1;
+    int i, r, failed = 0, unrouted = 0;
+
+    memset(workers, 0, sizeof(workers));
+    bench_stop = 0;
+    bench_window = -1;
+    pthread_barrier_init(&bench_barrier, NULL, p->channels + 1);
+    for (i = 0; i < p->channels; i++) {
+        workers[i].index = i;
+        workers[i].point = p;
+        workers[i].hist = malloc(config.repeats * sizeof(struct litepcie_hist));
+        if (!workers[i].hist) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (r = 0; r < config.repeats; r++)
+            litepcie_hist_reset(&workers[i].hist[r]);
+        pthread_create(&workers[i].thread, NULL, bench_worker_func, &workers[i]);
+    }
+    pthread_barrier_wait(&bench_barrier);
+    for (i = 0; i < p->channels; i++) {
+        failed |= workers[i].failed;
+        unrouted |= workers[i].irq_unrouted;
+    }
+    if (unrouted)
+        fprintf(stderr, "  IRQ routing for placement %s not supported, MSIs left in place\n", p->placement);
+
+    if (!failed) {
+        p->buffer_size_live = workers[0].dma.buffer_size;
+        bench_sleep(config.warmup_s);
+        for (r = 0; r < config.repeats && keep_running; r++) {
+            for (i = 0; i < p->channels; i++)
+                start[i] = __atomic_load_n(&workers[i].rx_buffers, __ATOMIC_RELAXED);
+            t0 = bench_now_ns();
+            __atomic_store_n(&bench_window, r, __ATOMIC_RELAXED);
+            bench_sleep(config.window_s);
+            __atomic_store_n(&bench_window, -1, __ATOMIC_RELAXED);
+            t1 = bench_now_ns();
+            p->gbps[r] = 0;
+            for (i = 0; i < p->channels; i++) {
+                buffers = __atomic_load_n(&workers[i].rx_buffers, __ATOMIC_RELAXED) - start[i];
+                p->gbps[r] += (double)buffers * workers[i].dma.buffer_size * 8 / (double)(t1 - t0);
+            }
+        }
+        p->repeats = r;
+    }
+
+    __atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < p->channels; i++)
+        pthread_join(workers[i].thread, NULL);
+    pthread_barrier_destroy(&bench_barrier);
+
+    if (!failed && p->repeats) {
+        p->valid = 1;
+        bench_ci(p->gbps, p->repeats, &p->gbps_mean, &p->gbps_stddev, &p->gbps_ci95);
+        litepcie_hist_reset(&p->hist);
+        for (r = 0; r < p->repeats; r++) {
+            litepcie_hist_reset(&window_hist);
+            for (i = 0; i < p->channels; i++)
+                litepcie_hist_merge(&window_hist, &workers[i].hist[r]);
+            litepcie_hist_merge(&p->hist, &window_hist);
+            p99[r] = litepcie_hist_quantile_ns(&window_hist, LITEPCIE_HIST_P99) / 1000.0;
+        }
+        bench_ci(p99, p->repeats, &mean, &stddev, &p->p99_ci95_us);
+    }
+    for (i = 0; i < p->channels; i++)
+        free(workers[i].hist);
+}
+
+static double bench_quantile_us(const struct bench_point *p, uint32_t ppm) {
+    return litepcie_hist_quantile_ns(&p->hist, ppm) / 1000.0;
+}
+
+static const char *bench_mode_name(const struct bench_point *p) {
+    return p->zero_copy ? "zero" : "copy";
+}
+
+static void bench_print_text_header(FILE *f) {
+    fprintf(f, "%-5s %8s %6s %-10s %3s %21s %10s %10s %10s\n",
+            "MODE", "BUF_SIZE", "BATCH", "PLACEMENT", "CH", "GBPS (95% CI)",
+            "P50_US", "P99_US", "P99.9_US");
+}
+
+static void bench_print_text(FILE *f, const struct bench_point *p) {
+    fprintf(f, "%-5s %8u %6u %-10s %3d %10.3f +- %7.3f",
+            bench_mode_name(p), p->buffer_size_live, p->batch, p->placement, p->channels,
+            p->gbps_mean, p->gbps_ci95);
+    if (p->hist.count)
+        fprintf(f, " %10.3f %10.3f %10.3f\n", bench_quantile_us(p, LITEPCIE_HIST_P50),
+                bench_quantile_us(p, LITEPCIE_HIST_P99), bench_quantile_us(p, LITEPCIE_HIST_P999));
+    else
+        fprintf(f, " %10s %10s %10s\n", "-", "-", "-");
+}
+
+static void bench_print_csv(FILE *f, const struct bench_point *p) {
+    fprintf(f, "%s,%u,%u,%s,%d,%d,%.6f,%.6f,%.6f",
+            bench_mode_name(p), p->buffer_size_live, p->batch, p->placement, p->channels, p->repeats,
+            p->gbps_mean, p->gbps_stddev, p->gbps_ci95);
+    if (p->hist.count)
+        fprintf(f, ",%.3f,%.3f,%.3f,%.3f,%.3f\n", bench_quantile_us(p, LITEPCIE_HIST_P50),
+                bench_quantile_us(p, LITEPCIE_HIST_P99), bench_quantile_us(p, LITEPCIE_HIST_P999),
+                bench_quantile_us(p, LITEPCIE_HIST_P9999), p->p99_ci95_us);
+    else
+        fprintf(f, ",,,,,\n");
+}
+
+static void bench_print_json(FILE *f, const struct bench_point *p, int last) {
+    int r;
+
+    fprintf(f, "    {\"mode\": \"%s\", \"buffer_size\": %u, \"batch\": %u, \"placement\": \"%s\", "
+            "\"channels\": %d, \"repeats\": %d,\n",
+            bench_mode_name(p), p->buffer_size_live, p->batch, p->placement, p->channels, p->repeats);
+    fprintf(f, "     \"gbps\": {\"mean\": %.6f, \"stddev\": %.6f, \"ci95\": %.6f, \"windows\": [",
+            p->gbps_mean, p->gbps_stddev, p->gbps_ci95);
+    for (r = 0; r < p->repeats; r++)
+        fprintf(f, "%s%.6f", r ? ", " : "", p->gbps[r]);
+    fprintf(f, "]},\n");
+    if (p->hist.count)
+        fprintf(f, "     \"latency_us\": {\"samples\": %llu, \"min\": %.3f, \"mean\": %.3f, \"max\": %.3f, "
+                "\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"p9999\": %.3f, \"p99_ci95\": %.3f}}%s\n",
+                (unsigned long long)p->hist.count, p->hist.min_ns / 1000.0,
+                litepcie_hist_mean_ns(&p->hist) / 1000.0, p->hist.max_ns / 1000.0,
+                bench_quantile_us(p, LITEPCIE_HIST_P50), bench_quantile_us(p, LITEPCIE_HIST_P99),
+                bench_quantile_us(p, LITEPCIE_HIST_P999), bench_quantile_us(p, LITEPCIE_HIST_P9999),
+                p->p99_ci95_us, last ? "" : ",");
+    else
+        fprintf(f, "     \"latency_us\": null}%s\n", last ? "" : ",");
+}
+
+static void bench_report(FILE *f) {
+    int i, n = 0, last = -1;
+
+    for (i = 0; i < point_count; i++)
+        if (points[i].valid)
+            last = i;
+
+    switch (config.output) {
+    case OUTPUT_JSON:
+        fprintf(f, "{\n  \"tool\": \"litepcie_bench\",\n  \"device\": \"%s\",\n", config.device);
+        fprintf(f, "  \"warmup_s\": %.3f,\n  \"window_s\": %.3f,\n  \"results\": [\n",
+                config.warmup_s, config.window_s);
+        for (i = 0; i < point_count; i++)
+            if (points[i].valid)
+                bench_print_json(f, &points[i], i == last);
+        fprintf(f, "  ]\n}\n");
+        break;
+    case OUTPUT_CSV:
+        fprintf(f, "%s\n", CSV_HEADER);
+        for (i = 0; i < point_count; i++)
+            if (points[i].valid)
+                bench_print_csv(f, &points[i]);
+        break;
+    default:
+        for (i = 0; i < point_count; i++) {
+            if (!points[i].valid)
+                continue;
+            if (n++ % 20 == 0)
+                bench_print_text_header(f);
+            bench_print_text(f, &points[i]);
+        }
+        break;
+    }
+}
+
+/*
+ * Compare against a CSV baseline from a previous -o csv run. A point has
+ * regressed when its throughput CI lies below the baseline mean by more than
+ * the tolerance, or its p99 latency grew by more than the tolerance.
+ * Returns the number of regressions, -1 if the baseline can't be read.
+ */
+static int bench_compare(const char *path) {
+    char line[1024], key[256], mode[8], placement[16];
+    double gbps_mean, lat_p99, base_gbps, base_p99, limit;
+    unsigned buffer_size, batch;
+    int channels, i, matched, regressions = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        fprintf(stderr, "Could not open baseline %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(stderr, "\nBaseline %s (tolerance %.1f%%):\n", path, config.tolerance_pct);
+    for (i = 0; i < point_count; i++) {
+        struct bench_point *p = &points[i];
+        double cur_p99 = p->hist.count ? bench_quantile_us(p, LITEPCIE_HIST_P99) : 0;
+        int gbps_bad, lat_bad;
+
+        if (!p->valid)
+            continue;
+        snprintf(key, sizeof(key), "%s,%u,%u,%s,%d,", bench_mode_name(p), p->buffer_size_live, p->batch,
+                 p->placement, p->channels);
+        matched = 0;
+        rewind(f);
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, key, strlen(key)))
+                continue;
+            lat_p99 = 0;
+            if (sscanf(line, "%7[^,],%u,%u,%15[^,],%d,%*d,%lf,%*f,%*f,%*f,%lf",
+                       mode, &buffer_size, &batch, placement, &channels, &gbps_mean, &lat_p99) < 6)
+                continue;
+            matched = 1;
+            break;
+        }
+        if (!matched) {
+            fprintf(stderr, "  %s no baseline\n", key);
+            continue;
+        }
+        base_gbps = gbps_mean;
+        base_p99 = lat_p99;
+        limit = base_gbps * (1 - config.tolerance_pct / 100);
+        gbps_bad = p->gbps_mean + p->gbps_ci95 < limit;
+        lat_bad = base_p99 > 0 && cur_p99 > base_p99 * (1 + config.tolerance_pct / 100);
+        fprintf(stderr, "  %s %8.3f Gbps (%+6.1f%%)", key, p->gbps_mean,
+                base_gbps > 0 ? 100 * (p->gbps_mean - base_gbps) / base_gbps : 0.0);
+        if (base_p99 > 0 && cur_p99 > 0)
+            fprintf(stderr, "  p99 %9.3f us (%+6.1f%%)", cur_p99, 100 * (cur_p99 - base_p99) / base_p99);
+        fprintf(stderr, "%s\n", gbps_bad || lat_bad ? "  REGRESSION" : "");
+        regressions += gbps_bad || lat_bad;
+    }
+    fclose(f);
+
+    return regressions;
+}
+
+/* Comma list of unsigned values, returns the count or -1. */
+static int parse_uint_list(const char *arg, uint32_t *list) {
+    char buf[256], *tok, *save, *end;
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (n == BENCH_LIST_MAX)
+            return -1;
+        list[n++] = strtoul(tok, &end, 0);
+        if (*end)
+            return -1;
+    }
+    return n;
+}
+
+/* "local" (thread and MSIs on the device's NUMA node), "any", "N" (thread
+ * and MSIs on CPU N) or "N:M" (thread on N, MSIs on M). */
+static int parse_placement(const char *s, int *thread_cpu, int *irq_cpu) {
+    char *end;
+
+    if (!strcmp(s, "local")) {
+        *thread_cpu = *irq_cpu = PLACEMENT_LOCAL;
+        return 0;
+    }
+    if (!strcmp(s, "any")) {
+        *thread_cpu = *irq_cpu = -1;
+        return 0;
+    }
+    *thread_cpu = strtol(s, &end, 10);
+    if (end == s || *thread_cpu < 0)
+        return -1;
+    if (*end == '\0') {
+        *irq_cpu = *thread_cpu;
+        return 0;
+    }
+    if (*end != ':')
+        return -1;
+    s = end + 1;
+    *irq_cpu = strtol(s, &end, 10);
+    return end == s || *end || *irq_cpu < 0 ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("\nSweep options (comma separated lists, every combination is run):\n");
+    printf("  -s <sizes>     Buffer sizes in bytes, 0 = driver geometry (default: 0)\n");
+    printf("  -B <batches>   Buffers committed per pass, zero-copy only, 0 = all (default: 0)\n");
+    printf("  -m <modes>     copy (read/write) and/or zero (mmap) (default: copy,zero)\n");
+    printf("  -p <places>    local (CPUs of the device's NUMA node), any, N (thread and MSIs\n");
+    printf("                 on CPU N) or N:M (thread N, MSIs M); channel i takes the i-th\n");
+    printf("                 local CPU or adds i to N and M (default: local)\n");
+    printf("  -n <counts>    Channel counts, on the devices following -d (default: 1)\n");
+    printf("\nRun options:\n");
+    printf("  -d <device>    First device file (default: %s)\n", config.device);
+    printf("  -N <buffers>   Ring buffer count, 0 = driver geometry (default: 0)\n");
+    printf("  -w <seconds>   Warmup per point (default: %.1f)\n", config.warmup_s);
+    printf("  -t <seconds>   Measurement window (default: %.1f)\n", config.window_s);
+    printf("  -r <count>     Windows per point, for the confidence intervals (default: %d)\n", config.repeats);
+    printf("  -o <format>    text, json or csv (default: text)\n");
+    printf("  -f <file>      Write the report to a file (default: stdout)\n");
+    printf("  -b <file>      Compare with a baseline CSV from -o csv, exit 2 on regression\n");
+    printf("  -T <percent>   Regression tolerance (default: %.1f)\n", config.tolerance_pct);
+    printf("  -h             Show this help\n");
+    printf("\nExamples:\n");
+    printf("  # Store a baseline\n");
+    printf("  %s -s 4096,65536 -B 0,8 -o csv -f baseline.csv\n\n", prog);
+    printf("  # Same sweep, checked against it\n");
+    printf("  %s -s 4096,65536 -B 0,8 -b baseline.csv\n\n", prog);
+    printf("  # Placement and channel scaling\n");
+    printf("  %s -m zero -p any,2,2:4 -n 1,2\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_point *p;
+    char *tok, *save;
+    FILE *out = stdout;
+    int opt, m, s, b, c, n, i, ret = 0;
+
+    while ((opt = getopt(argc, argv, "s:B:m:p:n:d:N:w:t:r:o:f:b:T:h")) != -1) {
+        switch (opt) {
+        case 's':
+            config.buffer_size_count = parse_uint_list(optarg, config.buffer_sizes);
+            if (config.buffer_size_count <= 0) {
+                fprintf(stderr, "Invalid buffer size list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            config.batch_count = parse_uint_list(optarg, config.batches);
+            if (config.batch_count <= 0) {
+                fprintf(stderr, "Invalid batch list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            config.mode_count = 0;
+            for (tok = strtok_r(optarg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                if (config.mode_count == 2 || (strcmp(tok, "copy") && strcmp(tok, "zero"))) {
+                    fprintf(stderr, "Invalid mode list, use copy and/or zero\n");
+                    return 1;
+                }
+                config.modes[config.mode_count++] = !strcmp(tok, "zero");
+            }
+            break;
+        case 'p':
+            config.placement_count = 0;
+            for (tok = strtok_r(optarg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                int thread_cpu, irq_cpu;
+
+                if (config.placement_count == BENCH_LIST_MAX || strlen(tok) >= 16 ||
+                    parse_placement(tok, &thread_cpu, &irq_cpu)) {
+                    fprintf(stderr, "Invalid placement: %s\n", tok);
+                    return 1;
+                }
+                strcpy(config.placements[config.placement_count++], tok);
+            }
+            break;
+        case 'n':
+            config.channel_count = parse_uint_list(optarg, config.channels);
+            for (i = 0; i < config.channel_count; i++)
+                if (config.channels[i] < 1 || config.channels[i] > BENCH_CHANNELS_MAX)
+                    config.channel_count = -1;
+            if (config.channel_count <= 0) {
+                fprintf(stderr, "Channel counts must be between 1 and %d\n", BENCH_CHANNELS_MAX);
+                return 1;
+            }
+            break;
+        case 'd':
+            config.device = optarg;
+            break;
+        case 'N':
+            config.buffer_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            config.warmup_s = atof(optarg);
+            break;
+        case 't':
+            config.window_s = atof(optarg);
+            if (config.window_s <= 0) {
+                fprintf(stderr, "Invalid window: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            config.repeats = atoi(optarg);
+            if (config.repeats < 1 || config.repeats > BENCH_REPEATS_MAX) {
+                fprintf(stderr, "Windows per point must be between 1 and %d\n", BENCH_REPEATS_MAX);
+                return 1;
+            }
+            break;
+        case 'o':
+            if (!strcmp(optarg, "text"))
+                config.output = OUTPUT_TEXT;
+            else if (!strcmp(optarg, "json"))
+                config.output = OUTPUT_JSON;
+            else if (!strcmp(optarg, "csv"))
+                config.output = OUTPUT_CSV;
+            else {
+                fprintf(stderr, "Invalid output format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            config.output_file = optarg;
+            break;
+        case 'b':
+            config.baseline_file = optarg;
+            break;
+        case 'T':
+            config.tolerance_pct = atof(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Build the sweep: the batch only matters in zero-copy mode. */
+    for (m = 0; m < config.mode_count; m++)
+    for (s = 0; s < config.buffer_size_count; s++)
+    for (b = 0; b < (config.modes[m] ? config.batch_count : 1); b++)
+    for (i = 0; i < config.placement_count; i++)
+    for (c = 0; c < config.channel_count; c++) {
+        if (point_count == BENCH_POINTS_MAX) {
+            fprintf(stderr, "Too many points, %d max\n", BENCH_POINTS_MAX);
+            return 1;
+        }
+        p = &points[point_count++];
+        p->zero_copy = config.modes[m];
+        p->buffer_size = config.buffer_sizes[s];
+        p->batch = config.modes[m] ? config.batches[b] : 0;
+        strcpy(p->placement, config.placements[i]);
+        parse_placement(p->placement, &p->thread_cpu, &p->irq_cpu);
+        p->channels = config.channels[c];
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    fprintf(stderr, "LitePCIe DMA Benchmark: %d points, %.1f s warmup + %d x %.1f s windows each\n",
+            point_count, config.warmup_s, config.repeats, config.window_s);
+    for (n = 0; n < point_count && keep_running; n++) {
+        p = &points[n];
+        fprintf(stderr, "[%d/%d] %s size %u batch %u placement %s channels %d\n", n + 1, point_count,
+                bench_mode_name(p), p->buffer_size, p->batch, p->placement, p->channels);
+        bench_run_point(p);
+        if (p->valid)
+            fprintf(stderr, "  %.3f Gbps +- %.3f\n", p->gbps_mean, p->gbps_ci95);
+        else
+            fprintf(stderr, "  skipped\n");
+    }
+
+    if (config.output_file) {
+        out = fopen(config.output_file, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open %s: %s\n", config.output_file, strerror(errno));
+            return 1;
+        }
+    }
+    bench_report(out);
+    if (out != stdout)
+        fclose(out);
+
+    if (config.baseline_file) {
+        n = bench_compare(config.baseline_file);
+        if (n < 0)
+            ret = 1;
+        else if (n > 0) {
+            fprintf(stderr, "%d regression(s)\n", n);
+            ret = 2;
+        }
+    }
+
+    return ret;
+}
@@ -20,6 +20,7 @@
 #include "litepcie.h"
 #include "liblitepcie.h"
 #include "litepcie_dma.h"
+#include "litepcie_hist.h"
 
 /* Test configuration */
 #define DEFAULT_ITERATIONS 1000
@@ -27,18 +28,6 @@
 #define MIN_BUFFER_SIZE    64
 #define TEST_PATTERN       0xCAFEBABE
 
-/* Statistics structure */
-typedef struct {
-    double min;
-    double max;
-    double mean;
-    double stddev;
-    double p50;
-    double p90;
-    double p95;
-    double p99;
-} latency_stats_t;
-
 /* Global state */
 static volatile int keep_running = 1;
 
@@ -121,132 +110,16 @@ static uint64_t measure_dma_latency(struct litepcie_dma_ctrl *dma, int size, int
     return UINT64_MAX;
 }
 
-/* Compare function for qsort */
-static int compare_uint64(const void *a, const void *b) {
-    uint64_t ua = *(const uint64_t*)a;
-    uint64_t ub = *(const uint64_t*)b;
-    return (ua > ub) - (ua < ub);
-}
-
-/* Calculate statistics */
-static void calculate_stats(uint64_t *latencies, int count, latency_stats_t *stats) {
-    double sum = 0, sum_sq = 0;
-    int valid_count = 0;
-    
-    /* Filter out timeouts */
-    for (int i = 0; i < count; i++) {
-        if (latencies[i] != UINT64_MAX) {
-            valid_count++;
-        }
-    }
-    
-    if (valid_count == 0) {
-        memset(stats, 0, sizeof(*stats));
-        return;
-    }
-    
-    /* Sort for percentiles */
-    qsort(latencies, count, sizeof(uint64_t), compare_uint64);
-    
-    /* Calculate stats */
-    stats->min = latencies[0] / 1000.0;
-    stats->max = latencies[valid_count-1] / 1000.0;
-    
-    for (int i = 0; i < valid_count; i++) {
-        double val = latencies[i] / 1000.0;
-        sum += val;
-        sum_sq += val * val;
-    }
-    
-    stats->mean = sum / valid_count;
-    stats->stddev = sqrt((sum_sq / valid_count) - (stats->mean * stats->mean));
-    
-    /* Percentiles */
-    stats->p50 = latencies[valid_count * 50 / 100] / 1000.0;
-    stats->p90 = latencies[valid_count * 90 / 100] / 1000.0;
-    stats->p95 = latencies[valid_count * 95 / 100] / 1000.0;
-    stats->p99 = latencies[valid_count * 99 / 100] / 1000.0;
-}
-
 /* Print statistics */
-static void print_stats(latency_stats_t *stats) {
+static void print_stats(const struct litepcie_hist *hist) {
     printf("\nDMA Latency Statistics (microseconds):\n");
-    printf("  Min:    %8.3f µs\n", stats->min);
-    printf("  Max:    %8.3f µs\n", stats->max);
-    printf("  Mean:   %8.3f µs\n", stats->mean);
-    printf("  StdDev: %8.3f µs\n", stats->stddev);
+    printf("  Min:    %10.3f us\n", hist->min_ns / 1000.0);
+    printf("  Max:    %10.3f us\n", hist->max_ns / 1000.0);
+    printf("  Mean:   %10.3f us\n", litepcie_hist_mean_ns(hist) / 1000.0);
     printf("\nPercentiles:\n");
-    printf("  50%%:    %8.3f µs (median)\n", stats->p50);
-    printf("  90%%:    %8.3f µs\n", stats->p90);
-    printf("  95%%:    %8.3f µs\n", stats->p95);
-    printf("  99%%:    %8.3f µs\n", stats->p99);
-}
-
-/* Print histogram */
-static void print_histogram(uint64_t *latencies, int count) {
-    const int num_bins = 20;
-    const int bar_width = 50;
-    int bins[num_bins];
-    double bin_width;
-    double min_us, max_us;
-    int max_count = 0;
-    int valid_count = 0;
-    
-    /* Initialize bins */
-    memset(bins, 0, sizeof(bins));
-    
-    /* Find min/max of valid measurements */
-    min_us = 1e9;
-    max_us = 0;
-    for (int i = 0; i < count; i++) {
-        if (latencies[i] != UINT64_MAX) {
-            double us = latencies[i] / 1000.0;
-            if (us < min_us) min_us = us;
-            if (us > max_us) max_us = us;
-            valid_count++;
-        }
-    }
-    
-    if (valid_count == 0) return;
-    
-    /* Calculate bin width */
-    bin_width = (max_us - min_us) / num_bins;
-    if (bin_width == 0) bin_width = 1;
-    
-    /* Fill bins */
-    for (int i = 0; i < count; i++) {
-        if (latencies[i] != UINT64_MAX) {
-            double us = latencies[i] / 1000.0;
-            int bin = (int)((us - min_us) / bin_width);
-            if (bin >= num_bins) bin = num_bins - 1;
-            if (bin < 0) bin = 0;
-            bins[bin]++;
-            if (bins[bin] > max_count) max_count = bins[bin];
-        }
-    }
-    
-    /* Print histogram */
-    printf("\nLatency Distribution Histogram:\n");
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-    
-    for (int i = 0; i < num_bins; i++) {
-        double bin_start = min_us + i * bin_width;
-        double bin_end = bin_start + bin_width;
-        int bar_len = max_count > 0 ? (bins[i] * bar_width) / max_count : 0;
-        
-        printf("%6.1f-%6.1f µs [%4d] ", bin_start, bin_end, bins[i]);
-        
-        /* Print bar */
-        for (int j = 0; j < bar_len; j++) {
-            printf("█");
-        }
-        
-        /* Print percentage */
-        double percent = valid_count > 0 ? (100.0 * bins[i]) / valid_count : 0;
-        printf(" %.1f%%\n", percent);
-    }
-    
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+    litepcie_hist_print(stdout, hist);
+    printf("\nLatency Distribution:\n");
+    litepcie_hist_print_distribution(stdout, hist);
 }
 
 /* Usage */
@@ -273,8 +146,7 @@ int main(int argc, char *argv[]) {
     int verbose = 0;
     uint8_t zero_copy = 0;
     int opt;
-    uint64_t *latencies;
-    latency_stats_t stats;
+    static struct litepcie_hist hist;
     struct litepcie_dma_ctrl dma;
     
     /* Parse options */
@@ -291,9 +163,8 @@ int main(int argc, char *argv[]) {
             break;
         case 's':
             test_size = atoi(optarg);
-            if (test_size < MIN_BUFFER_SIZE || test_size > DMA_BUFFER_SIZE) {
-                fprintf(stderr, "Test size must be between %d and %d bytes\n",
-                        MIN_BUFFER_SIZE, DMA_BUFFER_SIZE);
+            if (test_size < MIN_BUFFER_SIZE) {
+                fprintf(stderr, "Test size must be at least %d bytes\n", MIN_BUFFER_SIZE);
                 return 1;
             }
             break;
@@ -340,18 +211,19 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Failed to initialize DMA\n");
         return 1;
     }
+
+    if ((uint32_t)test_size > dma.buffer_size) {
+        fprintf(stderr, "Test size must be between %d and %u bytes\n",
+                MIN_BUFFER_SIZE, dma.buffer_size);
+        litepcie_dma_cleanup(&dma);
+        return 1;
+    }
     
     /* Enable DMA channels */
     dma.reader_enable = 1;
     dma.writer_enable = 1;
     
-    /* Allocate results buffer */
-    latencies = malloc(iterations * sizeof(uint64_t));
-    if (!latencies) {
-        fprintf(stderr, "Failed to allocate memory\n");
-        litepcie_dma_cleanup(&dma);
-        return 1;
-    }
+    litepcie_hist_reset(&hist);
     
     printf("LitePCIe DMA Latency Test (Simple)\n");
     printf("Device: %s\n", device);
@@ -376,8 +248,9 @@ int main(int argc, char *argv[]) {
     
     int valid = 0;
     for (int i = 0; i < iterations && keep_running; i++) {
-        latencies[i] = measure_dma_latency(&dma, test_size, verbose);
-        if (latencies[i] != UINT64_MAX) {
+        uint64_t latency = measure_dma_latency(&dma, test_size, verbose);
+        if (latency != UINT64_MAX) {
+            litepcie_hist_record(&hist, latency);
             valid++;
         }
         
@@ -395,17 +268,13 @@ int main(int argc, char *argv[]) {
     
     /* Calculate and print statistics */
     if (valid > 0) {
-        calculate_stats(latencies, iterations, &stats);
-        print_stats(&stats);
-        
-        /* Print histogram */
-        print_histogram(latencies, iterations);
+        print_stats(&hist);
         
         printf("\nAnalysis:\n");
         printf("  Valid measurements: %d/%d (%.1f%%)\n", 
                valid, iterations, 100.0 * valid / iterations);
         printf("  Buffer utilization: %.1f%% of %d bytes\n",
-               100.0 * test_size / DMA_BUFFER_SIZE, DMA_BUFFER_SIZE);
+               100.0 * test_size / dma.buffer_size, dma.buffer_size);
         
         if (valid < iterations * 0.9) {
             printf("\nWarning: High failure rate. Check:\n");
@@ -419,7 +288,6 @@ int main(int argc, char *argv[]) {
     }
     
     /* Cleanup */
-    free(latencies);
     litepcie_dma_cleanup(&dma);
     
     return 0;
@@ -10,6 +10,8 @@
  * - Continuous monitoring mode with real-time statistics
  * - CPU affinity support for consistent measurements
  * - Multiple test patterns for comprehensive testing
+ * - Timestamp mode (-T): driver per-buffer completion stamps, no poll jitter
+ * - Message mode (-M): each transfer sent alone with its real size
  */
 
 #define _GNU_SOURCE
@@ -32,6 +34,7 @@
 #include "litepcie.h"
 #include "liblitepcie.h"
 #include "litepcie_dma.h"
+#include "litepcie_hist.h"
 #include "kernel/mem.h"
 #include "kernel/config.h"
 #include "kernel/csr.h"
@@ -42,8 +45,9 @@
 #define DEFAULT_TRANSFER_SIZE 64      /* Small transfer for latency test */
 #define MAX_TRANSFER_SIZE    4096
 #define CACHE_LINE_SIZE      64
-#define HISTOGRAM_BUCKETS    1000     /* 1us buckets up to 1ms */
 #define UPDATE_INTERVAL_MS   1000     /* Stats update every second */
+#define TS_TAG_MAGIC         0x4c50544dULL /* TX buffer tag in timestamp mode */
+#define MSG_TIMEOUT_NS       1000000000ULL /* message mode: lost after 1 s */
 
 /* Test patterns */
 #define PATTERN_SEQ        0
@@ -58,10 +62,6 @@ static pthread_t latency_thread, monitor_thread, dma_thread;
 static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t dma_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* Latency histogram */
-static uint64_t *latency_histogram;
-static uint64_t histogram_overflow = 0;
-
 /* Statistics structure */
 typedef struct {
     uint64_t count;
@@ -71,10 +71,8 @@ typedef struct {
     double sum_us;
     double sum_sq_us;
     struct timeval start_time;
-    /* Recent samples for percentiles */
-    uint64_t *recent_samples;
-    int sample_index;
-    int sample_count;
+    /* Fixed-size histogram for percentiles, whatever the run length */
+    struct litepcie_hist hist;
 } latency_stats_t;
 
 static latency_stats_t stats = {
@@ -95,6 +93,8 @@ typedef struct {
     int verbose;
     int cpu_core;
     int dma_poll_us;
+    int timestamps;
+    int messages;
     uint32_t target_addr;
 } test_config_t;
 
@@ -198,24 +198,7 @@ static void update_stats(uint64_t latency_ns) {
     if (latency_us < stats.min_us) stats.min_us = latency_us;
     if (latency_us > stats.max_us) stats.max_us = latency_us;
 
-    /* Update histogram */
-    if (config.histogram && latency_histogram) {
-        int bucket = (int)latency_us;
-        if (bucket < HISTOGRAM_BUCKETS) {
-            latency_histogram[bucket]++;
-        } else {
-            histogram_overflow++;
-        }
-    }
-
-    /* Store recent sample for percentiles */
-    if (stats.recent_samples && stats.sample_count < config.iterations) {
-        stats.recent_samples[stats.sample_index] = latency_ns;
-        stats.sample_index = (stats.sample_index + 1) % config.iterations;
-        if (stats.sample_count < config.iterations) {
-            stats.sample_count++;
-        }
-    }
+    litepcie_hist_record(&stats.hist, latency_ns);
 
     pthread_mutex_unlock(&stats_mutex);
 }
@@ -376,51 +359,156 @@ static void* latency_thread_func(void *arg) {
     return NULL;
 }
 
-/* Calculate percentile from recent samples */
-static double calculate_percentile(double p) {
-    uint64_t *sorted;
-    int count;
-    double result;
+/* Timestamp mode: each TX buffer carries its sequence number. The latency of
+ * a looped-back buffer is the driver's stamp of the RX buffer written to host
+ * memory minus its stamp of the matching TX buffer fetched by the FPGA, so
+ * neither the poll loop nor the scheduler is part of the measurement. */
+static void run_timestamp_test(void) {
+    const struct litepcie_mmap_dma_ctrl *ctrl = dma_ctrl.ctrl;
+    uint64_t tx_count = 0, stale = 0;
+    int warmup = config.continuous ? 0 : config.warmup;
+    char *buf;
 
-    pthread_mutex_lock(&stats_mutex);
+    if (config.cpu_core >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(config.cpu_core, &cpuset);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
 
-    if (!stats.recent_samples || stats.sample_count == 0) {
-        pthread_mutex_unlock(&stats_mutex);
-        return 0;
+    while (keep_running) {
+        litepcie_dma_process(&dma_ctrl);
+
+        /* Tag the TX buffers, in ring order. */
+        while ((buf = litepcie_dma_next_write_buffer(&dma_ctrl)) != NULL) {
+            uint64_t *tag = (uint64_t *)buf;
+            tag[0] = TS_TAG_MAGIC;
+            tag[1] = tx_count++;
+        }
+
+        /* Match the RX buffers with their TX stamps. */
+        while ((buf = litepcie_dma_next_read_buffer(&dma_ctrl)) != NULL) {
+            const uint64_t *tag = (const uint64_t *)buf;
+            uint64_t seq, rx_ts, tx_ts;
+            int64_t reader_hw_count;
+
+            if (tag[0] != TS_TAG_MAGIC)
+                continue;
+            seq = tag[1];
+            rx_ts = litepcie_dma_buffer_ts(&dma_ctrl, buf);
+            tx_ts = __atomic_load_n(&dma_ctrl.ts->reader_ts[seq % dma_ctrl.buffer_count], __ATOMIC_RELAXED);
+            /* The TX stamp is only seq's while its slot was not reused. */
+            reader_hw_count = __atomic_load_n(&ctrl->reader_hw_count, __ATOMIC_ACQUIRE);
+            if ((int64_t)seq >= reader_hw_count || reader_hw_count - (int64_t)seq > dma_ctrl.buffer_count ||
+                rx_ts < tx_ts) {
+                stale++;
+                continue;
+            }
+            if (warmup > 0) {
+                warmup--;
+                continue;
+            }
+            update_stats(rx_ts - tx_ts);
+        }
+
+        if (!config.continuous && stats.count >= (uint64_t)config.iterations)
+            keep_running = 0;
     }
 
-    count = stats.sample_count;
-    sorted = malloc(count * sizeof(uint64_t));
-    if (!sorted) {
-        pthread_mutex_unlock(&stats_mutex);
-        return 0;
+    if (stale)
+        printf("\nStale samples:    %lu (TX stamp reused or missed)\n", stale);
+}
+
+/* Message mode: one request in flight, sent as a single transfer of
+ * transfer_size bytes (plus the in-band header) instead of riding in a
+ * full ring buffer, then spin until it is back in its own RX buffer. */
+static void run_message_test(void) {
+    uint32_t *write_buf, *verify_buf;
+    size_t words = config.transfer_size / sizeof(uint32_t);
+    uint32_t iteration = 0, length, seq, tx_seq;
+    uint64_t start, lost = 0;
+    int warmup = config.continuous ? 0 : config.warmup;
+    const char *buf;
+
+    if (config.cpu_core >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(config.cpu_core, &cpuset);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
     }
 
-    memcpy(sorted, stats.recent_samples, count * sizeof(uint64_t));
-    pthread_mutex_unlock(&stats_mutex);
+    write_buf = aligned_alloc(CACHE_LINE_SIZE, MAX_TRANSFER_SIZE);
+    verify_buf = aligned_alloc(CACHE_LINE_SIZE, MAX_TRANSFER_SIZE);
+    if (!write_buf || !verify_buf) {
+        fprintf(stderr, "Failed to allocate measurement buffers\n");
+        free(write_buf);
+        free(verify_buf);
+        return;
+    }
 
-    /* Sort samples */
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = i + 1; j < count; j++) {
-            if (sorted[i] > sorted[j]) {
-                uint64_t tmp = sorted[i];
-                sorted[i] = sorted[j];
-                sorted[j] = tmp;
+    /* Let the enable ioctls through before the first send. */
+    litepcie_dma_process(&dma_ctrl);
+
+    while (keep_running) {
+        generate_pattern(write_buf, words, iteration);
+
+        start = get_time_ns();
+        while (litepcie_dma_msg_send(&dma_ctrl, write_buf, config.transfer_size, LITEPCIE_DMA_MSG_LAST)) {
+            if (errno != EAGAIN) {
+                perror("litepcie_dma_msg_send");
+                keep_running = 0;
+                break;
             }
+            litepcie_dma_process(&dma_ctrl);
+        }
+        if (!keep_running)
+            break;
+        tx_seq = (uint32_t)(dma_ctrl.reader_sw_count - 1);
+
+        /* Wait for our message, dropping stale ones. */
+        buf = NULL;
+        while (keep_running && get_time_ns() - start < MSG_TIMEOUT_NS) {
+            litepcie_dma_process(&dma_ctrl);
+            while ((buf = litepcie_dma_msg_recv(&dma_ctrl, &length, &seq)) != NULL && seq != tx_seq)
+                ;
+            if (buf)
+                break;
+        }
+        if (!buf) {
+            lost += keep_running;
+            iteration++;
+            continue;
         }
-    }
 
-    int index = (int)(p * count / 100.0);
-    if (index >= count) index = count - 1;
-    result = sorted[index] / 1000.0;  /* Convert to microseconds */
+        if (warmup > 0) {
+            warmup--;
+        } else {
+            update_stats(get_time_ns() - start);
+            if (config.verify_data) {
+                memcpy(verify_buf, buf, length < (uint32_t)config.transfer_size ? length : (uint32_t)config.transfer_size);
+                if (length != (uint32_t)config.transfer_size ||
+                    verify_pattern(verify_buf, write_buf, words) > 0) {
+                    pthread_mutex_lock(&stats_mutex);
+                    stats.errors++;
+                    pthread_mutex_unlock(&stats_mutex);
+                }
+            }
+        }
+        iteration++;
 
-    free(sorted);
-    return result;
+        if (!config.continuous && stats.count >= (uint64_t)config.iterations)
+            keep_running = 0;
+    }
+
+    if (lost)
+        printf("\nLost messages:    %lu (no loopback within 1 s)\n", lost);
+    free(write_buf);
+    free(verify_buf);
 }
 
 /* Print statistics */
 static void print_stats(int final) {
-    double mean, stddev;
+    double mean, stddev, p99_us;
     uint64_t elapsed_us;
 
     pthread_mutex_lock(&stats_mutex);
@@ -432,6 +520,7 @@ static void print_stats(int final) {
 
     mean = stats.sum_us / stats.count;
     stddev = sqrt((stats.sum_sq_us / stats.count) - (mean * mean));
+    p99_us = litepcie_hist_quantile_ns(&stats.hist, LITEPCIE_HIST_P99) / 1000.0;
 
     elapsed_us = get_time_us() -
                  (stats.start_time.tv_sec * 1000000ULL + stats.start_time.tv_usec);
@@ -448,14 +537,8 @@ static void print_stats(int final) {
         printf("Mean latency:     %.3f µs\n", mean);
         printf("Std deviation:    %.3f µs\n", stddev);
 
-        if (stats.recent_samples) {
-            printf("\nPercentiles:\n");
-            printf("  50%% (median):  %.3f µs\n", calculate_percentile(50));
-            printf("  90%%:           %.3f µs\n", calculate_percentile(90));
-            printf("  95%%:           %.3f µs\n", calculate_percentile(95));
-            printf("  99%%:           %.3f µs\n", calculate_percentile(99));
-            printf("  99.9%%:         %.3f µs\n", calculate_percentile(99.9));
-        }
+        printf("\nPercentiles:\n");
+        litepcie_hist_print(stdout, &stats.hist);
 
         printf("\nThroughput Analysis:\n");
         printf("Transfer size:    %d bytes\n", config.transfer_size);
@@ -465,31 +548,16 @@ static void print_stats(int final) {
                stats.count * 1000000.0 / elapsed_us);
 
         /* Print histogram if enabled */
-        if (config.histogram && latency_histogram) {
-            printf("\nLatency Distribution (µs):\n");
-            for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
-                if (latency_histogram[i] > 0) {
-                    printf("  [%3d-%3d): %8lu", i, i+1, latency_histogram[i]);
-
-                    /* Simple bar graph */
-                    int bar_len = (latency_histogram[i] * 40) / stats.count;
-                    if (bar_len > 40) bar_len = 40;
-                    printf(" |");
-                    for (int j = 0; j < bar_len; j++) printf("█");
-                    printf("\n");
-                }
-            }
-            if (histogram_overflow > 0) {
-                printf("  [%d+):    %8lu (overflow)\n",
-                       HISTOGRAM_BUCKETS, histogram_overflow);
-            }
+        if (config.histogram) {
+            printf("\nLatency Distribution:\n");
+            litepcie_hist_print_distribution(stdout, &stats.hist);
         }
     } else {
         /* Progress update */
         printf("\r[%6.1fs] Samples: %8lu | Min: %6.2fµs | Mean: %6.2fµs | "
-               "Max: %6.2fµs | StdDev: %6.2fµs",
+               "p99: %6.2fµs | Max: %6.2fµs | StdDev: %6.2fµs",
                elapsed_us / 1000000.0, stats.count, stats.min_us, mean,
-               stats.max_us, stddev);
+               p99_us, stats.max_us, stddev);
         fflush(stdout);
     }
 }
@@ -531,6 +599,8 @@ static void usage(const char *prog) {
     printf("  -c <cpu>       Pin to CPU core\n");
     printf("  -i <us>        DMA poll interval in microseconds (default: %d)\n",
            config.dma_poll_us);
+    printf("  -T             Timestamp mode: driver completion stamps, whole buffers, zero-copy\n");
+    printf("  -M             Message mode: one transfer per request, sized to it, zero-copy\n");
     printf("  -C             Continuous mode (run until interrupted)\n");
     printf("  -H             Disable histogram\n");
     printf("  -V             Disable data verification\n");
@@ -550,7 +620,7 @@ int main(int argc, char *argv[]) {
     int opt;
 
     /* Parse options */
-    while ((opt = getopt(argc, argv, "d:s:n:w:p:a:c:i:CHVvh")) != -1) {
+    while ((opt = getopt(argc, argv, "d:s:n:w:p:a:c:i:TMCHVvh")) != -1) {
         switch (opt) {
         case 'd':
             config.device = optarg;
@@ -585,6 +655,12 @@ int main(int argc, char *argv[]) {
         case 'i':
             config.dma_poll_us = atoi(optarg);
             break;
+        case 'T':
+            config.timestamps = 1;
+            break;
+        case 'M':
+            config.messages = 1;
+            break;
         case 'C':
             config.continuous = 1;
             break;
@@ -606,25 +682,20 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (config.timestamps && config.messages) {
+        fprintf(stderr, "Timestamp and message modes are exclusive\n");
+        return 1;
+    }
+    if (config.messages && config.transfer_size % sizeof(uint32_t)) {
+        fprintf(stderr, "Message mode needs a multiple of 4 bytes\n");
+        return 1;
+    }
+
     /* Setup signal handler */
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    /* Allocate statistics structures */
-    if (config.histogram) {
-        latency_histogram = calloc(HISTOGRAM_BUCKETS, sizeof(uint64_t));
-        if (!latency_histogram) {
-            fprintf(stderr, "Failed to allocate histogram\n");
-            return 1;
-        }
-    }
-
-    stats.recent_samples = malloc(config.iterations * sizeof(uint64_t));
-    if (!stats.recent_samples) {
-        fprintf(stderr, "Failed to allocate sample buffer\n");
-        if (latency_histogram) free(latency_histogram);
-        return 1;
-    }
+    litepcie_hist_reset(&stats.hist);
 
     /* Initialize DMA */
     printf("LitePCIe DMA Latency Test V2\n");
@@ -642,6 +713,8 @@ int main(int argc, char *argv[]) {
                config.iterations, config.warmup);
     }
     printf("Verification:     %s\n", config.verify_data ? "Enabled" : "Disabled");
+    printf("Timing:           %s\n", config.timestamps ? "Driver completion stamps" :
+           config.messages ? "Message round trip" : "Poll loop");
     printf("CPU affinity:     %s\n",
            config.cpu_core >= 0 ? "Enabled" : "Disabled");
     printf("\nInitializing DMA...\n");
@@ -650,11 +723,19 @@ int main(int argc, char *argv[]) {
     dma_ctrl.loopback = 1;  /* Internal loopback for latency test */
     dma_ctrl.use_reader = 1;
     dma_ctrl.use_writer = 1;
+    if (config.timestamps) {
+        dma_ctrl.use_ctrl_page = 1;
+        dma_ctrl.use_timestamps = 1;
+        dma_ctrl.buffer_per_irq = 1; /* one MSI, so one stamp, per buffer */
+    }
+    if (config.messages) {
+        dma_ctrl.use_ctrl_page = 1;
+        dma_ctrl.nonblock = 1;       /* spin, the RX MSI only refreshes the page */
+        dma_ctrl.msg_mode = 1;
+    }
 
-    if (litepcie_dma_init(&dma_ctrl, config.device, 0)) {
+    if (litepcie_dma_init(&dma_ctrl, config.device, config.timestamps || config.messages)) {
         fprintf(stderr, "Failed to initialize DMA\n");
-        if (latency_histogram) free(latency_histogram);
-        free(stats.recent_samples);
         return 1;
     }
 
@@ -674,6 +755,38 @@ int main(int argc, char *argv[]) {
     }
     printf("\n");
 
+    if (config.timestamps) {
+        config.transfer_size = dma_ctrl.buffer_size; /* whole buffers */
+        if (config.continuous &&
+            pthread_create(&monitor_thread, NULL, monitor_thread_func, NULL) != 0) {
+            fprintf(stderr, "Failed to create monitor thread\n");
+            goto cleanup;
+        }
+        run_timestamp_test();
+        if (config.continuous)
+            pthread_join(monitor_thread, NULL);
+        print_stats(1);
+        goto cleanup;
+    }
+
+    if (config.messages) {
+        if ((size_t)config.transfer_size > LITEPCIE_DMA_MSG_MAX(&dma_ctrl)) {
+            fprintf(stderr, "Transfer size above the %zu bytes a message carries\n",
+                    LITEPCIE_DMA_MSG_MAX(&dma_ctrl));
+            goto cleanup;
+        }
+        if (config.continuous &&
+            pthread_create(&monitor_thread, NULL, monitor_thread_func, NULL) != 0) {
+            fprintf(stderr, "Failed to create monitor thread\n");
+            goto cleanup;
+        }
+        run_message_test();
+        if (config.continuous)
+            pthread_join(monitor_thread, NULL);
+        print_stats(1);
+        goto cleanup;
+    }
+
     /* Start DMA processing thread */
     if (pthread_create(&dma_thread, NULL, dma_thread_func, NULL) != 0) {
         fprintf(stderr, "Failed to create DMA thread\n");
@@ -714,8 +827,6 @@ int main(int argc, char *argv[]) {
 cleanup:
     /* Cleanup */
     litepcie_dma_cleanup(&dma_ctrl);
-    if (latency_histogram) free(latency_histogram);
-    if (stats.recent_samples) free(stats.recent_samples);
 
     return 0;
 }
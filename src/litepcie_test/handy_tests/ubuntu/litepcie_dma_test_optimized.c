@@ -24,10 +24,11 @@
 #include "litepcie.h"
 #include "liblitepcie.h"
 #include "litepcie_dma.h"
+#include "litepcie_pattern.h"
+#include "litepcie_copy.h"
+#include "litepcie_numa.h"
 
 /* Buffer configuration */
-#define DMA_BUFFER_SIZE    8192
-#define DMA_BUFFER_COUNT   256
 #define BATCH_SIZE         16
 #define CACHE_LINE_SIZE    64
 
@@ -44,6 +45,7 @@ static struct litepcie_dma_ctrl dma_ctrl;
 static pthread_t reader_thread, writer_thread;
 static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t global_seed = 0;
+static struct litepcie_placement placement; /* CPUs and memory local to the device */
 
 /* Statistics */
 typedef struct {
@@ -65,6 +67,9 @@ typedef struct {
     int verbose;
     int cpu_affinity;
     int batch_process;
+    uint32_t buffer_size;     /* 0: driver geometry */
+    uint32_t buffer_count;
+    uint32_t buffer_per_irq;
 } dma_config_t;
 
 static dma_config_t config = {
@@ -76,15 +81,6 @@ static dma_config_t config = {
     .batch_process = 1
 };
 
-/* Memory prefetch hints */
-static inline void prefetch_read(const void *addr) {
-    __builtin_prefetch(addr, 0, 3);
-}
-
-static inline void prefetch_write(void *addr) {
-    __builtin_prefetch(addr, 1, 3);
-}
-
 /* Get current time in microseconds */
 static inline uint64_t get_time_us(void) {
     struct timeval tv;
@@ -104,10 +100,7 @@ static void generate_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
         break;
         
     case PATTERN_RANDOM:
-        for (i = 0; i < count; i++) {
-            *seed = *seed * 69069 + 1;
-            buffer[i] = *seed;
-        }
+        litepcie_lcg_fill(buffer, count, seed);
         break;
         
     case PATTERN_ONES:
@@ -148,16 +141,18 @@ static int verify_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
         break;
         
     case PATTERN_RANDOM:
-        for (i = 0; i < count; i++) {
-            *seed = *seed * 69069 + 1;
-            expected = *seed;
-            if (buffer[i] != expected) {
-                if (config.verbose) {
+        expected = *seed;
+        errors = litepcie_lcg_check(buffer, count, seed);
+        /* Report the first mismatches from the scalar sequence */
+        if (errors && config.verbose) {
+            int reported = 0;
+            for (i = 0; i < count && reported <= 10; i++) {
+                expected = expected * 69069 + 1;
+                if (buffer[i] != expected) {
                     printf("Error at %zu: expected 0x%08x, got 0x%08x\n", 
                            i, expected, buffer[i]);
+                    reported++;
                 }
-                errors++;
-                if (errors > 10) break;
             }
         }
         break;
@@ -197,50 +192,30 @@ static int verify_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
 /* Writer thread - generates and sends data */
 static void* writer_thread_func(void *arg) {
     uint32_t seed = global_seed;
-    int i;
     (void)arg; /* unused parameter */
     
-    /* Set CPU affinity if requested */
-    if (config.cpu_affinity) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(0, &cpuset);
-        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    }
+    /* Set CPU affinity if requested: first CPU of the device's node */
+    if (config.cpu_affinity)
+        litepcie_placement_pin(&placement, 0);
     
-    /* Pre-generate pattern buffer for efficiency */
-    uint32_t *pattern = malloc(DMA_BUFFER_SIZE);
+    /* Pre-generate pattern buffer for efficiency, on the device's node */
+    uint32_t *pattern = litepcie_placement_alloc(&placement, dma_ctrl.buffer_size);
     if (!pattern) {
         fprintf(stderr, "Failed to allocate pattern buffer\n");
         return NULL;
     }
-    generate_pattern(pattern, DMA_BUFFER_SIZE / sizeof(uint32_t), &seed);
+    generate_pattern(pattern, dma_ctrl.buffer_size / sizeof(uint32_t), &seed);
     
     while (keep_running) {
         char *buf = litepcie_dma_next_write_buffer(&dma_ctrl);
         
         if (buf) {
-            /* Copy pattern with prefetching */
-            if (config.data_width == 32) {
-                uint32_t *dst = (uint32_t*)buf;
-                uint32_t *src = pattern;
-                size_t words = DMA_BUFFER_SIZE / sizeof(uint32_t);
-                
-                for (i = 0; i < words; i += 16) {
-                    if (i + 64 < words) {
-                        prefetch_read(src + i + 64);
-                        prefetch_write(dst + i + 64);
-                    }
-                    memcpy(dst + i, src + i, 16 * sizeof(uint32_t));
-                }
-            } else {
-                /* Handle other data widths */
-                memcpy(buf, pattern, DMA_BUFFER_SIZE);
-            }
+            /* Streaming copy: the device reads the buffer, the CPU never does */
+            litepcie_copy(buf, pattern, dma_ctrl.buffer_size);
             
             /* Update statistics */
             pthread_mutex_lock(&stats_mutex);
-            stats.tx_bytes += DMA_BUFFER_SIZE;
+            stats.tx_bytes += dma_ctrl.buffer_size;
             stats.tx_buffers++;
             pthread_mutex_unlock(&stats_mutex);
             
@@ -255,7 +230,7 @@ static void* writer_thread_func(void *arg) {
         }
     }
     
-    free(pattern);
+    litepcie_placement_free(pattern, dma_ctrl.buffer_size);
     return NULL;
 }
 
@@ -264,13 +239,9 @@ static void* reader_thread_func(void *arg) {
     uint32_t seed = global_seed;
     (void)arg; /* unused parameter */
     
-    /* Set CPU affinity if requested */
-    if (config.cpu_affinity) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(1, &cpuset);
-        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    }
+    /* Set CPU affinity if requested: second CPU of the device's node */
+    if (config.cpu_affinity)
+        litepcie_placement_pin(&placement, 1);
     
     while (keep_running) {
         char *buf = litepcie_dma_next_read_buffer(&dma_ctrl);
@@ -279,7 +250,7 @@ static void* reader_thread_func(void *arg) {
             /* Verify data if enabled */
             if (config.verify_data && config.pattern_type <= PATTERN_ALT) {
                 int errors = verify_pattern((uint32_t*)buf, 
-                                           DMA_BUFFER_SIZE / sizeof(uint32_t), 
+                                           dma_ctrl.buffer_size / sizeof(uint32_t), 
                                            &seed);
                 if (errors > 0) {
                     pthread_mutex_lock(&stats_mutex);
@@ -290,7 +261,7 @@ static void* reader_thread_func(void *arg) {
             
             /* Update statistics */
             pthread_mutex_lock(&stats_mutex);
-            stats.rx_bytes += DMA_BUFFER_SIZE;
+            stats.rx_bytes += dma_ctrl.buffer_size;
             stats.rx_buffers++;
             pthread_mutex_unlock(&stats_mutex);
         } else {
@@ -345,6 +316,9 @@ static void usage(const char *prog) {
     printf("  -n             Disable data verification\n");
     printf("  -a             Disable CPU affinity\n");
     printf("  -b             Disable batch processing\n");
+    printf("  -B <bytes>     DMA buffer size (default: driver setting)\n");
+    printf("  -N <count>     DMA buffer count, power of 2 (default: driver setting)\n");
+    printf("  -I <count>     DMA buffers per MSI (default: driver setting)\n");
     printf("  -v             Verbose output\n");
     printf("  -t <seconds>   Test duration (0 = infinite)\n");
     printf("  -h             Show this help\n");
@@ -359,7 +333,7 @@ int main(int argc, char *argv[]) {
     uint8_t external_loopback = 0;
     
     /* Parse options */
-    while ((opt = getopt(argc, argv, "d:p:w:lznavbt:h")) != -1) {
+    while ((opt = getopt(argc, argv, "d:p:w:lznavbB:N:I:t:h")) != -1) {
         switch (opt) {
         case 'd':
             device = optarg;
@@ -399,6 +373,15 @@ int main(int argc, char *argv[]) {
         case 't':
             duration = atoi(optarg);
             break;
+        case 'B':
+            config.buffer_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            config.buffer_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'I':
+            config.buffer_per_irq = strtoul(optarg, NULL, 0);
+            break;
         case 'h':
             usage(argv[0]);
             return 0;
@@ -420,6 +403,9 @@ int main(int argc, char *argv[]) {
     dma_ctrl.loopback = external_loopback ? 0 : 1;
     dma_ctrl.use_reader = 1;
     dma_ctrl.use_writer = 1;
+    dma_ctrl.buffer_size = config.buffer_size;
+    dma_ctrl.buffer_count = config.buffer_count;
+    dma_ctrl.buffer_per_irq = config.buffer_per_irq;
     
     if (litepcie_dma_init(&dma_ctrl, device, zero_copy)) {
         fprintf(stderr, "Failed to initialize DMA\n");
@@ -429,6 +415,12 @@ int main(int argc, char *argv[]) {
     dma_ctrl.reader_enable = 1;
     dma_ctrl.writer_enable = 1;
     
+    if (litepcie_placement_init(&placement, device)) {
+        fprintf(stderr, "Failed to find usable CPUs\n");
+        litepcie_dma_cleanup(&dma_ctrl);
+        return 1;
+    }
+    
     /* Initialize statistics */
     gettimeofday(&stats.start_time, NULL);
     
@@ -455,6 +447,9 @@ int main(int argc, char *argv[]) {
            config.cpu_affinity ? "enabled" : "disabled",
            config.batch_process ? "enabled" : "disabled",
            config.verify_data ? "enabled" : "disabled");
+    if (config.cpu_affinity)
+        printf("NUMA node: %d, Writer CPU: %d, Reader CPU: %d\n", placement.node,
+               litepcie_placement_cpu(&placement, 0), litepcie_placement_cpu(&placement, 1));
     printf("Press Ctrl+C to stop.\n\n");
     
     if (pthread_create(&writer_thread, NULL, writer_thread_func, NULL) != 0) {
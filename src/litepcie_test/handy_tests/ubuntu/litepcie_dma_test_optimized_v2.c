@@ -5,6 +5,8 @@
  * - More frequent DMA processing for better TX throughput
  * - Reduced polling timeout
  * - Better buffer management
+ * - Multi-channel mode: one reader/writer/DMA thread set per /dev/litepcieX
+ * - Zero-copy: lock-free liblitepcie handoff and per-thread counters, no mutexes
  */
 
 #define _GNU_SOURCE
@@ -18,17 +20,21 @@
 #include <pthread.h>
 #include <errno.h>
 #include <sched.h>
+#include <ctype.h>
 #include <sys/time.h>
 
 #include "litepcie.h"
 #include "liblitepcie.h"
 #include "litepcie_dma.h"
+#include "litepcie_pattern.h"
+#include "litepcie_copy.h"
+#include "litepcie_numa.h"
 
 /* Buffer configuration */
-#define DMA_BUFFER_SIZE    8192
-#define DMA_BUFFER_COUNT   256
 #define BATCH_SIZE         16
 #define CACHE_LINE_SIZE    64
+#define MAX_CHANNELS       16
+#define MAX_CPUS           64
 
 /* Test patterns */
 #define PATTERN_SEQ        0
@@ -37,15 +43,26 @@
 #define PATTERN_ZEROS      3
 #define PATTERN_ALT        4
 
+/* Thread roles, in CPU list order */
+#define THREAD_DMA         0
+#define THREAD_WRITER      1
+#define THREAD_READER      2
+#define THREADS_PER_CHAN   3
+
 /* Global state */
 static volatile int keep_running = 1;
-static struct litepcie_dma_ctrl dma_ctrl;
-static pthread_t reader_thread, writer_thread, dma_thread;
-static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t dma_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t global_seed = 0;
+static struct timeval start_time;
+
+/* Statistics: written by a single thread, on its own cache line */
+typedef struct {
+    uint64_t bytes;
+    uint64_t buffers;
+    uint64_t errors;
+    uint64_t calls;
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_stats_t;
 
-/* Statistics */
+/* Channel statistics snapshot, for printing */
 typedef struct {
     uint64_t tx_bytes;
     uint64_t rx_bytes;
@@ -53,10 +70,24 @@ typedef struct {
     uint64_t rx_buffers;
     uint64_t errors;
     uint64_t dma_calls;
-    struct timeval start_time;
 } dma_stats_t;
 
-static dma_stats_t stats = {0};
+/* Per-channel state: each channel has its own DMA, lock and counters */
+typedef struct {
+    int index;
+    char device[64];
+    struct litepcie_dma_ctrl dma_ctrl;
+    struct litepcie_placement placement; /* CPUs and memory local to the device */
+    pthread_mutex_t dma_mutex;   /* copy mode only, zero-copy uses the lock-free handoff */
+    thread_stats_t dma_stats;
+    thread_stats_t tx_stats;
+    thread_stats_t rx_stats;
+} dma_channel_t;
+
+static dma_channel_t channels[MAX_CHANNELS];
+static int num_channels = 1;
+static pthread_t threads[MAX_CHANNELS * THREADS_PER_CHAN];
+static int num_threads = 0;
 
 /* Configuration */
 typedef struct {
@@ -66,6 +97,11 @@ typedef struct {
     int verbose;
     int cpu_affinity;
     int poll_interval_us;
+    uint32_t buffer_size;     /* 0: driver geometry */
+    uint32_t buffer_count;
+    uint32_t buffer_per_irq;
+    int cpus[MAX_CPUS];       /* -C list, consumed as dma,writer,reader per channel */
+    int num_cpus;
 } dma_config_t;
 
 static dma_config_t config = {
@@ -77,15 +113,6 @@ static dma_config_t config = {
     .poll_interval_us = 100  /* 100 microseconds instead of 100ms */
 };
 
-/* Memory prefetch hints */
-static inline void prefetch_read(const void *addr) {
-    __builtin_prefetch(addr, 0, 3);
-}
-
-static inline void prefetch_write(void *addr) {
-    __builtin_prefetch(addr, 1, 3);
-}
-
 /* Get current time in microseconds */
 static inline uint64_t get_time_us(void) {
     struct timeval tv;
@@ -93,6 +120,67 @@ static inline uint64_t get_time_us(void) {
     return tv.tv_sec * 1000000ULL + tv.tv_usec;
 }
 
+/* Single-writer counter update, read concurrently by print_stats() */
+static inline void stat_add(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stat_read(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Next TX/RX buffer: lock-free handoff in zero-copy mode, dma_mutex otherwise */
+static char *channel_next_write_buffer(dma_channel_t *ch) {
+    char *buf;
+
+    if (ch->dma_ctrl.handoff)
+        return litepcie_dma_tx_acquire(&ch->dma_ctrl);
+    pthread_mutex_lock(&ch->dma_mutex);
+    buf = litepcie_dma_next_write_buffer(&ch->dma_ctrl);
+    pthread_mutex_unlock(&ch->dma_mutex);
+    return buf;
+}
+
+static char *channel_next_read_buffer(dma_channel_t *ch) {
+    char *buf;
+
+    if (ch->dma_ctrl.handoff)
+        return litepcie_dma_rx_acquire(&ch->dma_ctrl);
+    pthread_mutex_lock(&ch->dma_mutex);
+    buf = litepcie_dma_next_read_buffer(&ch->dma_ctrl);
+    pthread_mutex_unlock(&ch->dma_mutex);
+    return buf;
+}
+
+/* CPU of a channel thread: from the -C list, else the 2,0,1 local CPUs of
+ * the channel's NUMA node, shifted by 3 per channel */
+static int channel_cpu(const dma_channel_t *ch, int role) {
+    static const int default_cpu[THREADS_PER_CHAN] = {2, 0, 1};
+
+    if (config.num_cpus > 0)
+        return config.cpus[(ch->index * THREADS_PER_CHAN + role) % config.num_cpus];
+    return litepcie_placement_cpu(&ch->placement, ch->index * THREADS_PER_CHAN + default_cpu[role]);
+}
+
+static void set_thread_affinity(int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+/* Channel device: /dev/litepcie0 with index 2 gives /dev/litepcie2 */
+static void channel_device_name(char *name, size_t len, const char *base, int index) {
+    size_t n = strlen(base);
+
+    while (n > 0 && isdigit((unsigned char)base[n - 1]))
+        n--;
+    if (n == strlen(base))
+        snprintf(name, len, index ? "%s%d" : "%s", base, index);
+    else
+        snprintf(name, len, "%.*s%d", (int)n, base, atoi(base + n) + index);
+}
+
 /* Generate test pattern */
 static void generate_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
     size_t i;
@@ -105,10 +193,7 @@ static void generate_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
         break;
         
     case PATTERN_RANDOM:
-        for (i = 0; i < count; i++) {
-            *seed = *seed * 69069 + 1;
-            buffer[i] = *seed;
-        }
+        litepcie_lcg_fill(buffer, count, seed);
         break;
         
     case PATTERN_ONES:
@@ -149,16 +234,18 @@ static int verify_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
         break;
         
     case PATTERN_RANDOM:
-        for (i = 0; i < count; i++) {
-            *seed = *seed * 69069 + 1;
-            expected = *seed;
-            if (buffer[i] != expected) {
-                if (config.verbose) {
+        expected = *seed;
+        errors = litepcie_lcg_check(buffer, count, seed);
+        /* Report the first mismatches from the scalar sequence */
+        if (errors && config.verbose) {
+            int reported = 0;
+            for (i = 0; i < count && reported <= 10; i++) {
+                expected = expected * 69069 + 1;
+                if (buffer[i] != expected) {
                     printf("Error at %zu: expected 0x%08x, got 0x%08x\n", 
                            i, expected, buffer[i]);
+                    reported++;
                 }
-                errors++;
-                if (errors > 10) break;
             }
         }
         break;
@@ -197,26 +284,29 @@ static int verify_pattern(uint32_t *buffer, size_t count, uint32_t *seed) {
 
 /* DMA processing thread - handles litepcie_dma_process calls */
 static void* dma_thread_func(void *arg) {
-    (void)arg;
+    dma_channel_t *ch = arg;
     
-    /* Set CPU affinity if requested */
+    /* Set CPU affinity if requested, and route the channel's MSIs to this
+     * thread's core since it is the one woken up by them. */
     if (config.cpu_affinity) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(2, &cpuset);  /* Use core 2 for DMA processing */
-        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        int cpu = channel_cpu(ch, THREAD_DMA);
+        set_thread_affinity(cpu);
+        if (litepcie_dma_set_irq_cpu(ch->dma_ctrl.fds.fd, cpu, cpu) && config.verbose)
+            fprintf(stderr, "%s: IRQ affinity not set: %s\n", ch->device, strerror(errno));
     }
     
     while (keep_running) {
-        pthread_mutex_lock(&dma_mutex);
-        litepcie_dma_process(&dma_ctrl);
-        pthread_mutex_unlock(&dma_mutex);
-        
-        pthread_mutex_lock(&stats_mutex);
-        stats.dma_calls++;
-        pthread_mutex_unlock(&stats_mutex);
+        /* handoff: litepcie_dma_process() waits in poll() itself, no lock, no sleep */
+        if (ch->dma_ctrl.handoff) {
+            litepcie_dma_process(&ch->dma_ctrl);
+        } else {
+            pthread_mutex_lock(&ch->dma_mutex);
+            litepcie_dma_process(&ch->dma_ctrl);
+            pthread_mutex_unlock(&ch->dma_mutex);
+            usleep(config.poll_interval_us);
+        }
         
-        usleep(config.poll_interval_us);
+        stat_add(&ch->dma_stats.calls, 1);
     }
     
     return NULL;
@@ -224,58 +314,38 @@ static void* dma_thread_func(void *arg) {
 
 /* Writer thread - generates and sends data */
 static void* writer_thread_func(void *arg) {
+    dma_channel_t *ch = arg;
+    struct litepcie_dma_ctrl *dma = &ch->dma_ctrl;
     uint32_t seed = global_seed;
-    int i;
     int consecutive_empty = 0;
-    (void)arg;
     
     /* Set CPU affinity if requested */
-    if (config.cpu_affinity) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(0, &cpuset);
-        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    }
+    if (config.cpu_affinity)
+        set_thread_affinity(channel_cpu(ch, THREAD_WRITER));
     
-    /* Pre-generate pattern buffer for efficiency */
-    uint32_t *pattern = malloc(DMA_BUFFER_SIZE);
+    /* Pre-generate pattern buffer for efficiency, on the device's node */
+    uint32_t *pattern = litepcie_placement_alloc(&ch->placement, dma->buffer_size);
     if (!pattern) {
         fprintf(stderr, "Failed to allocate pattern buffer\n");
         return NULL;
     }
-    generate_pattern(pattern, DMA_BUFFER_SIZE / sizeof(uint32_t), &seed);
+    generate_pattern(pattern, dma->buffer_size / sizeof(uint32_t), &seed);
     
     while (keep_running) {
-        pthread_mutex_lock(&dma_mutex);
-        char *buf = litepcie_dma_next_write_buffer(&dma_ctrl);
-        pthread_mutex_unlock(&dma_mutex);
+        char *buf = channel_next_write_buffer(ch);
         
         if (buf) {
             consecutive_empty = 0;
             
-            /* Copy pattern with prefetching */
-            if (config.data_width == 32) {
-                uint32_t *dst = (uint32_t*)buf;
-                uint32_t *src = pattern;
-                size_t words = DMA_BUFFER_SIZE / sizeof(uint32_t);
-                
-                for (i = 0; i < words; i += 16) {
-                    if (i + 64 < words) {
-                        prefetch_read(src + i + 64);
-                        prefetch_write(dst + i + 64);
-                    }
-                    memcpy(dst + i, src + i, 16 * sizeof(uint32_t));
-                }
-            } else {
-                /* Handle other data widths */
-                memcpy(buf, pattern, DMA_BUFFER_SIZE);
-            }
+            /* Streaming copy: the device reads the buffer, the CPU never does */
+            litepcie_copy(buf, pattern, dma->buffer_size);
+            
+            if (dma->handoff)
+                litepcie_dma_tx_release(dma);
             
             /* Update statistics */
-            pthread_mutex_lock(&stats_mutex);
-            stats.tx_bytes += DMA_BUFFER_SIZE;
-            stats.tx_buffers++;
-            pthread_mutex_unlock(&stats_mutex);
+            stat_add(&ch->tx_stats.bytes, dma->buffer_size);
+            stat_add(&ch->tx_stats.buffers, 1);
         } else {
             consecutive_empty++;
             /* If no buffers for a while, yield CPU */
@@ -285,28 +355,23 @@ static void* writer_thread_func(void *arg) {
         }
     }
     
-    free(pattern);
+    litepcie_placement_free(pattern, dma->buffer_size);
     return NULL;
 }
 
 /* Reader thread - receives and verifies data */
 static void* reader_thread_func(void *arg) {
+    dma_channel_t *ch = arg;
+    struct litepcie_dma_ctrl *dma = &ch->dma_ctrl;
     uint32_t seed = global_seed;
     int consecutive_empty = 0;
-    (void)arg;
     
     /* Set CPU affinity if requested */
-    if (config.cpu_affinity) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(1, &cpuset);
-        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    }
+    if (config.cpu_affinity)
+        set_thread_affinity(channel_cpu(ch, THREAD_READER));
     
     while (keep_running) {
-        pthread_mutex_lock(&dma_mutex);
-        char *buf = litepcie_dma_next_read_buffer(&dma_ctrl);
-        pthread_mutex_unlock(&dma_mutex);
+        char *buf = channel_next_read_buffer(ch);
         
         if (buf) {
             consecutive_empty = 0;
@@ -314,20 +379,18 @@ static void* reader_thread_func(void *arg) {
             /* Verify data if enabled */
             if (config.verify_data && config.pattern_type <= PATTERN_ALT) {
                 int errors = verify_pattern((uint32_t*)buf, 
-                                           DMA_BUFFER_SIZE / sizeof(uint32_t), 
+                                           dma->buffer_size / sizeof(uint32_t), 
                                            &seed);
-                if (errors > 0) {
-                    pthread_mutex_lock(&stats_mutex);
-                    stats.errors += errors;
-                    pthread_mutex_unlock(&stats_mutex);
-                }
+                if (errors > 0)
+                    stat_add(&ch->rx_stats.errors, errors);
             }
             
+            if (dma->handoff)
+                litepcie_dma_rx_release(dma);
+            
             /* Update statistics */
-            pthread_mutex_lock(&stats_mutex);
-            stats.rx_bytes += DMA_BUFFER_SIZE;
-            stats.rx_buffers++;
-            pthread_mutex_unlock(&stats_mutex);
+            stat_add(&ch->rx_stats.bytes, dma->buffer_size);
+            stat_add(&ch->rx_stats.buffers, 1);
         } else {
             consecutive_empty++;
             /* If no buffers for a while, yield CPU */
@@ -346,29 +409,65 @@ static void signal_handler(int sig) {
     keep_running = 0;
 }
 
-/* Print statistics */
-static void print_stats(void) {
+/* Print statistics: one line per channel plus the aggregate, redrawn in place */
+static void print_stats(int redraw) {
     uint64_t now = get_time_us();
     uint64_t elapsed_us;
     double elapsed_s;
-    double tx_gbps, rx_gbps;
-    
-    pthread_mutex_lock(&stats_mutex);
+    dma_stats_t snap[MAX_CHANNELS];
+    dma_stats_t total = {0};
+    int c;
     
-    elapsed_us = now - (stats.start_time.tv_sec * 1000000ULL + stats.start_time.tv_usec);
+    elapsed_us = now - (start_time.tv_sec * 1000000ULL + start_time.tv_usec);
     elapsed_s = elapsed_us / 1000000.0;
+    if (elapsed_s <= 0)
+        return;
+    
+    for (c = 0; c < num_channels; c++) {
+        snap[c].tx_bytes   = stat_read(&channels[c].tx_stats.bytes);
+        snap[c].rx_bytes   = stat_read(&channels[c].rx_stats.bytes);
+        snap[c].tx_buffers = stat_read(&channels[c].tx_stats.buffers);
+        snap[c].rx_buffers = stat_read(&channels[c].rx_stats.buffers);
+        snap[c].errors     = stat_read(&channels[c].rx_stats.errors);
+        snap[c].dma_calls  = stat_read(&channels[c].dma_stats.calls);
+        total.tx_bytes   += snap[c].tx_bytes;
+        total.rx_bytes   += snap[c].rx_bytes;
+        total.tx_buffers += snap[c].tx_buffers;
+        total.rx_buffers += snap[c].rx_buffers;
+        total.errors     += snap[c].errors;
+        total.dma_calls  += snap[c].dma_calls;
+    }
     
-    if (elapsed_s > 0) {
-        tx_gbps = (stats.tx_bytes * 8.0) / (elapsed_s * 1e9);
-        rx_gbps = (stats.rx_bytes * 8.0) / (elapsed_s * 1e9);
-        
+    if (num_channels == 1) {
         printf("\r[%6.2fs] TX: %8.3f Gbps (%lu buffers) | RX: %8.3f Gbps (%lu buffers) | Errors: %lu | DMA: %lu/s",
-               elapsed_s, tx_gbps, stats.tx_buffers, rx_gbps, stats.rx_buffers, stats.errors,
-               (uint64_t)(stats.dma_calls / elapsed_s));
+               elapsed_s, (total.tx_bytes * 8.0) / (elapsed_s * 1e9), total.tx_buffers,
+               (total.rx_bytes * 8.0) / (elapsed_s * 1e9), total.rx_buffers, total.errors,
+               (uint64_t)(total.dma_calls / elapsed_s));
         fflush(stdout);
+        return;
     }
     
-    pthread_mutex_unlock(&stats_mutex);
+    if (redraw)
+        printf("\033[%dA", num_channels + 1);
+    for (c = 0; c < num_channels; c++) {
+        printf("\r[%6.2fs] CH%-2d TX: %8.3f Gbps | RX: %8.3f Gbps | Errors: %lu | DMA: %lu/s\033[K\n",
+               elapsed_s, c,
+               (snap[c].tx_bytes * 8.0) / (elapsed_s * 1e9),
+               (snap[c].rx_bytes * 8.0) / (elapsed_s * 1e9),
+               snap[c].errors, (uint64_t)(snap[c].dma_calls / elapsed_s));
+    }
+    printf("\r[%6.2fs] ALL  TX: %8.3f Gbps | RX: %8.3f Gbps | Errors: %lu\033[K\n",
+           elapsed_s, (total.tx_bytes * 8.0) / (elapsed_s * 1e9),
+           (total.rx_bytes * 8.0) / (elapsed_s * 1e9), total.errors);
+    fflush(stdout);
+}
+
+/* Start a channel thread, tracked for the final join */
+static int start_thread(void *(*func)(void *), dma_channel_t *ch) {
+    if (pthread_create(&threads[num_threads], NULL, func, ch) != 0)
+        return -1;
+    num_threads++;
+    return 0;
 }
 
 /* Usage */
@@ -376,13 +475,19 @@ static void usage(const char *prog) {
     printf("Usage: %s [options]\n", prog);
     printf("Options:\n");
     printf("  -d <device>    Device file (default: /dev/litepcie0)\n");
+    printf("  -c <count>     Number of DMA channels: <device>, <device>+1, ... (default: 1)\n");
+    printf("  -C <cpus>      CPU list, e.g. 2,0,1,5,3,4: dma,writer,reader per channel\n");
+    printf("                 (default: CPUs of the device's NUMA node)\n");
     printf("  -p <pattern>   Pattern: 0=seq, 1=random, 2=ones, 3=zeros, 4=alt (default: 1)\n");
     printf("  -w <width>     Data width in bits (default: 32)\n");
     printf("  -l             Enable external loopback (default: internal)\n");
-    printf("  -z             Enable zero-copy mode\n");
+    printf("  -z             Enable zero-copy mode (lock-free buffer handoff)\n");
     printf("  -n             Disable data verification\n");
     printf("  -a             Disable CPU affinity\n");
-    printf("  -i <us>        DMA poll interval in microseconds (default: 100)\n");
+    printf("  -i <us>        DMA poll interval in microseconds, copy mode only (default: 100)\n");
+    printf("  -B <bytes>     DMA buffer size (default: driver setting)\n");
+    printf("  -N <count>     DMA buffer count, power of 2 (default: driver setting)\n");
+    printf("  -I <count>     DMA buffers per MSI (default: driver setting)\n");
     printf("  -v             Verbose output\n");
     printf("  -t <seconds>   Test duration (0 = infinite)\n");
     printf("  -h             Show this help\n");
@@ -393,15 +498,35 @@ int main(int argc, char *argv[]) {
     const char *device = "/dev/litepcie0";
     int opt;
     int duration = 0;
+    int c, ret = 0;
+    int initialized = 0;
     uint8_t zero_copy = 0;
     uint8_t external_loopback = 0;
+    char *cpu, *cpu_list;
     
     /* Parse options */
-    while ((opt = getopt(argc, argv, "d:p:w:lznai:vt:h")) != -1) {
+    while ((opt = getopt(argc, argv, "d:c:C:p:w:lznai:B:N:I:vt:h")) != -1) {
         switch (opt) {
         case 'd':
             device = optarg;
             break;
+        case 'c':
+            num_channels = atoi(optarg);
+            if (num_channels < 1 || num_channels > MAX_CHANNELS) {
+                fprintf(stderr, "Invalid channel count: %d\n", num_channels);
+                return 1;
+            }
+            break;
+        case 'C':
+            config.num_cpus = 0;
+            for (cpu_list = optarg; (cpu = strtok(cpu_list, ",")) != NULL; cpu_list = NULL) {
+                if (config.num_cpus == MAX_CPUS) {
+                    fprintf(stderr, "Too many CPUs (max %d)\n", MAX_CPUS);
+                    return 1;
+                }
+                config.cpus[config.num_cpus++] = atoi(cpu);
+            }
+            break;
         case 'p':
             config.pattern_type = atoi(optarg);
             if (config.pattern_type < 0 || config.pattern_type > 4) {
@@ -441,6 +566,15 @@ int main(int argc, char *argv[]) {
         case 't':
             duration = atoi(optarg);
             break;
+        case 'B':
+            config.buffer_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            config.buffer_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'I':
+            config.buffer_per_irq = strtoul(optarg, NULL, 0);
+            break;
         case 'h':
             usage(argv[0]);
             return 0;
@@ -454,25 +588,51 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    /* Initialize DMA */
-    printf("Initializing DMA with %s loopback...\n", 
-           external_loopback ? "external" : "internal");
-    
-    memset(&dma_ctrl, 0, sizeof(dma_ctrl));
-    dma_ctrl.loopback = external_loopback ? 0 : 1;
-    dma_ctrl.use_reader = 1;
-    dma_ctrl.use_writer = 1;
+    /* Initialize DMA, one litepcie_dma_ctrl per channel */
+    printf("Initializing %d DMA channel(s) with %s loopback...\n",
+           num_channels, external_loopback ? "external" : "internal");
     
-    if (litepcie_dma_init(&dma_ctrl, device, zero_copy)) {
-        fprintf(stderr, "Failed to initialize DMA\n");
-        return 1;
+    for (c = 0; c < num_channels; c++) {
+        dma_channel_t *ch = &channels[c];
+        
+        memset(ch, 0, sizeof(*ch));
+        ch->index = c;
+        channel_device_name(ch->device, sizeof(ch->device), device, c);
+        pthread_mutex_init(&ch->dma_mutex, NULL);
+        ch->dma_ctrl.loopback = external_loopback ? 0 : 1;
+        ch->dma_ctrl.use_reader = 1;
+        ch->dma_ctrl.use_writer = 1;
+        ch->dma_ctrl.buffer_size = config.buffer_size;
+        ch->dma_ctrl.buffer_count = config.buffer_count;
+        ch->dma_ctrl.buffer_per_irq = config.buffer_per_irq;
+        /* zero-copy: counters through the control page, buffers through the lock-free handoff */
+        ch->dma_ctrl.use_ctrl_page = zero_copy;
+        ch->dma_ctrl.handoff = zero_copy;
+        
+        if (litepcie_dma_init(&ch->dma_ctrl, ch->device, zero_copy)) {
+            fprintf(stderr, "Failed to initialize DMA on %s\n", ch->device);
+            ret = 1;
+            goto cleanup;
+        }
+        initialized++;
+        
+        if (litepcie_placement_init(&ch->placement, ch->device)) {
+            fprintf(stderr, "Failed to find usable CPUs for %s\n", ch->device);
+            ret = 1;
+            goto cleanup;
+        }
+        
+        ch->dma_ctrl.reader_enable = 1;
+        ch->dma_ctrl.writer_enable = 1;
+        
+        if (config.cpu_affinity)
+            printf("  %s: NUMA node %d, DMA on CPU %d, writer on CPU %d, reader on CPU %d\n",
+                   ch->device, ch->placement.node,
+                   channel_cpu(ch, THREAD_DMA), channel_cpu(ch, THREAD_WRITER), channel_cpu(ch, THREAD_READER));
     }
     
-    dma_ctrl.reader_enable = 1;
-    dma_ctrl.writer_enable = 1;
-    
     /* Initialize statistics */
-    gettimeofday(&stats.start_time, NULL);
+    gettimeofday(&start_time, NULL);
     
     /* Initialize global seed for pattern generation */
     global_seed = time(NULL);
@@ -499,35 +659,26 @@ int main(int argc, char *argv[]) {
            config.verify_data ? "enabled" : "disabled");
     printf("Press Ctrl+C to stop.\n\n");
     
-    /* Start DMA processing thread */
-    if (pthread_create(&dma_thread, NULL, dma_thread_func, NULL) != 0) {
-        fprintf(stderr, "Failed to create DMA thread\n");
-        goto cleanup;
-    }
-    
-    /* Start writer thread */
-    if (pthread_create(&writer_thread, NULL, writer_thread_func, NULL) != 0) {
-        fprintf(stderr, "Failed to create writer thread\n");
-        keep_running = 0;
-        pthread_join(dma_thread, NULL);
-        goto cleanup;
-    }
-    
-    /* Start reader thread */
-    if (pthread_create(&reader_thread, NULL, reader_thread_func, NULL) != 0) {
-        fprintf(stderr, "Failed to create reader thread\n");
-        keep_running = 0;
-        pthread_join(dma_thread, NULL);
-        pthread_join(writer_thread, NULL);
-        goto cleanup;
+    /* Start DMA processing, writer and reader threads of each channel */
+    for (c = 0; c < num_channels; c++) {
+        if (start_thread(dma_thread_func, &channels[c]) ||
+            start_thread(writer_thread_func, &channels[c]) ||
+            start_thread(reader_thread_func, &channels[c])) {
+            fprintf(stderr, "Failed to create threads for %s\n", channels[c].device);
+            keep_running = 0;
+            ret = 1;
+            break;
+        }
     }
     
     /* Monitor loop */
     uint64_t end_time = duration > 0 ? get_time_us() + duration * 1000000ULL : 0;
+    int redraw = 0;
     
     while (keep_running) {
         usleep(200000); /* 200ms update interval */
-        print_stats();
+        print_stats(redraw);
+        redraw = 1;
         
         if (duration > 0 && get_time_us() >= end_time) {
             keep_running = 0;
@@ -537,17 +688,17 @@ int main(int argc, char *argv[]) {
     printf("\n\nStopping test...\n");
     
     /* Wait for threads */
-    pthread_join(dma_thread, NULL);
-    pthread_join(writer_thread, NULL);
-    pthread_join(reader_thread, NULL);
+    for (c = 0; c < num_threads; c++)
+        pthread_join(threads[c], NULL);
     
     /* Final statistics */
-    print_stats();
+    print_stats(0);
     printf("\n");
     
 cleanup:
     /* Cleanup */
-    litepcie_dma_cleanup(&dma_ctrl);
+    for (c = 0; c < initialized; c++)
+        litepcie_dma_cleanup(&channels[c].dma_ctrl);
     
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
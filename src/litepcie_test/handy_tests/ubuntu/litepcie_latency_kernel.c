@@ -1,7 +1,8 @@
 /*
  * LitePCIe Kernel-Assisted Latency Test
  * 
- * Uses the kernel latency IOCTL for precise measurements.
+ * Uses the kernel latency IOCTLs for precise measurements: CSR scratch
+ * round-trip, then DMA loopback round-trip.
  */
 
 #include <stdio.h>
@@ -17,21 +18,23 @@
 
 /* Test kernel latency support */
 static int test_kernel_latency(int fd, int iterations) {
+    struct litepcie_ioctl_latency_ext ext;
     struct litepcie_ioctl_latency lat;
     int ret;
     
-    lat.iterations = iterations;
+    ext.lat.iterations = iterations;
     
-    ret = ioctl(fd, LITEPCIE_IOCTL_LATENCY_TEST, &lat);
+    ret = ioctl(fd, LITEPCIE_IOCTL_LATENCY_TEST_EXT, &ext);
     if (ret < 0) {
         if (errno == ENOTTY || errno == EINVAL) {
             printf("Kernel latency test not supported (IOCTL not found)\n");
             printf("Make sure you loaded the updated kernel module\n");
             return -1;
         }
-        perror("ioctl LATENCY_TEST");
+        perror("ioctl LATENCY_TEST_EXT");
         return -1;
     }
+    lat = ext.lat;
     
     printf("\nKernel Latency Test Results:\n");
     printf("  Iterations: %u\n", lat.iterations);
@@ -39,10 +42,53 @@ static int test_kernel_latency(int fd, int iterations) {
     printf("  Avg latency: %.3f µs (%.1f ns)\n", lat.avg_ns / 1000.0, (double)lat.avg_ns);
     printf("  Max latency: %.3f µs (%.1f ns)\n", lat.max_ns / 1000.0, (double)lat.max_ns);
     printf("  Total time:  %.3f ms\n", lat.total_ns / 1000000.0);
+    printf("  p50:    %10.3f µs\n", ext.p50_ns / 1000.0);
+    printf("  p99:    %10.3f µs\n", ext.p99_ns / 1000.0);
+    printf("  p99.9:  %10.3f µs\n", ext.p999_ns / 1000.0);
+    printf("  p99.99: %10.3f µs\n", ext.p9999_ns / 1000.0);
     
     return 0;
 }
 
+/* Test kernel DMA loopback latency support */
+static int test_kernel_dma_latency(int fd, int iterations) {
+    struct litepcie_ioctl_dma_latency *lat;
+    int ret;
+
+    lat = calloc(1, sizeof(*lat));
+    if (!lat) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+    lat->iterations = iterations;
+
+    ret = ioctl(fd, LITEPCIE_IOCTL_DMA_LATENCY_TEST, lat);
+    if (ret < 0) {
+        if (errno == ENOTTY) {
+            printf("Kernel DMA latency test not supported (IOCTL not found)\n");
+            printf("Make sure you loaded the updated kernel module\n");
+        } else if (errno == EBUSY) {
+            printf("Kernel DMA latency test: DMA channel in use\n");
+        } else {
+            perror("ioctl DMA_LATENCY_TEST");
+        }
+        free(lat);
+        return -1;
+    }
+
+    printf("\nKernel DMA Loopback Latency Test Results:\n");
+    printf("  Iterations: %u x %u bytes\n", lat->iterations, lat->buffer_size);
+    printf("  Min latency: %.3f µs\n", lat->min_ns / 1000.0);
+    printf("  Avg latency: %.3f µs\n", lat->avg_ns / 1000.0);
+    printf("  Max latency: %.3f µs\n", lat->max_ns / 1000.0);
+    litepcie_hist_print(stdout, &lat->hist);
+    printf("\n  Distribution:\n");
+    litepcie_hist_print_distribution(stdout, &lat->hist);
+
+    free(lat);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     const char *device = "/dev/litepcie0";
     int iterations = 10000;
@@ -70,6 +116,11 @@ int main(int argc, char *argv[]) {
         printf("\nKernel latency test failed.\n");
         printf("You can also use ./litepcie_latency_test for userspace measurements.\n");
     }
+
+    if (test_kernel_dma_latency(fd, iterations) < 0) {
+        printf("\nKernel DMA latency test failed.\n");
+        printf("You can also use ./litepcie_dma_latency_test for userspace measurements.\n");
+    }
     
     close(fd);
     return 0;
@@ -22,24 +22,22 @@
 
 #include "litepcie.h"
 #include "mem.h"
+#include "litepcie_hist.h"
+#include "litepcie_helpers.h"
 
 /* Test configuration */
 #define DEFAULT_ITERATIONS 10000
 #define WARMUP_ITERATIONS  1000
 #define SCRATCH_REGISTER   0x4  /* CSR_CTRL_SCRATCH_ADDR */
 
-/* Statistics structure */
-typedef struct {
-    double min;
-    double max;
-    double mean;
-    double stddev;
-    double p50;  /* median */
-    double p90;
-    double p95;
-    double p99;
-    double p999;
-} latency_stats_t;
+/* Register access paths */
+#define ACCESS_IOCTL 0 /* one LITEPCIE_IOCTL_REG per access */
+#define ACCESS_BATCH 1 /* write + read in one LITEPCIE_IOCTL_REG_BATCH */
+#define ACCESS_MMAP  2 /* loads/stores on BAR0 mapped read-write */
+
+static const char *access_names[] = { "ioctl", "batch", "mmap" };
+static int access_mode = -1; /* default: mmap if permitted, else batch */
+static struct litepcie_reg_batch batch;
 
 /* Global state */
 static volatile int keep_running = 1;
@@ -83,6 +81,21 @@ static void reg_write(int fd, uint32_t addr, uint32_t val) {
     }
 }
 
+/* Write + readback in one syscall */
+static uint32_t reg_write_read(int fd, uint32_t addr, uint32_t val) {
+    uint32_t index;
+
+    litepcie_reg_batch_init(&batch);
+    litepcie_reg_batch_write(&batch, addr, val);
+    index = litepcie_reg_batch_read(&batch, addr);
+    if (litepcie_reg_batch_run(fd, &batch) < 0) {
+        perror("ioctl batch");
+        return 0;
+    }
+
+    return batch.ops[index].val;
+}
+
 /* Measure single round-trip latency */
 static uint64_t measure_latency(int fd, uint32_t test_value) {
     uint64_t start, end;
@@ -90,11 +103,18 @@ static uint64_t measure_latency(int fd, uint32_t test_value) {
 
     start = get_time_ns();
 
-    /* Write to scratch register */
-    reg_write(fd, SCRATCH_REGISTER, test_value);
-
-    /* Read back to ensure completion */
-    readback = reg_read(fd, SCRATCH_REGISTER);
+    if (access_mode == ACCESS_BATCH) {
+        readback = reg_write_read(fd, SCRATCH_REGISTER, test_value);
+    } else if (access_mode == ACCESS_MMAP) {
+        litepcie_writel(fd, SCRATCH_REGISTER, test_value);
+        readback = litepcie_readl(fd, SCRATCH_REGISTER);
+    } else {
+        /* Write to scratch register */
+        reg_write(fd, SCRATCH_REGISTER, test_value);
+
+        /* Read back to ensure completion */
+        readback = reg_read(fd, SCRATCH_REGISTER);
+    }
 
     end = get_time_ns();
 
@@ -107,55 +127,21 @@ static uint64_t measure_latency(int fd, uint32_t test_value) {
     return end - start;
 }
 
-/* Compare function for qsort */
-static int compare_uint64(const void *a, const void *b) {
-    uint64_t ua = *(const uint64_t*)a;
-    uint64_t ub = *(const uint64_t*)b;
-    return (ua > ub) - (ua < ub);
-}
-
-/* Calculate statistics from latency measurements */
-static void calculate_stats(uint64_t *latencies, int count, latency_stats_t *stats) {
-    double sum = 0, sum_sq = 0;
-    int i;
-
-    /* Sort for percentiles */
-    qsort(latencies, count, sizeof(uint64_t), compare_uint64);
-
-    /* Calculate basic stats */
-    stats->min = latencies[0] / 1000.0;  /* Convert to microseconds */
-    stats->max = latencies[count-1] / 1000.0;
-
-    for (i = 0; i < count; i++) {
-        double val = latencies[i] / 1000.0;
-        sum += val;
-        sum_sq += val * val;
-    }
-
-    stats->mean = sum / count;
-    stats->stddev = sqrt((sum_sq / count) - (stats->mean * stats->mean));
-
-    /* Calculate percentiles */
-    stats->p50 = latencies[count * 50 / 100] / 1000.0;
-    stats->p90 = latencies[count * 90 / 100] / 1000.0;
-    stats->p95 = latencies[count * 95 / 100] / 1000.0;
-    stats->p99 = latencies[count * 99 / 100] / 1000.0;
-    stats->p999 = latencies[count * 999 / 1000] / 1000.0;
-}
+/* Print statistics. sum_sq_us is the sum of squared samples in us^2, the
+ * histogram does not keep it. */
+static void print_stats(const struct litepcie_hist *hist, double sum_sq_us) {
+    double mean = litepcie_hist_mean_ns(hist) / 1000.0;
+    double var = sum_sq_us / hist->count - mean * mean;
 
-/* Print statistics */
-static void print_stats(latency_stats_t *stats) {
     printf("\nLatency Statistics (microseconds):\n");
-    printf("  Min:    %8.3f µs\n", stats->min);
-    printf("  Max:    %8.3f µs\n", stats->max);
-    printf("  Mean:   %8.3f µs\n", stats->mean);
-    printf("  StdDev: %8.3f µs\n", stats->stddev);
+    printf("  Min:    %10.3f us\n", hist->min_ns / 1000.0);
+    printf("  Max:    %10.3f us\n", hist->max_ns / 1000.0);
+    printf("  Mean:   %10.3f us\n", mean);
+    printf("  StdDev: %10.3f us\n", var > 0 ? sqrt(var) : 0.0);
     printf("\nPercentiles:\n");
-    printf("  50%%:    %8.3f µs (median)\n", stats->p50);
-    printf("  90%%:    %8.3f µs\n", stats->p90);
-    printf("  95%%:    %8.3f µs\n", stats->p95);
-    printf("  99%%:    %8.3f µs\n", stats->p99);
-    printf("  99.9%%:  %8.3f µs\n", stats->p999);
+    litepcie_hist_print(stdout, hist);
+    printf("\nLatency Distribution:\n");
+    litepcie_hist_print_distribution(stdout, hist);
 }
 
 /* Usage */
@@ -167,6 +153,8 @@ static void usage(const char *prog) {
     printf("  -w <count>     Warmup iterations (default: %d)\n", WARMUP_ITERATIONS);
     printf("  -c <cpu>       Pin to CPU core (default: no pinning)\n");
     printf("  -p             Use high priority scheduling\n");
+    printf("  -m <mode>      Register access: ioctl, batch or mmap (default: mmap if\n");
+    printf("                 permitted, needs CAP_SYS_RAWIO, else batch)\n");
     printf("  -v             Verbose output\n");
     printf("  -h             Show this help\n");
 }
@@ -180,12 +168,12 @@ int main(int argc, char *argv[]) {
     int high_priority = 0;
     int verbose = 0;
     int opt, fd;
-    uint64_t *latencies;
-    latency_stats_t stats;
+    static struct litepcie_hist hist;
+    double sum_sq_us = 0;
     int i;
 
     /* Parse options */
-    while ((opt = getopt(argc, argv, "d:n:w:c:pvh")) != -1) {
+    while ((opt = getopt(argc, argv, "d:n:w:c:pm:vh")) != -1) {
         switch (opt) {
         case 'd':
             device = optarg;
@@ -206,6 +194,16 @@ int main(int argc, char *argv[]) {
         case 'p':
             high_priority = 1;
             break;
+        case 'm':
+            for (access_mode = ACCESS_MMAP; access_mode >= 0; access_mode--) {
+                if (strcmp(optarg, access_names[access_mode]) == 0)
+                    break;
+            }
+            if (access_mode < 0) {
+                fprintf(stderr, "Invalid access mode: %s\n", optarg);
+                return 1;
+            }
+            break;
         case 'v':
             verbose = 1;
             break;
@@ -254,16 +252,25 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    /* Allocate measurement buffer */
-    latencies = malloc(iterations * sizeof(uint64_t));
-    if (!latencies) {
-        fprintf(stderr, "Failed to allocate memory\n");
-        close(fd);
-        return 1;
+    litepcie_hist_reset(&hist);
+
+    /* Register access path */
+    if (access_mode < 0 || access_mode == ACCESS_MMAP) {
+        if (litepcie_reg_mmap(fd) == 1) {
+            access_mode = ACCESS_MMAP;
+        } else if (access_mode == ACCESS_MMAP) {
+            fprintf(stderr, "Failed to map BAR0 read-write (needs CAP_SYS_RAWIO)\n");
+            close(fd);
+            return 1;
+        } else {
+            litepcie_reg_munmap(fd);
+            access_mode = ACCESS_BATCH;
+        }
     }
 
     printf("LitePCIe Round-Trip Latency Test\n");
     printf("Device: %s\n", device);
+    printf("Access: %s\n", access_names[access_mode]);
     printf("Iterations: %d (after %d warmup)\n", iterations, warmup);
     printf("Measuring latency using scratch register at 0x%08x\n\n", SCRATCH_REGISTER);
 
@@ -283,7 +290,10 @@ int main(int argc, char *argv[]) {
 
     for (i = 0; i < iterations && keep_running; i++) {
         uint32_t test_value = 0xcafebabe ^ i;  /* Varying test pattern */
-        latencies[i] = measure_latency(fd, test_value);
+        uint64_t latency = measure_latency(fd, test_value);
+
+        litepcie_hist_record(&hist, latency);
+        sum_sq_us += (latency / 1000.0) * (latency / 1000.0);
 
         if (verbose && (i % 1000 == 0)) {
             printf("\r  Progress: %d/%d (%.1f%%)",
@@ -299,18 +309,23 @@ int main(int argc, char *argv[]) {
 
     /* Calculate and print statistics */
     if (i > 0) {
-        calculate_stats(latencies, i, &stats);
-        print_stats(&stats);
+        double min_us = hist.min_ns / 1000.0;
+
+        print_stats(&hist, sum_sq_us);
 
         /* Additional analysis */
         printf("\nAnalysis:\n");
         printf("  Total measurements: %d\n", i);
-        printf("  Approximate overhead: ~%.1f µs per syscall\n", stats.min / 2);
-        printf("  Estimated PCIe RTT: ~%.1f µs\n", stats.min - (stats.min / 2));
+        if (access_mode == ACCESS_MMAP) {
+            printf("  Estimated PCIe RTT: ~%.1f µs (no syscall)\n", min_us);
+        } else {
+            printf("  Approximate overhead: ~%.1f µs per syscall\n", min_us / 2);
+            printf("  Estimated PCIe RTT: ~%.1f µs\n", min_us - (min_us / 2));
+        }
     }
 
     /* Cleanup */
-    free(latencies);
+    litepcie_reg_munmap(fd);
     close(fd);
 
     return 0;
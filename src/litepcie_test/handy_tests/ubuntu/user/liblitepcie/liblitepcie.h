@@ -18,6 +18,10 @@ extern "C" {
 #include "litepcie_dma.h"
 #include "litepcie_flash.h"
 #include "litepcie_helpers.h"
+#include "litepcie_pattern.h"
+#include "litepcie_copy.h"
+#include "litepcie_numa.h"
+#include "litepcie_multi.h"
 #include "litepcie.h"
 
 #ifdef __cplusplus
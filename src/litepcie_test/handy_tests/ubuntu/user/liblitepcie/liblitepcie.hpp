@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef LITEPCIE_LIB_HPP
+#define LITEPCIE_LIB_HPP
+
+/* Header-only C++20 layer over liblitepcie: move-only owners with
+ * deterministic cleanup, and rings whose geometry is a template parameter so
+ * slot/offset math folds to masks and shifts.
+ *
+ *   using Ring8k = litepcie::Geometry<8192, 256>;
+ *   litepcie::Channel<Ring8k> ch("/dev/litepcie0", {.rx = true, .tx = true, .loopback = true});
+ *   ch.start();
+ *   for (;;) {
+ *       ch.process();
+ *       auto rx = ch.rx();
+ *       for (auto words : rx.as<uint32_t>())  // std::span<const uint32_t, 2048>
+ *           check(words);
+ *       ch.release_rx(rx.size());
+ *   }
+ *
+ * Buffers are zero-copy views of the mmapped rings, valid until released.
+ * Errors in constructors throw std::system_error; the hot calls never throw. */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include "liblitepcie.h"
+
+namespace litepcie {
+
+[[noreturn]] inline void throw_errno(int err, const char *what)
+{
+    throw std::system_error(err ? err : EIO, std::generic_category(), what);
+}
+
+/* Ring geometry, fixed at compile time (the driver is asked for it at open). */
+template <uint32_t BufferSize, uint32_t BufferCount>
+struct Geometry {
+    static_assert(BufferCount > 0 && (BufferCount & (BufferCount - 1)) == 0,
+                  "buffer count must be a power of two");
+    static_assert(BufferCount <= LITEPCIE_DMA_TS_COUNT, "buffer count above the DMA table depth");
+    static_assert(BufferSize > 0 && BufferSize % 4096 == 0, "buffer size must be a multiple of the page size");
+    static_assert(BufferSize < (1u << 24), "buffer size must fit the 24-bit descriptor length");
+
+    static constexpr uint32_t buffer_size = BufferSize;
+    static constexpr uint32_t buffer_count = BufferCount;
+    static constexpr uint32_t mask = BufferCount - 1;
+    static constexpr std::size_t total_size = std::size_t(BufferSize) * BufferCount;
+
+    template <class T>
+    static constexpr std::size_t words = BufferSize / sizeof(T);
+
+    /* Ring slot and byte offset of a buffer count (sw_count, hw_count). */
+    static constexpr uint32_t slot(int64_t count) { return static_cast<uint32_t>(count) & mask; }
+    static constexpr std::size_t offset(int64_t count) { return std::size_t(slot(count)) * BufferSize; }
+};
+
+/* Device file for register access (CSRs, BAR0 mapping). */
+class Device {
+public:
+    explicit Device(const char *path) : fd_(::open(path, O_RDWR | O_CLOEXEC))
+    {
+        if (fd_ < 0)
+            throw_errno(errno, path);
+    }
+    ~Device() { reset(); }
+
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+    Device(Device &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+    Device &operator=(Device &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            fd_ = std::exchange(other.fd_, -1);
+        }
+        return *this;
+    }
+
+    int fd() const { return fd_; }
+    uint32_t readl(uint32_t addr) const { return litepcie_readl(fd_, addr); }
+    void writel(uint32_t addr, uint32_t val) const { litepcie_writel(fd_, addr, val); }
+    /* See litepcie_reg_mmap(): 1 writable, 0 read-only, -1 not mapped. */
+    int map_registers() const { return litepcie_reg_mmap(fd_); }
+
+private:
+    void reset()
+    {
+        if (fd_ < 0)
+            return;
+        litepcie_reg_munmap(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    int fd_;
+};
+
+/* The buffers of one ring between two buffer counts, in ring order. Element
+ * i is std::span<std::byte, buffer_size> (const on RX); as<T>() gives typed
+ * views of the same buffers for verification kernels. */
+template <class G, class T>
+class Ring {
+public:
+    using buffer_base = std::conditional_t<std::is_const_v<T>, const char, char>;
+    using value_type = std::span<T, G::template words<std::remove_const_t<T>>>;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Ring::value_type;
+        using reference = value_type;
+        using pointer = void;
+
+        iterator() = default;
+        iterator(buffer_base *base, int64_t count) : base_(base), count_(count) {}
+
+        value_type operator*() const { return Ring::view(base_, count_); }
+        iterator &operator++() { ++count_; return *this; }
+        iterator operator++(int) { iterator it = *this; ++count_; return it; }
+        bool operator==(const iterator &other) const { return count_ == other.count_; }
+        /* buffer count (sw_count) of the current buffer */
+        int64_t count() const { return count_; }
+
+    private:
+        buffer_base *base_ = nullptr;
+        int64_t count_ = 0;
+    };
+
+    Ring() = default;
+    Ring(buffer_base *base, int64_t begin, int64_t end) : base_(base), begin_(begin), end_(end) {}
+
+    iterator begin() const { return iterator(base_, begin_); }
+    iterator end() const { return iterator(base_, end_); }
+    std::size_t size() const { return static_cast<std::size_t>(end_ - begin_); }
+    bool empty() const { return end_ == begin_; }
+    value_type operator[](std::size_t i) const { return view(base_, begin_ + int64_t(i)); }
+    int64_t first_count() const { return begin_; }
+
+    /* Same buffers as spans of U (const on RX). */
+    template <class U>
+    Ring<G, std::conditional_t<std::is_const_v<T>, const U, U>> as() const
+    {
+        static_assert(G::buffer_size % sizeof(U) == 0, "buffer size is not a multiple of the element");
+        return {base_, begin_, end_};
+    }
+
+private:
+    static value_type view(buffer_base *base, int64_t count)
+    {
+        return value_type(reinterpret_cast<T *>(base + G::offset(count)), value_type::extent);
+    }
+
+    buffer_base *base_ = nullptr;
+    int64_t begin_ = 0, end_ = 0;
+};
+
+struct ChannelConfig {
+    bool rx = true;             /* DMA writer: FPGA -> host */
+    bool tx = false;            /* DMA reader: host -> FPGA */
+    bool loopback = false;
+    uint32_t buffer_per_irq = 0; /* 0 keeps the driver's */
+    bool busy_poll = false;     /* spin on LOOP_STATUS, DMA MSIs off */
+};
+
+/* One DMA channel in zero-copy batch mode: process() collects the ready
+ * buffers, rx()/tx() expose them, release_rx()/submit_tx() hand them back. */
+template <class G>
+class Channel {
+public:
+    using geometry = G;
+    using rx_ring = Ring<G, const std::byte>;
+    using tx_ring = Ring<G, std::byte>;
+
+    explicit Channel(const char *path, const ChannelConfig &config = {}) : dma_{}
+    {
+        dma_.use_writer = config.rx;
+        dma_.use_reader = config.tx;
+        dma_.loopback = config.loopback;
+        dma_.buffer_size = G::buffer_size;
+        dma_.buffer_count = G::buffer_count;
+        dma_.buffer_per_irq = config.buffer_per_irq;
+        dma_.busy_poll = config.busy_poll;
+        dma_.use_ctrl_page = !config.busy_poll;
+        dma_.batch_commit = 1;
+        /* failed inits leave nothing open or mapped */
+        if (litepcie_dma_init(&dma_, path, 1))
+            throw_errno(errno, path);
+        open_ = true;
+        if (dma_.buffer_size != G::buffer_size || dma_.buffer_count != G::buffer_count) {
+            reset();
+            throw_errno(EINVAL, "DMA ring geometry refused by the driver");
+        }
+    }
+    ~Channel() { reset(); }
+
+    Channel(const Channel &) = delete;
+    Channel &operator=(const Channel &) = delete;
+    /* the C state holds no pointers to itself: moving is a copy plus disowning the source */
+    Channel(Channel &&other) noexcept : dma_(other.dma_), open_(std::exchange(other.open_, false)) {}
+    Channel &operator=(Channel &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            dma_ = other.dma_;
+            open_ = std::exchange(other.open_, false);
+        }
+        return *this;
+    }
+
+    /* Enables apply at the next process(). */
+    void start() { enable(1); }
+    void pause() { enable(LITEPCIE_DMA_PAUSE); }
+    void stop() { enable(0); }
+
+    void process() { litepcie_dma_process(&dma_); }
+
+    /* Ready buffers since the last process(), minus those released since. */
+    rx_ring rx() const
+    {
+        return {dma_.buf_rd, dma_.writer_sw_count, dma_.writer_sw_count + dma_.buffers_available_read};
+    }
+    tx_ring tx() const
+    {
+        return {dma_.buf_wr, dma_.reader_sw_count, dma_.reader_sw_count + dma_.buffers_available_write};
+    }
+    void release_rx(std::size_t count) { litepcie_dma_read_commit(&dma_, static_cast<unsigned>(count)); }
+    void submit_tx(std::size_t count) { litepcie_dma_write_commit(&dma_, static_cast<unsigned>(count)); }
+
+    int fd() const { return dma_.fds.fd; }
+    /* The C state, for the calls not wrapped here. */
+    struct litepcie_dma_ctrl &dma() { return dma_; }
+    const struct litepcie_dma_ctrl &dma() const { return dma_; }
+
+private:
+    void enable(uint8_t value)
+    {
+        dma_.writer_enable = dma_.use_writer ? value : 0;
+        dma_.reader_enable = dma_.use_reader ? value : 0;
+    }
+
+    void reset()
+    {
+        if (!open_)
+            return;
+        litepcie_dma_cleanup(&dma_);
+        open_ = false;
+    }
+
+    struct litepcie_dma_ctrl dma_;
+    bool open_ = false;
+};
+
+} // namespace litepcie
+
+#endif /* LITEPCIE_LIB_HPP */
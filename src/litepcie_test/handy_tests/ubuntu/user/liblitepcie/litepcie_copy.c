@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "litepcie_copy.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LITEPCIE_COPY_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define LITEPCIE_COPY_NEON
+#include <arm_neon.h>
+#endif
+
+enum {
+    COPY_ISA_SCALAR,
+    COPY_ISA_SSE2,
+    COPY_ISA_AVX2,
+    COPY_ISA_AVX512,
+    COPY_ISA_NEON,
+};
+
+static size_t copy_nt_threshold = LITEPCIE_COPY_NT_THRESHOLD_DEFAULT;
+
+/* Bytes to store normally before dst is aligned for the streaming stores. */
+static inline size_t copy_head(const void *dst, size_t align, size_t size)
+{
+    size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+
+    return head < size ? head : size;
+}
+
+#ifdef LITEPCIE_COPY_X86
+
+/* SSE2: 16 bytes per store, 64 per step */
+/*-------------------------------------*/
+
+static void copy_sse2(char *dst, const char *src, size_t size)
+{
+    size_t i, head = copy_head(dst, 16, size);
+
+    memcpy(dst, src, head);
+    for (i = head; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        _mm_stream_si128((__m128i *)(dst + i), a);
+        _mm_stream_si128((__m128i *)(dst + i + 16), b);
+        _mm_stream_si128((__m128i *)(dst + i + 32), c);
+        _mm_stream_si128((__m128i *)(dst + i + 48), d);
+    }
+    memcpy(dst + i, src + i, size - i);
+    _mm_sfence();
+}
+
+static void fill_sse2(char *dst, uint8_t value, size_t size)
+{
+    const __m128i v = _mm_set1_epi8((char)value);
+    size_t i, head = copy_head(dst, 16, size);
+
+    memset(dst, value, head);
+    for (i = head; i + 64 <= size; i += 64) {
+        _mm_stream_si128((__m128i *)(dst + i), v);
+        _mm_stream_si128((__m128i *)(dst + i + 16), v);
+        _mm_stream_si128((__m128i *)(dst + i + 32), v);
+        _mm_stream_si128((__m128i *)(dst + i + 48), v);
+    }
+    memset(dst + i, value, size - i);
+    _mm_sfence();
+}
+
+/* AVX2: 32 bytes per store, 128 per step */
+/*--------------------------------------*/
+
+__attribute__((target("avx2")))
+static void copy_avx2(char *dst, const char *src, size_t size)
+{
+    size_t i, head = copy_head(dst, 32, size);
+
+    memcpy(dst, src, head);
+    for (i = head; i + 128 <= size; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 96));
+        _mm256_stream_si256((__m256i *)(dst + i), a);
+        _mm256_stream_si256((__m256i *)(dst + i + 32), b);
+        _mm256_stream_si256((__m256i *)(dst + i + 64), c);
+        _mm256_stream_si256((__m256i *)(dst + i + 96), d);
+    }
+    memcpy(dst + i, src + i, size - i);
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(char *dst, uint8_t value, size_t size)
+{
+    const __m256i v = _mm256_set1_epi8((char)value);
+    size_t i, head = copy_head(dst, 32, size);
+
+    memset(dst, value, head);
+    for (i = head; i + 128 <= size; i += 128) {
+        _mm256_stream_si256((__m256i *)(dst + i), v);
+        _mm256_stream_si256((__m256i *)(dst + i + 32), v);
+        _mm256_stream_si256((__m256i *)(dst + i + 64), v);
+        _mm256_stream_si256((__m256i *)(dst + i + 96), v);
+    }
+    memset(dst + i, value, size - i);
+    _mm_sfence();
+}
+
+/* AVX-512: one cache line per store, 256 bytes per step */
+/*-----------------------------------------------------*/
+
+__attribute__((target("avx512f")))
+static void copy_avx512(char *dst, const char *src, size_t size)
+{
+    size_t i, head = copy_head(dst, 64, size);
+
+    memcpy(dst, src, head);
+    for (i = head; i + 256 <= size; i += 256) {
+        __m512i a = _mm512_loadu_si512(src + i);
+        __m512i b = _mm512_loadu_si512(src + i + 64);
+        __m512i c = _mm512_loadu_si512(src + i + 128);
+        __m512i d = _mm512_loadu_si512(src + i + 192);
+        _mm512_stream_si512((void *)(dst + i), a);
+        _mm512_stream_si512((void *)(dst + i + 64), b);
+        _mm512_stream_si512((void *)(dst + i + 128), c);
+        _mm512_stream_si512((void *)(dst + i + 192), d);
+    }
+    memcpy(dst + i, src + i, size - i);
+    _mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+static void fill_avx512(char *dst, uint8_t value, size_t size)
+{
+    const __m512i v = _mm512_set1_epi32(value * 0x01010101u);
+    size_t i, head = copy_head(dst, 64, size);
+
+    memset(dst, value, head);
+    for (i = head; i + 256 <= size; i += 256) {
+        _mm512_stream_si512((void *)(dst + i), v);
+        _mm512_stream_si512((void *)(dst + i + 64), v);
+        _mm512_stream_si512((void *)(dst + i + 128), v);
+        _mm512_stream_si512((void *)(dst + i + 192), v);
+    }
+    memset(dst + i, value, size - i);
+    _mm_sfence();
+}
+
+#endif /* LITEPCIE_COPY_X86 */
+
+#ifdef LITEPCIE_COPY_NEON
+
+/* NEON: STNP pairs of q registers, 64 bytes per step */
+/*--------------------------------------------------*/
+
+static inline void stnp_64(char *dst, uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d)
+{
+    __asm__ volatile("stnp %q1, %q2, [%0]\n\t"
+                     "stnp %q3, %q4, [%0, #32]"
+                     : : "r"(dst), "w"(a), "w"(b), "w"(c), "w"(d) : "memory");
+}
+
+static void copy_neon(char *dst, const char *src, size_t size)
+{
+    size_t i, head = copy_head(dst, 16, size);
+
+    memcpy(dst, src, head);
+    for (i = head; i + 64 <= size; i += 64)
+        stnp_64(dst + i,
+                vld1q_u8((const uint8_t *)(src + i)),      vld1q_u8((const uint8_t *)(src + i + 16)),
+                vld1q_u8((const uint8_t *)(src + i + 32)), vld1q_u8((const uint8_t *)(src + i + 48)));
+    memcpy(dst + i, src + i, size - i);
+    __asm__ volatile("dmb ishst" : : : "memory");
+}
+
+static void fill_neon(char *dst, uint8_t value, size_t size)
+{
+    const uint8x16_t v = vdupq_n_u8(value);
+    size_t i, head = copy_head(dst, 16, size);
+
+    memset(dst, value, head);
+    for (i = head; i + 64 <= size; i += 64)
+        stnp_64(dst + i, v, v, v, v);
+    memset(dst + i, value, size - i);
+    __asm__ volatile("dmb ishst" : : : "memory");
+}
+
+#endif /* LITEPCIE_COPY_NEON */
+
+/* Dispatch */
+/*----------*/
+
+static int copy_isa = -1;
+
+static int litepcie_copy_level(void)
+{
+    int isa = __atomic_load_n(&copy_isa, __ATOMIC_RELAXED);
+
+    if (isa >= 0)
+        return isa;
+    isa = COPY_ISA_SCALAR;
+#if defined(LITEPCIE_COPY_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        isa = COPY_ISA_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+        isa = COPY_ISA_AVX2;
+    else
+        isa = COPY_ISA_SSE2;
+#elif defined(LITEPCIE_COPY_NEON)
+    isa = COPY_ISA_NEON;
+#endif
+    __atomic_store_n(&copy_isa, isa, __ATOMIC_RELAXED);
+    return isa;
+}
+
+const char *litepcie_copy_isa(void)
+{
+    switch (litepcie_copy_level()) {
+    case COPY_ISA_AVX512:
+        return "avx512";
+    case COPY_ISA_AVX2:
+        return "avx2";
+    case COPY_ISA_SSE2:
+        return "sse2";
+    case COPY_ISA_NEON:
+        return "neon";
+    default:
+        return "scalar";
+    }
+}
+
+void litepcie_copy_set_nt_threshold(size_t size)
+{
+    __atomic_store_n(&copy_nt_threshold, size, __ATOMIC_RELAXED);
+}
+
+size_t litepcie_copy_nt_threshold(void)
+{
+    return __atomic_load_n(&copy_nt_threshold, __ATOMIC_RELAXED);
+}
+
+void litepcie_copy(void *dst, const void *src, size_t size)
+{
+    if (size >= litepcie_copy_nt_threshold()) {
+        switch (litepcie_copy_level()) {
+#ifdef LITEPCIE_COPY_X86
+        case COPY_ISA_AVX512:
+            copy_avx512(dst, src, size);
+            return;
+        case COPY_ISA_AVX2:
+            copy_avx2(dst, src, size);
+            return;
+        case COPY_ISA_SSE2:
+            copy_sse2(dst, src, size);
+            return;
+#endif
+#ifdef LITEPCIE_COPY_NEON
+        case COPY_ISA_NEON:
+            copy_neon(dst, src, size);
+            return;
+#endif
+        }
+    }
+    memcpy(dst, src, size);
+}
+
+void litepcie_fill(void *dst, uint8_t value, size_t size)
+{
+    if (size >= litepcie_copy_nt_threshold()) {
+        switch (litepcie_copy_level()) {
+#ifdef LITEPCIE_COPY_X86
+        case COPY_ISA_AVX512:
+            fill_avx512(dst, value, size);
+            return;
+        case COPY_ISA_AVX2:
+            fill_avx2(dst, value, size);
+            return;
+        case COPY_ISA_SSE2:
+            fill_sse2(dst, value, size);
+            return;
+#endif
+#ifdef LITEPCIE_COPY_NEON
+        case COPY_ISA_NEON:
+            fill_neon(dst, value, size);
+            return;
+#endif
+        }
+    }
+    memset(dst, value, size);
+}
+
+void litepcie_clear(void *dst, size_t size)
+{
+    litepcie_fill(dst, 0, size);
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef LITEPCIE_LIB_COPY_H
+#define LITEPCIE_LIB_COPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Copy/fill/clear of DMA buffers. From the non-temporal threshold up, the
+ * stores stream past the caches (AVX-512/AVX2/SSE2 or NEON, picked at run
+ * time), so that filling TX buffers the device reads anyway does not evict
+ * the consumer's working set. Smaller sizes use memcpy()/memset(). The data
+ * is ordered before any later store (e.g. the sw_count commit) on return. */
+
+#define LITEPCIE_COPY_NT_THRESHOLD_DEFAULT 4096
+
+void litepcie_copy(void *dst, const void *src, size_t size);
+void litepcie_fill(void *dst, uint8_t value, size_t size);
+void litepcie_clear(void *dst, size_t size);
+
+/* Smallest size using non-temporal stores: 0 always, SIZE_MAX never. */
+void litepcie_copy_set_nt_threshold(size_t size);
+size_t litepcie_copy_nt_threshold(void);
+
+/* "avx512", "avx2", "sse2", "neon" or "scalar": the stores used from the threshold up */
+const char *litepcie_copy_isa(void);
+
+#endif /* LITEPCIE_LIB_COPY_H */
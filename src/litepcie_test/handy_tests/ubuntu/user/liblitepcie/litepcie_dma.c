@@ -10,9 +10,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include "litepcie_dma.h"
 #include "litepcie_helpers.h"
 
@@ -28,6 +31,13 @@ void litepcie_dma_set_loopback(int fd, uint8_t loopback_enable) {
     checked_ioctl(fd, LITEPCIE_IOCTL_DMA, &m);
 }
 
+void litepcie_dma_set_irq(int fd, uint8_t writer_disable, uint8_t reader_disable) {
+    struct litepcie_ioctl_dma_irq m;
+    m.writer_disable = writer_disable;
+    m.reader_disable = reader_disable;
+    checked_ioctl(fd, LITEPCIE_IOCTL_DMA_IRQ, &m);
+}
+
 void litepcie_dma_writer(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_count) {
     struct litepcie_ioctl_dma_writer m;
     m.enable = enable;
@@ -44,6 +54,66 @@ void litepcie_dma_reader(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_
     *sw_count = m.sw_count;
 }
 
+int litepcie_dma_geometry(int fd, uint32_t *buffer_size, uint32_t *buffer_count, uint32_t *buffer_per_irq) {
+    struct litepcie_ioctl_dma_geometry m;
+    m.buffer_size = *buffer_size;
+    m.buffer_count = *buffer_count;
+    m.buffer_per_irq = *buffer_per_irq;
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_GEOMETRY, &m) < 0)
+        return -1;
+    *buffer_size = m.buffer_size;
+    *buffer_count = m.buffer_count;
+    *buffer_per_irq = m.buffer_per_irq;
+    return 0;
+}
+
+int litepcie_dma_user_buffer(int fd, uint8_t writer, void *addr, size_t size) {
+    struct litepcie_ioctl_dma_user_buffer m;
+    m.addr = (uintptr_t)addr;
+    m.size = size;
+    m.writer = writer;
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_USER_BUFFER, &m) < 0)
+        return -1;
+    return 0;
+}
+
+int litepcie_dma_set_irq_cpu(int fd, int writer_cpu, int reader_cpu) {
+    struct litepcie_ioctl_dma_irq_affinity m;
+    m.writer_cpu = writer_cpu;
+    m.reader_cpu = reader_cpu;
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_IRQ_AFFINITY, &m) < 0)
+        return -1;
+    return 0;
+}
+
+int litepcie_dma_eventfd(int fd, uint8_t writer, int efd, uint32_t watermark) {
+    struct litepcie_ioctl_dma_eventfd m;
+    m.fd = efd;
+    m.watermark = watermark;
+    m.writer = writer;
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_EVENTFD, &m) < 0)
+        return -1;
+    return 0;
+}
+
+int litepcie_dma_irq_stats(int fd, struct litepcie_ioctl_dma_irq_stats *stats) {
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_IRQ_STATS, stats) < 0)
+        return -1;
+    return 0;
+}
+
+int litepcie_dma_subscribe(int fd, uint8_t enable, uint8_t required, int *slot) {
+    struct litepcie_ioctl_dma_subscribe m;
+    m.enable = enable;
+    m.required = required;
+    m.slot = -1;
+    if (ioctl(fd, LITEPCIE_IOCTL_DMA_SUBSCRIBE, &m) < 0)
+        return -1;
+    if (slot)
+        *slot = m.slot;
+    return 0;
+}
+
 /* lock */
 
 uint8_t litepcie_request_dma(int fd, uint8_t reader, uint8_t writer) {
@@ -65,7 +135,45 @@ void litepcie_release_dma(int fd, uint8_t reader, uint8_t writer) {
     checked_ioctl(fd, LITEPCIE_IOCTL_LOCK, &m);
 }
 
-int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, uint8_t zero_copy)
+static size_t litepcie_dma_total_size(struct litepcie_dma_ctrl *dma)
+{
+    return (size_t)dma->buffer_size * dma->buffer_count;
+}
+
+/* Map a DMA ring at a 2 MB aligned address, so rings backed by contiguous
+ * chunks (dma_chunk_size module parameter) start on a huge page boundary. */
+#define LITEPCIE_DMA_MAP_ALIGN (2 * 1024 * 1024)
+
+static void *litepcie_dma_mmap_ring(struct litepcie_dma_ctrl *dma, int prot, off_t offset)
+{
+    size_t len = litepcie_dma_total_size(dma);
+    size_t align = LITEPCIE_DMA_MAP_ALIGN;
+    char *base, *addr;
+    void *ring;
+
+    if (len < align)
+        return mmap(NULL, len, prot, MAP_SHARED, dma->fds.fd, offset);
+
+    /* reserve len + align of address space, map the ring over its aligned part */
+    base = mmap(NULL, len + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return MAP_FAILED;
+    addr = (char *)(((uintptr_t)base + align - 1) & ~(uintptr_t)(align - 1));
+    ring = mmap(addr, len, prot, MAP_SHARED | MAP_FIXED, dma->fds.fd, offset);
+    if (ring == MAP_FAILED) {
+        munmap(base, len + align);
+        return MAP_FAILED;
+    }
+
+    /* release the unused head and tail of the reservation */
+    if (addr > base)
+        munmap(base, addr - base);
+    munmap(addr + len, base + align - addr);
+
+    return ring;
+}
+
+static int litepcie_dma_init_channel(struct litepcie_dma_ctrl *dma, const char *device_name, uint8_t zero_copy)
 {
     dma->reader_hw_count = 0;
     dma->reader_sw_count = 0;
@@ -73,6 +181,54 @@ int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, ui
     dma->writer_sw_count = 0;
 
     dma->zero_copy = zero_copy;
+    dma->rx.head = dma->rx.tail = 0;
+    dma->tx.head = dma->tx.tail = 0;
+    dma->ctrl = NULL;
+    dma->cursor = NULL;
+    dma->bar0 = NULL;
+    dma->ts = NULL;
+    dma->buf_rd = dma->buf_wr = NULL;
+    dma->fds.fd = -1;
+
+    if (dma->use_ctrl_page && !dma->zero_copy) {
+        fprintf(stderr, "Control page requires zero-copy mode\n");
+        return -1;
+    }
+    if (dma->use_timestamps && !dma->zero_copy) {
+        fprintf(stderr, "Timestamps require zero-copy mode\n");
+        return -1;
+    }
+    if (dma->busy_poll && !dma->zero_copy) {
+        fprintf(stderr, "Busy-poll requires zero-copy mode\n");
+        return -1;
+    }
+    if (dma->handoff && !dma->zero_copy) {
+        fprintf(stderr, "Lock-free handoff requires zero-copy mode\n");
+        return -1;
+    }
+    if (dma->batch_commit && (!dma->zero_copy || dma->handoff)) {
+        fprintf(stderr, "Batch commit requires zero-copy mode without handoff\n");
+        return -1;
+    }
+    if ((dma->writer_user_buf || dma->reader_user_buf) && !dma->zero_copy) {
+        fprintf(stderr, "User buffers require zero-copy mode\n");
+        return -1;
+    }
+    if (dma->subscriber && (!dma->zero_copy || !dma->use_writer || dma->use_reader ||
+                            dma->busy_poll || dma->handoff || dma->writer_user_buf)) {
+        fprintf(stderr, "Subscribers require zero-copy RX only, without busy-poll, handoff or user buffers\n");
+        return -1;
+    }
+    if (dma->msg_mode && (!dma->zero_copy || dma->subscriber || dma->busy_poll || dma->handoff ||
+                          dma->batch_commit)) {
+        fprintf(stderr, "Message mode requires zero-copy mode, without subscriber, busy-poll, handoff or batch commit\n");
+        return -1;
+    }
+    if (dma->subscriber) {
+        /* hw_counts from the control page, the geometry is the primary's */
+        dma->use_ctrl_page = 1;
+        dma->buffer_size = dma->buffer_count = dma->buffer_per_irq = 0;
+    }
 
     if (dma->use_reader)
         dma->fds.events |= POLLOUT;
@@ -85,46 +241,135 @@ int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, ui
         return -1;
     }
 
-    /* request dma reader and writer */
-    if ((litepcie_request_dma(dma->fds.fd, dma->use_reader, dma->use_writer) == 0)) {
-        fprintf(stderr, "DMA not available\n");
+    if (dma->subscriber) {
+        /* share the RX stream, the DMA stays owned by another file */
+        if (litepcie_dma_subscribe(dma->fds.fd, 1, dma->subscriber_required, &dma->subscriber_slot)) {
+            fprintf(stderr, "Could not subscribe to RX stream: %s\n", strerror(errno));
+            return -1;
+        }
+    } else {
+        /* request dma reader and writer */
+        if ((litepcie_request_dma(dma->fds.fd, dma->use_reader, dma->use_writer) == 0)) {
+            fprintf(stderr, "DMA not available\n");
+            return -1;
+        }
+
+        litepcie_dma_set_loopback(dma->fds.fd, dma->loopback);
+    }
+
+    /* set / get the ring geometry */
+    if (litepcie_dma_geometry(dma->fds.fd, &dma->buffer_size, &dma->buffer_count, &dma->buffer_per_irq)) {
+        fprintf(stderr, "Could not set DMA geometry: %s\n", strerror(errno));
         return -1;
     }
 
-    litepcie_dma_set_loopback(dma->fds.fd, dma->loopback);
+    if (dma->msg_mode) {
+        /* before the first enable: both tables are built for messages */
+        struct litepcie_ioctl_dma_msg_mode m = { .enable = 1 };
+        if (ioctl(dma->fds.fd, LITEPCIE_IOCTL_DMA_MSG_MODE, &m) < 0) {
+            fprintf(stderr, "Could not set message mode: %s\n", strerror(errno));
+            return -1;
+        }
+    }
 
     if (dma->zero_copy) {
         /* if mmap: get it from the kernel */
         checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_INFO, &dma->mmap_dma_info);
-        if (dma->use_writer) {
-            dma->buf_rd = mmap(NULL, DMA_BUFFER_TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
-                               dma->fds.fd, dma->mmap_dma_info.dma_rx_buf_offset);
+        if (dma->use_writer && dma->writer_user_buf) {
+            /* DMA straight into application memory */
+            if (litepcie_dma_user_buffer(dma->fds.fd, 1, dma->writer_user_buf, litepcie_dma_total_size(dma))) {
+                fprintf(stderr, "Could not register RX user buffer: %s\n", strerror(errno));
+                return -1;
+            }
+            dma->buf_rd = dma->writer_user_buf;
+        } else if (dma->use_writer) {
+            dma->buf_rd = litepcie_dma_mmap_ring(dma, dma->subscriber ? PROT_READ : PROT_READ | PROT_WRITE,
+                                                 dma->mmap_dma_info.dma_rx_buf_offset);
             if (dma->buf_rd == MAP_FAILED) {
+                dma->buf_rd = NULL;
                 fprintf(stderr, "MMAP failed\n");
                 return -1;
             }
         }
-        if (dma->use_reader) {
-            dma->buf_wr = mmap(NULL, DMA_BUFFER_TOTAL_SIZE, PROT_WRITE, MAP_SHARED,
-                               dma->fds.fd, dma->mmap_dma_info.dma_tx_buf_offset);
+        if (dma->use_reader && dma->reader_user_buf) {
+            /* DMA straight from application memory */
+            if (litepcie_dma_user_buffer(dma->fds.fd, 0, dma->reader_user_buf, litepcie_dma_total_size(dma))) {
+                fprintf(stderr, "Could not register TX user buffer: %s\n", strerror(errno));
+                return -1;
+            }
+            dma->buf_wr = dma->reader_user_buf;
+        } else if (dma->use_reader) {
+            dma->buf_wr = litepcie_dma_mmap_ring(dma, PROT_WRITE, dma->mmap_dma_info.dma_tx_buf_offset);
             if (dma->buf_wr == MAP_FAILED) {
+                dma->buf_wr = NULL;
                 fprintf(stderr, "MMAP failed\n");
                 return -1;
             }
         }
+        if (dma->use_ctrl_page) {
+            /* map the shared control page: counters without ioctls (read-only for subscribers) */
+            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_CTRL_INFO, &dma->mmap_dma_ctrl_info);
+            dma->ctrl = mmap(NULL, dma->mmap_dma_ctrl_info.dma_ctrl_size,
+                             dma->subscriber ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED,
+                             dma->fds.fd, dma->mmap_dma_ctrl_info.dma_ctrl_offset);
+            if (dma->ctrl == MAP_FAILED) {
+                dma->ctrl = NULL;
+                fprintf(stderr, "MMAP failed\n");
+                return -1;
+            }
+        }
+        if (dma->subscriber) {
+            /* map our own cursor page, the only one the driver lets us write */
+            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_CURSOR_INFO, &dma->mmap_dma_cursor_info);
+            dma->cursor = mmap(NULL, dma->mmap_dma_cursor_info.dma_cursor_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                               dma->fds.fd, dma->mmap_dma_cursor_info.dma_cursor_offset);
+            if (dma->cursor == MAP_FAILED) {
+                dma->cursor = NULL;
+                fprintf(stderr, "MMAP failed\n");
+                return -1;
+            }
+            dma->writer_sw_count = __atomic_load_n(&dma->cursor->sw_count, __ATOMIC_ACQUIRE);
+        }
+        if (dma->use_timestamps) {
+            /* map the completion timestamps, written by the driver with the hw_counts */
+            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_TS_INFO, &dma->mmap_dma_ts_info);
+            dma->ts = mmap(NULL, dma->mmap_dma_ts_info.dma_ts_size, PROT_READ, MAP_SHARED,
+                           dma->fds.fd, dma->mmap_dma_ts_info.dma_ts_offset);
+            if (dma->ts == MAP_FAILED) {
+                dma->ts = NULL;
+                fprintf(stderr, "MMAP failed\n");
+                return -1;
+            }
+        }
+        if (dma->busy_poll) {
+            /* map BAR0 read-only to get hw_counts from LOOP_STATUS, no MSIs needed */
+            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_BAR0_INFO, &dma->mmap_bar0_info);
+            dma->bar0 = mmap(NULL, dma->mmap_bar0_info.bar0_size, PROT_READ, MAP_SHARED,
+                             dma->fds.fd, dma->mmap_bar0_info.bar0_offset);
+            if (dma->bar0 == MAP_FAILED) {
+                dma->bar0 = NULL;
+                fprintf(stderr, "MMAP failed\n");
+                return -1;
+            }
+            /* the MSIs belong to the owner: a subscriber only spins */
+            if (!dma->subscriber)
+                litepcie_dma_set_irq(dma->fds.fd, dma->use_writer, dma->use_reader);
+        }
+        /* force the first enable/disable ioctl */
+        dma->reader_enable_last = 0xff;
+        dma->writer_enable_last = 0xff;
     } else {
         /* else: allocate it */
         if (dma->use_writer) {
-            dma->buf_rd = calloc(1, DMA_BUFFER_TOTAL_SIZE);
+            dma->buf_rd = calloc(1, litepcie_dma_total_size(dma));
             if (!dma->buf_rd) {
                 fprintf(stderr, "%d: alloc failed\n", __LINE__);
                 return -1;
             }
         }
         if (dma->use_reader) {
-            dma->buf_wr = calloc(1, DMA_BUFFER_TOTAL_SIZE);
+            dma->buf_wr = calloc(1, litepcie_dma_total_size(dma));
             if (!dma->buf_wr) {
-                free(dma->buf_rd);
                 fprintf(stderr, "%d: alloc failed\n", __LINE__);
                 return -1;
             }
@@ -134,20 +379,96 @@ int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, ui
     return 0;
 }
 
+/* Undo a failed init: unmap or free what was set up, closing the file drops
+ * the locks, user buffers and subscription. */
+static void litepcie_dma_init_undo(struct litepcie_dma_ctrl *dma)
+{
+    size_t len = litepcie_dma_total_size(dma);
+
+    if (dma->zero_copy) {
+        if (dma->buf_rd && dma->buf_rd != dma->writer_user_buf)
+            munmap(dma->buf_rd, len);
+        if (dma->buf_wr && dma->buf_wr != dma->reader_user_buf)
+            munmap(dma->buf_wr, len);
+        if (dma->ctrl)
+            munmap(dma->ctrl, dma->mmap_dma_ctrl_info.dma_ctrl_size);
+        if (dma->cursor)
+            munmap(dma->cursor, dma->mmap_dma_cursor_info.dma_cursor_size);
+        if (dma->ts)
+            munmap((void *)dma->ts, dma->mmap_dma_ts_info.dma_ts_size);
+        if (dma->bar0)
+            munmap((void *)dma->bar0, dma->mmap_bar0_info.bar0_size);
+    } else {
+        free(dma->buf_rd);
+        free(dma->buf_wr);
+    }
+    if (dma->fds.fd >= 0)
+        close(dma->fds.fd);
+
+    dma->buf_rd = dma->buf_wr = NULL;
+    dma->ctrl = NULL;
+    dma->cursor = NULL;
+    dma->ts = NULL;
+    dma->bar0 = NULL;
+    dma->fds.fd = -1;
+}
+
+int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, uint8_t zero_copy)
+{
+    if (litepcie_dma_init_channel(dma, device_name, zero_copy)) {
+        litepcie_dma_init_undo(dma);
+        return -1;
+    }
+    return 0;
+}
+
+/* New non-blocking eventfd signalled at the watermark, for epoll/io_uring loops */
+int litepcie_dma_notify_fd(struct litepcie_dma_ctrl *dma, uint8_t writer, uint32_t watermark)
+{
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (efd < 0) {
+        fprintf(stderr, "Could not create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+    if (litepcie_dma_eventfd(dma->fds.fd, writer, efd, watermark)) {
+        fprintf(stderr, "Could not register eventfd: %s\n", strerror(errno));
+        close(efd);
+        return -1;
+    }
+    return efd;
+}
+
 void litepcie_dma_cleanup(struct litepcie_dma_ctrl *dma)
 {
+    /* subscribers leave the DMA running, closing the file frees the slot */
+    if (dma->subscriber)
+        goto unmap;
+
     if (dma->use_reader)
-        litepcie_dma_reader(dma->fds.fd, 0, &dma->reader_hw_count, &dma->reader_sw_count);
+        litepcie_dma_reader(dma->fds.fd, dma->reader_enable == LITEPCIE_DMA_PAUSE ? LITEPCIE_DMA_PAUSE : 0,
+                            &dma->reader_hw_count, &dma->reader_sw_count);
     if (dma->use_writer)
-        litepcie_dma_writer(dma->fds.fd, 0, &dma->writer_hw_count, &dma->writer_sw_count);
+        litepcie_dma_writer(dma->fds.fd, dma->writer_enable == LITEPCIE_DMA_PAUSE ? LITEPCIE_DMA_PAUSE : 0,
+                            &dma->writer_hw_count, &dma->writer_sw_count);
 
+    /* releasing the lock also unregisters the user buffers */
     litepcie_release_dma(dma->fds.fd, dma->use_reader, dma->use_writer);
 
+unmap:
     if (dma->zero_copy) {
-        if (dma->use_reader)
+        if (dma->use_reader && !dma->reader_user_buf)
             munmap(dma->buf_wr, dma->mmap_dma_info.dma_tx_buf_size * dma->mmap_dma_info.dma_tx_buf_count);
-        if (dma->use_writer)
+        if (dma->use_writer && !dma->writer_user_buf)
             munmap(dma->buf_rd, dma->mmap_dma_info.dma_tx_buf_size * dma->mmap_dma_info.dma_tx_buf_count);
+        if (dma->ctrl)
+            munmap(dma->ctrl, dma->mmap_dma_ctrl_info.dma_ctrl_size);
+        if (dma->cursor)
+            munmap(dma->cursor, dma->mmap_dma_cursor_info.dma_cursor_size);
+        if (dma->ts)
+            munmap((void *)dma->ts, dma->mmap_dma_ts_info.dma_ts_size);
+        if (dma->bar0)
+            munmap((void *)dma->bar0, dma->mmap_bar0_info.bar0_size);
     } else {
         free(dma->buf_rd);
         free(dma->buf_wr);
@@ -156,19 +477,210 @@ void litepcie_dma_cleanup(struct litepcie_dma_ctrl *dma)
     close(dma->fds.fd);
 }
 
-void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
+/* only issue the enable ioctls on transitions (counters are cleared by the driver then) */
+static void litepcie_dma_enable_update(struct litepcie_dma_ctrl *dma)
 {
-    ssize_t len;
-    int ret;
+    if (dma->use_writer && dma->writer_enable != dma->writer_enable_last) {
+        litepcie_dma_writer(dma->fds.fd, dma->writer_enable, &dma->writer_hw_count, &dma->writer_sw_count);
+        dma->writer_hw_count_last = dma->writer_hw_count;
+        dma->writer_enable_last = dma->writer_enable;
+    }
+    if (dma->use_reader && dma->reader_enable != dma->reader_enable_last) {
+        litepcie_dma_reader(dma->fds.fd, dma->reader_enable, &dma->reader_hw_count, &dma->reader_sw_count);
+        dma->reader_hw_count_last = dma->reader_hw_count;
+        dma->reader_enable_last = dma->reader_enable;
+    }
+}
+
+static void litepcie_dma_writer_sw_update(struct litepcie_dma_ctrl *dma, int64_t sw_count);
+
+/* subscriber: follow the primary's writer, never wait on overwritten buffers */
+static void litepcie_dma_subscriber_update(struct litepcie_dma_ctrl *dma)
+{
+    int64_t oldest;
 
-    /* set / get dma */
+    dma->writer_hw_count = __atomic_load_n(&dma->ctrl->writer_hw_count, __ATOMIC_ACQUIRE);
+    /* the driver reset the cursor on a writer restart */
+    if (dma->writer_sw_count > dma->writer_hw_count)
+        dma->writer_sw_count = __atomic_load_n(&dma->cursor->sw_count, __ATOMIC_ACQUIRE);
+    /* overrun: skip to the oldest buffer not being rewritten (the driver counts the drops) */
+    oldest = dma->writer_hw_count - dma->buffer_count + 1;
+    if (dma->writer_sw_count < oldest)
+        litepcie_dma_writer_sw_update(dma, oldest);
+}
+
+/* control page: read hw_counts from the page */
+static void litepcie_dma_ctrl_update(struct litepcie_dma_ctrl *dma)
+{
+    if (dma->subscriber) {
+        litepcie_dma_subscriber_update(dma);
+        return;
+    }
+    litepcie_dma_enable_update(dma);
     if (dma->use_writer)
-        litepcie_dma_writer(dma->fds.fd, dma->writer_enable, &dma->writer_hw_count, &dma->writer_sw_count);
+        dma->writer_hw_count = __atomic_load_n(&dma->ctrl->writer_hw_count, __ATOMIC_ACQUIRE);
     if (dma->use_reader)
-        litepcie_dma_reader(dma->fds.fd, dma->reader_enable, &dma->reader_hw_count, &dma->reader_sw_count);
+        dma->reader_hw_count = __atomic_load_n(&dma->ctrl->reader_hw_count, __ATOMIC_ACQUIRE);
+}
+
+/* same wrap logic as litepcie_interrupt() */
+static void litepcie_dma_update_hw_count(int64_t *hw_count, int64_t *hw_count_last, uint32_t loop_status,
+    uint32_t buffer_count)
+{
+    *hw_count &= ~(((int64_t)buffer_count << 16) - 1);
+    *hw_count |= (loop_status >> 16) * buffer_count + (loop_status & 0xffff);
+    if (*hw_count_last > *hw_count)
+        *hw_count += (int64_t)buffer_count << 16;
+    *hw_count_last = *hw_count;
+}
+
+static uint32_t litepcie_dma_bar0_readl(struct litepcie_dma_ctrl *dma, uint32_t offset)
+{
+    return *(volatile uint32_t *)(dma->bar0 + dma->mmap_bar0_info.dma_base + offset);
+}
+
+/* busy-poll: compute hw_counts straight from the LOOP_STATUS CSRs */
+static void litepcie_dma_busy_update(struct litepcie_dma_ctrl *dma)
+{
+    litepcie_dma_enable_update(dma);
+    if (dma->use_writer && dma->writer_enable)
+        litepcie_dma_update_hw_count(&dma->writer_hw_count, &dma->writer_hw_count_last,
+            litepcie_dma_bar0_readl(dma, PCIE_DMA_WRITER_TABLE_LOOP_STATUS_OFFSET), dma->buffer_count);
+    if (dma->use_reader && dma->reader_enable)
+        litepcie_dma_update_hw_count(&dma->reader_hw_count, &dma->reader_hw_count_last,
+            litepcie_dma_bar0_readl(dma, PCIE_DMA_READER_TABLE_LOOP_STATUS_OFFSET), dma->buffer_count);
+}
+
+static short litepcie_dma_ctrl_events(struct litepcie_dma_ctrl *dma)
+{
+    short events = 0;
+
+    if (dma->use_writer && (dma->writer_hw_count - dma->writer_sw_count) > 0)
+        events |= POLLIN;
+    if (dma->use_reader && (dma->reader_sw_count - dma->reader_hw_count) < dma->buffer_count/2)
+        events |= POLLOUT;
+    return events;
+}
+
+/* poll() timeout of litepcie_dma_process(), in ms */
+static inline int litepcie_dma_poll_timeout(struct litepcie_dma_ctrl *dma)
+{
+    return dma->nonblock ? 0 : 100;
+}
+
+/* control page polling: only fall back to poll() when nothing is ready */
+static int litepcie_dma_ctrl_poll(struct litepcie_dma_ctrl *dma)
+{
+    int ret;
+
+    litepcie_dma_ctrl_update(dma);
+    dma->fds.revents = litepcie_dma_ctrl_events(dma);
+    if (dma->fds.revents || dma->nonblock)
+        return dma->fds.revents != 0;
 
-    /* polling */
     ret = poll(&dma->fds, 1, 100);
+    if (ret <= 0)
+        return ret;
+
+    litepcie_dma_ctrl_update(dma);
+    dma->fds.revents = litepcie_dma_ctrl_events(dma);
+    return 1;
+}
+
+/* zero-copy: hand the new sw_counts to the driver */
+static void litepcie_dma_writer_sw_update(struct litepcie_dma_ctrl *dma, int64_t sw_count)
+{
+    dma->mmap_dma_update.sw_count = sw_count;
+    if (dma->subscriber) {
+        __atomic_store_n(&dma->cursor->sw_count, sw_count, __ATOMIC_RELEASE);
+        dma->writer_sw_count = sw_count;
+    } else if (dma->ctrl) {
+        __atomic_store_n(&dma->ctrl->writer_sw_count, sw_count, __ATOMIC_RELEASE);
+        dma->writer_sw_count = sw_count;
+    } else if (dma->bar0) {
+        /* the driver does not track sw_count in busy-poll mode */
+        dma->writer_sw_count = sw_count;
+    } else {
+        checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &dma->mmap_dma_update);
+    }
+}
+
+static void litepcie_dma_reader_sw_update(struct litepcie_dma_ctrl *dma, int64_t sw_count)
+{
+    dma->mmap_dma_update.sw_count = sw_count;
+    if (dma->ctrl) {
+        __atomic_store_n(&dma->ctrl->reader_sw_count, sw_count, __ATOMIC_RELEASE);
+        dma->reader_sw_count = sw_count;
+    } else if (dma->bar0) {
+        /* the driver does not track sw_count in busy-poll mode */
+        dma->reader_sw_count = sw_count;
+    } else {
+        checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE, &dma->mmap_dma_update);
+    }
+}
+
+/* lock-free handoff: publish hw_counts to the rx/tx threads, forward their progress as sw_counts */
+static void litepcie_dma_handoff_process(struct litepcie_dma_ctrl *dma)
+{
+    int64_t sw_count;
+
+    if (dma->bar0) {
+        litepcie_dma_busy_update(dma);
+    } else if (dma->ctrl) {
+        litepcie_dma_ctrl_poll(dma);
+    } else {
+        if (dma->use_writer)
+            litepcie_dma_writer(dma->fds.fd, dma->writer_enable, &dma->writer_hw_count, &dma->writer_sw_count);
+        if (dma->use_reader)
+            litepcie_dma_reader(dma->fds.fd, dma->reader_enable, &dma->reader_hw_count, &dma->reader_sw_count);
+    }
+
+    if (dma->use_writer) {
+        __atomic_store_n(&dma->rx.head, dma->writer_hw_count, __ATOMIC_RELEASE);
+        sw_count = __atomic_load_n(&dma->rx.tail, __ATOMIC_ACQUIRE);
+        if (sw_count != dma->writer_sw_count)
+            litepcie_dma_writer_sw_update(dma, sw_count);
+    }
+    if (dma->use_reader) {
+        __atomic_store_n(&dma->tx.tail, dma->reader_hw_count, __ATOMIC_RELEASE);
+        sw_count = __atomic_load_n(&dma->tx.head, __ATOMIC_ACQUIRE);
+        if (sw_count != dma->reader_sw_count)
+            litepcie_dma_reader_sw_update(dma, sw_count);
+    }
+
+    /* legacy mode: sleep until the driver sees progress (the sw_counts above were just sent) */
+    if (!dma->bar0 && !dma->ctrl && poll(&dma->fds, 1, litepcie_dma_poll_timeout(dma)) < 0)
+        perror("poll");
+}
+
+void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
+{
+    int64_t sw_count, in_flight;
+    ssize_t len;
+    int ret;
+
+    if (dma->handoff) {
+        litepcie_dma_handoff_process(dma);
+        return;
+    }
+
+    if (dma->bar0) {
+        /* never sleep: return with nothing available and let the caller spin */
+        litepcie_dma_busy_update(dma);
+        dma->fds.revents = litepcie_dma_ctrl_events(dma);
+        ret = dma->fds.revents != 0;
+    } else if (dma->ctrl) {
+        ret = litepcie_dma_ctrl_poll(dma);
+    } else {
+        /* set / get dma */
+        if (dma->use_writer)
+            litepcie_dma_writer(dma->fds.fd, dma->writer_enable, &dma->writer_hw_count, &dma->writer_sw_count);
+        if (dma->use_reader)
+            litepcie_dma_reader(dma->fds.fd, dma->reader_enable, &dma->reader_hw_count, &dma->reader_sw_count);
+
+        /* polling */
+        ret = poll(&dma->fds, 1, litepcie_dma_poll_timeout(dma));
+    }
     if (ret < 0) {
         perror("poll");
         return;
@@ -180,20 +692,29 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
     /* read event */
     if (dma->fds.revents & POLLIN) {
         if (dma->zero_copy) {
+            /* overrun: the DMA went round the ring over unread buffers, skip
+             * them as read() does ("Reading too late") */
+            if (dma->writer_hw_count - dma->writer_sw_count > dma->buffer_count) {
+                sw_count = dma->writer_hw_count - dma->buffer_count;
+                dma->writer_overruns += sw_count - dma->writer_sw_count;
+                litepcie_dma_writer_sw_update(dma, sw_count);
+                dma->writer_sw_count = sw_count;
+            }
+
             /* count available buffers */
             dma->buffers_available_read = dma->writer_hw_count - dma->writer_sw_count;
-            dma->usr_read_buf_offset = dma->writer_sw_count % DMA_BUFFER_COUNT;
+            dma->usr_read_buf_offset = dma->writer_sw_count % dma->buffer_count;
 
-            /* update dma sw_count*/
-            dma->mmap_dma_update.sw_count = dma->writer_sw_count + dma->buffers_available_read;
-            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &dma->mmap_dma_update);
+            /* update dma sw_count (deferred to litepcie_dma_read_commit() in batch mode) */
+            if (!dma->batch_commit)
+                litepcie_dma_writer_sw_update(dma, dma->writer_sw_count + dma->buffers_available_read);
         } else {
-            len = read(dma->fds.fd, dma->buf_rd, DMA_BUFFER_TOTAL_SIZE);
+            len = read(dma->fds.fd, dma->buf_rd, litepcie_dma_total_size(dma));
             if (len < 0) {
                 perror("read");
                 abort();
             }
-            dma->buffers_available_read = len / DMA_BUFFER_SIZE;
+            dma->buffers_available_read = len / dma->buffer_size;
             dma->usr_read_buf_offset = 0;
         }
     } else {
@@ -203,21 +724,27 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
     /* write event */
     if (dma->fds.revents & POLLOUT) {
         if (dma->zero_copy) {
-            /* count available buffers */
-            dma->buffers_available_write = DMA_BUFFER_COUNT / 2 - (dma->reader_sw_count - dma->reader_hw_count);
-            dma->usr_write_buf_offset = dma->reader_sw_count % DMA_BUFFER_COUNT;
+            /* count available buffers: half the ring at most, also if hw_count ran ahead */
+            in_flight = dma->reader_sw_count - dma->reader_hw_count;
+            if (in_flight < 0)
+                in_flight = 0;
+            dma->buffers_available_write = in_flight < dma->buffer_count / 2 ? dma->buffer_count / 2 - in_flight : 0;
+            dma->usr_write_buf_offset = dma->reader_sw_count % dma->buffer_count;
 
-            /* update dma sw_count */
-            dma->mmap_dma_update.sw_count = dma->reader_sw_count + dma->buffers_available_write;
-            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE, &dma->mmap_dma_update);
+            /* update dma sw_count (deferred to litepcie_dma_write_commit() in batch mode,
+             * moved by the driver per message in message mode) */
+            if (dma->msg_mode)
+                dma->buffers_available_write = 0;
+            else if (!dma->batch_commit)
+                litepcie_dma_reader_sw_update(dma, dma->reader_sw_count + dma->buffers_available_write);
 
         } else {
-            len = write(dma->fds.fd, dma->buf_wr, DMA_BUFFER_TOTAL_SIZE);
+            len = write(dma->fds.fd, dma->buf_wr, litepcie_dma_total_size(dma));
             if (len < 0) {
                 perror("write");
                 abort();
             }
-            dma->buffers_available_write = len / DMA_BUFFER_SIZE;
+            dma->buffers_available_write = len / dma->buffer_size;
             dma->usr_write_buf_offset = 0;
         }
     } else {
@@ -225,13 +752,78 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
     }
 }
 
+static unsigned litepcie_dma_spans(struct litepcie_dma_ctrl *dma, char *base, unsigned offset, unsigned available,
+    unsigned limit, struct litepcie_dma_span span[2])
+{
+    unsigned first = dma->buffer_count - offset;
+
+    /* never past the ring: span[1] wraps onto span[0] otherwise */
+    if (available > limit)
+        available = limit;
+    if (first > available)
+        first = available;
+    span[0].buf = base + (size_t)offset * dma->buffer_size;
+    span[0].count = first;
+    span[1].buf = base;
+    span[1].count = available - first;
+    return available;
+}
+
+unsigned litepcie_dma_read_spans(struct litepcie_dma_ctrl *dma, struct litepcie_dma_span span[2])
+{
+    return litepcie_dma_spans(dma, dma->buf_rd, dma->usr_read_buf_offset, dma->buffers_available_read,
+                              dma->buffer_count, span);
+}
+
+unsigned litepcie_dma_write_spans(struct litepcie_dma_ctrl *dma, struct litepcie_dma_span span[2])
+{
+    return litepcie_dma_spans(dma, dma->buf_wr, dma->usr_write_buf_offset, dma->buffers_available_write,
+                              dma->buffer_count / 2, span);
+}
+
+void litepcie_dma_read_commit(struct litepcie_dma_ctrl *dma, unsigned count)
+{
+    if (count > dma->buffers_available_read)
+        count = dma->buffers_available_read;
+    dma->buffers_available_read -= count;
+    dma->usr_read_buf_offset = (dma->usr_read_buf_offset + count) % dma->buffer_count;
+    if (dma->batch_commit && count) {
+        dma->writer_sw_count += count;
+        litepcie_dma_writer_sw_update(dma, dma->writer_sw_count);
+    }
+}
+
+void litepcie_dma_write_commit(struct litepcie_dma_ctrl *dma, unsigned count)
+{
+    if (count > dma->buffers_available_write)
+        count = dma->buffers_available_write;
+    dma->buffers_available_write -= count;
+    dma->usr_write_buf_offset = (dma->usr_write_buf_offset + count) % dma->buffer_count;
+    if (dma->batch_commit && count) {
+        dma->reader_sw_count += count;
+        litepcie_dma_reader_sw_update(dma, dma->reader_sw_count);
+    }
+}
+
+uint64_t litepcie_dma_buffer_ts(struct litepcie_dma_ctrl *dma, const char *buf)
+{
+    size_t total = litepcie_dma_total_size(dma);
+
+    if (!dma->ts)
+        return 0;
+    if (dma->buf_rd && buf >= dma->buf_rd && buf < dma->buf_rd + total)
+        return __atomic_load_n(&dma->ts->writer_ts[(buf - dma->buf_rd) / dma->buffer_size], __ATOMIC_RELAXED);
+    if (dma->buf_wr && buf >= dma->buf_wr && buf < dma->buf_wr + total)
+        return __atomic_load_n(&dma->ts->reader_ts[(buf - dma->buf_wr) / dma->buffer_size], __ATOMIC_RELAXED);
+    return 0;
+}
+
 char *litepcie_dma_next_read_buffer(struct litepcie_dma_ctrl *dma)
 {
     if (!dma->buffers_available_read)
         return NULL;
-    dma->buffers_available_read --;
-    char *ret = dma->buf_rd + dma->usr_read_buf_offset * DMA_BUFFER_SIZE;
-    dma->usr_read_buf_offset = (dma->usr_read_buf_offset + 1) % DMA_BUFFER_COUNT;
+    char *ret = dma->buf_rd + (size_t)dma->usr_read_buf_offset * dma->buffer_size;
+    litepcie_dma_read_commit(dma, 1);
     return ret;
 }
 
@@ -239,8 +831,106 @@ char *litepcie_dma_next_write_buffer(struct litepcie_dma_ctrl *dma)
 {
     if (!dma->buffers_available_write)
         return NULL;
-    dma->buffers_available_write --;
-    char *ret = dma->buf_wr + dma->usr_write_buf_offset * DMA_BUFFER_SIZE;
-    dma->usr_write_buf_offset = (dma->usr_write_buf_offset + 1) % DMA_BUFFER_COUNT;
+    char *ret = dma->buf_wr + (size_t)dma->usr_write_buf_offset * dma->buffer_size;
+    litepcie_dma_write_commit(dma, 1);
     return ret;
 }
+
+/* message mode */
+
+static int litepcie_dma_msg_ioctl(struct litepcie_dma_ctrl *dma, uint32_t length, uint32_t flags)
+{
+    struct litepcie_ioctl_dma_msg m;
+
+    m.length = length;
+    m.flags = flags;
+    if (ioctl(dma->fds.fd, LITEPCIE_IOCTL_DMA_MSG_SEND, &m) < 0) {
+        /* ring full: nothing queued, but the counts are fresh */
+        if (errno == EAGAIN) {
+            dma->reader_sw_count = m.count;
+            dma->reader_hw_count = m.hw_count;
+        }
+        return -1;
+    }
+    dma->reader_sw_count = m.count + (length != 0);
+    dma->reader_hw_count = m.hw_count;
+    return 0;
+}
+
+int litepcie_dma_msg_send(struct litepcie_dma_ctrl *dma, const void *data, uint32_t length, uint32_t flags)
+{
+    struct litepcie_dma_msg_header *header;
+    char *buf;
+
+    if (!dma->msg_mode || !dma->use_reader || length > LITEPCIE_DMA_MSG_MAX(dma)) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* ring full as last seen: refresh the hw_count first */
+    if (dma->reader_sw_count - dma->reader_hw_count >= dma->buffer_count / 2) {
+        if (litepcie_dma_msg_ioctl(dma, 0, 0))
+            return -1;
+        if (dma->reader_sw_count - dma->reader_hw_count >= dma->buffer_count / 2) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    buf = dma->buf_wr + (size_t)(dma->reader_sw_count % dma->buffer_count) * dma->buffer_size;
+    header = (struct litepcie_dma_msg_header *)buf;
+    header->length = length;
+    header->seq = (uint32_t)dma->reader_sw_count;
+    memcpy(buf + sizeof(*header), data, length);
+
+    length = (sizeof(*header) + length + LITEPCIE_DMA_MSG_ALIGN - 1) & ~(LITEPCIE_DMA_MSG_ALIGN - 1);
+    /* one message per buffer: the RX descriptor must end on it, whatever the caller passed */
+    return litepcie_dma_msg_ioctl(dma, length, flags | LITEPCIE_DMA_MSG_LAST);
+}
+
+const char *litepcie_dma_msg_recv(struct litepcie_dma_ctrl *dma, uint32_t *length, uint32_t *seq)
+{
+    const struct litepcie_dma_msg_header *header;
+    char *buf;
+
+    buf = litepcie_dma_next_read_buffer(dma);
+    if (!buf)
+        return NULL;
+    /* a corrupted header must not point past the buffer */
+    header = (const struct litepcie_dma_msg_header *)buf;
+    *length = header->length < dma->buffer_size - sizeof(*header) ?
+        header->length : dma->buffer_size - sizeof(*header);
+    if (seq)
+        *seq = header->seq;
+    return buf + sizeof(*header);
+}
+
+/* lock-free handoff: the rx thread owns rx.tail, the tx thread owns tx.head */
+
+char *litepcie_dma_rx_acquire(struct litepcie_dma_ctrl *dma)
+{
+    int64_t tail = __atomic_load_n(&dma->rx.tail, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&dma->rx.head, __ATOMIC_ACQUIRE) - tail <= 0)
+        return NULL;
+    return dma->buf_rd + (size_t)(tail % dma->buffer_count) * dma->buffer_size;
+}
+
+void litepcie_dma_rx_release(struct litepcie_dma_ctrl *dma)
+{
+    __atomic_store_n(&dma->rx.tail, __atomic_load_n(&dma->rx.tail, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+char *litepcie_dma_tx_acquire(struct litepcie_dma_ctrl *dma)
+{
+    int64_t head = __atomic_load_n(&dma->tx.head, __ATOMIC_RELAXED);
+
+    /* same half-ring limit as the POLLOUT condition */
+    if (head - __atomic_load_n(&dma->tx.tail, __ATOMIC_ACQUIRE) >= dma->buffer_count / 2)
+        return NULL;
+    return dma->buf_wr + (size_t)(head % dma->buffer_count) * dma->buffer_size;
+}
+
+void litepcie_dma_tx_release(struct litepcie_dma_ctrl *dma)
+{
+    __atomic_store_n(&dma->tx.head, __atomic_load_n(&dma->tx.head, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
@@ -15,31 +15,117 @@
 #include <poll.h>
 #include "litepcie.h"
 
+/* Lock-free handoff ring counts: head and tail each have a single writer thread */
+struct litepcie_dma_ring {
+    int64_t head __attribute__((aligned(64)));
+    int64_t tail __attribute__((aligned(64)));
+};
+
+/* Run of ring buffers contiguous in memory: count * buffer_size bytes at buf */
+struct litepcie_dma_span {
+    char *buf;
+    unsigned count;
+};
+
 struct litepcie_dma_ctrl {
     uint8_t use_reader, use_writer, loopback, zero_copy;
+    uint8_t use_ctrl_page; /* zero-copy only: poll/update counters through the shared control page */
+    uint8_t busy_poll;     /* zero-copy only: spin on LOOP_STATUS from mmapped BAR0, DMA MSIs off */
+    uint32_t buffer_size, buffer_count, buffer_per_irq; /* ring geometry: 0 keeps the driver's, live after init */
+    char *writer_user_buf, *reader_user_buf; /* zero-copy only: application memory used as RX/TX ring */
+    uint8_t handoff;       /* zero-copy only: litepcie_dma_{rx,tx}_* from other threads, no locks */
+    uint8_t nonblock;      /* litepcie_dma_process() never waits in poll(): the caller waits (epoll, eventfds) */
+    uint8_t batch_commit;  /* zero-copy only: sw_counts only advance on litepcie_dma_*_commit() */
+    uint8_t subscriber;    /* zero-copy RX only: read-only fan-out of the writer owner's stream */
+    uint8_t subscriber_required; /* subscriber: lag gates writer_overflows instead of own drops */
+    int subscriber_slot;   /* subscriber: index in ctrl->subscribers, set by init */
+    uint8_t use_timestamps; /* zero-copy only: map the per-buffer completion timestamps */
+    uint8_t msg_mode;      /* zero-copy only: variable-length messages, litepcie_dma_msg_{send,recv}() */
     struct pollfd fds;
     char *buf_rd, *buf_wr;
-    uint8_t reader_enable;
+    uint8_t reader_enable; /* 0, 1, or LITEPCIE_DMA_PAUSE: off, table kept for a fast restart */
     uint8_t writer_enable;
     int64_t reader_hw_count, reader_sw_count;
     int64_t writer_hw_count, writer_sw_count;
+    int64_t writer_overruns; /* zero-copy RX: buffers the DMA rewrote before they were read, skipped */
     unsigned buffers_available_read, buffers_available_write;
     unsigned usr_read_buf_offset, usr_write_buf_offset;
     struct litepcie_ioctl_mmap_dma_info mmap_dma_info;
     struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
+    struct litepcie_ioctl_mmap_dma_ctrl_info mmap_dma_ctrl_info;
+    struct litepcie_mmap_dma_ctrl *ctrl;
+    struct litepcie_ioctl_mmap_dma_cursor_info mmap_dma_cursor_info;
+    struct litepcie_mmap_dma_cursor *cursor; /* subscriber: own RX cursor, ctrl is read-only */
+    uint8_t reader_enable_last, writer_enable_last;
+    struct litepcie_ioctl_mmap_bar0_info mmap_bar0_info;
+    volatile uint8_t *bar0;
+    int64_t reader_hw_count_last, writer_hw_count_last;
+    struct litepcie_ioctl_mmap_dma_ts_info mmap_dma_ts_info;
+    const struct litepcie_mmap_dma_ts *ts;
+    struct litepcie_dma_ring rx; /* head: filled (process thread), tail: consumed (rx thread) */
+    struct litepcie_dma_ring tx; /* head: filled (tx thread), tail: sent (process thread) */
 };
 
 void litepcie_dma_set_loopback(int fd, uint8_t loopback_enable);
+void litepcie_dma_set_irq(int fd, uint8_t writer_disable, uint8_t reader_disable);
+int litepcie_dma_geometry(int fd, uint32_t *buffer_size, uint32_t *buffer_count, uint32_t *buffer_per_irq);
+int litepcie_dma_user_buffer(int fd, uint8_t writer, void *addr, size_t size);
+int litepcie_dma_set_irq_cpu(int fd, int writer_cpu, int reader_cpu);
+int litepcie_dma_eventfd(int fd, uint8_t writer, int efd, uint32_t watermark);
+int litepcie_dma_irq_stats(int fd, struct litepcie_ioctl_dma_irq_stats *stats);
+int litepcie_dma_subscribe(int fd, uint8_t enable, uint8_t required, int *slot);
 void litepcie_dma_reader(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_count);
 void litepcie_dma_writer(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_count);
 
 uint8_t litepcie_request_dma(int fd, uint8_t reader, uint8_t writer);
 void litepcie_release_dma(int fd, uint8_t reader, uint8_t writer);
 
+/* Returns 0, or -1 with nothing left open or mapped (fds.fd is -1). */
 int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, uint8_t zero_copy);
 void litepcie_dma_cleanup(struct litepcie_dma_ctrl *dma);
+int litepcie_dma_notify_fd(struct litepcie_dma_ctrl *dma, uint8_t writer, uint32_t watermark);
 void litepcie_dma_process(struct litepcie_dma_ctrl *dma);
 char *litepcie_dma_next_read_buffer(struct litepcie_dma_ctrl *dma);
 char *litepcie_dma_next_write_buffer(struct litepcie_dma_ctrl *dma);
 
+/* Batched access: the buffers available since the last litepcie_dma_process(),
+ * as at most two spans (split at the ring wrap). Returns the total count, at
+ * most the ring (RX) or half of it (TX). An RX backlog past the ring is an
+ * overrun: the lost buffers are skipped and counted in writer_overruns. */
+unsigned litepcie_dma_read_spans(struct litepcie_dma_ctrl *dma, struct litepcie_dma_span span[2]);
+unsigned litepcie_dma_write_spans(struct litepcie_dma_ctrl *dma, struct litepcie_dma_span span[2]);
+void litepcie_dma_read_commit(struct litepcie_dma_ctrl *dma, unsigned count);
+void litepcie_dma_write_commit(struct litepcie_dma_ctrl *dma, unsigned count);
+
+/* Completion time (CLOCK_MONOTONIC ns) of a RX or TX ring buffer, 0 without
+ * use_timestamps. Valid until the DMA reuses the buffer. */
+uint64_t litepcie_dma_buffer_ts(struct litepcie_dma_ctrl *dma, const char *buf);
+
+/* Message mode (msg_mode = 1): one message per ring buffer, sent as soon as
+ * queued with its real length (rounded up to LITEPCIE_DMA_MSG_ALIGN). The
+ * header travels in-band, ahead of the payload: the RX side has no length. */
+struct litepcie_dma_msg_header {
+    uint32_t length;       /* payload bytes */
+    uint32_t seq;          /* low bits of the TX buffer count */
+};
+
+/* Payload bytes a message can carry. */
+#define LITEPCIE_DMA_MSG_MAX(dma) \
+    (((dma)->buffer_size & ~(LITEPCIE_DMA_MSG_ALIGN - 1)) - sizeof(struct litepcie_dma_msg_header))
+
+/* Queue a message (flags: LITEPCIE_DMA_MSG_IRQ, LITEPCIE_DMA_MSG_LAST is always
+ * set). Returns 0, or -1 with errno EAGAIN while half the TX ring is in
+ * flight, EINVAL if it does not fit. */
+int litepcie_dma_msg_send(struct litepcie_dma_ctrl *dma, const void *data, uint32_t length, uint32_t flags);
+/* Next received message after litepcie_dma_process(), NULL if none; seq may
+ * be NULL. Valid until the DMA reuses the buffer. */
+const char *litepcie_dma_msg_recv(struct litepcie_dma_ctrl *dma, uint32_t *length, uint32_t *seq);
+
+/* Lock-free handoff (handoff = 1): one thread loops on litepcie_dma_process(),
+ * one RX consumer and one TX producer thread use these concurrently. */
+char *litepcie_dma_rx_acquire(struct litepcie_dma_ctrl *dma);
+void litepcie_dma_rx_release(struct litepcie_dma_ctrl *dma);
+char *litepcie_dma_tx_acquire(struct litepcie_dma_ctrl *dma);
+void litepcie_dma_tx_release(struct litepcie_dma_ctrl *dma);
+
 #endif /* LITEPCIE_LIB_DMA_H */
@@ -12,30 +12,61 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 #include "litepcie_flash.h"
 #include "litepcie_helpers.h"
 #include "litepcie.h"
+#include "flags.h"
 
 #ifdef CSR_FLASH_BASE
 
 //#define FLASH_FULL_ERASE
 #define FLASH_RETRIES 16
+#define FLASH_SPI_TIMEOUT_US 100000
 
-static void flash_spi_cs(int fd, uint8_t cs_n)
+/* SPI transfers are queued as register batches, a whole page per call. */
+static struct litepcie_reg_batch flash_batch;
+
+static void flash_batch_run(int fd)
+{
+    _check_ioctl(litepcie_reg_batch_run(fd, &flash_batch), __FILE__, __LINE__);
+    litepcie_reg_batch_init(&flash_batch);
+}
+
+static void flash_spi_cs(struct litepcie_reg_batch *b, uint8_t cs_n)
 {
-    litepcie_writel(fd, CSR_FLASH_CS_N_OUT_ADDR, cs_n);
+    litepcie_reg_batch_write(b, CSR_FLASH_CS_N_OUT_ADDR, cs_n);
 }
 
-static uint64_t flash_spi(int fd, int tx_len, uint8_t cmd,
+/* Start a transfer of what is in MOSI and wait for it. Reads can't pass the
+ * posted START write, so DONE is low for this transfer when first polled. */
+static void flash_spi_start(struct litepcie_reg_batch *b, int tx_len)
+{
+    litepcie_reg_batch_write(b, CSR_FLASH_SPI_CONTROL_ADDR,
+                             SPI_CTRL_START | (tx_len * SPI_CTRL_LENGTH));
+    litepcie_reg_batch_poll(b, CSR_FLASH_SPI_STATUS_ADDR,
+                            SPI_STATUS_DONE, SPI_STATUS_DONE, FLASH_SPI_TIMEOUT_US);
+}
+
+static void flash_spi_transfer(struct litepcie_reg_batch *b, int tx_len, uint64_t tx_data)
+{
+    litepcie_reg_batch_write(b, CSR_FLASH_SPI_MOSI_ADDR, tx_data >> 32);
+    litepcie_reg_batch_write(b, CSR_FLASH_SPI_MOSI_ADDR + 4, tx_data);
+    flash_spi_start(b, tx_len);
+}
+
+/* Returns the low 32 bits of MISO, all the callers need. */
+static uint32_t flash_spi(int fd, int tx_len, uint8_t cmd,
                           uint32_t tx_data)
 {
-    struct litepcie_ioctl_flash m;
-    flash_spi_cs(fd, 0);
-    m.tx_len = tx_len;
-    m.tx_data = tx_data | ((uint64_t)cmd << 32);
-    checked_ioctl(fd, LITEPCIE_IOCTL_FLASH, &m);
-    flash_spi_cs(fd, 1);
-    return m.rx_data;
+    uint32_t miso;
+
+    flash_spi_cs(&flash_batch, 0);
+    flash_spi_transfer(&flash_batch, tx_len, tx_data | ((uint64_t)cmd << 32));
+    miso = litepcie_reg_batch_read(&flash_batch, CSR_FLASH_SPI_MISO_ADDR + 4);
+    flash_spi_cs(&flash_batch, 1);
+    flash_batch_run(fd);
+    return flash_batch.ops[miso].val;
 }
 
 uint32_t flash_read_id(int fd, int reg)
@@ -89,29 +120,25 @@ static void flash_write_buffer(int fd, uint32_t addr, uint8_t *buf, uint16_t siz
         flash_write(fd, addr, buf[0]);
     } else {
         int i;
-        struct litepcie_ioctl_flash m;
 
         /* set cs_n */
-        flash_spi_cs(fd, 0);
+        flash_spi_cs(&flash_batch, 0);
 
         /* send cmd */
-        m.tx_len = 32;
-        m.tx_data = ((uint64_t)FLASH_PP << 32) | ((uint64_t)addr << 8);
-        checked_ioctl(fd, LITEPCIE_IOCTL_FLASH, &m);
+        flash_spi_transfer(&flash_batch, 32, ((uint64_t)FLASH_PP << 32) | ((uint64_t)addr << 8));
 
         /* send bytes */
         for (i=0; i<size; i+=4) {
-            m.tx_len = 32;
-            m.tx_data = (
+            flash_spi_transfer(&flash_batch, 32,
                 ((uint64_t)buf[i+0] << 32) |
                 ((uint64_t)buf[i+1] << 24) |
                 ((uint64_t)buf[i+2] << 16) |
                 ((uint64_t)buf[i+3] << 8));
-            checked_ioctl(fd, LITEPCIE_IOCTL_FLASH, &m);
         }
 
         /* release cs_n */
-        flash_spi_cs(fd, 1);
+        flash_spi_cs(&flash_batch, 1);
+        flash_batch_run(fd);
     }
 }
 
@@ -120,36 +147,50 @@ uint8_t litepcie_flash_read(int fd, uint32_t addr)
     return flash_spi(fd, 40, FLASH_READ, addr << 8) & 0xff;
 }
 
-static void litepcie_flash_read_buffer(int fd, uint32_t addr, uint8_t *buf, uint16_t size)
-{
-    int i;
+/* Words read per batch: 3 ops each, within LITEPCIE_REG_OPS_MAX. */
+#define FLASH_READ_BATCH_WORDS 256
 
-    struct litepcie_ioctl_flash m;
+/* size is 1 or a multiple of 4. CS stays low across the batches, so any
+ * size is one READ command. */
+static void litepcie_flash_read_buffer(int fd, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+    uint32_t miso[FLASH_READ_BATCH_WORDS];
+    uint32_t i, j, n;
 
     if (size == 1) {
         buf[0] = litepcie_flash_read(fd, addr);
 
     } else {
         /* set cs_n */
-        flash_spi_cs(fd, 0);
+        flash_spi_cs(&flash_batch, 0);
 
         /* send cmd */
-        m.tx_len = 32;
-        m.tx_data = ((uint64_t)FLASH_READ << 32) | ((uint64_t)addr << 8);
-        checked_ioctl(fd, LITEPCIE_IOCTL_FLASH, &m);
-
-        /* read bytes */
-        for (i=0; i<size; i+=4) {
-            m.tx_len = 32;
-            checked_ioctl(fd, LITEPCIE_IOCTL_FLASH, &m);
-            buf[i+0] = (m.rx_data >> 24 & 0xff);
-            buf[i+1] = (m.rx_data >> 16 & 0xff);
-            buf[i+2] = (m.rx_data >>  8 & 0xff);
-            buf[i+3] = (m.rx_data >>  0 & 0xff);
+        flash_spi_transfer(&flash_batch, 32, ((uint64_t)FLASH_READ << 32) | ((uint64_t)addr << 8));
+
+        for (i=0; i<size; i+=n) {
+            n = size - i;
+            if (n > FLASH_READ_BATCH_WORDS * 4)
+                n = FLASH_READ_BATCH_WORDS * 4;
+
+            /* read bytes, MOSI keeps the cmd, don't care */
+            for (j=0; j<n; j+=4) {
+                flash_spi_start(&flash_batch, 32);
+                miso[j/4] = litepcie_reg_batch_read(&flash_batch, CSR_FLASH_SPI_MISO_ADDR + 4);
+            }
+
+            /* release cs_n */
+            if (i + n == size)
+                flash_spi_cs(&flash_batch, 1);
+            flash_batch_run(fd);
+
+            for (j=0; j<n; j+=4) {
+                uint32_t rx_data = flash_batch.ops[miso[j/4]].val;
+                buf[i+j+0] = (rx_data >> 24 & 0xff);
+                buf[i+j+1] = (rx_data >> 16 & 0xff);
+                buf[i+j+2] = (rx_data >>  8 & 0xff);
+                buf[i+j+3] = (rx_data >>  0 & 0xff);
+            }
         }
-
-        /* release cs_n */
-        flash_spi_cs(fd, 1);
     }
 }
 
@@ -261,4 +302,125 @@ int litepcie_flash_write(int fd,
     return 0;
 }
 
+/* Fast programming */
+
+#define FLASH_PAGE_SIZE      256
+#define FLASH_ERASE_POLL_US  100 /* erases take 100s of ms, page programs are polled without sleeping */
+
+static void flash_wait_ready(int fd, int sleep_us)
+{
+    while (flash_read_status(fd) & FLASH_WIP) {
+        if (sleep_us)
+            usleep(sleep_us);
+    }
+}
+
+static void flash_progress_rate(void (*progress_cb)(void *opaque, const char *fmt, ...), void *opaque,
+                                const char *what, uint32_t addr, uint32_t done, int64_t start_ms)
+{
+    int64_t elapsed_ms = get_time_ms() - start_ms;
+
+    if (progress_cb)
+        progress_cb(opaque, "%s @%08x (%.1f KB/s)\r", what, addr,
+                    elapsed_ms > 0 ? done / 1.024 / elapsed_ms : 0.0);
+}
+
+int litepcie_flash_write_fast(int fd,
+                              uint8_t *buf, uint32_t base, uint32_t size,
+                              void (*progress_cb)(void *opaque, const char *fmt, ...),
+                              void *opaque)
+{
+    uint32_t i, j, len;
+    uint32_t skipped = 0, erased = 0, pages = 0, errors = 0;
+    uint8_t *cur;
+    int64_t start_ms;
+
+    /* Page streaming needs software CS, otherwise the byte by byte path it is. */
+    if (litepcie_flash_get_flash_program_size(fd) != FLASH_PAGE_SIZE)
+        return litepcie_flash_write(fd, buf, base, size, progress_cb, opaque);
+
+    /* Erases are whole sectors, so the range must start on one. */
+    if ((base % FLASH_SECTOR_SIZE) || (size % FLASH_PAGE_SIZE)) {
+        fprintf(stderr, "Flash range must start on a sector and be a multiple of %d bytes\n",
+                FLASH_PAGE_SIZE);
+        return 1;
+    }
+
+    cur = malloc(FLASH_SECTOR_SIZE);
+    if (!cur) {
+        fprintf(stderr, "Failed to allocate flash sector buffer\n");
+        return 1;
+    }
+
+    /* dummy command because in some case the first erase does not
+       work. */
+    flash_read_id(fd, 0);
+
+    start_ms = get_time_ms();
+    for (i = 0; i < size; i += len) {
+        len = size - i;
+        if (len > FLASH_SECTOR_SIZE)
+            len = FLASH_SECTOR_SIZE;
+        flash_progress_rate(progress_cb, opaque, "Writing", base + i, i, start_ms);
+
+        /* Diff against what is there: skip the sector, program it in place
+           (only 1 -> 0 bits), or erase it first. */
+        litepcie_flash_read_buffer(fd, base + i, cur, len);
+        if (memcmp(cur, buf + i, len) == 0) {
+            skipped++;
+            continue;
+        }
+        for (j = 0; j < len; j++) {
+            if ((cur[j] & buf[i + j]) != buf[i + j])
+                break;
+        }
+        if (j < len) {
+            flash_write_enable(fd);
+            flash_erase_sector(fd, base + i);
+            flash_wait_ready(fd, FLASH_ERASE_POLL_US);
+            memset(cur, 0xff, len);
+            erased++;
+        }
+
+        /* Program the pages that differ, erased pages left as they are. */
+        for (j = 0; j < len; j += FLASH_PAGE_SIZE) {
+            if (memcmp(cur + j, buf + i + j, FLASH_PAGE_SIZE) == 0)
+                continue;
+            flash_write_enable(fd);
+            flash_write_buffer(fd, base + i + j, buf + i + j, FLASH_PAGE_SIZE);
+            flash_wait_ready(fd, 0);
+            pages++;
+        }
+    }
+    flash_write_disable(fd);
+    if (progress_cb) {
+        progress_cb(opaque, "\n%u sectors: %u unchanged, %u erased, %u pages programmed in %.1f s\n",
+                    (size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE, skipped, erased, pages,
+                    (get_time_ms() - start_ms) / 1000.0);
+    }
+
+    /* Verify everything in one pass at the end. */
+    start_ms = get_time_ms();
+    for (i = 0; i < size; i += len) {
+        len = size - i;
+        if (len > FLASH_SECTOR_SIZE)
+            len = FLASH_SECTOR_SIZE;
+        flash_progress_rate(progress_cb, opaque, "Verifying", base + i, i, start_ms);
+        litepcie_flash_read_buffer(fd, base + i, cur, len);
+        for (j = 0; j < len; j += FLASH_PAGE_SIZE) {
+            if (memcmp(cur + j, buf + i + j, FLASH_PAGE_SIZE) != 0) {
+                if (progress_cb)
+                    progress_cb(opaque, "\nVerify failed @%08x\n", base + i + j);
+                errors++;
+            }
+        }
+    }
+    if (progress_cb) {
+        progress_cb(opaque, "\n");
+    }
+
+    free(cur);
+    return errors;
+}
+
 #endif
@@ -35,4 +35,14 @@ int litepcie_flash_write(int fd,
                          void (*progress_cb)(void *opaque, const char *fmt, ...),
                          void *opaque);
 
+/* Faster litepcie_flash_write(): sectors already holding buf are skipped, the
+ * others are only erased when a bit must go 0 -> 1, unchanged pages are not
+ * programmed, WIP is polled without sleeping and the whole range is verified
+ * in one read at the end. base is sector aligned and size a multiple of the
+ * page size (256). Returns the number of pages failing verification. */
+int litepcie_flash_write_fast(int fd,
+                              uint8_t *buf, uint32_t base, uint32_t size,
+                              void (*progress_cb)(void *opaque, const char *fmt, ...),
+                              void *opaque);
+
 #endif //LITEPCIE_LIB_FLASH_H
@@ -14,9 +14,38 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "litepcie_helpers.h"
 #include "litepcie.h"
 
+/* BAR0 mappings registered with litepcie_reg_mmap(). */
+#define LITEPCIE_REG_MAPS_MAX 16
+
+struct litepcie_reg_map {
+    int fd;
+    int writable;
+    volatile uint8_t *bar0; /* NULL: free slot */
+    size_t size;
+};
+
+static struct litepcie_reg_map litepcie_reg_maps[LITEPCIE_REG_MAPS_MAX];
+
+static struct litepcie_reg_map *litepcie_reg_map_find(int fd)
+{
+    int i;
+
+    for (i = 0; i < LITEPCIE_REG_MAPS_MAX; i++) {
+        if (litepcie_reg_maps[i].bar0 && litepcie_reg_maps[i].fd == fd)
+            return &litepcie_reg_maps[i];
+    }
+    return NULL;
+}
+
+static inline volatile uint32_t *litepcie_reg_map_addr(struct litepcie_reg_map *map, uint32_t addr)
+{
+    return (volatile uint32_t *)(map->bar0 + (addr - CSR_BASE));
+}
+
 int64_t get_time_ms(void)
 {
     struct timespec ts;
@@ -25,7 +54,11 @@ int64_t get_time_ms(void)
 }
 
 uint32_t litepcie_readl(int fd, uint32_t addr) {
+    struct litepcie_reg_map *map = litepcie_reg_map_find(fd);
     struct litepcie_ioctl_reg m;
+
+    if (map)
+        return *litepcie_reg_map_addr(map, addr);
     m.is_write = 0;
     m.addr = addr;
     checked_ioctl(fd, LITEPCIE_IOCTL_REG, &m);
@@ -33,13 +66,166 @@ uint32_t litepcie_readl(int fd, uint32_t addr) {
 }
 
 void litepcie_writel(int fd, uint32_t addr, uint32_t val) {
+    struct litepcie_reg_map *map = litepcie_reg_map_find(fd);
     struct litepcie_ioctl_reg m;
+
+    if (map && map->writable) {
+        *litepcie_reg_map_addr(map, addr) = val;
+        return;
+    }
     m.is_write = 1;
     m.addr = addr;
     m.val = val;
     checked_ioctl(fd, LITEPCIE_IOCTL_REG, &m);
 }
 
+int litepcie_reg_mmap(int fd)
+{
+    struct litepcie_ioctl_mmap_bar0_info info;
+    struct litepcie_reg_map *map = litepcie_reg_map_find(fd);
+    void *bar0;
+    int i, writable = 1;
+
+    if (map)
+        return map->writable;
+    for (i = 0; i < LITEPCIE_REG_MAPS_MAX && litepcie_reg_maps[i].bar0; i++)
+        ;
+    if (i == LITEPCIE_REG_MAPS_MAX)
+        return -1;
+    if (ioctl(fd, LITEPCIE_IOCTL_MMAP_BAR0_INFO, &info) < 0)
+        return -1;
+
+    /* Writable needs CAP_SYS_RAWIO, fall back to read-only. */
+    bar0 = mmap(NULL, info.bar0_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, info.bar0_offset);
+    if (bar0 == MAP_FAILED) {
+        writable = 0;
+        bar0 = mmap(NULL, info.bar0_size, PROT_READ, MAP_SHARED, fd, info.bar0_offset);
+        if (bar0 == MAP_FAILED)
+            return -1;
+    }
+
+    litepcie_reg_maps[i].fd = fd;
+    litepcie_reg_maps[i].writable = writable;
+    litepcie_reg_maps[i].size = info.bar0_size;
+    litepcie_reg_maps[i].bar0 = bar0;
+    return writable;
+}
+
+void litepcie_reg_munmap(int fd)
+{
+    struct litepcie_reg_map *map = litepcie_reg_map_find(fd);
+
+    if (!map)
+        return;
+    munmap((void *)map->bar0, map->size);
+    map->bar0 = NULL;
+}
+
+void litepcie_reg_batch_init(struct litepcie_reg_batch *b)
+{
+    b->count = 0;
+    b->done = 0;
+}
+
+static struct litepcie_reg_op *litepcie_reg_batch_add(struct litepcie_reg_batch *b,
+                                                      uint8_t op, uint32_t addr)
+{
+    struct litepcie_reg_op *o;
+
+    if (b->count == LITEPCIE_REG_OPS_MAX) {
+        fprintf(stderr, "Register batch full (%d ops)\n", LITEPCIE_REG_OPS_MAX);
+        abort();
+    }
+    o = &b->ops[b->count++];
+    memset(o, 0, sizeof(*o));
+    o->op = op;
+    o->addr = addr;
+    return o;
+}
+
+uint32_t litepcie_reg_batch_read(struct litepcie_reg_batch *b, uint32_t addr)
+{
+    litepcie_reg_batch_add(b, LITEPCIE_REG_OP_READ, addr);
+    return b->count - 1;
+}
+
+void litepcie_reg_batch_write(struct litepcie_reg_batch *b, uint32_t addr, uint32_t val)
+{
+    litepcie_reg_batch_add(b, LITEPCIE_REG_OP_WRITE, addr)->val = val;
+}
+
+void litepcie_reg_batch_poll(struct litepcie_reg_batch *b, uint32_t addr,
+                             uint32_t mask, uint32_t expect, uint32_t timeout_us)
+{
+    struct litepcie_reg_op *o = litepcie_reg_batch_add(b, LITEPCIE_REG_OP_POLL, addr);
+
+    o->mask = mask;
+    o->expect = expect;
+    o->timeout_us = timeout_us;
+}
+
+static uint64_t litepcie_reg_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Run the batch op by op, through the mapping or single REG ioctls. */
+static int litepcie_reg_batch_run_local(int fd, struct litepcie_reg_batch *b)
+{
+    struct litepcie_reg_op *o;
+    uint64_t deadline;
+
+    for (b->done = 0; b->done < b->count; b->done++) {
+        o = &b->ops[b->done];
+        switch (o->op) {
+        case LITEPCIE_REG_OP_READ:
+            o->val = litepcie_readl(fd, o->addr);
+            break;
+        case LITEPCIE_REG_OP_WRITE:
+            litepcie_writel(fd, o->addr, o->val);
+            break;
+        case LITEPCIE_REG_OP_POLL:
+            deadline = litepcie_reg_time_us() + o->timeout_us;
+            while (((o->val = litepcie_readl(fd, o->addr)) & o->mask) != o->expect) {
+                if (litepcie_reg_time_us() >= deadline) {
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+            }
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int litepcie_reg_batch_run(int fd, struct litepcie_reg_batch *b)
+{
+    struct litepcie_reg_map *map = litepcie_reg_map_find(fd);
+    struct litepcie_ioctl_reg_batch m;
+    int ret;
+
+    if (b->count == 0)
+        return 0;
+    /* Writable mapping: no syscall at all. */
+    if (map && map->writable)
+        return litepcie_reg_batch_run_local(fd, b);
+
+    m.ops = (uintptr_t)b->ops;
+    m.count = b->count;
+    m.done = 0;
+    ret = ioctl(fd, LITEPCIE_IOCTL_REG_BATCH, &m);
+    b->done = m.done;
+    /* Older driver without batches. */
+    if (ret < 0 && errno == ENOTTY)
+        return litepcie_reg_batch_run_local(fd, b);
+    return ret < 0 ? -1 : 0;
+}
+
 void litepcie_reload(int fd) {
     struct litepcie_ioctl_icap m;
     m.addr = 0x4;
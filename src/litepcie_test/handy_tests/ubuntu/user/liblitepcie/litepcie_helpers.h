@@ -13,6 +13,7 @@
 
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include "litepcie.h"
 
 int64_t get_time_ms(void);
 
@@ -20,6 +21,29 @@ uint32_t litepcie_readl(int fd, uint32_t addr);
 void litepcie_writel(int fd, uint32_t addr, uint32_t val);
 void litepcie_reload(int fd);
 
+/* Map BAR0 so that litepcie_readl()/litepcie_writel() and register batches on
+ * fd skip the ioctls: reads always, writes only when the mapping is writable
+ * (CAP_SYS_RAWIO). Returns 1 writable, 0 read-only, -1 not mapped. */
+int litepcie_reg_mmap(int fd);
+void litepcie_reg_munmap(int fd);
+
+/* Register batches: queue ops, then run them in one LITEPCIE_IOCTL_REG_BATCH
+ * (or straight on a writable BAR0 mapping). Read results are in
+ * ops[index].val, index being what litepcie_reg_batch_read() returned. */
+struct litepcie_reg_batch {
+    struct litepcie_reg_op ops[LITEPCIE_REG_OPS_MAX];
+    uint32_t count;
+    uint32_t done; /* ops completed by the last run */
+};
+
+void litepcie_reg_batch_init(struct litepcie_reg_batch *b);
+uint32_t litepcie_reg_batch_read(struct litepcie_reg_batch *b, uint32_t addr);
+void litepcie_reg_batch_write(struct litepcie_reg_batch *b, uint32_t addr, uint32_t val);
+void litepcie_reg_batch_poll(struct litepcie_reg_batch *b, uint32_t addr,
+                             uint32_t mask, uint32_t expect, uint32_t timeout_us);
+/* Returns 0, or -1 with errno (ETIMEDOUT: poll ops[done] expired). */
+int litepcie_reg_batch_run(int fd, struct litepcie_reg_batch *b);
+
 #define checked_ioctl(...) _check_ioctl(ioctl(__VA_ARGS__), __FILE__, __LINE__)
 void _check_ioctl(int status, const char *file, int line);
 
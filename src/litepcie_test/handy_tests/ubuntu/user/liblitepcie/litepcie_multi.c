@@ -0,0 +1,322 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "litepcie_multi.h"
+
+/* Longest a poller sleeps without a DMA event: bounds how late the RX
+ * releases and TX submissions of an idle device reach the driver. */
+#define LITEPCIE_MULTI_POLL_MS 10
+
+static void litepcie_multi_efd_drain(int efd)
+{
+    uint64_t value;
+
+    if (read(efd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        perror("eventfd read");
+}
+
+static void *litepcie_multi_poller_func(void *arg)
+{
+    struct litepcie_multi_poller *p = arg;
+    struct litepcie_multi *m = p->multi;
+    struct epoll_event events[2 * LITEPCIE_MULTI_DEVICES_MAX];
+    struct litepcie_dma_ctrl *dma;
+    uint64_t one = 1;
+    int64_t head;
+    int i, n, fresh;
+
+    if (m->config.poller_cpus) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(m->config.poller_cpus[p->index], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            fprintf(stderr, "Could not pin poller %d to CPU %d\n", p->index, m->config.poller_cpus[p->index]);
+    }
+
+    while (!__atomic_load_n(&m->stop, __ATOMIC_RELAXED)) {
+        n = epoll_wait(p->epfd, events, 2 * LITEPCIE_MULTI_DEVICES_MAX, LITEPCIE_MULTI_POLL_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        if (n > 0)
+            __atomic_store_n(&p->wakeups, p->wakeups + 1, __ATOMIC_RELAXED);
+        for (i = 0; i < n; i++)
+            litepcie_multi_efd_drain(events[i].data.fd);
+
+        /* publish hw_counts, forward the consumers' progress (never sleeps: nonblock) */
+        fresh = 0;
+        for (i = p->index; i < m->count; i += m->pollers) {
+            dma = &m->dev[i].dma;
+            head = dma->rx.head;
+            litepcie_dma_process(dma);
+            fresh |= dma->rx.head != head;
+        }
+        if (fresh && write(m->rx_efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("eventfd write");
+    }
+
+    return NULL;
+}
+
+static int litepcie_multi_watch(struct litepcie_multi *m, int index, int efd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = efd;
+    if (epoll_ctl(m->poller[index % m->pollers].epfd, EPOLL_CTL_ADD, efd, &ev)) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+int litepcie_multi_init(struct litepcie_multi *m, const char *const *devices, int count,
+                        const struct litepcie_multi_config *config)
+{
+    struct litepcie_multi_dev *dev;
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    m->config = *config;
+    m->rx_efd = -1;
+    if (count < 1 || count > LITEPCIE_MULTI_DEVICES_MAX) {
+        fprintf(stderr, "Invalid device count: %d (1 to %d)\n", count, LITEPCIE_MULTI_DEVICES_MAX);
+        return -1;
+    }
+    m->pollers = config->pollers > 0 ? config->pollers : 1;
+    if (m->pollers > LITEPCIE_MULTI_POLLERS_MAX)
+        m->pollers = LITEPCIE_MULTI_POLLERS_MAX;
+    if (m->pollers > count)
+        m->pollers = count;
+    for (i = 0; i < m->pollers; i++)
+        m->poller[i].epfd = -1;
+
+    m->rx_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m->rx_efd < 0) {
+        fprintf(stderr, "Could not create eventfd: %s\n", strerror(errno));
+        goto fail;
+    }
+    for (i = 0; i < m->pollers; i++) {
+        m->poller[i].multi = m;
+        m->poller[i].index = i;
+        m->poller[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (m->poller[i].epfd < 0) {
+            fprintf(stderr, "Could not create epoll: %s\n", strerror(errno));
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        dev = &m->dev[i];
+        snprintf(dev->device, sizeof(dev->device), "%s", devices[i]);
+        dev->rx_efd = dev->tx_efd = -1;
+        dev->dma.use_reader = config->use_reader;
+        dev->dma.use_writer = config->use_writer;
+        dev->dma.loopback = config->loopback;
+        dev->dma.buffer_size = config->buffer_size;
+        dev->dma.buffer_count = config->buffer_count;
+        dev->dma.buffer_per_irq = config->buffer_per_irq;
+        /* pollers own the counters, the consumer and producers only touch the handoff rings */
+        dev->dma.use_ctrl_page = 1;
+        dev->dma.handoff = 1;
+        dev->dma.nonblock = 1;
+        dev->dma.use_timestamps = 1;
+        if (litepcie_dma_init(&dev->dma, dev->device, 1)) {
+            fprintf(stderr, "%s: DMA init failed\n", dev->device);
+            goto fail;
+        }
+        m->count++;
+
+        if (config->use_writer) {
+            dev->rx_efd = litepcie_dma_notify_fd(&dev->dma, 1, config->watermark);
+            if (dev->rx_efd < 0 || litepcie_multi_watch(m, i, dev->rx_efd))
+                goto fail;
+        }
+        if (config->use_reader) {
+            /* TX readiness stops at half a ring */
+            dev->tx_efd = litepcie_dma_notify_fd(&dev->dma, 0,
+                config->watermark < dev->dma.buffer_count / 2 ? config->watermark : dev->dma.buffer_count / 2);
+            if (dev->tx_efd < 0 || litepcie_multi_watch(m, i, dev->tx_efd))
+                goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    litepcie_multi_cleanup(m);
+    return -1;
+}
+
+int litepcie_multi_start(struct litepcie_multi *m)
+{
+    int i;
+
+    /* the pollers issue the enable ioctls on their first pass */
+    for (i = 0; i < m->count; i++) {
+        m->dev[i].dma.writer_enable = m->config.use_writer;
+        m->dev[i].dma.reader_enable = m->config.use_reader;
+    }
+
+    m->stop = 0;
+    for (i = 0; i < m->pollers; i++) {
+        if (pthread_create(&m->poller[i].thread, NULL, litepcie_multi_poller_func, &m->poller[i])) {
+            fprintf(stderr, "Could not start poller %d\n", i);
+            __atomic_store_n(&m->stop, 1, __ATOMIC_RELAXED);
+            while (i--)
+                pthread_join(m->poller[i].thread, NULL);
+            return -1;
+        }
+    }
+    m->running = 1;
+
+    return 0;
+}
+
+void litepcie_multi_cleanup(struct litepcie_multi *m)
+{
+    struct litepcie_multi_dev *dev;
+    int i;
+
+    if (m->running) {
+        __atomic_store_n(&m->stop, 1, __ATOMIC_RELAXED);
+        for (i = 0; i < m->pollers; i++)
+            pthread_join(m->poller[i].thread, NULL);
+        m->running = 0;
+    }
+
+    /* closing the devices also drops their eventfd registrations */
+    for (i = 0; i < m->count; i++) {
+        dev = &m->dev[i];
+        litepcie_dma_cleanup(&dev->dma);
+        if (dev->rx_efd >= 0)
+            close(dev->rx_efd);
+        if (dev->tx_efd >= 0)
+            close(dev->tx_efd);
+    }
+    m->count = 0;
+    for (i = 0; i < m->pollers; i++)
+        if (m->poller[i].epfd >= 0)
+            close(m->poller[i].epfd);
+    m->pollers = 0;
+    if (m->rx_efd >= 0)
+        close(m->rx_efd);
+    m->rx_efd = -1;
+}
+
+int litepcie_multi_rx_acquire(struct litepcie_multi *m, struct litepcie_multi_buffer *b)
+{
+    struct litepcie_multi_dev *dev, *best = NULL;
+    uint64_t ts, best_ts = 0;
+    char *buf, *best_buf = NULL;
+    int i, j;
+
+    /* tagged: first ready device after the last one served; ordered: oldest head buffer */
+    for (j = 0; j < m->count; j++) {
+        i = (m->rx_cursor + j) % m->count;
+        dev = &m->dev[i];
+        if (!dev->dma.use_writer ||
+            __atomic_load_n(&dev->dma.rx.head, __ATOMIC_ACQUIRE) - dev->rx_next <= 0)
+            continue;
+        buf = dev->dma.buf_rd + (size_t)(dev->rx_next % dev->dma.buffer_count) * dev->dma.buffer_size;
+        ts = litepcie_dma_buffer_ts(&dev->dma, buf);
+        if (!best || ts < best_ts) {
+            best = dev;
+            best_buf = buf;
+            best_ts = ts;
+        }
+        if (!m->config.ordered)
+            break;
+    }
+    if (!best)
+        return 0;
+
+    b->buf = best_buf;
+    b->size = best->dma.buffer_size;
+    b->device = best - m->dev;
+    b->seq = best->rx_next++;
+    b->ts = best_ts;
+    m->rx_cursor = (b->device + 1) % m->count;
+    return 1;
+}
+
+void litepcie_multi_rx_release(struct litepcie_multi *m, const struct litepcie_multi_buffer *b)
+{
+    litepcie_dma_rx_release(&m->dev[b->device].dma);
+}
+
+int litepcie_multi_rx_wait(struct litepcie_multi *m, int timeout_ms)
+{
+    struct pollfd fds = { .fd = m->rx_efd, .events = POLLIN };
+    int ret;
+
+    ret = poll(&fds, 1, timeout_ms);
+    if (ret <= 0)
+        return 0;
+    litepcie_multi_efd_drain(m->rx_efd);
+    return 1;
+}
+
+char *litepcie_multi_tx_acquire(struct litepcie_multi *m, int device)
+{
+    return litepcie_dma_tx_acquire(&m->dev[device].dma);
+}
+
+void litepcie_multi_tx_release(struct litepcie_multi *m, int device)
+{
+    litepcie_dma_tx_release(&m->dev[device].dma);
+}
+
+static void litepcie_multi_dev_stats(struct litepcie_multi *m, int device, struct litepcie_multi_stats *stats)
+{
+    struct litepcie_multi_dev *dev = &m->dev[device];
+    struct litepcie_ioctl_dma_irq_stats irq;
+    int64_t rx, tx;
+
+    rx = __atomic_load_n(&dev->dma.rx.tail, __ATOMIC_RELAXED);
+    tx = __atomic_load_n(&dev->dma.tx.tail, __ATOMIC_RELAXED);
+    stats->rx_buffers += rx;
+    stats->rx_bytes += rx * dev->dma.buffer_size;
+    stats->tx_buffers += tx;
+    stats->tx_bytes += tx * dev->dma.buffer_size;
+    if (dev->dma.ctrl)
+        stats->rx_overflows += __atomic_load_n(&dev->dma.ctrl->writer_overflows, __ATOMIC_RELAXED);
+    if (!litepcie_dma_irq_stats(dev->dma.fds.fd, &irq))
+        stats->irqs += irq.writer_irqs + irq.reader_irqs;
+}
+
+void litepcie_multi_stats(struct litepcie_multi *m, int device, struct litepcie_multi_stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    if (device >= 0) {
+        litepcie_multi_dev_stats(m, device, stats);
+        stats->wakeups = __atomic_load_n(&m->poller[device % m->pollers].wakeups, __ATOMIC_RELAXED);
+        return;
+    }
+    for (i = 0; i < m->count; i++)
+        litepcie_multi_dev_stats(m, i, stats);
+    for (i = 0; i < m->pollers; i++)
+        stats->wakeups += __atomic_load_n(&m->poller[i].wakeups, __ATOMIC_RELAXED);
+}
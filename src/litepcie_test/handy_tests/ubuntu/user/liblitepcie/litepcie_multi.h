@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef LITEPCIE_LIB_MULTI_H
+#define LITEPCIE_LIB_MULTI_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "litepcie_dma.h"
+
+#define LITEPCIE_MULTI_DEVICES_MAX 32
+#define LITEPCIE_MULTI_POLLERS_MAX 8
+
+/* Several channels (of one or more boards) in zero-copy handoff mode, driven
+ * by a few poller threads that wait on the DMA eventfds with epoll. Device i
+ * goes to poller i % pollers. One consumer thread takes the RX buffers of all
+ * devices as a single stream; TX uses the per-device handoff calls. */
+
+struct litepcie_multi_config {
+    uint8_t use_reader, use_writer, loopback;
+    uint8_t ordered;      /* RX stream in completion time order across devices, else tagged round-robin */
+    uint32_t buffer_size, buffer_count, buffer_per_irq; /* 0 keeps the driver's */
+    uint32_t watermark;   /* buffers per eventfd wakeup, 0: driver default */
+    int pollers;          /* poller threads, 0: 1 */
+    const int *poller_cpus; /* pollers entries, NULL: not pinned */
+};
+
+/* One RX buffer of the merged stream */
+struct litepcie_multi_buffer {
+    char *buf;
+    uint32_t size;
+    int device;           /* index in the device list */
+    int64_t seq;          /* buffer number on that device */
+    uint64_t ts;          /* completion time (CLOCK_MONOTONIC ns) */
+};
+
+struct litepcie_multi_stats {
+    int64_t rx_buffers, rx_bytes; /* released by the consumer */
+    int64_t rx_overflows;         /* overwritten before release */
+    int64_t tx_buffers, tx_bytes; /* fetched by the FPGA */
+    int64_t irqs;                 /* DMA MSIs */
+    int64_t wakeups;              /* poller epoll wakeups */
+};
+
+struct litepcie_multi_dev {
+    char device[256];
+    struct litepcie_dma_ctrl dma;
+    int rx_efd, tx_efd;           /* -1: unused */
+    int64_t rx_next;              /* consumer: next buffer to acquire (rx.tail <= rx_next <= rx.head) */
+};
+
+struct litepcie_multi_poller {
+    pthread_t thread;
+    struct litepcie_multi *multi;
+    int index;
+    int epfd;
+    int64_t wakeups;
+};
+
+struct litepcie_multi {
+    struct litepcie_multi_config config;
+    int count;
+    struct litepcie_multi_dev dev[LITEPCIE_MULTI_DEVICES_MAX];
+    int pollers;
+    struct litepcie_multi_poller poller[LITEPCIE_MULTI_POLLERS_MAX];
+    int running, stop;
+    int rx_efd;                   /* signalled by the pollers on new RX buffers */
+    int rx_cursor;                /* round-robin start of the tagged stream */
+};
+
+/* Open and map devices[0..count-1]. Returns 0, or -1 with everything closed. */
+int litepcie_multi_init(struct litepcie_multi *m, const char *const *devices, int count,
+                        const struct litepcie_multi_config *config);
+/* Enable the DMAs and start the pollers. */
+int litepcie_multi_start(struct litepcie_multi *m);
+/* Stop the pollers and the DMAs, then close everything. */
+void litepcie_multi_cleanup(struct litepcie_multi *m);
+
+/* Consumer thread only. Acquire returns 1 with the next RX buffer, 0 if
+ * none is ready. Buffers may be held, but must be released in acquire order
+ * per device. Wait sleeps until new buffers may be ready (1) or timeout (0). */
+int litepcie_multi_rx_acquire(struct litepcie_multi *m, struct litepcie_multi_buffer *b);
+void litepcie_multi_rx_release(struct litepcie_multi *m, const struct litepcie_multi_buffer *b);
+int litepcie_multi_rx_wait(struct litepcie_multi *m, int timeout_ms);
+
+/* TX producer of a device (one thread per device). */
+char *litepcie_multi_tx_acquire(struct litepcie_multi *m, int device);
+void litepcie_multi_tx_release(struct litepcie_multi *m, int device);
+
+/* Counters since start: one device, or all merged with device -1. */
+void litepcie_multi_stats(struct litepcie_multi *m, int device, struct litepcie_multi_stats *stats);
+
+#endif /* LITEPCIE_LIB_MULTI_H */
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#define _GNU_SOURCE /* sched_getaffinity, pthread_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "litepcie_numa.h"
+
+int litepcie_numa_node(const char *device)
+{
+    const char *name = strrchr(device, '/');
+    char path[256];
+    FILE *f;
+    int node = -1;
+
+    name = name ? name + 1 : device;
+    snprintf(path, sizeof(path), "/sys/class/litepcie/%s/numa_node", name);
+    f = fopen(path, "r");
+    if (!f) {
+        /* Drivers without the attribute: the PCI device's own */
+        snprintf(path, sizeof(path), "/sys/class/litepcie/%s/device/numa_node", name);
+        f = fopen(path, "r");
+    }
+    if (!f)
+        return -1;
+    if (fscanf(f, "%d", &node) != 1)
+        node = -1;
+    fclose(f);
+    return node;
+}
+
+/* Parse a sysfs CPU list ("0-7,16-23") into set. */
+static int litepcie_cpulist_read(const char *path, cpu_set_t *set)
+{
+    char line[4096], *s, *end;
+    long first, last;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    CPU_ZERO(set);
+    for (s = line; *s && *s != '\n'; s = end) {
+        first = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET(first, set);
+        if (*end == ',')
+            end++;
+    }
+    return 0;
+}
+
+int litepcie_placement_init(struct litepcie_placement *p, const char *device)
+{
+    cpu_set_t allowed, local;
+    char path[128];
+    int cpu;
+
+    memset(p, 0, sizeof(*p));
+    p->node = litepcie_numa_node(device);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return -1;
+    if (p->node >= 0) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", p->node);
+        if (!litepcie_cpulist_read(path, &local)) {
+            CPU_AND(&local, &local, &allowed);
+            /* Node CPUs all excluded (taskset, cgroup): stay where allowed */
+            if (CPU_COUNT(&local))
+                allowed = local;
+        }
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE && p->cpu_count < LITEPCIE_PLACEMENT_CPUS_MAX; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            p->cpus[p->cpu_count++] = cpu;
+
+    return p->cpu_count ? 0 : -1;
+}
+
+int litepcie_placement_cpu(const struct litepcie_placement *p, int n)
+{
+    if (p->cpu_count <= 0 || n < 0)
+        return -1;
+    return p->cpus[n % p->cpu_count];
+}
+
+int litepcie_placement_pin(const struct litepcie_placement *p, int n)
+{
+    int cpu = litepcie_placement_cpu(p, n);
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        return -1;
+    return cpu;
+}
+
+void *litepcie_placement_alloc(const struct litepcie_placement *p, size_t size)
+{
+    unsigned long mask[4];
+    void *buf;
+
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        return NULL;
+
+    /* Prefer the node before the first touch places the pages; without
+     * NUMA support the kernel refuses and the default policy applies. */
+    if (p->node >= 0 && p->node < (int)(8 * sizeof(mask))) {
+        memset(mask, 0, sizeof(mask));
+        mask[p->node / (8 * sizeof(mask[0]))] |= 1UL << (p->node % (8 * sizeof(mask[0])));
+        syscall(SYS_mbind, buf, size, MPOL_PREFERRED, mask, 8 * sizeof(mask) + 1, 0);
+    }
+
+    return buf;
+}
+
+void litepcie_placement_free(void *buf, size_t size)
+{
+    if (buf)
+        munmap(buf, size);
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef LITEPCIE_LIB_NUMA_H
+#define LITEPCIE_LIB_NUMA_H
+
+#include <stddef.h>
+
+#define LITEPCIE_PLACEMENT_CPUS_MAX 1024
+
+/* CPUs and memory local to a device: the online CPUs of its NUMA node that
+ * the process may run on. Without NUMA information (node -1, or a driver
+ * without the numa_node attribute) these are all the allowed CPUs. */
+struct litepcie_placement {
+    int node;
+    int cpu_count;
+    int cpus[LITEPCIE_PLACEMENT_CPUS_MAX];
+};
+
+/* NUMA node of a device (e.g. "/dev/litepcie0") from sysfs, -1 if unknown. */
+int litepcie_numa_node(const char *device);
+
+/* Returns 0, or -1 when no CPU at all could be found. */
+int litepcie_placement_init(struct litepcie_placement *p, const char *device);
+
+/* n-th local CPU, wrapping around the node. */
+int litepcie_placement_cpu(const struct litepcie_placement *p, int n);
+
+/* Pin the calling thread to the n-th local CPU. Returns the CPU, or -1. */
+int litepcie_placement_pin(const struct litepcie_placement *p, int n);
+
+/* Page-aligned, zeroed staging memory on the device's node (any node if
+ * unknown). Free with litepcie_placement_free(). Returns NULL on failure. */
+void *litepcie_placement_alloc(const struct litepcie_placement *p, size_t size);
+void litepcie_placement_free(void *buf, size_t size);
+
+#endif /* LITEPCIE_LIB_NUMA_H */
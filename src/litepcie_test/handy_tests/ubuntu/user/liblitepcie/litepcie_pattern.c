@@ -0,0 +1,338 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "litepcie_pattern.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LITEPCIE_PATTERN_X86
+#include <immintrin.h>
+#endif
+
+#define PATTERN_MUL 69069
+
+enum {
+    PATTERN_ISA_SCALAR,
+    PATTERN_ISA_AVX2,
+    PATTERN_ISA_AVX512,
+};
+
+/* Scalar reference */
+/*------------------*/
+
+/* words [i, n) of the PN sequence: fill out, or count mismatches against in */
+static unsigned pn_scalar(const uint32_t *in, uint32_t *out, unsigned i, unsigned n, unsigned count,
+    uint32_t *pseed, uint32_t mask)
+{
+    uint32_t seed = *pseed;
+    uint32_t data;
+    unsigned errors = 0;
+
+    for (; i < n; i++) {
+        data = (seed * PATTERN_MUL + 1) & mask;
+        if (out)
+            out[i] = data;
+        else if ((in[i] & mask) != data)
+            errors++;
+        seed += 1;
+        if (seed >= count)
+            seed -= count;
+    }
+    *pseed = seed;
+    return errors;
+}
+
+static size_t lcg_scalar(const uint32_t *in, uint32_t *out, size_t i, size_t n, uint32_t *pseed)
+{
+    uint32_t seed = *pseed;
+    size_t errors = 0;
+
+    for (; i < n; i++) {
+        seed = seed * PATTERN_MUL + 1;
+        if (out)
+            out[i] = seed;
+        else if (in[i] != seed)
+            errors++;
+    }
+    *pseed = seed;
+    return errors;
+}
+
+void litepcie_pn_fill_scalar(uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    pn_scalar(NULL, buf, 0, count, count, pseed, mask);
+}
+
+unsigned litepcie_pn_check_scalar(const uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    return pn_scalar(buf, NULL, 0, count, count, pseed, mask);
+}
+
+void litepcie_lcg_fill_scalar(uint32_t *buf, size_t count, uint32_t *pseed)
+{
+    lcg_scalar(NULL, buf, 0, count, pseed);
+}
+
+size_t litepcie_lcg_check_scalar(const uint32_t *buf, size_t count, uint32_t *pseed)
+{
+    return lcg_scalar(buf, NULL, 0, count, pseed);
+}
+
+/* LCG jump-ahead: state(k + lanes) = state(k) * mul + add */
+static void lcg_jump(unsigned lanes, uint32_t *mul, uint32_t *add)
+{
+    unsigned j;
+
+    *mul = 1;
+    *add = 0;
+    for (j = 0; j < lanes; j++) {
+        *mul *= PATTERN_MUL;
+        *add = *add * PATTERN_MUL + 1;
+    }
+}
+
+#ifdef LITEPCIE_PATTERN_X86
+
+/* AVX2: 8 words per step */
+/*-----------------------*/
+
+__attribute__((target("avx2")))
+static unsigned pn_avx2(const uint32_t *in, uint32_t *out, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    const __m256i vmul   = _mm256_set1_epi32(PATTERN_MUL);
+    const __m256i vone   = _mm256_set1_epi32(1);
+    const __m256i vmask  = _mm256_set1_epi32(mask);
+    const __m256i vstep  = _mm256_set1_epi32(8);
+    const __m256i vcount = _mm256_set1_epi32(count);
+    const __m256i vlast  = _mm256_set1_epi32(count - 1);
+    __m256i seed, data;
+    unsigned i, errors = 0;
+
+    /* one seed per lane, wrapped modulo count (count >= 8 and < 2^31) */
+    seed = _mm256_add_epi32(_mm256_set1_epi32(*pseed), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    seed = _mm256_sub_epi32(seed, _mm256_and_si256(_mm256_cmpgt_epi32(seed, vlast), vcount));
+    for (i = 0; i + 8 <= count; i += 8) {
+        data = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(seed, vmul), vone), vmask);
+        if (out) {
+            _mm256_storeu_si256((__m256i *)(out + i), data);
+        } else {
+            __m256i word = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(in + i)), vmask);
+            errors += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(word, data))));
+        }
+        seed = _mm256_add_epi32(seed, vstep);
+        seed = _mm256_sub_epi32(seed, _mm256_and_si256(_mm256_cmpgt_epi32(seed, vlast), vcount));
+    }
+    *pseed = _mm256_cvtsi256_si32(seed);
+    return errors + pn_scalar(in, out, i, count, count, pseed, mask);
+}
+
+__attribute__((target("avx2")))
+static size_t lcg_avx2(const uint32_t *in, uint32_t *out, size_t count, uint32_t *pseed)
+{
+    uint32_t lane[8], mul, add, seed = *pseed;
+    __m256i vmul, vadd, data, last;
+    size_t i, errors = 0;
+    unsigned j;
+
+    for (j = 0; j < 8; j++)
+        lane[j] = seed = seed * PATTERN_MUL + 1;
+    lcg_jump(8, &mul, &add);
+    vmul = _mm256_set1_epi32(mul);
+    vadd = _mm256_set1_epi32(add);
+    data = _mm256_loadu_si256((const __m256i *)lane);
+    last = _mm256_set1_epi32(*pseed);
+    for (i = 0; i + 8 <= count; i += 8) {
+        if (out)
+            _mm256_storeu_si256((__m256i *)(out + i), data);
+        else
+            errors += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(in + i)), data))));
+        last = data;
+        data = _mm256_add_epi32(_mm256_mullo_epi32(data, vmul), vadd);
+    }
+    _mm256_storeu_si256((__m256i *)lane, last);
+    *pseed = lane[7];
+    return errors + lcg_scalar(in, out, i, count, pseed);
+}
+
+/* AVX-512: 16 words per step */
+/*---------------------------*/
+
+__attribute__((target("avx512f")))
+static unsigned pn_avx512(const uint32_t *in, uint32_t *out, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    const __m512i vmul   = _mm512_set1_epi32(PATTERN_MUL);
+    const __m512i vone   = _mm512_set1_epi32(1);
+    const __m512i vmask  = _mm512_set1_epi32(mask);
+    const __m512i vstep  = _mm512_set1_epi32(16);
+    const __m512i vcount = _mm512_set1_epi32(count);
+    const __m512i vlast  = _mm512_set1_epi32(count - 1);
+    __m512i seed, data;
+    unsigned i, errors = 0;
+
+    seed = _mm512_add_epi32(_mm512_set1_epi32(*pseed),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    seed = _mm512_mask_sub_epi32(seed, _mm512_cmpgt_epu32_mask(seed, vlast), seed, vcount);
+    for (i = 0; i + 16 <= count; i += 16) {
+        data = _mm512_and_si512(_mm512_add_epi32(_mm512_mullo_epi32(seed, vmul), vone), vmask);
+        if (out) {
+            _mm512_storeu_si512(out + i, data);
+        } else {
+            __m512i word = _mm512_and_si512(_mm512_loadu_si512(in + i), vmask);
+            errors += __builtin_popcount(_mm512_cmpneq_epu32_mask(word, data));
+        }
+        seed = _mm512_add_epi32(seed, vstep);
+        seed = _mm512_mask_sub_epi32(seed, _mm512_cmpgt_epu32_mask(seed, vlast), seed, vcount);
+    }
+    *pseed = _mm_cvtsi128_si32(_mm512_castsi512_si128(seed));
+    return errors + pn_scalar(in, out, i, count, count, pseed, mask);
+}
+
+__attribute__((target("avx512f")))
+static size_t lcg_avx512(const uint32_t *in, uint32_t *out, size_t count, uint32_t *pseed)
+{
+    uint32_t lane[16], mul, add, seed = *pseed;
+    __m512i vmul, vadd, data, last;
+    size_t i, errors = 0;
+    unsigned j;
+
+    for (j = 0; j < 16; j++)
+        lane[j] = seed = seed * PATTERN_MUL + 1;
+    lcg_jump(16, &mul, &add);
+    vmul = _mm512_set1_epi32(mul);
+    vadd = _mm512_set1_epi32(add);
+    data = _mm512_loadu_si512(lane);
+    last = _mm512_set1_epi32(*pseed);
+    for (i = 0; i + 16 <= count; i += 16) {
+        if (out)
+            _mm512_storeu_si512(out + i, data);
+        else
+            errors += __builtin_popcount(_mm512_cmpneq_epu32_mask(_mm512_loadu_si512(in + i), data));
+        last = data;
+        data = _mm512_add_epi32(_mm512_mullo_epi32(data, vmul), vadd);
+    }
+    _mm512_storeu_si512(lane, last);
+    *pseed = lane[15];
+    return errors + lcg_scalar(in, out, i, count, pseed);
+}
+
+#endif /* LITEPCIE_PATTERN_X86 */
+
+/* Dispatch */
+/*----------*/
+
+static int pattern_isa = -1;
+
+/* best kernels this CPU runs */
+static int litepcie_pattern_detect(void)
+{
+    int isa = PATTERN_ISA_SCALAR;
+#ifdef LITEPCIE_PATTERN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        isa = PATTERN_ISA_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+        isa = PATTERN_ISA_AVX2;
+#endif
+    return isa;
+}
+
+static int litepcie_pattern_level(void)
+{
+    int isa = __atomic_load_n(&pattern_isa, __ATOMIC_RELAXED);
+
+    if (isa >= 0)
+        return isa;
+    isa = litepcie_pattern_detect();
+    __atomic_store_n(&pattern_isa, isa, __ATOMIC_RELAXED);
+    return isa;
+}
+
+int litepcie_pattern_select(const char *isa)
+{
+    int level;
+
+    if (!isa)
+        level = litepcie_pattern_detect();
+    else if (!strcmp(isa, "avx512"))
+        level = PATTERN_ISA_AVX512;
+    else if (!strcmp(isa, "avx2"))
+        level = PATTERN_ISA_AVX2;
+    else if (!strcmp(isa, "scalar"))
+        level = PATTERN_ISA_SCALAR;
+    else
+        return -1;
+    if (level > litepcie_pattern_detect())
+        return -1;
+    __atomic_store_n(&pattern_isa, level, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char *litepcie_pattern_isa(void)
+{
+    switch (litepcie_pattern_level()) {
+    case PATTERN_ISA_AVX512:
+        return "avx512";
+    case PATTERN_ISA_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+static unsigned litepcie_pn(const uint32_t *in, uint32_t *out, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    /* the lane-wise wrap needs count >= lanes, a seed in range and signed-safe compares */
+    if (count < 16 || count > INT32_MAX || *pseed >= count)
+        return pn_scalar(in, out, 0, count, count, pseed, mask);
+#ifdef LITEPCIE_PATTERN_X86
+    switch (litepcie_pattern_level()) {
+    case PATTERN_ISA_AVX512:
+        return pn_avx512(in, out, count, pseed, mask);
+    case PATTERN_ISA_AVX2:
+        return pn_avx2(in, out, count, pseed, mask);
+    }
+#endif
+    return pn_scalar(in, out, 0, count, count, pseed, mask);
+}
+
+static size_t litepcie_lcg(const uint32_t *in, uint32_t *out, size_t count, uint32_t *pseed)
+{
+#ifdef LITEPCIE_PATTERN_X86
+    switch (litepcie_pattern_level()) {
+    case PATTERN_ISA_AVX512:
+        return lcg_avx512(in, out, count, pseed);
+    case PATTERN_ISA_AVX2:
+        return lcg_avx2(in, out, count, pseed);
+    }
+#endif
+    return lcg_scalar(in, out, 0, count, pseed);
+}
+
+void litepcie_pn_fill(uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    litepcie_pn(NULL, buf, count, pseed, mask);
+}
+
+unsigned litepcie_pn_check(const uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask)
+{
+    return litepcie_pn(buf, NULL, count, pseed, mask);
+}
+
+void litepcie_lcg_fill(uint32_t *buf, size_t count, uint32_t *pseed)
+{
+    litepcie_lcg(NULL, buf, count, pseed);
+}
+
+size_t litepcie_lcg_check(const uint32_t *buf, size_t count, uint32_t *pseed)
+{
+    return litepcie_lcg(buf, NULL, count, pseed);
+}
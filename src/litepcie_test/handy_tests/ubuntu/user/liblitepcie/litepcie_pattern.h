@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+#ifndef LITEPCIE_LIB_PATTERN_H
+#define LITEPCIE_LIB_PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Test data generators/checkers, SIMD (AVX2/AVX-512) when the CPU has it.
+ *
+ * PN: word i = ((seed + i) % count) * 69069 + 1, masked (litepcie_util dma_test).
+ * LCG: state = state * 69069 + 1, one word per step (optimized DMA tests).
+ * Checkers return the number of mismatching words and always advance the seed
+ * over the whole buffer. The *_scalar variants are the reference versions. */
+
+void litepcie_pn_fill(uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask);
+unsigned litepcie_pn_check(const uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask);
+void litepcie_lcg_fill(uint32_t *buf, size_t count, uint32_t *pseed);
+size_t litepcie_lcg_check(const uint32_t *buf, size_t count, uint32_t *pseed);
+
+void litepcie_pn_fill_scalar(uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask);
+unsigned litepcie_pn_check_scalar(const uint32_t *buf, unsigned count, uint32_t *pseed, uint32_t mask);
+void litepcie_lcg_fill_scalar(uint32_t *buf, size_t count, uint32_t *pseed);
+size_t litepcie_lcg_check_scalar(const uint32_t *buf, size_t count, uint32_t *pseed);
+
+/* "avx512", "avx2" or "scalar": the kernels selected for this CPU */
+const char *litepcie_pattern_isa(void);
+/* Force the kernels by name (NULL: back to the best ones), e.g. to compare
+ * them with the reference. Returns -1 when this CPU can't run them. */
+int litepcie_pattern_select(const char *isa);
+
+#endif /* LITEPCIE_LIB_PATTERN_H */
@@ -16,9 +16,9 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
-#include <sys/time.h>
 #include <pthread.h>
 #include "liblitepcie.h"
+#include "litepcie_hist.h"
 
 /* Variables */
 /*-----------*/
@@ -38,11 +38,11 @@ void intHandler(int dummy) {
     keep_running = 0;
 }
 
-/* Get current time in microseconds */
-static inline uint64_t get_time_us(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+/* Get current time in nanoseconds (monotonic, immune to NTP steps) */
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /* Loopback Latency Test */
@@ -65,22 +65,26 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
     uint64_t *write_data, *read_data;
     size_t data_size;
     int i, j;
+    static struct litepcie_hist hist;
+
+    litepcie_hist_reset(&hist);
 
     /* Validate packet size */
     if (packet_size < sizeof(uint64_t)) {
         printf("Error: packet size must be at least %zu bytes\n", sizeof(uint64_t));
         return;
     }
-    if (packet_size > DMA_BUFFER_SIZE) {
-        printf("Error: packet size cannot exceed DMA buffer size (%d bytes)\n", DMA_BUFFER_SIZE);
-        return;
-    }
 
     /* Initialize DMA with loopback enabled */
     if (litepcie_dma_init(&dma, device_name, zero_copy)) {
         printf("Failed to initialize DMA\n");
         exit(1);
     }
+    if (packet_size > dma.buffer_size) {
+        printf("Error: packet size cannot exceed DMA buffer size (%u bytes)\n", dma.buffer_size);
+        litepcie_dma_cleanup(&dma);
+        return;
+    }
 
     /* Enable DMA reader and writer */
     dma.reader_enable = 1;
@@ -122,7 +126,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
         }
 
         /* Clear buffer first */
-        memset(buf_wr, 0, DMA_BUFFER_SIZE);
+        memset(buf_wr, 0, dma.buffer_size);
         
         /* Write unique pattern for this iteration */
         write_data = (uint64_t *)buf_wr;
@@ -132,7 +136,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
         }
 
         /* Record start time just before sending */
-        start_time = get_time_us();
+        start_time = get_time_ns();
 
         /* Commit write buffer - this sends the data */
         dma.reader_sw_count++;
@@ -168,7 +172,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
         }
 
         /* Record end time */
-        end_time = get_time_us();
+        end_time = get_time_ns();
         
         /* Verify received data */
         int data_valid = 1;
@@ -188,7 +192,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
 
         if (data_valid) {
             /* Calculate latency */
-            latency_us = (double)(end_time - start_time);
+            latency_us = (double)(end_time - start_time) / 1000.0;
             
             /* Update statistics */
             if (latency_us < stats.min_latency_us)
@@ -197,6 +201,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
                 stats.max_latency_us = latency_us;
             stats.total_latency_us += latency_us;
             stats.count++;
+            litepcie_hist_record(&hist, end_time - start_time);
 
             /* Print progress every 100 iterations for small tests, 1000 for large */
             int progress_interval = (iterations <= 1000) ? 100 : 1000;
@@ -224,6 +229,7 @@ static void litepcie_loopback_latency(const char *device_name, uint32_t packet_s
         printf("Min latency: %.2f us\n", stats.min_latency_us);
         printf("Max latency: %.2f us\n", stats.max_latency_us);
         printf("Avg latency: %.2f us\n", stats.avg_latency_us);
+        litepcie_hist_print(stdout, &hist);
         printf("Throughput: %.2f MB/s (based on avg latency)\n", 
                (double)packet_size / stats.avg_latency_us);
     } else {
@@ -16,8 +16,8 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
-#include <sys/time.h>
 #include "liblitepcie.h"
+#include "litepcie_hist.h"
 
 /* Variables */
 /*-----------*/
@@ -38,11 +38,11 @@ void intHandler(int dummy) {
     keep_running = 0;
 }
 
-/* Get current time in microseconds */
-static inline uint64_t get_time_us(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+/* Get current time in nanoseconds (monotonic, immune to NTP steps) */
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /* PCIe Loopback Latency Test */
@@ -60,6 +60,7 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
     uint64_t max_latency = 0;
     uint64_t total_latency = 0;
     uint32_t successful = 0;
+    static struct litepcie_hist hist;
     uint32_t sequence = 0;
     uint32_t duplicates = 0;
     
@@ -76,12 +77,15 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
         exit(1);
     }
     memset(pending, 0, sizeof(pending));
+    litepcie_hist_reset(&hist);
 
     /* Initialize DMA with loopback enabled */
     if (litepcie_dma_init(&dma, device_name, 0)) {
         printf("Failed to initialize DMA\n");
         exit(1);
     }
+    if (packet_size > dma.buffer_size)
+        packet_size = dma.buffer_size;
 
     /* Enable DMA */
     dma.reader_enable = 1;
@@ -119,7 +123,7 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
             buf_wr = litepcie_dma_next_write_buffer(&dma);
             if (buf_wr) {
                 /* Clear buffer */
-                memset(buf_wr, 0, DMA_BUFFER_SIZE);
+                memset(buf_wr, 0, dma.buffer_size);
                 
                 /* Create packet with sequence number and timestamp */
                 uint32_t *data = (uint32_t *)buf_wr;
@@ -132,7 +136,7 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
                 }
                 
                 /* Record timestamp */
-                uint64_t timestamp = get_time_us();
+                uint64_t timestamp = get_time_ns();
                 
                 /* Store in pending queue */
                 int next_tail = (pending_tail + 1) % MAX_PENDING;
@@ -162,7 +166,7 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
             /* Check if this is one of our packets */
             if (data[0] == MARKER_VALUE) {
                 uint32_t rx_sequence = data[1];
-                uint64_t rx_time = get_time_us();
+                uint64_t rx_time = get_time_ns();
                 
                 /* Check if this is a duplicate */
                 if (rx_sequence < iterations && processed[rx_sequence]) {
@@ -194,6 +198,7 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
                                 if (latency > max_latency) max_latency = latency;
                                 total_latency += latency;
                                 successful++;
+                                litepcie_hist_record(&hist, latency);
                             }
                             
                             /* Mark as found */
@@ -231,13 +236,14 @@ static void pcie_latency_test(const char *device_name, uint32_t iterations, uint
     
     if (successful > 0) {
         printf("\nLatency Statistics:\n");
-        printf("Min latency: %lu us\n", min_latency);
-        printf("Max latency: %lu us\n", max_latency);
-        printf("Avg latency: %.2f us\n", (double)total_latency / successful);
+        printf("Min latency: %.2f us\n", min_latency / 1000.0);
+        printf("Max latency: %.2f us\n", max_latency / 1000.0);
+        printf("Avg latency: %.2f us\n", (double)total_latency / successful / 1000.0);
+        litepcie_hist_print(stdout, &hist);
         
-        double throughput_mbps = ((double)packet_size * 8.0) / ((double)total_latency / successful);
+        double throughput_mbps = ((double)packet_size * 8.0) / ((double)total_latency / successful / 1000.0);
         printf("\nThroughput (based on avg latency): %.2f Mbps\n", throughput_mbps);
-        printf("Bandwidth efficiency: %.2f MB/s\n", (double)packet_size / ((double)total_latency / successful));
+        printf("Bandwidth efficiency: %.2f MB/s\n", (double)packet_size / ((double)total_latency / successful / 1000.0));
     }
 
     /* Cleanup */
@@ -298,7 +304,6 @@ int main(int argc, char **argv)
         case 's':
             packet_size = strtoul(optarg, NULL, 0);
             if (packet_size < 8) packet_size = 8;
-            if (packet_size > DMA_BUFFER_SIZE) packet_size = DMA_BUFFER_SIZE;
             break;
         default:
             help();
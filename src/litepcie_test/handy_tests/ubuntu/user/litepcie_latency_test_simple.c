@@ -16,8 +16,8 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
-#include <sys/time.h>
 #include "liblitepcie.h"
+#include "litepcie_hist.h"
 
 /* Variables */
 /*-----------*/
@@ -28,11 +28,11 @@ void intHandler(int dummy) {
     keep_running = 0;
 }
 
-/* Get current time in microseconds */
-static inline uint64_t get_time_us(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+/* Get current time in nanoseconds (monotonic, immune to NTP steps) */
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /* Simple Loopback Test */
@@ -46,6 +46,9 @@ static void simple_loopback_test(const char *device_name, uint32_t iterations)
     uint64_t max_latency = 0;
     uint64_t total_latency = 0;
     uint32_t successful = 0;
+    static struct litepcie_hist hist;
+
+    litepcie_hist_reset(&hist);
     
     printf("\nStarting simple PCIe loopback test:\n");
     printf("- Device: %s\n", device_name);
@@ -95,12 +98,12 @@ static void simple_loopback_test(const char *device_name, uint32_t iterations)
 
         /* Fill buffer with test pattern */
         uint32_t *data = (uint32_t *)buf_wr;
-        for (int i = 0; i < DMA_BUFFER_SIZE / sizeof(uint32_t); i++) {
+        for (int i = 0; i < dma.buffer_size / sizeof(uint32_t); i++) {
             data[i] = test_value + i;
         }
 
         /* Record start time */
-        start_time = get_time_us();
+        start_time = get_time_ns();
 
         /* Send buffer - increment sw_count to commit the buffer */
         dma.reader_sw_count++;
@@ -122,7 +125,7 @@ static void simple_loopback_test(const char *device_name, uint32_t iterations)
         }
 
         /* Record end time */
-        end_time = get_time_us();
+        end_time = get_time_ns();
 
         /* Verify data */
         uint32_t *read_data = (uint32_t *)buf_rd;
@@ -145,6 +148,7 @@ static void simple_loopback_test(const char *device_name, uint32_t iterations)
             if (latency > max_latency) max_latency = latency;
             total_latency += latency;
             successful++;
+            litepcie_hist_record(&hist, latency);
             
             if ((iter + 1) % 100 == 0) {
                 printf("Progress: %u/%u iterations completed\n", iter + 1, iterations);
@@ -157,10 +161,11 @@ static void simple_loopback_test(const char *device_name, uint32_t iterations)
     printf("=============\n");
     printf("Successful iterations: %u / %u\n", successful, iterations);
     if (successful > 0) {
-        printf("Min latency: %lu us\n", min_latency);
-        printf("Max latency: %lu us\n", max_latency);
-        printf("Avg latency: %.2f us\n", (double)total_latency / successful);
-        printf("Throughput: %.2f MB/s\n", (double)DMA_BUFFER_SIZE / ((double)total_latency / successful));
+        printf("Min latency: %.2f us\n", min_latency / 1000.0);
+        printf("Max latency: %.2f us\n", max_latency / 1000.0);
+        printf("Avg latency: %.2f us\n", (double)total_latency / successful / 1000.0);
+        litepcie_hist_print(stdout, &hist);
+        printf("Throughput: %.2f MB/s\n", (double)dma.buffer_size / ((double)total_latency / successful / 1000.0));
     }
 
     /* Cleanup */
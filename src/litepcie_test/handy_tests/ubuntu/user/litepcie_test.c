@@ -8,31 +8,82 @@
  *
  */
 
+#define _GNU_SOURCE /* O_DIRECT, splice */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/aio_abi.h>
 #include "liblitepcie.h"
 
 /* Variables */
 /*-----------*/
 
+static uint32_t litepcie_buffer_size;    /* 0: driver geometry */
+static uint32_t litepcie_buffer_count;
+
+static uint8_t litepcie_user_buffer;     /* record into an application owned ring */
+static uint8_t litepcie_direct_record;   /* record with O_DIRECT async writes from the ring */
+static uint8_t litepcie_mmap_play;       /* play from a mapped, RAM resident copy of the file */
+static uint8_t litepcie_subscriber;      /* record: 1: best-effort, 2: required RX subscriber */
+
 sig_atomic_t keep_running = 1;
 
 void intHandler(int dummy) {
     keep_running = 0;
 }
 
+/* User Ring */
+/*-----------*/
+
+#define USER_RING_ALIGN (2 << 20)
+
+/* Hugepage backed, so each DMA buffer stays bus contiguous. Only page-sized
+ * buffers can do with regular pages: the driver refuses larger ones split
+ * across pages (without an IOMMU merging them). */
+static void *litepcie_alloc_user_ring(size_t len, uint32_t buffer_size)
+{
+    void *ring;
+
+    ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ring == MAP_FAILED && buffer_size > (uint32_t)sysconf(_SC_PAGESIZE)) {
+        fprintf(stderr, "User ring: no huge pages (%s), %u bytes DMA buffers need them to be bus contiguous.\n"
+                "It needs %zu free 2 MB huge pages (e.g. echo %zu > /proc/sys/vm/nr_hugepages).\n",
+                strerror(errno), buffer_size, len / USER_RING_ALIGN, len / USER_RING_ALIGN);
+        exit(1);
+    }
+    if (ring == MAP_FAILED)
+        ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return ring;
+}
+
 /* Record (DMA RX) */
 /*-----------------*/
 
-static void litepcie_record(const char *device_name, const char *filename, uint32_t size, uint8_t zero_copy)
+static void litepcie_record(const char *device_name, const char *filename, uint32_t size, uint8_t zero_copy, uint8_t ctrl_page)
 {
     static struct litepcie_dma_ctrl dma = {.use_writer = 1};
+    dma.use_ctrl_page = ctrl_page;
+    dma.buffer_size = litepcie_buffer_size;
+    dma.buffer_count = litepcie_buffer_count;
+    dma.subscriber = litepcie_subscriber != 0;
+    dma.subscriber_required = litepcie_subscriber == 2;
 
     FILE * fo = NULL;
     int i = 0;
@@ -40,6 +91,17 @@ static void litepcie_record(const char *device_name, const char *filename, uint3
     size_t total_len = 0;
     int64_t last_time;
     int64_t writer_sw_count_last = 0;
+    size_t user_ring_len = 0;
+
+    /* Allocate the ring in application memory (the geometry must be known upfront). */
+    if (litepcie_user_buffer) {
+        if (!dma.buffer_size)
+            dma.buffer_size = DMA_BUFFER_SIZE;
+        if (!dma.buffer_count)
+            dma.buffer_count = DMA_BUFFER_COUNT;
+        user_ring_len = ((size_t)dma.buffer_size * dma.buffer_count + USER_RING_ALIGN - 1) & ~(size_t)(USER_RING_ALIGN - 1);
+        dma.writer_user_buf = litepcie_alloc_user_ring(user_ring_len, dma.buffer_size);
+    }
 
     /* Open File to write to. */
     if (filename != NULL) {
@@ -75,7 +137,7 @@ static void litepcie_record(const char *device_name, const char *filename, uint3
                 break;
             /* Copy Read data to File. */
             if (filename != NULL) {
-                len = fwrite(buf_rd, 1, fmin(size - total_len, DMA_BUFFER_SIZE), fo);
+                len = fwrite(buf_rd, 1, fmin(size - total_len, dma.buffer_size), fo);
                 total_len += len;
             }
             /* Stop when specified size is reached */
@@ -92,29 +154,500 @@ static void litepcie_record(const char *device_name, const char *filename, uint3
             i++;
             /* Print statistics. */
             printf("%10.2f %10" PRIu64 "  %8" PRIu64"\n",
-                    (double)(dma.writer_sw_count - writer_sw_count_last) * DMA_BUFFER_SIZE * 8 / ((double)duration * 1e6),
+                    (double)(dma.writer_sw_count - writer_sw_count_last) * dma.buffer_size * 8 / ((double)duration * 1e6),
                     dma.writer_sw_count,
-                    (size > 0) ? ((dma.writer_sw_count) * DMA_BUFFER_SIZE) / 1024 / 1024 : 0);
+                    (size > 0) ? ((dma.writer_sw_count) * dma.buffer_size) / 1024 / 1024 : 0);
             /* Update time/count. */
             last_time = get_time_ms();
             writer_sw_count_last = dma.writer_sw_count;
         }
     }
 
+    if (dma.subscriber)
+        printf("Subscriber slot %d: %" PRId64 " buffers dropped, %" PRId64 " ring overflows\n",
+               dma.subscriber_slot, dma.ctrl->subscribers[dma.subscriber_slot].drops, dma.ctrl->writer_overflows);
+
     /* Cleanup DMA. */
     litepcie_dma_cleanup(&dma);
+    if (dma.writer_user_buf)
+        munmap(dma.writer_user_buf, user_ring_len);
 
     /* Close File. */
     if (filename != NULL)
         fclose(fo);
 }
 
+/* Direct Record (DMA RX -> O_DIRECT async writes) */
+/*-------------------------------------------------*/
+
+#define RECORD_AIO_DEPTH   64 /* writes in flight */
+#define RECORD_AIO_BUFFERS 64 /* DMA buffers per write (at most) */
+
+struct record_write {
+    struct iocb cb;
+    unsigned buffers;
+    uint8_t done;
+};
+
+static int litepcie_aio_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int litepcie_aio_destroy(aio_context_t ctx)
+{
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static int litepcie_aio_submit(aio_context_t ctx, long nr, struct iocb **cbs)
+{
+    return syscall(__NR_io_submit, ctx, nr, cbs);
+}
+
+static int litepcie_aio_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event *events,
+    struct timespec *timeout)
+{
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+/* Writes are whole DMA buffers at buffer multiples: buffer_size must suit the
+ * O_DIRECT alignment of the file (reported since Linux 6.1, else left to the
+ * kernel's EINVAL). */
+static int litepcie_direct_check_align(int fd, const char *filename, uint32_t buffer_size)
+{
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) < 0 || !(stx.stx_mask & STATX_DIOALIGN))
+        return 0;
+    if (!stx.stx_dio_offset_align) {
+        fprintf(stderr, "%s: O_DIRECT not supported by this file system\n", filename);
+        return -1;
+    }
+    if (buffer_size % stx.stx_dio_offset_align || buffer_size % stx.stx_dio_mem_align) {
+        fprintf(stderr, "%s: %u bytes DMA buffers are not a multiple of the O_DIRECT alignment (%u bytes)\n",
+                filename, buffer_size,
+                stx.stx_dio_offset_align > stx.stx_dio_mem_align ? stx.stx_dio_offset_align : stx.stx_dio_mem_align);
+        return -1;
+    }
+#else
+    (void)fd;
+    (void)filename;
+    (void)buffer_size;
+#endif
+    return 0;
+}
+
+/* The DMA writes into a pinned application ring (O_DIRECT cannot use the
+ * driver's PFN mapped buffers). Buffers are queued to the file straight
+ * from the ring and only handed back to the DMA once their write completed. */
+static void litepcie_record_direct(const char *device_name, const char *filename, uint32_t size, uint8_t ctrl_page)
+{
+    static struct litepcie_dma_ctrl dma = {.use_writer = 1, .batch_commit = 1};
+    static struct record_write writes[RECORD_AIO_DEPTH];
+    struct iocb *cbs[RECORD_AIO_DEPTH];
+    struct io_event events[RECORD_AIO_DEPTH];
+    struct litepcie_dma_span span[2];
+    struct timespec timeout;
+    aio_context_t ctx = 0;
+    dma.use_ctrl_page = ctrl_page;
+    dma.buffer_size = litepcie_buffer_size ? litepcie_buffer_size : DMA_BUFFER_SIZE;
+    dma.buffer_count = litepcie_buffer_count ? litepcie_buffer_count : DMA_BUFFER_COUNT;
+
+    int fd;
+    int i = 0;
+    int j, ret;
+    unsigned head = 0, tail = 0;  /* writes in flight: [head, tail) */
+    unsigned pending = 0;         /* DMA buffers in flight */
+    unsigned skip, s, nr, count, done;
+    off_t offset = 0, end;
+    uint8_t writing = 1;
+    int64_t overrun_last = 0;     /* buffers overwritten by the DMA before reaching the file */
+    int64_t last_time;
+    int64_t writer_sw_count_last = 0;
+    size_t user_ring_len;
+
+    user_ring_len = ((size_t)dma.buffer_size * dma.buffer_count + USER_RING_ALIGN - 1) & ~(size_t)(USER_RING_ALIGN - 1);
+    dma.writer_user_buf = litepcie_alloc_user_ring(user_ring_len, dma.buffer_size);
+
+    /* Open File to write to. */
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (litepcie_direct_check_align(fd, filename, dma.buffer_size))
+        exit(1);
+    if (litepcie_aio_setup(RECORD_AIO_DEPTH, &ctx) < 0) {
+        perror("io_setup");
+        exit(1);
+    }
+
+    /* Initialize DMA. */
+    if (litepcie_dma_init(&dma, device_name, 1))
+        exit(1);
+
+    dma.writer_enable = 1;
+
+    /* Test Loop. */
+    last_time = get_time_ms();
+    for (;;) {
+        /* Stop queueing on CTRL+C, exit once the writes in flight are done. */
+        if (!keep_running)
+            writing = 0;
+        if (!writing && !pending)
+            break;
+
+        /* Update DMA status. */
+        litepcie_dma_process(&dma);
+
+        /* Queue the buffers not in flight yet, one write per contiguous run. */
+        litepcie_dma_read_spans(&dma, span);
+        skip = pending;
+        nr = 0;
+        end = offset;
+        for (s = 0; s < 2 && writing && !(size > 0 && end >= size); s++) {
+            unsigned first = span[s].count < skip ? span[s].count : skip;
+            char *buf = span[s].buf + (size_t)first * dma.buffer_size;
+            unsigned left = span[s].count - first;
+            skip -= first;
+            while (left && (tail + nr) - head < RECORD_AIO_DEPTH && !(size > 0 && end >= size)) {
+                struct record_write *w = &writes[(tail + nr) % RECORD_AIO_DEPTH];
+                count = left < RECORD_AIO_BUFFERS ? left : RECORD_AIO_BUFFERS;
+                memset(&w->cb, 0, sizeof(w->cb));
+                w->cb.aio_data       = (tail + nr) % RECORD_AIO_DEPTH;
+                w->cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+                w->cb.aio_fildes     = fd;
+                w->cb.aio_buf        = (uintptr_t)buf;
+                w->cb.aio_nbytes     = (size_t)count * dma.buffer_size;
+                w->cb.aio_offset     = end;
+                w->buffers = count;
+                w->done    = 0;
+                cbs[nr++] = &w->cb;
+                end  += w->cb.aio_nbytes;
+                buf  += w->cb.aio_nbytes;
+                left -= count;
+            }
+        }
+        if (nr) {
+            ret = litepcie_aio_submit(ctx, nr, cbs);
+            if (ret < 0) {
+                if (errno != EAGAIN) {
+                    perror("io_submit");
+                    break;
+                }
+                ret = 0;
+            }
+            /* What the kernel did not take is queued again on the next loop. */
+            for (j = 0; j < ret; j++) {
+                pending += writes[(tail + j) % RECORD_AIO_DEPTH].buffers;
+                offset  += writes[(tail + j) % RECORD_AIO_DEPTH].cb.aio_nbytes;
+            }
+            tail += ret;
+            /* Stop when specified size is reached */
+            if (size > 0 && offset >= size)
+                writing = 0;
+        }
+
+        /* Reap completions, wait a little when there was nothing new to queue. */
+        timeout.tv_sec  = 0;
+        timeout.tv_nsec = (nr || !pending) ? 0 : 100000;
+        ret = litepcie_aio_getevents(ctx, (nr || !pending) ? 0 : 1, RECORD_AIO_DEPTH, events, &timeout);
+        if (ret < 0 && errno != EINTR) {
+            perror("io_getevents");
+            break;
+        }
+        for (j = 0; j < ret; j++) {
+            struct record_write *w = &writes[events[j].data];
+            if (events[j].res != (int64_t)w->cb.aio_nbytes) {
+                fprintf(stderr, "%s: write failed: %s\n", filename,
+                    events[j].res < 0 ? strerror(-events[j].res) : "short write");
+                writing = 0;
+            }
+            w->done = 1;
+        }
+
+        /* Hand completed buffers back to the DMA, in ring order. */
+        done = 0;
+        while (head != tail && writes[head % RECORD_AIO_DEPTH].done) {
+            done += writes[head % RECORD_AIO_DEPTH].buffers;
+            head++;
+        }
+        if (done) {
+            pending -= done;
+            litepcie_dma_read_commit(&dma, done);
+        }
+
+        /* Statistics every 200ms. */
+        int64_t duration = get_time_ms() - last_time;
+        if (duration > 200) {
+            /* Print banner every 10 lines. */
+            if (i % 10 == 0)
+                printf("\e[1mSPEED(Gbps)    BUFFERS SIZE(MB) BACKLOG(MB) OVERRUN\e[0m\n");
+            i++;
+            /* Print statistics. */
+            printf("%10.2f %10" PRIu64 "  %8" PRIu64 " %11.2f %7" PRId64 "\n",
+                    (double)(dma.writer_sw_count - writer_sw_count_last) * dma.buffer_size * 8 / ((double)duration * 1e6),
+                    dma.writer_sw_count,
+                    (dma.writer_sw_count * dma.buffer_size) / 1024 / 1024,
+                    (double)pending * dma.buffer_size / (1024 * 1024),
+                    dma.writer_overruns - overrun_last);
+            /* Update time/count/overrun. */
+            last_time = get_time_ms();
+            writer_sw_count_last = dma.writer_sw_count;
+            overrun_last = dma.writer_overruns;
+        }
+    }
+
+    /* Cleanup DMA. On an io_submit/io_getevents error writes from the ring may
+     * still be in flight: io_destroy() waits for them before the ring goes. */
+    litepcie_aio_destroy(ctx);
+    litepcie_dma_cleanup(&dma);
+    munmap(dma.writer_user_buf, user_ring_len);
+
+    /* Trim the last buffer and close File. */
+    if (size > 0 && offset > size && ftruncate(fd, size) < 0)
+        perror("ftruncate");
+    close(fd);
+}
+
+/* Multi-Device Record (DMA RX of several channels/boards, one process) */
+/*-----------------------------------------------------------------------*/
+
+static void litepcie_record_multi(const int *device_nums, int count, const char *filename, uint64_t size,
+                                  int pollers, uint8_t ordered)
+{
+    static struct litepcie_multi multi;
+    struct litepcie_multi_config config = {
+        .use_writer   = 1,
+        .ordered      = ordered,
+        .buffer_size  = litepcie_buffer_size,
+        .buffer_count = litepcie_buffer_count,
+        .pollers      = pollers,
+    };
+    static char names[LITEPCIE_MULTI_DEVICES_MAX][64];
+    const char *devices[LITEPCIE_MULTI_DEVICES_MAX];
+    FILE *fo[LITEPCIE_MULTI_DEVICES_MAX] = {NULL};
+    struct litepcie_multi_buffer b;
+    struct litepcie_multi_stats stats, stats_last;
+    char path[1024];
+    uint64_t total_len = 0;
+    size_t len;
+    int64_t last_time, duration;
+    int i, l = 0;
+
+    /* One file per device (filename.N), each a plain stream for play. */
+    for (i = 0; i < count; i++) {
+        snprintf(names[i], sizeof(names[i]), "/dev/litepcie%d", device_nums[i]);
+        devices[i] = names[i];
+        if (filename != NULL) {
+            snprintf(path, sizeof(path), "%s.%d", filename, device_nums[i]);
+            fo[i] = fopen(path, "wb");
+            if (!fo[i]) {
+                perror(path);
+                exit(1);
+            }
+        }
+    }
+
+    /* Initialize DMAs and start the pollers. */
+    if (litepcie_multi_init(&multi, devices, count, &config))
+        exit(1);
+    if (litepcie_multi_start(&multi)) {
+        litepcie_multi_cleanup(&multi);
+        exit(1);
+    }
+    printf("Recording %d device(s) with %d poller(s), %s stream\n",
+           multi.count, multi.pollers, ordered ? "time ordered" : "tagged");
+
+    /* Test Loop. */
+    memset(&stats_last, 0, sizeof(stats_last));
+    last_time = get_time_ms();
+    while (keep_running) {
+        /* Drain the merged stream, then sleep until a poller publishes more. */
+        while (litepcie_multi_rx_acquire(&multi, &b)) {
+            if (fo[b.device]) {
+                len = b.size;
+                if (size > 0 && size - total_len < len)
+                    len = size - total_len;
+                total_len += fwrite(b.buf, 1, len, fo[b.device]);
+            }
+            litepcie_multi_rx_release(&multi, &b);
+            /* Stop when specified size is reached */
+            if (size > 0 && total_len >= size) {
+                keep_running = 0;
+                break;
+            }
+        }
+        litepcie_multi_rx_wait(&multi, 100);
+
+        /* Statistics every 200ms, all devices merged. */
+        duration = get_time_ms() - last_time;
+        if (duration > 200) {
+            litepcie_multi_stats(&multi, -1, &stats);
+            /* Print banner every 10 lines. */
+            if (l % 10 == 0)
+                printf("\e[1mSPEED(Gbps)    BUFFERS  OVERFLOWS    WAKEUPS\e[0m\n");
+            l++;
+            printf("%10.2f %10" PRId64 " %10" PRId64 " %10" PRId64 "\n",
+                   (double)(stats.rx_bytes - stats_last.rx_bytes) * 8 / ((double)duration * 1e6),
+                   stats.rx_buffers, stats.rx_overflows, stats.wakeups);
+            /* Update time/count. */
+            last_time = get_time_ms();
+            stats_last = stats;
+        }
+    }
+
+    for (i = 0; i < multi.count; i++) {
+        litepcie_multi_stats(&multi, i, &stats);
+        printf("%s: %" PRId64 " buffers, %" PRId64 " overflows, %" PRId64 " IRQs\n",
+               devices[i], stats.rx_buffers, stats.rx_overflows, stats.irqs);
+    }
+
+    /* Cleanup DMAs. */
+    litepcie_multi_cleanup(&multi);
+
+    /* Close Files. */
+    for (i = 0; i < count; i++)
+        if (fo[i])
+            fclose(fo[i]);
+}
+
+/* Stream (DMA RX -> splice -> TCP) */
+/*-----------------------------------*/
+
+#define STREAM_PIPE_SIZE (1 << 20)
+
+static int litepcie_connect(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(ret));
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        fprintf(stderr, "%s:%s: could not connect\n", host, port);
+    return fd;
+}
+
+/* The driver copies each RX buffer into pipe pages once, the socket then
+ * takes those pages without the data ever crossing to user space. */
+static void litepcie_stream(const char *device_name, const char *host, const char *port, uint64_t size)
+{
+    static struct litepcie_dma_ctrl dma = {.use_writer = 1};
+    dma.buffer_size = litepcie_buffer_size;
+    dma.buffer_count = litepcie_buffer_count;
+
+    struct pollfd pfd;
+    int sock, pipefd[2];
+    int64_t hw_count, sw_count;
+    ssize_t chunk, n, m;
+    uint64_t total_len = 0, total_len_last = 0;
+    int64_t last_time, duration;
+    int i = 0;
+
+    sock = litepcie_connect(host, port);
+    if (sock < 0)
+        exit(1);
+    if (pipe(pipefd)) {
+        perror("pipe");
+        exit(1);
+    }
+    /* Larger pipe: fewer splice calls per buffer (the default is 16 pages) */
+    fcntl(pipefd[1], F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+
+    /* Initialize DMA (no mmap: the data moves through the pipe). */
+    if (litepcie_dma_init(&dma, device_name, 0))
+        exit(1);
+    /* Never sleep in the driver, so CTRL+C is seen between polls */
+    fcntl(dma.fds.fd, F_SETFL, fcntl(dma.fds.fd, F_GETFL) | O_NONBLOCK);
+    litepcie_dma_writer(dma.fds.fd, 1, &hw_count, &sw_count);
+
+    /* Whole DMA buffers only: the chunk is what fits in the pipe. */
+    chunk = fcntl(pipefd[1], F_GETPIPE_SZ);
+    if (chunk < (ssize_t)dma.buffer_size)
+        chunk = dma.buffer_size;
+    chunk -= chunk % dma.buffer_size;
+    printf("Streaming to %s:%s, %zd bytes per splice\n", host, port, chunk);
+
+    /* Test Loop. */
+    pfd.fd = dma.fds.fd;
+    pfd.events = POLLIN;
+    last_time = get_time_ms();
+    while (keep_running) {
+        if (poll(&pfd, 1, 100) > 0) {
+            n = splice(dma.fds.fd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("splice");
+                break;
+            }
+            /* Drain the pipe to the socket. */
+            while (n > 0) {
+                m = splice(pipefd[0], NULL, sock, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (m < 0 && errno == EINTR)
+                    continue;
+                if (m <= 0) {
+                    if (m < 0)
+                        perror("splice");
+                    keep_running = 0;
+                    break;
+                }
+                n -= m;
+                total_len += m;
+            }
+            /* Stop when specified size is reached */
+            if (size > 0 && total_len >= size)
+                keep_running = 0;
+        }
+
+        /* Statistics every 200ms. */
+        duration = get_time_ms() - last_time;
+        if (duration > 200) {
+            /* Print banner every 10 lines. */
+            if (i % 10 == 0)
+                printf("\e[1mSPEED(Gbps)   SIZE(MB)\e[0m\n");
+            i++;
+            printf("%10.2f %10" PRIu64 "\n",
+                   (double)(total_len - total_len_last) * 8 / ((double)duration * 1e6),
+                   total_len / 1024 / 1024);
+            /* Update time/count. */
+            last_time = get_time_ms();
+            total_len_last = total_len;
+        }
+    }
+
+    /* Cleanup DMA. */
+    litepcie_dma_cleanup(&dma);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(sock);
+}
+
 /* Play (DMA TX) */
 /*---------------*/
 
-static void litepcie_play(const char *device_name, const char *filename, uint32_t loops, uint8_t zero_copy)
+static void litepcie_play(const char *device_name, const char *filename, uint32_t loops, uint8_t zero_copy, uint8_t ctrl_page)
 {
     static struct litepcie_dma_ctrl dma = {.use_reader = 1};
+    dma.use_ctrl_page = ctrl_page;
+    dma.buffer_size = litepcie_buffer_size;
+    dma.buffer_count = litepcie_buffer_count;
 
     FILE * fo;
     int i = 0;
@@ -158,14 +691,14 @@ static void litepcie_play(const char *device_name, const char *filename, uint32_
             if (dma.reader_sw_count - dma.reader_hw_count < 0)
                 sw_underflows += (dma.reader_hw_count - dma.reader_sw_count);
             /* Read data from File and fill Write buffer */
-            len = fread(buf_wr, 1, DMA_BUFFER_SIZE, fo);
+            len = fread(buf_wr, 1, dma.buffer_size, fo);
             if (feof(fo)) {
                 /* Rewind on end of file. */
                 current_loop += 1;
                 if (current_loop >= loops)
                     keep_running = 0;
                 rewind(fo);
-                len += fread(buf_wr + len, 1, DMA_BUFFER_SIZE - len, fo);
+                len += fread(buf_wr + len, 1, dma.buffer_size - len, fo);
             }
         }
 
@@ -178,9 +711,9 @@ static void litepcie_play(const char *device_name, const char *filename, uint32_
             i++;
             /* Print statistics. */
             printf("%10.2f %10" PRIu64 " %10" PRIu64 " %6d %10ld\n",
-                   (double)(dma.reader_sw_count - reader_sw_count_last) * DMA_BUFFER_SIZE * 8 / ((double)duration * 1e6),
+                   (double)(dma.reader_sw_count - reader_sw_count_last) * dma.buffer_size * 8 / ((double)duration * 1e6),
                    dma.reader_sw_count,
-                   (dma.reader_sw_count * DMA_BUFFER_SIZE) / 1024 / 1024,
+                   (dma.reader_sw_count * dma.buffer_size) / 1024 / 1024,
                    current_loop,
                    sw_underflows);
            /* Update time/count/underflows. */
@@ -197,6 +730,125 @@ static void litepcie_play(const char *device_name, const char *filename, uint32_
     fclose(fo);
 }
 
+/* Mapped Play (DMA TX) */
+/*----------------------*/
+
+/* The file is mapped and kept resident (mlock when allowed), so looping
+ * never goes back to the disk. TX buffers are filled span by span with
+ * straight copies that only split at the ring wrap or the end of file. */
+static void litepcie_play_mmap(const char *device_name, const char *filename, uint32_t loops, uint8_t zero_copy, uint8_t ctrl_page)
+{
+    static struct litepcie_dma_ctrl dma = {.use_reader = 1};
+    dma.use_ctrl_page = ctrl_page;
+    dma.batch_commit = zero_copy;
+    dma.buffer_size = litepcie_buffer_size;
+    dma.buffer_count = litepcie_buffer_count;
+
+    struct litepcie_dma_span span[2];
+    struct stat st;
+    int fd;
+    int i = 0;
+    unsigned count, s;
+    const char *data;
+    size_t file_len, file_pos = 0, len, n;
+    int64_t reader_sw_count_last = 0;
+    int64_t last_time;
+    uint32_t current_loop = 0;
+    uint64_t sw_underflows = 0;
+
+    /* Map File to read from. */
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    file_len = st.st_size;
+    if (!file_len) {
+        fprintf(stderr, "%s: empty file\n", filename);
+        exit(1);
+    }
+    data = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    close(fd);
+    /* advice values are not flags: one call each */
+    madvise((void *)data, file_len, MADV_SEQUENTIAL);
+    madvise((void *)data, file_len, MADV_WILLNEED);
+    if (mlock(data, file_len) < 0)
+        fprintf(stderr, "%s: not locked in RAM (%s), later loops may hit the disk\n", filename, strerror(errno));
+
+    /* Initialize DMA. */
+    if (litepcie_dma_init(&dma, device_name, zero_copy))
+        exit(1);
+
+    dma.reader_enable = 1;
+
+    /* Test Loop. */
+    last_time = get_time_ms();
+    for (;;) {
+        /* Exit loop on CTRL+C. */
+        if (!(keep_running))
+            break;
+
+        /* Update DMA status. */
+        litepcie_dma_process(&dma);
+
+        /* Detect DMA underflows. */
+        if (dma.reader_sw_count - dma.reader_hw_count < 0)
+            sw_underflows += (dma.reader_hw_count - dma.reader_sw_count);
+
+        /* Fill all free Write buffers from the file (wrapping on end of file). */
+        count = litepcie_dma_write_spans(&dma, span);
+        for (s = 0; s < 2; s++) {
+            char *buf = span[s].buf;
+            len = (size_t)span[s].count * dma.buffer_size;
+            while (len) {
+                n = file_len - file_pos < len ? file_len - file_pos : len;
+                litepcie_copy(buf, data + file_pos, n);
+                buf += n;
+                len -= n;
+                file_pos += n;
+                if (file_pos == file_len) {
+                    /* Rewind on end of file. */
+                    current_loop += 1;
+                    if (current_loop >= loops)
+                        keep_running = 0;
+                    file_pos = 0;
+                }
+            }
+        }
+        litepcie_dma_write_commit(&dma, count);
+
+        /* Statistics every 200ms. */
+        int64_t duration = get_time_ms() - last_time;
+        if (duration > 200) {
+             /* Print banner every 10 lines. */
+            if (i % 10 == 0)
+                printf("\e[1mSPEED(Gbps)   BUFFERS   SIZE(MB)   LOOP UNDERFLOWS\e[0m\n");
+            i++;
+            /* Print statistics. */
+            printf("%10.2f %10" PRIu64 " %10" PRIu64 " %6d %10ld\n",
+                   (double)(dma.reader_sw_count - reader_sw_count_last) * dma.buffer_size * 8 / ((double)duration * 1e6),
+                   dma.reader_sw_count,
+                   (dma.reader_sw_count * dma.buffer_size) / 1024 / 1024,
+                   current_loop,
+                   sw_underflows);
+           /* Update time/count/underflows. */
+            last_time = get_time_ms();
+            reader_sw_count_last = dma.reader_sw_count;
+            sw_underflows = 0;
+        }
+    }
+
+    /* Cleanup DMA. */
+    litepcie_dma_cleanup(&dma);
+
+    /* Unmap File. */
+    munmap((void *)data, file_len);
+}
+
 /* Help */
 /*------*/
 
@@ -207,10 +859,22 @@ static void help(void)
            "\n"
            "options:\n"
            "-h                               Help.\n"
-           "-c device_num                    Select the device (default = 0).\n"
+           "-c device_num[,device_num...]    Select the device, several for record_multi (default = 0).\n"
            "-z                               Enable zero-copy DMA mode.\n"
+           "-s                               Use the shared control page (with -z, no per-poll ioctls).\n"
+           "-B buffer_size                   DMA buffer size in bytes (default = driver setting).\n"
+           "-N buffer_count                  DMA buffer count, power of 2 (default = driver setting).\n"
+           "-u                               Record: DMA straight into an application buffer (with -z).\n"
+           "-d                               Record: O_DIRECT async writes straight from the ring (with -z, implies -u).\n"
+           "-m                               Play: map the file once and loop it from RAM.\n"
+           "-S                               Record: read-only subscriber of the RX stream of another process (with -z).\n"
+           "-R                               Record: same as -S, but required (gates the overflow accounting).\n"
+           "-P pollers                       Record_multi: poller threads, devices spread over them (default = 1).\n"
+           "-O                               Record_multi: serve buffers in completion time order (default = round-robin).\n"
            "\n"
            "record [filename] [size]         Record DMA stream to file.\n"
+           "record_multi [filename] [size]   Record the DMA streams of all -c devices to filename.N.\n"
+           "stream host port [size]          Stream the DMA RX to a TCP peer with splice (no user copy).\n"
            "play filename [loops]            Play DMA stream from file.\n"
            );
     exit(1);
@@ -226,15 +890,26 @@ int main(int argc, char **argv)
     static char litepcie_device[1024];
     static int litepcie_device_num;
     static uint8_t litepcie_device_zero_copy;
+    static uint8_t litepcie_device_ctrl_page;
+    static int litepcie_device_nums[LITEPCIE_MULTI_DEVICES_MAX];
+    static int litepcie_device_count;
+    static int litepcie_pollers;
+    static uint8_t litepcie_ordered;
+    char *list, *end;
 
     litepcie_device_num = 0;
+    litepcie_device_nums[0] = 0;
+    litepcie_device_count = 1;
+    litepcie_pollers = 1;
+    litepcie_ordered = 0;
     litepcie_device_zero_copy = 0;
+    litepcie_device_ctrl_page = 0;
 
     signal(SIGINT, intHandler);
 
     /* Parameters. */
     for (;;) {
-        c = getopt(argc, argv, "hc:z");
+        c = getopt(argc, argv, "hc:zsB:N:udmSRP:O");
         if (c == -1)
             break;
         switch(c) {
@@ -242,11 +917,51 @@ int main(int argc, char **argv)
             help();
             break;
         case 'c':
-            litepcie_device_num = atoi(optarg);
+            litepcie_device_count = 0;
+            for (list = optarg;; list = end + 1) {
+                if (litepcie_device_count == LITEPCIE_MULTI_DEVICES_MAX) {
+                    fprintf(stderr, "Too many devices, %d max\n", LITEPCIE_MULTI_DEVICES_MAX);
+                    exit(1);
+                }
+                litepcie_device_nums[litepcie_device_count++] = strtol(list, &end, 10);
+                if (*end != ',')
+                    break;
+            }
+            litepcie_device_num = litepcie_device_nums[0];
             break;
         case 'z':
             litepcie_device_zero_copy = 1;
             break;
+        case 's':
+            litepcie_device_ctrl_page = 1;
+            break;
+        case 'B':
+            litepcie_buffer_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            litepcie_buffer_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            litepcie_user_buffer = 1;
+            break;
+        case 'd':
+            litepcie_direct_record = 1;
+            break;
+        case 'm':
+            litepcie_mmap_play = 1;
+            break;
+        case 'S':
+            litepcie_subscriber = 1;
+            break;
+        case 'R':
+            litepcie_subscriber = 2;
+            break;
+        case 'P':
+            litepcie_pollers = atoi(optarg);
+            break;
+        case 'O':
+            litepcie_ordered = 1;
+            break;
         default:
             exit(1);
         }
@@ -271,7 +986,37 @@ int main(int argc, char **argv)
             filename = argv[optind++];
             size = strtoul(argv[optind++], NULL, 0);
         }
-        litepcie_record(litepcie_device, filename, size, litepcie_device_zero_copy);
+        if (litepcie_direct_record) {
+            if (!filename || !litepcie_device_zero_copy) {
+                fprintf(stderr, "Direct record requires zero-copy mode and a filename\n");
+                exit(1);
+            }
+            litepcie_record_direct(litepcie_device, filename, size, litepcie_device_ctrl_page);
+        } else
+            litepcie_record(litepcie_device, filename, size, litepcie_device_zero_copy, litepcie_device_ctrl_page);
+    /* Multi-Device Record cmd. */
+    } else if (!strcmp(cmd, "record_multi")) {
+        const char *filename = NULL;
+        uint64_t size = 0;
+        if (optind != argc) {
+            if (optind + 2 > argc)
+                goto show_help;
+            filename = argv[optind++];
+            size = strtoull(argv[optind++], NULL, 0);
+        }
+        litepcie_record_multi(litepcie_device_nums, litepcie_device_count, filename, size,
+                              litepcie_pollers, litepcie_ordered);
+    /* Stream cmd. */
+    } else if (!strcmp(cmd, "stream")) {
+        const char *host, *port;
+        uint64_t size = 0;
+        if (optind + 2 > argc)
+            goto show_help;
+        host = argv[optind++];
+        port = argv[optind++];
+        if (optind < argc)
+            size = strtoull(argv[optind++], NULL, 0);
+        litepcie_stream(litepcie_device, host, port, size);
     /* Play cmd. */
     } else if (!strcmp(cmd, "play")) {
         const char *filename;
@@ -281,7 +1026,10 @@ int main(int argc, char **argv)
         filename = argv[optind++];
         if (optind < argc)
             loops = strtoul(argv[optind++], NULL, 0);
-        litepcie_play(litepcie_device, filename, loops, litepcie_device_zero_copy);
+        if (litepcie_mmap_play)
+            litepcie_play_mmap(litepcie_device, filename, loops, litepcie_device_zero_copy, litepcie_device_ctrl_page);
+        else
+            litepcie_play(litepcie_device, filename, loops, litepcie_device_zero_copy, litepcie_device_ctrl_page);
     /* Show help otherwise. */
     } else
 show_help:
@@ -29,6 +29,10 @@
 
 static char litepcie_device[1024];
 static int litepcie_device_num;
+static uint32_t litepcie_buffer_size;    /* 0: driver geometry */
+static uint32_t litepcie_buffer_count;
+static uint32_t litepcie_buffer_per_irq;
+static uint8_t litepcie_flash_fast;      /* litepcie_flash_write_fast() */
 
 sig_atomic_t keep_running = 1;
 
@@ -138,6 +142,9 @@ static void flash_program(uint32_t base, const uint8_t *buf1, int size1)
         exit(1);
     }
 
+    /* Direct BAR0 register access when permitted, batches otherwise. */
+    litepcie_reg_mmap(fd);
+
     /* Get flash sector size and pad size to it. */
     sector_size = litepcie_flash_get_erase_block_size(fd);
     size = ((size1 + sector_size - 1) / sector_size) * sector_size;
@@ -152,7 +159,10 @@ static void flash_program(uint32_t base, const uint8_t *buf1, int size1)
 
     /* Program flash. */
     printf("Programming (%d bytes at 0x%08x)...\n", size, base);
-    errors = litepcie_flash_write(fd, buf, base, size, flash_progress, NULL);
+    if (litepcie_flash_fast)
+        errors = litepcie_flash_write_fast(fd, buf, base, size, flash_progress, NULL);
+    else
+        errors = litepcie_flash_write(fd, buf, base, size, flash_progress, NULL);
     if (errors) {
         printf("Failed %d errors.\n", errors);
         exit(1);
@@ -162,6 +172,7 @@ static void flash_program(uint32_t base, const uint8_t *buf1, int size1)
 
     /* Free buffer and close LitePCIe device. */
     free(buf);
+    litepcie_reg_munmap(fd);
     close(fd);
 }
 
@@ -222,6 +233,7 @@ static void flash_read(const char *filename, uint32_t size, uint32_t offset)
         fprintf(stderr, "Could not init driver\n");
         exit(1);
     }
+    litepcie_reg_mmap(fd);
 
     /* Get flash sector size. */
     sector_size = litepcie_flash_get_erase_block_size(fd);
@@ -239,6 +251,7 @@ static void flash_read(const char *filename, uint32_t size, uint32_t offset)
 
     /* Close destination file and LitePCIe device. */
     fclose(f);
+    litepcie_reg_munmap(fd);
     close(fd);
 }
 
@@ -316,10 +329,17 @@ static void write_pn_data(uint32_t *buf, int count, uint32_t *pseed, int data_wi
     uint32_t seed;
     uint32_t mask = get_data_mask(data_width);
 
+#ifdef DMA_RANDOM_DATA
+    /* SIMD kernels when the CPU has them (the loop below is the reference). */
+    if (count > 0) {
+        litepcie_pn_fill(buf, count, pseed, mask);
+        return;
+    }
+#endif
     seed = *pseed;
     for(i = 0; i < count; i++) {
         buf[i] = (seed_to_data(seed) & mask);
-        seed = add_mod_int(seed, 1, DMA_BUFFER_SIZE / sizeof(uint32_t));
+        seed = add_mod_int(seed, 1, count);
     }
     *pseed = seed;
 }
@@ -330,23 +350,33 @@ static int check_pn_data(const uint32_t *buf, int count, uint32_t *pseed, int da
     uint32_t seed;
     uint32_t mask = get_data_mask(data_width);
 
+#ifdef DMA_RANDOM_DATA
+    if (count > 0)
+        return litepcie_pn_check(buf, count, pseed, mask);
+#endif
     errors = 0;
     seed = *pseed;
     for (i = 0; i < count; i++) {
         if ((buf[i] & mask) != (seed_to_data(seed) & mask)) {
             errors ++;
         }
-        seed = add_mod_int(seed, 1, DMA_BUFFER_SIZE / sizeof(uint32_t));
+        seed = add_mod_int(seed, 1, count);
     }
     *pseed = seed;
     return errors;
 }
 #endif
 
-static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_width, int auto_rx_delay, int duration)
+static void dma_test(uint8_t zero_copy, uint8_t ctrl_page, uint8_t busy_poll, uint8_t external_loopback, int data_width, int auto_rx_delay, int duration)
 {
     static struct litepcie_dma_ctrl dma = {.use_reader = 1, .use_writer = 1};
     dma.loopback = external_loopback ? 0 : 1;
+    dma.use_ctrl_page = ctrl_page;
+    dma.busy_poll = busy_poll;
+    dma.buffer_size = litepcie_buffer_size;
+    dma.buffer_count = litepcie_buffer_count;
+    dma.buffer_per_irq = litepcie_buffer_per_irq;
+    dma.batch_commit = zero_copy;
 
     if (data_width > 32 || data_width < 1) {
         fprintf(stderr, "Invalid data width %d\n", data_width);
@@ -359,6 +389,7 @@ static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_widt
     int64_t last_time;
     uint32_t errors = 0;
     int64_t end_time = (duration > 0) ? get_time_ms() + duration * 1000 : 0;
+    struct litepcie_ioctl_dma_irq_stats irq_stats;
 
 #ifdef DMA_CHECK_DATA
     uint32_t seed_wr = 0;
@@ -372,6 +403,9 @@ static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_widt
 
     printf("\e[1m[> DMA loopback test:\e[0m\n");
     printf("---------------------\n");
+#ifdef DMA_CHECK_DATA
+    printf("PN kernels: %s\n", litepcie_pattern_isa());
+#endif
 
     if (litepcie_dma_init(&dma, litepcie_device, zero_copy))
         exit(1);
@@ -390,60 +424,61 @@ static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_widt
         litepcie_dma_process(&dma);
 
 #ifdef DMA_CHECK_DATA
-        char *buf_wr;
+        struct litepcie_dma_span span[2];
+        unsigned count, s, j;
         char *buf_rd;
 
         /* DMA-TX Write. */
-        while (1) {
-            /* Get Write buffer. */
-            buf_wr = litepcie_dma_next_write_buffer(&dma);
-            /* Break when no buffer available for Write. */
-            if (!buf_wr)
-                break;
-            /* Write data to buffer. */
-            write_pn_data((uint32_t *) buf_wr, DMA_BUFFER_SIZE / sizeof(uint32_t), &seed_wr, data_width);
+        count = litepcie_dma_write_spans(&dma, span);
+        for (s = 0; s < 2; s++) {
+            /* Write data to buffers (the PN sequence restarts on each buffer). */
+            for (j = 0; j < span[s].count; j++)
+                write_pn_data((uint32_t *) (span[s].buf + (size_t)j * dma.buffer_size),
+                    dma.buffer_size / sizeof(uint32_t), &seed_wr, data_width);
         }
+        litepcie_dma_write_commit(&dma, count);
 
         /* DMA-RX Read/Check */
-        while (1) {
-            /* Get Read buffer. */
-            buf_rd = litepcie_dma_next_read_buffer(&dma);
-            /* Break when no buffer available for Read. */
-            if (!buf_rd)
-                break;
-            /* Skip the first 128 DMA loops. */
-            if (dma.writer_hw_count < 128*DMA_BUFFER_COUNT)
-                break;
-            /* When running... */
-            if (run) {
-                /* Check data in Read buffer. */
-                errors += check_pn_data((uint32_t *) buf_rd, DMA_BUFFER_SIZE / sizeof(uint32_t), &seed_rd, data_width);
-                /* Clear Read buffer */
-                memset(buf_rd, 0, DMA_BUFFER_SIZE);
-            } else {
-                /* Find initial Delay/Seed (Useful when loopback is introducing delay). */
-                uint32_t errors_min = 0xffffffff;
-                for (int delay = 0; delay < DMA_BUFFER_SIZE / sizeof(uint32_t); delay++) {
-                    seed_rd = delay;
-                    errors = check_pn_data((uint32_t *) buf_rd, DMA_BUFFER_SIZE / sizeof(uint32_t), &seed_rd, data_width);
-                    //printf("delay: %d / errors: %d\n", delay, errors);
-                    if (errors < errors_min)
-                        errors_min = errors;
-                    if (errors < (DMA_BUFFER_SIZE / sizeof(uint32_t)) / 2) {
-                        printf("RX_DELAY: %d (errors: %d)\n", delay, errors);
-                        run = 1;
-                        break;
+        count = litepcie_dma_read_spans(&dma, span);
+        /* Skip the first 128 DMA loops. */
+        if (dma.writer_hw_count < 128*dma.buffer_count)
+            span[0].count = span[1].count = 0;
+        for (s = 0; s < 2; s++) {
+            for (j = 0; j < span[s].count; j++) {
+                buf_rd = span[s].buf + (size_t)j * dma.buffer_size;
+                /* When running... */
+                if (run) {
+                    /* Check data in Read buffer. */
+                    errors += check_pn_data((uint32_t *) buf_rd, dma.buffer_size / sizeof(uint32_t), &seed_rd, data_width);
+                } else {
+                    /* Find initial Delay/Seed (Useful when loopback is introducing delay). */
+                    uint32_t errors_min = 0xffffffff;
+                    for (int delay = 0; delay < dma.buffer_size / sizeof(uint32_t); delay++) {
+                        seed_rd = delay;
+                        errors = check_pn_data((uint32_t *) buf_rd, dma.buffer_size / sizeof(uint32_t), &seed_rd, data_width);
+                        //printf("delay: %d / errors: %d\n", delay, errors);
+                        if (errors < errors_min)
+                            errors_min = errors;
+                        if (errors < (dma.buffer_size / sizeof(uint32_t)) / 2) {
+                            printf("RX_DELAY: %d (errors: %d)\n", delay, errors);
+                            run = 1;
+                            break;
+                        }
+                    }
+                    if (!run) {
+                        printf("Unable to find DMA RX_DELAY (min errors: %d/%ld), exiting.\n",
+                            errors_min,
+                            dma.buffer_size / sizeof(uint32_t));
+                        goto end;
                     }
-                }
-                if (!run) {
-                    printf("Unable to find DMA RX_DELAY (min errors: %d/%ld), exiting.\n",
-                        errors_min,
-                        DMA_BUFFER_SIZE / sizeof(uint32_t));
-                    goto end;
                 }
             }
-
+            /* Clear Read buffers */
+            if (run)
+                litepcie_clear(span[s].buf, (size_t)span[s].count * dma.buffer_size);
         }
+        /* Hand the whole batch back to the DMA at once. */
+        litepcie_dma_read_commit(&dma, count);
 #endif
 
         /* Statistics every 200ms. */
@@ -455,7 +490,7 @@ static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_widt
             i++;
             /* Print statistics. */
             printf("%14.2f\t%10" PRIu64 "\t%10" PRIu64 "\t%4" PRIu64 "\t%6u\n",
-                   (double)(dma.reader_sw_count - reader_sw_count_last) * DMA_BUFFER_SIZE * 8 * data_width / (get_next_pow2(data_width) * (double)duration_ms * 1e6),
+                   (double)(dma.reader_sw_count - reader_sw_count_last) * dma.buffer_size * 8 * data_width / (get_next_pow2(data_width) * (double)duration_ms * 1e6),
                    dma.reader_sw_count,
                    dma.writer_sw_count,
                    (uint64_t) abs(dma.reader_sw_count - dma.writer_sw_count),
@@ -471,9 +506,148 @@ static void dma_test(uint8_t zero_copy, uint8_t external_loopback, int data_widt
 #ifdef DMA_CHECK_DATA
 end:
 #endif
+    /* MSI statistics (before cleanup stops the DMAs and clears them). */
+    if (litepcie_dma_irq_stats(dma.fds.fd, &irq_stats) == 0)
+        printf("MSIs: TX %" PRIu64 " (%.1f buffers/MSI, %" PRIu64 " polls), RX %" PRIu64 " (%.1f buffers/MSI, %" PRIu64 " polls)\n",
+               irq_stats.reader_irqs,
+               irq_stats.reader_irqs ? (double)irq_stats.reader_irq_buffers / irq_stats.reader_irqs : 0.0,
+               irq_stats.reader_polls,
+               irq_stats.writer_irqs,
+               irq_stats.writer_irqs ? (double)irq_stats.writer_irq_buffers / irq_stats.writer_irqs : 0.0,
+               irq_stats.writer_polls);
+    if (dma.writer_overruns)
+        printf("RX overruns: %" PRId64 " buffers rewritten before being read, skipped\n", dma.writer_overruns);
     litepcie_dma_cleanup(&dma);
 }
 
+/* Pattern */
+/*---------*/
+
+#define PATTERN_TEST_WORDS 4099
+
+/* Runs and diffs one generator/checker case: returns 1 on mismatch. */
+static int pattern_test_pn(uint32_t *ref, uint32_t *buf, unsigned count, uint32_t seed, uint32_t mask)
+{
+    uint32_t seed_ref = seed, seed_buf = seed;
+    unsigned errors_ref, errors_buf, i;
+
+    /* fill, twice: the second call continues from *pseed */
+    for (i = 0; i < 2; i++) {
+        litepcie_pn_fill_scalar(ref, count, &seed_ref, mask);
+        litepcie_pn_fill(buf, count, &seed_buf, mask);
+        if (memcmp(ref, buf, count * sizeof(uint32_t)) || seed_ref != seed_buf)
+            return 1;
+    }
+    /* check: bits outside the mask are ignored, corrupt words counted (first, middle, last) */
+    for (i = 0; i < count; i++)
+        ref[i] |= ~mask;
+    ref[0] ^= 1;
+    ref[count / 2] ^= 1;
+    ref[count - 1] ^= 1;
+    for (i = 0; i < 2; i++) {
+        errors_ref = litepcie_pn_check_scalar(ref, count, &seed_ref, mask);
+        errors_buf = litepcie_pn_check(ref, count, &seed_buf, mask);
+        if (errors_ref != errors_buf || seed_ref != seed_buf)
+            return 1;
+    }
+    return 0;
+}
+
+static int pattern_test_lcg(uint32_t *ref, uint32_t *buf, size_t count, uint32_t seed)
+{
+    uint32_t seed_ref = seed, seed_buf = seed;
+    size_t errors_ref, errors_buf;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        litepcie_lcg_fill_scalar(ref, count, &seed_ref);
+        litepcie_lcg_fill(buf, count, &seed_buf);
+        if (memcmp(ref, buf, count * sizeof(uint32_t)) || seed_ref != seed_buf)
+            return 1;
+    }
+    if (count) {
+        ref[0] ^= 1;
+        ref[count / 2] ^= 1;
+        ref[count - 1] ^= 1;
+    }
+    for (i = 0; i < 2; i++) {
+        errors_ref = litepcie_lcg_check_scalar(ref, count, &seed_ref);
+        errors_buf = litepcie_lcg_check(ref, count, &seed_buf);
+        if (errors_ref != errors_buf || seed_ref != seed_buf)
+            return 1;
+    }
+    return 0;
+}
+
+/* No hardware needed: each SIMD kernel set against the scalar reference, over
+ * odd/lane-sized counts, seeds near the wrap, tails and data width masks. */
+static void pattern_test(void)
+{
+    static const char *isas[] = {"avx2", "avx512"};
+    static const unsigned counts[] = {1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1023, 2048, PATTERN_TEST_WORDS};
+    static const int widths[] = {1, 8, 12, 16, 31, 32};
+    uint32_t *ref, *buf;
+    uint32_t seeds[6], mask;
+    unsigned c, s, w, i, count, cases, failures = 0;
+
+    ref = malloc(PATTERN_TEST_WORDS * sizeof(uint32_t));
+    buf = malloc(PATTERN_TEST_WORDS * sizeof(uint32_t));
+    if (!ref || !buf) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    printf("\e[1m[> Pattern test:\e[0m\n");
+    printf("-----------------\n");
+    for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (litepcie_pattern_select(isas[i])) {
+            printf("%-8s skipped (not supported by this CPU)\n", isas[i]);
+            continue;
+        }
+        cases = 0;
+        for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            count = counts[c];
+            /* in range, around the lane wrap, and out of range (scalar fallback) */
+            seeds[0] = 0;
+            seeds[1] = 1;
+            seeds[2] = count / 2;
+            seeds[3] = count > 8 ? count - 8 : 0;
+            seeds[4] = count - 1;
+            seeds[5] = count + 3;
+            for (s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++) {
+                for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+                    mask = widths[w] == 32 ? 0xffffffff : (1u << widths[w]) - 1;
+                    cases++;
+                    if (pattern_test_pn(ref, buf, count, seeds[s], mask)) {
+                        printf("%-8s PN mismatch: count %u, seed %u, width %d\n", isas[i], count, seeds[s], widths[w]);
+                        failures++;
+                    }
+                }
+                cases++;
+                if (pattern_test_lcg(ref, buf, count, seeds[s] * 2654435761u)) {
+                    printf("%-8s LCG mismatch: count %u, seed %u\n", isas[i], count, seeds[s] * 2654435761u);
+                    failures++;
+                }
+            }
+        }
+        cases++;
+        if (pattern_test_lcg(ref, buf, 0, 1)) {
+            printf("%-8s LCG mismatch: count 0\n", isas[i]);
+            failures++;
+        }
+        printf("%-8s %u cases checked against scalar\n", isas[i], cases);
+    }
+    litepcie_pattern_select(NULL);
+
+    free(ref);
+    free(buf);
+    if (failures) {
+        printf("%u mismatches\n", failures);
+        exit(1);
+    }
+    printf("OK\n");
+}
+
 /* Help */
 /*------*/
 
@@ -486,15 +660,24 @@ static void help(void)
            "-h                                Help.\n"
            "-c device_num                     Select the device (default = 0).\n"
            "-z                                Enable zero-copy DMA mode.\n"
+           "-s                                Use the shared control page (with -z, no per-poll ioctls).\n"
+           "-b                                Busy-poll DMA status from BAR0 (with -z, DMA MSIs disabled).\n"
+           "-B buffer_size                    DMA buffer size in bytes (default = driver setting).\n"
+           "-N buffer_count                   DMA buffer count, power of 2 (default = driver setting).\n"
+           "-I buffers_per_irq                DMA buffers per MSI (default = driver setting).\n"
            "-e                                Use external loopback (default = internal).\n"
            "-w data_width                     Width of data bus (default = 16).\n"
            "-a                                Automatic DMA RX-Delay calibration.\n"
            "-t duration                       Duration of the test in seconds (default = 0, infinite).\n"
+#ifdef CSR_FLASH_BASE
+           "-F                                Fast flash_write: skip unchanged sectors, verify once at the end.\n"
+#endif
            "\n"
            "available commands:\n"
            "info                              Get Board information.\n"
            "\n"
            "dma_test                          Test DMA.\n"
+           "pattern_test                      Check the SIMD PN/LCG kernels against the scalar ones (no device).\n"
            "scratch_test                      Test Scratch register.\n"
            "\n"
 #ifdef CSR_FLASH_BASE
@@ -514,6 +697,8 @@ int main(int argc, char **argv)
     const char *cmd;
     int c;
     static uint8_t litepcie_device_zero_copy;
+    static uint8_t litepcie_device_ctrl_page;
+    static uint8_t litepcie_device_busy_poll;
     static uint8_t litepcie_device_external_loopback;
     static int litepcie_data_width;
     static int litepcie_auto_rx_delay;
@@ -523,11 +708,13 @@ int main(int argc, char **argv)
     litepcie_data_width = 16;
     litepcie_auto_rx_delay = 0;
     litepcie_device_zero_copy = 0;
+    litepcie_device_ctrl_page = 0;
+    litepcie_device_busy_poll = 0;
     litepcie_device_external_loopback = 0;
 
     /* Parameters. */
     for (;;) {
-        c = getopt(argc, argv, "hc:w:zeat:");
+        c = getopt(argc, argv, "hc:w:zsbB:N:I:eat:F");
         if (c == -1)
             break;
         switch(c) {
@@ -543,6 +730,21 @@ int main(int argc, char **argv)
         case 'z':
             litepcie_device_zero_copy = 1;
             break;
+        case 's':
+            litepcie_device_ctrl_page = 1;
+            break;
+        case 'b':
+            litepcie_device_busy_poll = 1;
+            break;
+        case 'B':
+            litepcie_buffer_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            litepcie_buffer_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'I':
+            litepcie_buffer_per_irq = strtoul(optarg, NULL, 0);
+            break;
         case 'e':
             litepcie_device_external_loopback = 1;
             break;
@@ -552,6 +754,9 @@ int main(int argc, char **argv)
         case 't':
             test_duration = atoi(optarg);
             break;
+        case 'F':
+            litepcie_flash_fast = 1;
+            break;
         default:
             exit(1);
         }
@@ -604,10 +809,14 @@ int main(int argc, char **argv)
     else if (!strcmp(cmd, "dma_test"))
         dma_test(
             litepcie_device_zero_copy,
+            litepcie_device_ctrl_page,
+            litepcie_device_busy_poll,
             litepcie_device_external_loopback,
             litepcie_data_width,
             litepcie_auto_rx_delay,
             test_duration);
+    else if (!strcmp(cmd, "pattern_test"))
+        pattern_test();
 
     /* Show help otherwise. */
     else
@@ -0,0 +1,555 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * LitePCIe Python bindings
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2023 / EnjoyDigital  / florent@enjoy-digital.fr
+ *
+ */
+
+/* Zero-copy access to the mmapped DMA rings from Python.
+ *
+ *   with pylitepcie.Dma("/dev/litepcie0", rx=True) as dma:
+ *       dma.start()
+ *       while True:
+ *           dma.poll()                      # GIL released
+ *           with dma.rx() as batch:         # ready RX buffers, released on exit
+ *               for span in batch.spans:    # 1 or 2 runs (ring wrap)
+ *                   a = numpy.frombuffer(span, dtype=numpy.int16)
+ *
+ * A Span exports its run of ring buffers through the buffer protocol as a
+ * (count, buffer_size) array of bytes, read-only on RX. Views are only
+ * meaningful until their batch is released: the DMA reuses the buffers.
+ * They stay mapped though, even past close(), so a stale array never faults. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "litepcie_dma.h"
+
+typedef struct {
+    PyObject_HEAD
+    struct litepcie_dma_ctrl dma;
+    int open;
+    int rx_held, tx_held;      /* a batch of that side is not released yet */
+    int polling;               /* poll() running without the GIL: the counters are its */
+    Py_ssize_t exports;        /* live buffer views into the rings */
+    int unmap_pending;         /* closed with views left: unmap after the last one */
+} DmaObject;
+
+typedef struct {
+    PyObject_HEAD
+    DmaObject *dma;
+    int rx;
+    int released;
+    unsigned count;
+    struct litepcie_dma_span span[2];
+} BatchObject;
+
+typedef struct {
+    PyObject_HEAD
+    BatchObject *batch;
+    char *buf;
+    Py_ssize_t shape[2];       /* buffers, buffer_size */
+    Py_ssize_t strides[2];
+} SpanObject;
+
+static PyTypeObject DmaType, BatchType, SpanType;
+
+/* Span */
+
+static int span_getbuffer(SpanObject *self, Py_buffer *view, int flags)
+{
+    int readonly = self->batch->rx;
+
+    if (self->batch->released || !self->batch->dma->open) {
+        PyErr_SetString(PyExc_BufferError, "batch already released");
+        return -1;
+    }
+    if (PyBuffer_FillInfo(view, (PyObject *)self, self->buf, self->shape[0] * self->shape[1],
+                          readonly, flags) < 0)
+        return -1;
+    if ((flags & PyBUF_ND) == PyBUF_ND) {
+        view->ndim = 2;
+        view->shape = self->shape;
+    }
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+        view->strides = self->strides;
+    self->batch->dma->exports++;
+    return 0;
+}
+
+static void span_releasebuffer(SpanObject *self, Py_buffer *view)
+{
+    DmaObject *dma = self->batch->dma;
+
+    (void)view;
+    if (--dma->exports == 0 && dma->unmap_pending) {
+        litepcie_dma_cleanup(&dma->dma);
+        dma->unmap_pending = 0;
+    }
+}
+
+static PyBufferProcs span_as_buffer = {
+    .bf_getbuffer = (getbufferproc)span_getbuffer,
+    .bf_releasebuffer = (releasebufferproc)span_releasebuffer,
+};
+
+static Py_ssize_t span_len(SpanObject *self)
+{
+    return self->shape[0];
+}
+
+static PySequenceMethods span_as_sequence = {
+    .sq_length = (lenfunc)span_len,
+};
+
+static void span_dealloc(SpanObject *self)
+{
+    Py_XDECREF(self->batch);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyTypeObject SpanType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pylitepcie.Span",
+    .tp_doc = "Run of contiguous ring buffers: buffer protocol, (count, buffer_size) bytes",
+    .tp_basicsize = sizeof(SpanObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)span_dealloc,
+    .tp_as_buffer = &span_as_buffer,
+    .tp_as_sequence = &span_as_sequence,
+};
+
+/* Batch */
+
+static PyObject *batch_new(DmaObject *dma, int rx)
+{
+    BatchObject *self;
+
+    self = PyObject_New(BatchObject, &BatchType);
+    if (!self)
+        return NULL;
+    self->dma = (DmaObject *)Py_NewRef(dma);
+    self->rx = rx;
+    self->released = 0;
+    self->count = rx ? litepcie_dma_read_spans(&dma->dma, self->span) :
+                       litepcie_dma_write_spans(&dma->dma, self->span);
+    if (rx)
+        dma->rx_held = 1;
+    else
+        dma->tx_held = 1;
+    return (PyObject *)self;
+}
+
+static int batch_check_idle(BatchObject *self)
+{
+    if (self->dma->polling) {
+        PyErr_SetString(PyExc_RuntimeError, "poll() running in another thread");
+        return -1;
+    }
+    return 0;
+}
+
+/* Hand count buffers back to the driver (RX: free to refill, TX: to send). */
+static void batch_release_count(BatchObject *self, unsigned count)
+{
+    if (self->released)
+        return;
+    self->released = 1;
+    if (self->rx)
+        self->dma->rx_held = 0;
+    else
+        self->dma->tx_held = 0;
+    /* closed: the DMAs are stopped and the control page may be unmapped already */
+    if (!self->dma->open)
+        return;
+    if (count > self->count)
+        count = self->count;
+    if (self->rx)
+        litepcie_dma_read_commit(&self->dma->dma, count);
+    else
+        litepcie_dma_write_commit(&self->dma->dma, count);
+}
+
+static PyObject *batch_release(BatchObject *self, PyObject *args)
+{
+    Py_ssize_t count = -1;
+
+    if (!PyArg_ParseTuple(args, "|n", &count))
+        return NULL;
+    if (self->released) {
+        PyErr_SetString(PyExc_RuntimeError, "batch already released");
+        return NULL;
+    }
+    if (batch_check_idle(self))
+        return NULL;
+    batch_release_count(self, count < 0 ? self->count : (unsigned)count);
+    Py_RETURN_NONE;
+}
+
+static PyObject *batch_enter(BatchObject *self, PyObject *unused)
+{
+    (void)unused;
+    return Py_NewRef(self);
+}
+
+/* RX buffers are always handed back, TX ones only sent without an exception. */
+static PyObject *batch_exit(BatchObject *self, PyObject *args)
+{
+    PyObject *type, *value, *tb;
+
+    if (!PyArg_ParseTuple(args, "OOO", &type, &value, &tb))
+        return NULL;
+    if (batch_check_idle(self))
+        return NULL;
+    batch_release_count(self, self->rx || type == Py_None ? self->count : 0);
+    Py_RETURN_FALSE;
+}
+
+static void batch_dealloc(BatchObject *self)
+{
+    /* dropped unreleased: RX buffers go back, TX ones are not sent */
+    batch_release_count(self, self->rx ? self->count : 0);
+    Py_XDECREF(self->dma);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static Py_ssize_t batch_len(BatchObject *self)
+{
+    return self->count;
+}
+
+/* New Span objects each time: they reference the batch, not the reverse. */
+static PyObject *batch_get_spans(BatchObject *self, void *closure)
+{
+    PyObject *spans;
+    SpanObject *s;
+    int i, n;
+
+    (void)closure;
+    n = (self->span[0].count > 0) + (self->span[1].count > 0);
+    spans = PyTuple_New(n);
+    if (!spans)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        s = PyObject_New(SpanObject, &SpanType);
+        if (!s) {
+            Py_DECREF(spans);
+            return NULL;
+        }
+        s->batch = (BatchObject *)Py_NewRef(self);
+        s->buf = self->span[i].buf;
+        s->shape[0] = self->span[i].count;
+        s->shape[1] = self->dma->dma.buffer_size;
+        s->strides[0] = self->dma->dma.buffer_size;
+        s->strides[1] = 1;
+        PyTuple_SET_ITEM(spans, i, (PyObject *)s);
+    }
+    return spans;
+}
+
+static PyObject *batch_get_released(BatchObject *self, void *closure)
+{
+    (void)closure;
+    return PyBool_FromLong(self->released);
+}
+
+static PyMethodDef batch_methods[] = {
+    {"release", (PyCFunction)batch_release, METH_VARARGS,
+     "release(count=-1): hand the first count buffers (all by default) back to the driver"},
+    {"__enter__", (PyCFunction)batch_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)batch_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef batch_getset[] = {
+    {"spans", (getter)batch_get_spans, NULL, "tuple of Span, in ring order", NULL},
+    {"released", (getter)batch_get_released, NULL, "buffers handed back to the driver", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PySequenceMethods batch_as_sequence = {
+    .sq_length = (lenfunc)batch_len,
+};
+
+static PyTypeObject BatchType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pylitepcie.Batch",
+    .tp_doc = "Ready ring buffers of one side, held until released",
+    .tp_basicsize = sizeof(BatchObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)batch_dealloc,
+    .tp_methods = batch_methods,
+    .tp_getset = batch_getset,
+    .tp_as_sequence = &batch_as_sequence,
+};
+
+/* Dma */
+
+static int dma_check_open(DmaObject *self)
+{
+    if (!self->open) {
+        PyErr_SetString(PyExc_ValueError, "DMA channel is closed");
+        return -1;
+    }
+    if (self->polling) {
+        PyErr_SetString(PyExc_RuntimeError, "poll() running in another thread");
+        return -1;
+    }
+    return 0;
+}
+
+static int dma_init(DmaObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"device", "rx", "tx", "loopback",
+                             "buffer_size", "buffer_count", "buffer_per_irq", NULL};
+    const char *device = "/dev/litepcie0";
+    int rx = 1, tx = 0, loopback = 0;
+    unsigned buffer_size = 0, buffer_count = 0, buffer_per_irq = 0;
+    int ret;
+
+    if (self->open) {
+        PyErr_SetString(PyExc_RuntimeError, "DMA channel already open");
+        return -1;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|spppIII", kwlist, &device, &rx, &tx, &loopback,
+                                     &buffer_size, &buffer_count, &buffer_per_irq))
+        return -1;
+    if (!rx && !tx) {
+        PyErr_SetString(PyExc_ValueError, "rx and/or tx required");
+        return -1;
+    }
+
+    memset(&self->dma, 0, sizeof(self->dma));
+    self->dma.use_writer = rx;
+    self->dma.use_reader = tx;
+    self->dma.loopback = loopback;
+    self->dma.buffer_size = buffer_size;
+    self->dma.buffer_count = buffer_count;
+    self->dma.buffer_per_irq = buffer_per_irq;
+    /* counters through the control page, buffers only move on release */
+    self->dma.use_ctrl_page = 1;
+    self->dma.batch_commit = 1;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = litepcie_dma_init(&self->dma, device, 1);
+    Py_END_ALLOW_THREADS
+    if (ret) {
+        PyErr_Format(PyExc_OSError, "%s: DMA init failed", device);
+        return -1;
+    }
+    self->open = 1;
+    return 0;
+}
+
+static PyObject *dma_close(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    if (!self->open)
+        Py_RETURN_NONE;
+    if (dma_check_open(self))
+        return NULL;
+    self->open = 0;
+    /* views left (arrays still alive): stop the DMAs now, keep the rings mapped */
+    if (self->exports) {
+        self->unmap_pending = 1;
+        Py_BEGIN_ALLOW_THREADS
+        if (self->dma.use_reader)
+            litepcie_dma_reader(self->dma.fds.fd, 0, &self->dma.reader_hw_count, &self->dma.reader_sw_count);
+        if (self->dma.use_writer)
+            litepcie_dma_writer(self->dma.fds.fd, 0, &self->dma.writer_hw_count, &self->dma.writer_sw_count);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    litepcie_dma_cleanup(&self->dma);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static void dma_dealloc(DmaObject *self)
+{
+    /* batches and views hold a reference: nothing points into the rings anymore */
+    if (self->open || self->unmap_pending)
+        litepcie_dma_cleanup(&self->dma);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *dma_enable(DmaObject *self, uint8_t enable)
+{
+    if (dma_check_open(self))
+        return NULL;
+    self->dma.writer_enable = self->dma.use_writer ? enable : 0;
+    self->dma.reader_enable = self->dma.use_reader ? enable : 0;
+    /* the enable ioctls go out with the next poll() */
+    Py_RETURN_NONE;
+}
+
+static PyObject *dma_start(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    return dma_enable(self, 1);
+}
+
+static PyObject *dma_stop(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    return dma_enable(self, 0);
+}
+
+static PyObject *dma_poll(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    if (dma_check_open(self))
+        return NULL;
+    /* waits up to 100 ms for a DMA event: let the other threads run */
+    self->polling = 1;
+    Py_BEGIN_ALLOW_THREADS
+    litepcie_dma_process(&self->dma);
+    Py_END_ALLOW_THREADS
+    self->polling = 0;
+    return Py_BuildValue("(II)", self->dma.buffers_available_read, self->dma.buffers_available_write);
+}
+
+static PyObject *dma_batch(DmaObject *self, int rx)
+{
+    if (dma_check_open(self))
+        return NULL;
+    if (rx ? !self->dma.use_writer : !self->dma.use_reader) {
+        PyErr_Format(PyExc_ValueError, "channel opened without %s", rx ? "rx" : "tx");
+        return NULL;
+    }
+    if (rx ? self->rx_held : self->tx_held) {
+        PyErr_Format(PyExc_RuntimeError, "previous %s batch not released", rx ? "rx" : "tx");
+        return NULL;
+    }
+    return batch_new(self, rx);
+}
+
+static PyObject *dma_rx(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    return dma_batch(self, 1);
+}
+
+static PyObject *dma_tx(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    return dma_batch(self, 0);
+}
+
+static PyObject *dma_enter(DmaObject *self, PyObject *unused)
+{
+    (void)unused;
+    if (dma_check_open(self))
+        return NULL;
+    return Py_NewRef(self);
+}
+
+static PyObject *dma_exit(DmaObject *self, PyObject *args)
+{
+    (void)args;
+    return dma_close(self, NULL);
+}
+
+static PyObject *dma_get_buffer_size(DmaObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromUnsignedLong(self->dma.buffer_size);
+}
+
+static PyObject *dma_get_buffer_count(DmaObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromUnsignedLong(self->dma.buffer_count);
+}
+
+static PyObject *dma_get_counts(DmaObject *self, void *closure)
+{
+    (void)closure;
+    /* RX: (written by the FPGA, released), TX: (fetched by the FPGA, submitted) */
+    return Py_BuildValue("((LL)(LL))",
+                         (long long)self->dma.writer_hw_count, (long long)self->dma.writer_sw_count,
+                         (long long)self->dma.reader_hw_count, (long long)self->dma.reader_sw_count);
+}
+
+static PyObject *dma_get_overruns(DmaObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromLongLong(self->dma.writer_overruns);
+}
+
+static PyObject *dma_get_fd(DmaObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromLong(self->open ? self->dma.fds.fd : -1);
+}
+
+static PyMethodDef dma_methods[] = {
+    {"start", (PyCFunction)dma_start, METH_NOARGS, "Enable the DMAs of the opened sides (at the next poll())"},
+    {"stop", (PyCFunction)dma_stop, METH_NOARGS, "Disable the DMAs (at the next poll())"},
+    {"poll", (PyCFunction)dma_poll, METH_NOARGS,
+     "Wait (up to 100 ms, GIL released) and update the counters: (rx ready, tx free)"},
+    {"rx", (PyCFunction)dma_rx, METH_NOARGS, "Batch of the RX buffers ready at the last poll()"},
+    {"tx", (PyCFunction)dma_tx, METH_NOARGS, "Batch of the TX buffers free at the last poll()"},
+    {"close", (PyCFunction)dma_close, METH_NOARGS, "Stop the DMAs, unmap the rings and close the device"},
+    {"__enter__", (PyCFunction)dma_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)dma_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef dma_getset[] = {
+    {"buffer_size", (getter)dma_get_buffer_size, NULL, "bytes per ring buffer", NULL},
+    {"buffer_count", (getter)dma_get_buffer_count, NULL, "buffers per ring", NULL},
+    {"counts", (getter)dma_get_counts, NULL, "((rx hw, rx sw), (tx hw, tx sw)) buffer counts", NULL},
+    {"overruns", (getter)dma_get_overruns, NULL, "RX buffers rewritten by the DMA before release, skipped", NULL},
+    {"fd", (getter)dma_get_fd, NULL, "device file descriptor, -1 once closed", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyTypeObject DmaType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pylitepcie.Dma",
+    .tp_doc = "Dma(device='/dev/litepcie0', rx=True, tx=False, loopback=False, "
+              "buffer_size=0, buffer_count=0, buffer_per_irq=0): zero-copy DMA channel",
+    .tp_basicsize = sizeof(DmaObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)dma_init,
+    .tp_dealloc = (destructor)dma_dealloc,
+    .tp_methods = dma_methods,
+    .tp_getset = dma_getset,
+};
+
+/* Module */
+
+static struct PyModuleDef pylitepcie_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pylitepcie",
+    .m_doc = "Zero-copy access to the LitePCIe DMA rings",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pylitepcie(void)
+{
+    PyObject *m;
+
+    if (PyType_Ready(&DmaType) < 0 || PyType_Ready(&BatchType) < 0 || PyType_Ready(&SpanType) < 0)
+        return NULL;
+
+    m = PyModule_Create(&pylitepcie_module);
+    if (!m)
+        return NULL;
+    if (PyModule_AddObjectRef(m, "Dma", (PyObject *)&DmaType) < 0 ||
+        PyModule_AddObjectRef(m, "Batch", (PyObject *)&BatchType) < 0 ||
+        PyModule_AddObjectRef(m, "Span", (PyObject *)&SpanType) < 0 ||
+        PyModule_AddIntConstant(m, "DMA_PAUSE", LITEPCIE_DMA_PAUSE) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
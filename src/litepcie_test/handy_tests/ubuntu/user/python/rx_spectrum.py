@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Live RX spectrum straight from the DMA ring, without copies or capture files.
+
+Build the extension with ``./build.sh -p`` and run with
+``PYTHONPATH=build python3 user/python/rx_spectrum.py``.
+"""
+
+import argparse
+import time
+
+import numpy as np
+
+import pylitepcie
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Average power spectrum of the RX stream")
+    parser.add_argument("-d", "--device", default="/dev/litepcie0", help="device file")
+    parser.add_argument("-n", "--fft-size", type=int, default=1024, help="FFT length in samples")
+    parser.add_argument("-l", "--loopback", action="store_true", help="loop TX back to RX")
+    args = parser.parse_args()
+
+    window = np.hanning(args.fft_size).astype(np.float32)
+    power = np.zeros(args.fft_size // 2 + 1)
+    frames = 0
+    rx_bytes = 0
+    last = time.monotonic()
+
+    with pylitepcie.Dma(args.device, rx=True, loopback=args.loopback) as dma:
+        dma.start()
+        while True:
+            # waits for the DMA with the GIL released
+            dma.poll()
+            with dma.rx() as batch:
+                for span in batch.spans:
+                    # int16 samples, viewed in the ring itself
+                    samples = np.frombuffer(span, dtype=np.int16)
+                    usable = len(samples) - len(samples) % args.fft_size
+                    if usable:
+                        blocks = samples[:usable].reshape(-1, args.fft_size) * window
+                        power += (np.abs(np.fft.rfft(blocks, axis=1)) ** 2).sum(axis=0)
+                        frames += len(blocks)
+                    rx_bytes += span_bytes(span)
+
+            now = time.monotonic()
+            if now - last >= 1.0 and frames:
+                peak = int(np.argmax(power[1:])) + 1
+                print(
+                    f"{rx_bytes / (now - last) / 1e6:8.1f} MB/s  "
+                    f"peak bin {peak:5d}  {10 * np.log10(power[peak] / frames):6.1f} dB"
+                )
+                power[:] = 0
+                frames = 0
+                rx_bytes = 0
+                last = now
+
+
+def span_bytes(span):
+    """Bytes in a span: ring buffers times buffer size."""
+    with memoryview(span) as view:
+        return view.nbytes
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass